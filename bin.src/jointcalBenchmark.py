@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+# See COPYRIGHT file at the top of the source tree.
+"""
+Time jointcal end-to-end on synthetic tracts of increasing size.
+
+Writes one JSON record per run (problem size, per-step wall/cpu timings, final
+chi2 and peak memory), e.g.:
+
+    jointcalBenchmark.py --scales small medium --output benchmarks.jsonl
+"""
+from lsst.jointcal.benchmark import main
+
+main()
@@ -0,0 +1,94 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_ALLOCATION_TRACKING_H
+#define LSST_JOINTCAL_ALLOCATION_TRACKING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace lsst {
+namespace jointcal {
+
+/*
+ * Heap allocation counting, for auditing the allocations of the hot paths.
+ *
+ * Only active when jointcal is built with JOINTCAL_ALLOC_TRACKING defined (e.g. `scons allocTracking=1`):
+ * the library then replaces the global operator new, to count the allocations of each thread and to
+ * record the call sites that allocate, but only inside an AllocationTrackingScope. Outside of any scope,
+ * the replacement only forwards to malloc, so the rest of the process is neither counted nor slowed
+ * down. ScopedPhase opens a scope, and uses the counts to attribute allocations to the phases of a
+ * Profile. Without JOINTCAL_ALLOC_TRACKING all counts stay at 0 and no call sites are recorded, at no
+ * cost.
+ *
+ * The call sites are recorded from a short backtrace of each allocation, which slows the allocations of
+ * the tracking scopes down considerably: timings of a tracking build are not representative.
+ */
+
+/// Number and total size of allocations.
+struct AllocationCount {
+    std::uint64_t count;
+    std::uint64_t bytes;
+
+    AllocationCount() : count(0), bytes(0) {}
+    AllocationCount(std::uint64_t count_, std::uint64_t bytes_) : count(count_), bytes(bytes_) {}
+};
+
+/// Return true if jointcal was built with JOINTCAL_ALLOC_TRACKING.
+bool isAllocationTrackingEnabled();
+
+/// Allocations made so far by the calling thread, inside AllocationTrackingScopes.
+AllocationCount getThreadAllocations();
+
+/**
+ * Count the allocations of the calling thread, and record their sites, while an instance exists.
+ *
+ * Scopes nest: the allocations are counted once, until the outermost scope ends.
+ */
+class AllocationTrackingScope {
+public:
+    AllocationTrackingScope();
+    ~AllocationTrackingScope();
+
+    AllocationTrackingScope(AllocationTrackingScope const &) = delete;
+    AllocationTrackingScope(AllocationTrackingScope &&) = delete;
+    AllocationTrackingScope &operator=(AllocationTrackingScope const &) = delete;
+    AllocationTrackingScope &operator=(AllocationTrackingScope &&) = delete;
+};
+
+/// A code location that allocates, identified by the innermost frames of its backtraces.
+struct AllocationSite {
+    std::vector<std::string> frames;  // innermost first: the allocating function, then its callers
+    std::uint64_t count;
+    std::uint64_t bytes;
+
+    friend std::ostream &operator<<(std::ostream &s, AllocationSite const &site);
+};
+
+/**
+ * Number of frames recorded per allocation site.
+ *
+ * Deep enough to get past the standard library frames (allocators, container growth) when they are not
+ * inlined; getTopAllocationSites() only keeps the innermost of those.
+ */
+constexpr std::size_t ALLOCATION_SITE_DEPTH = 6;
+
+/**
+ * The call sites that allocated most often inside AllocationTrackingScopes, since the start of the process
+ * or the last resetAllocationSites(), most frequent first.
+ *
+ * @param nSites  Maximum number of sites to return.
+ */
+std::vector<AllocationSite> getTopAllocationSites(std::size_t nSites = 20);
+
+/// Forget the recorded allocation sites.
+void resetAllocationSites();
+
+/// Write the top allocation sites, one per line, for logs.
+void printAllocationReport(std::ostream &s, std::size_t nSites = 20);
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_ALLOCATION_TRACKING_H
@@ -5,6 +5,8 @@
 #include <string>
 #include <iostream>
 #include <list>
+#include <unordered_map>
+#include <vector>
 
 #include "lsst/afw/table/Source.h"
 #include "lsst/afw/geom/SkyWcs.h"
@@ -18,6 +20,8 @@
 #include "lsst/jointcal/CcdImage.h"
 #include "lsst/jointcal/Point.h"
 #include "lsst/jointcal/JointcalControl.h"
+#include "lsst/jointcal/Profiling.h"
+#include "lsst/jointcal/StarArena.h"
 
 #include "lsst/afw/table/SortedCatalog.h"
 
@@ -44,7 +48,8 @@ public:
      */
     Associations()
             : _commonTangentPoint(Point(std::numeric_limits<double>::quiet_NaN(),
-                                        std::numeric_limits<double>::quiet_NaN())) {}
+                                        std::numeric_limits<double>::quiet_NaN())),
+              _starArena(std::make_shared<StarArena>()) {}
 
     /**
      * Create an Associations object from a pre-built list of ccdImages.
@@ -57,7 +62,8 @@ public:
     Associations(CcdImageList const &imageList)
             : ccdImageList(imageList),
               _commonTangentPoint(Point(std::numeric_limits<double>::quiet_NaN(),
-                                        std::numeric_limits<double>::quiet_NaN())) {}
+                                        std::numeric_limits<double>::quiet_NaN())),
+              _starArena(std::make_shared<StarArena>()) {}
 
     /// No moves or copies: jointcal only ever needs one Associations object.
     Associations(Associations const &) = delete;
@@ -116,6 +122,12 @@ public:
      * @param      refFluxErrMap  flux errors per filter of corresponding refCat objects (can be empty)
      * @param      rejectBadFluxes  Reject reference sources with flux=NaN or 0 and/or fluxErr=NaN or 0.
      *                              Typically false for astrometry and true for photometry.
+     *
+     * If the reference catalog has proper motions ("pm_ra", "pm_dec" per year and their "Err", along
+     * ra*cos(dec) and dec) and an "epoch" (MJD), the reference stars are moved to getEpoch() before being
+     * matched, and the FittedStars they match start with their proper motion if it has errors
+     * (PmBlock::mightMove). A "parallax" is kept in the RefStar, for the fit to displace the star at the
+     * epoch of each CcdImage.
      */
     void collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom::Angle matchCut,
                          std::string const &fluxField, RefFluxMapType const &refFluxMap = RefFluxMapType(),
@@ -126,6 +138,21 @@ public:
     //! track of that.
     void deprojectFittedStars();
 
+    /**
+     * Set the color of the fitted stars from their own measurements, as the magnitude difference between
+     * their mean measured fluxes in two filters.
+     *
+     * This is the color lever arm of the chromatic (refraction) terms of AstrometryFit, and must hence be
+     * called before constructing the fit. The stars not measured in both filters get the mean color of
+     * the others, so that they carry no chromatic term.
+     *
+     * @param[in]  blueFilter  The filter of the first term of the color.
+     * @param[in]  redFilter   The filter subtracted from it.
+     *
+     * @return The number of stars measured in both filters.
+     */
+    std::size_t computeFittedStarColors(std::string const &blueFilter, std::string const &redFilter);
+
 //! Set the color field of FittedStar 's from a colored catalog.
 /* If Color is "g-i", then the color is assigned from columns "g" and "i" of the colored catalog. */
 #ifdef TODO
@@ -136,15 +163,28 @@ public:
     /**
      * Prepare the fittedStar list by making quality cuts and normalizing measurements.
      *
+     * Also sorts ccdImageList by (visit, ccd) and fittedStarList along a Hilbert curve, which fixes the
+     * parameter layout of the fits (see ParameterLayout.h).
+     *
      * @param[in]  minMeasurements  The minimum number of measuredStars for a FittedStar to be included.
      */
     void prepareFittedStars(int minMeasurements);
 
     CcdImageList const &getCcdImageList() const { return ccdImageList; }
 
+    /// Mean MJD of the CcdImages: the epoch of the fitted star positions and of the matched RefStars.
+    double getEpoch() const;
+
     //! Number of different bands in the input image list. Not implemented so far
     unsigned getNFilters() const { return _filterMap.size(); }
 
+    /**
+     * Index of a filter in the per-filter reference fluxes (see RefStar::getFlux(size_t)).
+     *
+     * @throws pex::exceptions::NotFoundError if the reference catalog has no flux in this filter.
+     */
+    std::size_t getFilterIndex(std::string const &filter) const;
+
     // Return the bounding box in (ra, dec) coordinates containing the whole catalog
     const lsst::afw::geom::Box2D getRaDecBBox();
 
@@ -158,7 +198,73 @@ public:
      */
     size_t nFittedStarsWithAssociatedRefStar() const;
 
+    /**
+     * Timings of createCcdImage, associateCatalogs, collectRefStars and prepareFittedStars, the
+     * star counts they produced, and the memory high-water marks of the catalogs ("wholeCatalogs",
+     * "catalogsForFit") and star lists ("fittedStarList", "refStarList"), accumulated since construction
+     * or the last resetProfile().
+     */
+    Profile const &getProfile() const { return _profile; }
+
+    void resetProfile() { _profile.reset(); }
+
+    /**
+     * Allocate the stars created by associateCatalogs and collectRefStars (the MeasuredStars of the
+     * catalogs for fit, the FittedStars and the RefStars) from a StarArena, which is released when the
+     * lists are cleared at the next association. Enabled by default.
+     *
+     * Only affects the stars created after the call.
+     */
+    void setUseStarArena(bool useStarArena);
+
+    bool getUseStarArena() const { return _starArena != nullptr; }
+
+    /// The arena the stars are allocated from, or null if disabled.
+    std::shared_ptr<StarArena> const &getStarArena() const { return _starArena; }
+
+    /**
+     * The FittedStars as a catalog, to compare the solutions of fits that share stars (see
+     * decomposition.py).
+     *
+     * The record ids are the indices of the stars in fittedStarList, as used by setFittedStarPriors. The
+     * positions are on the sky, whether or not the fitted stars have been deprojected. The catalog has
+     * "flux" and "fluxErr" fields, in the units of the fitted stars, and a "nMeasurements" field. With
+     * reference fluxes per filter, it also has a "<filter>_flux" field per filter, holding the fluxes of
+     * the multi-band photometric fit (NaN if it did not fit the star in that filter).
+     */
+    afw::table::SimpleCatalog makeFittedStarCatalog() const;
+
+    /**
+     * Pull some FittedStars toward target values, by adding a Gaussian prior to their reference terms.
+     *
+     * This is how the fits of overlapping regions are brought to a consensus on their shared stars: the
+     * prior is combined with the star's own RefStar, if any, into a new RefStar (the inverse-variance
+     * weighted mean of the two), so the fitters need no special handling. The new RefStar keeps the
+     * fluxes per filter of the star's RefStar, for the multi-band photometric fit, and its proper motion,
+     * parallax and epoch, for the astrometric fit. Replaces the priors of a previous call; the lists may
+     * be empty to leave positions or fluxes unconstrained. Positions are in degrees and must only be
+     * constrained once the fitted stars are deprojected.
+     *
+     * @param indices      Indices of the stars in fittedStarList (the ids of makeFittedStarCatalog).
+     * @param ra, dec      Target positions, in degrees; empty to only constrain the fluxes.
+     * @param positionErr  Standard deviations of the position priors, per coordinate, in degrees.
+     * @param flux         Target fluxes; empty to only constrain the positions.
+     * @param fluxErr      Standard deviations of the flux priors.
+     */
+    void setFittedStarPriors(std::vector<std::size_t> const &indices, std::vector<double> const &ra,
+                             std::vector<double> const &dec, std::vector<double> const &positionErr,
+                             std::vector<double> const &flux, std::vector<double> const &fluxErr);
+
+    /// Remove the priors of setFittedStarPriors, giving the FittedStars back their own RefStars.
+    void clearFittedStarPriors();
+
+    /// Number of FittedStars with a prior from setFittedStarPriors.
+    std::size_t getNFittedStarPriors() const { return _priorBaseRefStars.size(); }
+
 private:
+    /// Record the memory held by the catalogs for fit and the star lists in the profile, and log it.
+    void recordMemory();
+
     void associateRefStars(double matchCutInArcsec, const Gtransfo *gtransfo);
 
     void assignMags();
@@ -182,6 +288,19 @@ private:
     std::unordered_map<std::string, std::size_t> _filterMap;
 
     Point _commonTangentPoint;
+
+    std::shared_ptr<StarArena> _starArena;
+
+    // The RefStars holding the priors of setFittedStarPriors and, for each FittedStar with a prior, the
+    // RefStar it had before (possibly null) and the prior that replaced it.
+    struct PriorRefStars {
+        RefStar const *base;
+        RefStar const *prior;
+    };
+    RefStarList _priorStarList;
+    std::unordered_map<FittedStar *, PriorRefStars> _priorBaseRefStars;
+
+    Profile _profile;
 };
 
 }  // namespace jointcal
@@ -2,9 +2,13 @@
 #ifndef LSST_JOINTCAL_ASTROMETRY_FIT_H
 #define LSST_JOINTCAL_ASTROMETRY_FIT_H
 
+#include <array>
+#include <map>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
+#include <vector>
 
 #include "lsst/jointcal/Associations.h"
 #include "lsst/jointcal/CcdImage.h"
@@ -84,6 +88,11 @@ public:
      */
     void assignIndices(std::string const &whatToFit) override;
 
+    /// @copydoc FitterBase::getNModelParameters
+    unsigned getNModelParameters() const override {
+        return _nParDistortions + (_fittingRefrac ? _nParRefrac : 0);
+    }
+
     /**
      * The transformations used to propagate errors are freezed to the current
      * state. The routine can be called when the mappings are roughly in place.
@@ -101,6 +110,27 @@ public:
     /// @copydoc FitterBase::saveChi2RefContributions
     void saveChi2RefContributions(std::string const &baseName) const override;
 
+    /**
+     * Read the measurements from single precision copies (CompactMeasurement) in the fit loops.
+     *
+     * The copies are made for all CcdImages when this is turned on and at each minimize(), and for the
+     * CcdImages of the outliers when they are removed; they are freed when this is turned off. They add
+     * 32 bytes per valid measurement to the memory of the fit, for a sequential traversal of the
+     * measurements in the derivative and chi2 loops. The chi2 and fitted parameters agree with those of
+     * the double precision path to well within their uncertainties.
+     */
+    void setUseCompactMeasurements(bool useCompactMeasurements);
+
+    bool getUseCompactMeasurements() const { return _useCompactMeasurements; }
+
+    /**
+     * The chromatic (refraction) coefficient of each filter of the fitted CcdImages.
+     *
+     * They are fit with "Refrac", all filters in one system sharing the mappings and star positions, and
+     * multiply the star colors (Associations::computeFittedStarColors) relative to their mean.
+     */
+    std::map<std::string, double> getRefractionCoefficients() const;
+
     /**
      * DEBUGGING routine
      */
@@ -110,8 +140,10 @@ private:
     bool _fittingDistortions, _fittingPos, _fittingRefrac, _fittingPM;
     std::shared_ptr<AstrometryModel> _astrometryModel;
     double _referenceColor, _sigCol;  // average and r.m.s color
-    double _refractionCoefficient;    // fit parameter
-    unsigned int _refracPosInMatrix;  // where it stands
+    // fit parameters: one refraction coefficient per filter, in the order of _refractionFilters.
+    std::vector<double> _refractionCoefficients;
+    std::map<std::string, unsigned> _refractionFilters;
+    unsigned int _refracPosInMatrix;  // where the coefficients stand
     double _JDRef;                    // average Julian date
 
     // counts in parameter subsets.
@@ -121,6 +153,21 @@ private:
 
     double _posError;  // constant term on error on position (in pixel unit)
 
+    bool _useCompactMeasurements;
+    std::unordered_map<CcdImage const *, CompactMeasurementList> _compactCatalogs;
+
+    void updateMeasurementCache(std::vector<CcdImage const *> const &ccdImages) override;
+
+    /**
+     * Call f(position, fittedStar, measuredStar) for each valid measurement of ccdImage, or of msList if
+     * given, with position the measured position and its variances in pixels. With compact measurements,
+     * the positions are those of the CompactMeasurements in all cases, and the loop over the whole
+     * ccdImage reads the records alone, with a null measuredStar, unless withStars.
+     */
+    template <typename F>
+    void forEachMeasurement(CcdImage const &ccdImage, MeasuredStarList const *msList, bool withStars,
+                            F f) const;
+
     void leastSquareDerivativesMeasurement(CcdImage const &ccdImage, TripletList &tripletList,
                                            Eigen::VectorXd &grad,
                                            MeasuredStarList const *msList = nullptr) const override;
@@ -128,6 +175,10 @@ private:
     void leastSquareDerivativesReference(FittedStarList const &fittedStarList, TripletList &tripletList,
                                          Eigen::VectorXd &grad) const override;
 
+    std::size_t countTripletsMeasurement(CcdImage const &ccdImage) const override;
+
+    std::size_t countTripletsReference(FittedStarList const &fittedStarList) const override;
+
     void accumulateStatImageList(CcdImageList const &ccdImageList, Chi2Accumulator &accum) const override;
 
     void accumulateStatRefStars(Chi2Accumulator &accum) const override;
@@ -135,8 +186,26 @@ private:
     void getIndicesOfMeasuredStar(MeasuredStar const &measuredStar,
                                   std::vector<unsigned> &indices) const override;
 
+    /**
+     * Position of fittedStar in the tangent plane of an image at mjd (relative to the fitted epoch).
+     *
+     * Accounts for the proper motion of the star, the parallax of its RefStar with the Sun at sunPosition
+     * (computeSunPosition of the image MJD), and refraction.
+     */
     Point transformFittedStar(FittedStar const &fittedStar, Gtransfo const &sky2TP,
-                              Point const &refractionVector, double refractionCoeff, double mjd) const;
+                              Point const &refractionVector, double refractionCoeff, double mjd,
+                              std::array<double, 3> const &sunPosition) const;
+
+    /**
+     * Whether the proper motion of fittedStar is a fit parameter: fitting "PM" fits those of the stars
+     * that might move, constrained by the proper motion of their RefStar.
+     */
+    bool fitsProperMotion(FittedStar const &fittedStar) const;
+
+    /// Index of the filter of ccdImage among the refraction coefficients.
+    unsigned getRefractionIndex(CcdImage const &ccdImage) const {
+        return _refractionFilters.at(ccdImage.getFilter());
+    }
 
     /// Compute the chi2 (per star or total, depending on which Chi2Accumulator is used) from one CcdImage.
     void accumulateStatImage(CcdImage const &ccdImage, Chi2Accumulator &accum) const;
@@ -66,10 +66,14 @@ public:
     MeasuredStarList &getCatalogForFit() { return _catalogForFit; }
     //@}
 
-    /// Clear the catalog for fitting and set it to a copy of the whole catalog.
-    void resetCatalogForFit() {
+    /**
+     * Clear the catalog for fitting and set it to a copy of the whole catalog.
+     *
+     * @param arena  Where to allocate the copied stars; the general heap if null.
+     */
+    void resetCatalogForFit(std::shared_ptr<StarArena> const &arena = nullptr) {
         getCatalogForFit().clear();
-        getWholeCatalog().copyTo(getCatalogForFit());
+        getWholeCatalog().copyTo(getCatalogForFit(), arena);
     }
 
     /**
@@ -22,6 +22,9 @@ class Chi2Accumulator {
 public:
     virtual void addEntry(double inc, unsigned dof, std::shared_ptr<BaseStar> star) = 0;
 
+    /// Whether addEntry() uses its star: the fits may pass a null one to those that do not.
+    virtual bool needsStars() const { return true; }
+
     virtual ~Chi2Accumulator(){};
 };
 
@@ -44,6 +47,8 @@ public:
         ndof += dof;
     }
 
+    bool needsStars() const override { return false; }
+
     Chi2Statistic& operator+=(Chi2Statistic const& rhs) {
         chi2 += rhs.chi2;
         ndof += rhs.ndof;
@@ -57,6 +57,18 @@ public:
         return ret;
     }
 
+    /// Number of non-zeros in the factor, as predicted by the last symbolic analysis.
+    double getFactorNonZeros() { return this->cholmod().lnz; }
+
+    /// Floating point operation count of the last factorization, as predicted by the symbolic analysis.
+    double getFactorFlops() { return this->cholmod().fl; }
+
+    /// Bytes currently allocated by cholmod for this factorization (factor and workspace).
+    std::size_t getMemoryInUse() { return this->cholmod().memory_inuse; }
+
+    /// Largest number of bytes cholmod allocated at once for this factorization.
+    std::size_t getMemoryPeak() { return this->cholmod().memory_usage; }
+
 protected:
     void init() {
         m_cholmod.final_asis = 1;
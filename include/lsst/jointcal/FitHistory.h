@@ -0,0 +1,93 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_FIT_HISTORY_H
+#define LSST_JOINTCAL_FIT_HISTORY_H
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lsst/jointcal/CcdImage.h"
+#include "lsst/jointcal/Chi2.h"
+
+namespace lsst {
+namespace jointcal {
+
+/**
+ * State of a fit after one iteration of the solve/outlier-rejection loop of FitterBase::minimize().
+ */
+struct IterationRecord {
+    unsigned call;             ///< Index of the minimize() call, counted since the history was reset.
+    std::string whatToFit;     ///< Parameters fitted in that call.
+    unsigned iteration;        ///< Iteration within that call, from 0.
+    unsigned nParameters;      ///< Number of fitted parameters.
+    double chi2;               ///< Total chi2 after applying this iteration's step.
+    unsigned ndof;             ///< Degrees of freedom of chi2.
+    double stepNorm;           ///< Euclidean norm of this iteration's parameter offsets.
+    unsigned nMeasOutliers;    ///< Measurement outliers removed at the end of this iteration.
+    unsigned nRefOutliers;     ///< Reference outliers removed at the end of this iteration.
+    double factorizationTime;  ///< Wall time (s) of the factorization, or of the downdate before this step.
+    unsigned nDowndates;       ///< Factor downdates done in this call before this iteration.
+    std::map<VisitIdType, Chi2Statistic> visitChi2;  ///< Measurement chi2 and ndof per visit.
+
+    IterationRecord()
+            : call(0),
+              iteration(0),
+              nParameters(0),
+              chi2(0),
+              ndof(0),
+              stepNorm(0),
+              nMeasOutliers(0),
+              nRefOutliers(0),
+              factorizationTime(0),
+              nDowndates(0) {}
+
+    friend std::ostream &operator<<(std::ostream &s, IterationRecord const &record);
+};
+
+/**
+ * The iterations of all minimize() calls of a fitter, in order.
+ *
+ * Used to see how a fit converges: how chi2, step size and outlier counts evolve, and where the
+ * iterations go.
+ */
+class FitHistory {
+public:
+    FitHistory() : _nCalls(0) {}
+
+    /// Start a new minimize() call, and return its index.
+    unsigned startCall() { return _nCalls++; }
+
+    /// Append a record, and return a reference to it so that it can be completed later in the iteration.
+    IterationRecord &add(IterationRecord record) {
+        _records.push_back(std::move(record));
+        return _records.back();
+    }
+
+    std::vector<IterationRecord> const &getRecords() const { return _records; }
+
+    /// Number of minimize() calls recorded.
+    unsigned getNCalls() const { return _nCalls; }
+
+    void reset() {
+        _records.clear();
+        _nCalls = 0;
+    }
+
+    /**
+     * Write the history as two CSV files.
+     *
+     * "baseName-iterations.csv" has one line per iteration, and "baseName-visits.csv" one line per
+     * iteration and visit, with the per-visit chi2.
+     */
+    void save(std::string const &baseName) const;
+
+private:
+    std::vector<IterationRecord> _records;
+    unsigned _nCalls;
+};
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_FIT_HISTORY_H
@@ -2,8 +2,11 @@
 #ifndef LSST_JOINTCAL_FITTED_STAR_H
 #define LSST_JOINTCAL_FITTED_STAR_H
 
+#include <bitset>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include "lsst/jointcal/BaseStar.h"
 #include "lsst/jointcal/StarList.h"
@@ -43,7 +46,8 @@ public:
               _wmag(0),
               _indexInMatrix(-1),
               _measurementCount(0),
-              _refStar(nullptr) {}
+              _refStar(nullptr),
+              _bandMask(0) {}
 
     FittedStar(const BaseStar& baseStar)
             : BaseStar(baseStar),
@@ -52,7 +56,8 @@ public:
               _wmag(0),
               _indexInMatrix(0),
               _measurementCount(0),
-              _refStar(nullptr) {}
+              _refStar(nullptr),
+              _bandMask(0) {}
 
     //!
     FittedStar(const MeasuredStar& measuredStar);
@@ -70,6 +75,7 @@ public:
         _measurementCount = 0;
         _refStar = nullptr;
         _wmag = 0;
+        _bandMask = 0;
     }
 
     //!
@@ -104,6 +110,27 @@ public:
     //! Get the astrometric reference star associated with this star.
     const RefStar* getRefStar() const { return _refStar; };
 
+    /**
+     * Fluxes per band, for multi-band photometric fits; band i is the filter of index i in Associations.
+     *
+     * Empty unless a multi-band fit initialized them.
+     */
+    std::vector<double> const& getBandFluxes() const { return _bandFluxes; }
+    std::vector<double>& getBandFluxes() { return _bandFluxes; }
+
+    /// Bit i is set if the flux in band i is a parameter of the current fit.
+    std::uint32_t getBandMask() const { return _bandMask; }
+    void setBandMask(std::uint32_t bandMask) { _bandMask = bandMask; }
+
+    /**
+     * Index of the flux in band i in the fit: the fitted bands of a star have consecutive indices, from
+     * getIndexInMatrix(). Only meaningful if bit i of the band mask is set.
+     */
+    unsigned getBandIndexInMatrix(std::size_t band) const {
+        std::uint32_t const lowerBands = _bandMask & ((std::uint32_t(1) << band) - 1);
+        return _indexInMatrix + std::bitset<32>(lowerBands).count();
+    }
+
 private:
     double _mag;
     int _gen;
@@ -113,6 +140,9 @@ private:
     const RefStar* _refStar;
 
     double _fluxErr;
+
+    std::vector<double> _bandFluxes;
+    std::uint32_t _bandMask;
 };
 
 /****** FittedStarList */
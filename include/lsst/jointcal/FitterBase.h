@@ -2,12 +2,19 @@
 #ifndef LSST_JOINTCAL_FITTER_BASE_H
 #define LSST_JOINTCAL_FITTER_BASE_H
 
+#include <cmath>
+#include <map>
+#include <memory>
+#include <vector>
+
 #include "lsst/log/Log.h"
 #include "lsst/jointcal/Associations.h"
 #include "lsst/jointcal/CcdImage.h"
 #include "lsst/jointcal/Chi2.h"
+#include "lsst/jointcal/FitHistory.h"
 #include "lsst/jointcal/FittedStar.h"
 #include "lsst/jointcal/MeasuredStar.h"
+#include "lsst/jointcal/Profiling.h"
 #include "lsst/jointcal/Tripletlist.h"
 
 namespace lsst {
@@ -20,6 +27,13 @@ enum class MinimizeResult {
     Failed          // factorization failed
 };
 
+/// Loss function of the chi2 terms; see FitterBase::setRobustLoss.
+enum class RobustLoss {
+    Squared,  // plain least squares
+    Huber,    // quadratic up to the scale, linear beyond
+    Cauchy    // logarithmic: the influence of large residuals goes to zero
+};
+
 /**
  * Base class for fitters.
  *
@@ -29,7 +43,14 @@ enum class MinimizeResult {
 class FitterBase {
 public:
     explicit FitterBase(std::shared_ptr<Associations> associations)
-            : _associations(associations), _whatToFit(""), _lastNTrip(0), _nParTot(0), _nMeasuredStars(0) {}
+            : _associations(associations),
+              _whatToFit(""),
+              _nParTot(0),
+              _nMeasuredStars(0),
+              _nProcesses(1),
+              _robustLoss(RobustLoss::Squared),
+              _robustScale(0),
+              _robustMaxIterations(0) {}
 
     /// No copy or move: there is only ever one fitter of a given type.
     FitterBase(FitterBase const &) = delete;
@@ -37,6 +58,8 @@ public:
     FitterBase &operator=(FitterBase const &) = delete;
     FitterBase &operator=(FitterBase &&) = delete;
 
+    virtual ~FitterBase();
+
     /**
      * Does a 1 step minimization, assuming a linear model.
      *
@@ -49,7 +72,8 @@ public:
      *
      * @param[in]  whatToFit  See child method assignIndices for valid string values.
      * @param[in]  nSigmaCut  How many sigma to reject outliers at. Outlier
-     *                        rejection ignored for nSigmaCut=0.
+     *                        rejection ignored for nSigmaCut=0, and with a robust loss (see
+     *                        setRobustLoss), which iterates the reweighted fit instead.
      *
      * @return  Return code describing success/failure of fit.
      *
@@ -66,6 +90,13 @@ public:
      */
     Chi2Statistic computeChi2() const;
 
+    /**
+     * Returns the chi2 for the current state, and accumulate the chi2 of the measurement terms per visit.
+     *
+     * @param[in,out] visitChi2  Measurement chi2 and ndof per visit, added to the existing entries.
+     */
+    Chi2Statistic computeChi2PerVisit(std::map<VisitIdType, Chi2Statistic> &visitChi2) const;
+
     /**
      * Evaluates the chI^2 derivatives (Jacobian and gradient) for the current whatToFit setting.
      *
@@ -77,6 +108,103 @@ public:
      */
     void leastSquareDerivatives(TripletList &tripletList, Eigen::VectorXd &grad) const;
 
+    /**
+     * Number of triplets leastSquareDerivatives will produce for the current whatToFit setting.
+     *
+     * This is exact, except when some derivatives are exactly zero: the astrometric fitter skips those,
+     * so its count is then an upper bound.
+     */
+    std::size_t countTriplets() const;
+
+    /**
+     * Select how the Jacobian entries are stored while they are accumulated.
+     *
+     * TripletList::Storage::Compact needs less memory and builds the Jacobian without intermediate
+     * copies; TripletList::Storage::Triplets is the plain Eigen triplet list.
+     */
+    void setTripletStorage(TripletList::Storage storage) {
+        _tripletList.setStorage(storage);
+        _outlierTripletList.setStorage(storage);
+    }
+
+    TripletList::Storage getTripletStorage() const { return _tripletList.getStorage(); }
+
+    /// Free the triplet storage kept between calls to minimize.
+    void releaseTripletStorage() {
+        _tripletList.release();
+        _outlierTripletList.release();
+    }
+
+    /**
+     * Set the number of worker processes computing the derivatives and the chi2 of the measurements.
+     *
+     * With more than one, the CcdImages are split into as many contiguous subsets with about the same
+     * number of Jacobian entries, and each subset is handled by a forked process (see ProcessParallel.h),
+     * which reads the measurements and the current parameters in place and returns its results through
+     * shared memory. The reference terms, the factorization, the solution and the outlier search stay in
+     * this process. The results only differ from those of a single process by the order of the sums.
+     *
+     * minimize() forks its workers once, and replays its parameter offsets and outlier removals in them;
+     * computeChi2() and computeChi2PerVisit(), called outside of minimize(), fork workers for each call.
+     *
+     * @throws pex::exceptions::InvalidParameterError if nProcesses is 0.
+     */
+    void setNProcesses(unsigned nProcesses);
+
+    unsigned getNProcesses() const { return _nProcesses; }
+
+    /**
+     * Downweight the large chi2 terms instead of rejecting them, by iteratively reweighted least squares.
+     *
+     * Each term of chi2 \f$r^2\f$ contributes \f$\rho(r^2)\f$ to the fitted chi2 instead, with
+     * \f$\rho(r^2) = r^2\f$ for \f$r \le c\f$ and \f$2cr - c^2\f$ beyond for Huber, and
+     * \f$c^2 \ln(1 + r^2/c^2)\f$ for Cauchy. minimize() then solves the least squares problem with each
+     * term weighted by \f$\rho'(r^2)\f$, evaluated at the current parameters, and repeats this with the
+     * updated weights until the relative change of the chi2 falls below 1e-4, or for maxIterations steps.
+     * The nSigmaCut of minimize() is then ignored: there is no outlier rejection loop.
+     *
+     * @param loss           The loss function; RobustLoss::Squared restores the least squares fit.
+     * @param scale          The scale c, in sigmas (of the 2D distance for astrometric terms). 0 selects
+     *                       the usual 95% efficiency values: 1.345 for Huber and 2.385 for Cauchy.
+     * @param maxIterations  The maximum number of reweighted steps per call to minimize().
+     *
+     * @throws pex::exceptions::InvalidParameterError if scale is negative or maxIterations is 0.
+     */
+    void setRobustLoss(RobustLoss loss, double scale = 0, unsigned maxIterations = 10);
+
+    RobustLoss getRobustLoss() const { return _robustLoss; }
+
+    double getRobustScale() const { return _robustScale; }
+
+    /**
+     * Fit the error model of the measurements: an additional variance shared by the CcdImages of each
+     * visit or of each chip, from the residuals of the current parameters.
+     *
+     * The subclasses add the term of a CcdImage to the variance of each of its measurements: in pixel^2 to
+     * both coordinates (on top of posError^2) for astrometry, as a squared fraction of the flux for
+     * photometry. Each term is set so that the chi2 of the measurements of its group is their number of
+     * degrees of freedom, less their share of the fitted parameters, or to 0 if it is already below.
+     * That chi2 is the sum of the squared normalized residuals, whatever the robust loss of the fit: the
+     * robust losses are not chi2 distributed. Only the chi2 of the group is evaluated while searching for
+     * its term: there is no refit, and the next minimize() simply uses the new weights.
+     *
+     * @param grouping  "visit" or "ccd".
+     *
+     * @return The term of each visit or chip.
+     *
+     * @throws pex::exceptions::InvalidParameterError if grouping is neither "visit" nor "ccd".
+     */
+    std::map<int, double> fitErrorModel(std::string const &grouping);
+
+    /// The additional variance of the measurements of ccdImage (see fitErrorModel); 0 if not fit.
+    double getErrorTerm(CcdImage const &ccdImage) const {
+        auto term = _errorTerms.find(&ccdImage);
+        return (term == _errorTerms.end()) ? 0 : term->second;
+    }
+
+    /// Forget the fitted error model.
+    void clearErrorModel() { _errorTerms.clear(); }
+
     /**
      * Offset the parameters by the requested quantities. The used parameter
      * layout is the one from the last call to assignIndices or minimize(). There
@@ -94,6 +222,15 @@ public:
      */
     virtual void assignIndices(std::string const &whatToFit) = 0;
 
+    /// Number of parameters in the layout of the last call to assignIndices or minimize().
+    unsigned getNParameters() const { return _nParTot; }
+
+    /**
+     * Number of model parameters (those not attached to a star) in the layout of the last call to
+     * assignIndices or minimize().
+     */
+    virtual unsigned getNModelParameters() const = 0;
+
     /**
      * Save the full chi2 term per star that was used in the minimization, for debugging.
      *
@@ -110,13 +247,57 @@ public:
     /// Save a CSV file containing residuals of reference terms.
     virtual void saveChi2RefContributions(std::string const &baseName) const = 0;
 
+    /**
+     * Timings of the stages of minimize() (derivatives, hessian, factorization, solve, chi2, outliers,
+     * downdate) and the matrix sizes, accumulated over all calls since construction or resetProfile().
+     *
+     * Counters for sizes (e.g. "nTriplets", "hessianNonZeros", "factorNonZeros") hold the values of the
+     * last call to minimize; "nOutliers", "nIterations" and "workerForks" (worker processes forked by
+     * minimize, see setNProcesses) are running totals. The memory entries are the
+     * high-water marks of the "tripletList", "jacobian", "hessian" and the cholmod factor and workspace
+     * ("cholmod", "cholmodPeak").
+     */
+    Profile const &getProfile() const { return _profile; }
+
+    void resetProfile() { _profile.reset(); }
+
+    /**
+     * The state of the fit after each iteration of each minimize() call since construction or
+     * resetHistory(): chi2 (also per visit), step norm, outliers removed, factorization time and
+     * downdate count.
+     */
+    FitHistory const &getHistory() const { return _history; }
+
+    void resetHistory() { _history.reset(); }
+
+    /// Save the history as "baseName-iterations.csv" and "baseName-visits.csv", see FitHistory::save.
+    void saveHistory(std::string const &baseName) const { _history.save(baseName); }
+
 protected:
     std::shared_ptr<Associations> _associations;
     std::string _whatToFit;
 
-    int _lastNTrip;  // last triplet count, used to speed up allocation
     unsigned int _nParTot;
     unsigned _nMeasuredStars;
+    unsigned _nProcesses;
+
+    RobustLoss _robustLoss;
+    double _robustScale;
+    unsigned _robustMaxIterations;
+
+    // The additional variance of the measurements of each CcdImage, see fitErrorModel.
+    std::map<CcdImage const *, double> _errorTerms;
+
+    Profile _profile;
+    FitHistory _history;
+
+    // Jacobian entries, kept from one minimize() to the next to avoid reallocating them.
+    TripletList _tripletList;
+    TripletList _outlierTripletList;
+
+    // The worker processes of the running minimize(), if _nProcesses > 1; see FitterBase.cc.
+    class Workers;
+    std::unique_ptr<Workers> _workers;
 
     // lsst.logging instance, to be created by subclass so that messages have consistent name while fitting.
     LOG_LOGGER _log;
@@ -146,12 +327,55 @@ protected:
     void outliersContributions(MeasuredStarList &msOutliers, FittedStarList &fsOutliers,
                                TripletList &tripletList, Eigen::VectorXd &grad);
 
+    /// The contribution of a term of chi2 chi2Term to the fitted chi2, according to the robust loss.
+    double robustChi2(double chi2Term) const {
+        if (_robustLoss == RobustLoss::Squared) return chi2Term;
+        double const c2 = _robustScale * _robustScale;
+        if (_robustLoss == RobustLoss::Huber) {
+            return (chi2Term <= c2) ? chi2Term : 2 * _robustScale * std::sqrt(chi2Term) - c2;
+        }
+        return c2 * std::log1p(chi2Term / c2);
+    }
+
+    /**
+     * The weight of a term of chi2 chi2Term in the reweighted least squares step: the derivative of
+     * robustChi2. The derivatives code multiplies the Jacobian entries of the term by its square root.
+     */
+    double robustWeight(double chi2Term) const {
+        if (_robustLoss == RobustLoss::Squared) return 1;
+        double const c2 = _robustScale * _robustScale;
+        if (_robustLoss == RobustLoss::Huber) {
+            return (chi2Term <= c2) ? 1 : _robustScale / std::sqrt(chi2Term);
+        }
+        return 1 / (1 + chi2Term / c2);
+    }
+
+    /// Fill the hessian and the gradient of the chi2 for the current parameters, recording the timings.
+    void computeHessianAndGradient(Eigen::SparseMatrix<double> &hessian, Eigen::VectorXd &grad);
+
+    /// leastSquareDerivatives of the measurement terms, computed by _nProcesses worker processes.
+    void leastSquareDerivativesInProcesses(TripletList &tripletList, Eigen::VectorXd &grad) const;
+
+    /// The chi2 of the measurement terms of each CcdImage, computed by _nProcesses worker processes.
+    std::vector<Chi2Statistic> computeImageChi2InProcesses() const;
+
+    /// Record the bytes held by a container in the profile, and log it.
+    void recordMemory(std::string const &name, std::size_t bytes);
+
     /// Remove measuredStar outliers from the fit. No Refit done.
     void removeMeasOutliers(MeasuredStarList &outliers);
 
     /// Remove refStar outliers from the fit. No Refit done.
     void removeRefOutliers(FittedStarList &outliers);
 
+    /**
+     * Refresh the copies of the measurements of these CcdImages that a subclass may keep for its loops.
+     *
+     * Called by minimize() for all CcdImages once the indices are assigned, and by removeMeasOutliers()
+     * for the CcdImages of the outliers. Does nothing by default.
+     */
+    virtual void updateMeasurementCache(std::vector<CcdImage const *> const &ccdImages) {}
+
     /// Set the indices of a measured star from the full matrix, for outlier removal.
     virtual void getIndicesOfMeasuredStar(MeasuredStar const &measuredStar,
                                           std::vector<unsigned> &indices) const = 0;
@@ -174,6 +398,12 @@ protected:
     /// Compute the derivatives of the reference terms
     virtual void leastSquareDerivativesReference(FittedStarList const &fittedStarList,
                                                  TripletList &tripletList, Eigen::VectorXd &grad) const = 0;
+
+    /// Number of triplets leastSquareDerivativesMeasurement will produce for this CcdImage.
+    virtual std::size_t countTripletsMeasurement(CcdImage const &ccdImage) const = 0;
+
+    /// Number of triplets leastSquareDerivativesReference will produce for these stars.
+    virtual std::size_t countTripletsReference(FittedStarList const &fittedStarList) const = 0;
 };
 }  // namespace jointcal
 }  // namespace lsst
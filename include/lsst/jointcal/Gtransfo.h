@@ -81,6 +81,12 @@ public:
       this(T1(p1)) = T2(p2), use StarMatchList::applyTransfo beforehand. */
     virtual double fit(StarMatchList const &starMatchList) = 0;
 
+    /**
+     * Fit again to a starMatchList that changed little since the last fit (e.g. a few outliers were
+     * removed), starting from the current parameters. The default just calls fit().
+     */
+    virtual double refit(StarMatchList const &starMatchList) { return fit(starMatchList); }
+
     //! allows to write MyTransfo(MyStar)
     void transformStar(FatPoint &in) const { transformPosAndErrors(in, in); }
 
@@ -249,6 +255,14 @@ bool isIntegerShift(const Gtransfo *gtransfo);
 
 /*====================   GtransfoPoly  =======================*/
 
+/// How well a polynomial of a given order fits a StarMatchList (see GtransfoPoly::compareOrders).
+struct PolyOrderScore {
+    unsigned order;
+    unsigned nPar;     ///< Number of coefficients of both coordinates.
+    double chi2;       ///< Weighted sum of squared residuals of the least-squares fit.
+    double criterion;  ///< chi2 penalized by the number of coefficients; lower is better.
+};
+
 //! Polynomial transformation class.
 class GtransfoPoly : public Gtransfo {
 public:
@@ -298,9 +312,72 @@ public:
     //! guess what
     double fit(StarMatchList const &starMatchList) override;
 
+    /**
+     * Fit again, weighting the matches with the current coefficients instead of an unweighted first pass.
+     *
+     * @copydoc Gtransfo::refit
+     */
+    double refit(StarMatchList const &starMatchList) override;
+
+    /**
+     * Fit to starMatchList and discard its outliers, as StarMatchList::refineTransfo does, without refitting
+     * the remaining matches at each clipping round.
+     *
+     * After a full fit, the weights of the matches are frozen: the matches discarded at each round are
+     * subtracted from the normal equations (a rank-k downdate), which are then solved again. The matches
+     * are packed into arrays once, and the median chi2 is found by selection rather than by sorting.
+     * As in StarMatchList::refineTransfo, a round first discards the matches sharing a star with a closer
+     * one, then those whose chi2 exceeds nSigmas^2 times the median chi2; the clipping stops at the first
+     * round that discards nothing.
+     *
+     * @param[in]  starMatchList  The matches to fit.
+     * @param[in]  nSigmas        The clipping threshold, in units of the square root of the median chi2.
+     * @param[out] kept           Whether each match of starMatchList, in list order, survived the clipping.
+     * @param[out] chi2s          The chi2 of each kept match to the returned transfo, as computed by
+     *                            StarMatch::computeChi2, whichever way the clipping stopped; -1 for the
+     *                            discarded matches, and for all of them if no fit was possible.
+     *
+     * @return The chi2 of the last fit, with the conventions of fit(); the clipping stops if it is not
+     *         positive.
+     */
+    double fitWithClipping(StarMatchList const &starMatchList, double nSigmas, std::vector<bool> &kept,
+                           std::vector<double> &chi2s);
+
+    /**
+     * Score the least-squares fits of polynomials of orders minOrder to maxOrder mapping point1 onto point2.
+     *
+     * The normal equations are accumulated once, at maxOrder: since the monomials are ordered by total
+     * degree, those of every lower order are their leading blocks, so each order only costs the
+     * factorization of a small matrix. point2 is weighted with its variances (1 if they are not positive).
+     *
+     * @param starMatchList  The matches to fit.
+     * @param minOrder       The lowest order to score, at least 1.
+     * @param maxOrder       The highest order to score.
+     * @param criterion      "BIC" (chi2 + nPar ln(nData)) or "AIC" (chi2 + 2 nPar).
+     *
+     * @return The scores of the orders that the matches constrain, by increasing order.
+     *
+     * @throws pex::exceptions::InvalidParameterError if the criterion is unknown or the orders are invalid.
+     */
+    static std::vector<PolyOrderScore> compareOrders(StarMatchList const &starMatchList, unsigned minOrder,
+                                                     unsigned maxOrder, std::string const &criterion = "BIC");
+
     //! Composition (internal stuff in quadruple precision)
     GtransfoPoly operator*(GtransfoPoly const &right) const;
 
+    /**
+     * Composition this(right(x)), truncated to the monomials of total degree up to maxOrder.
+     *
+     * The powers of the polynomials of right are tabulated once, and this is evaluated on them as a Horner
+     * scheme in x, all in long double over flat coefficient arrays. The terms beyond maxOrder are never
+     * computed.
+     *
+     * @param right     The transfo applied first.
+     * @param maxOrder  The highest total degree kept. The result is of order min(maxOrder,
+     *                  getOrder()*right.getOrder()), and exact (as operator*) if maxOrder is not smaller.
+     */
+    GtransfoPoly compose(GtransfoPoly const &right, unsigned maxOrder) const;
+
     //! Addition
     GtransfoPoly operator+(GtransfoPoly const &right) const;
 
@@ -343,7 +420,30 @@ public:
     void read(std::istream &s);
 
 private:
-    double computeFit(StarMatchList const &starMatchList, Gtransfo const &InTransfo, const bool UseErrors);
+    /// What the least-squares passes of fit() need from a StarMatchList, computed once for all of them.
+    struct FitDesign;
+
+    /// The normal equations solved by a pass of computeFit, and the weights of the matches in them.
+    struct NormalEquations;
+
+    /**
+     * Fill design from the matches, point1 being transformed by shiftToCenter first.
+     *
+     * The derivatives of the monomials are only needed by the weighted passes.
+     */
+    void computeFitDesign(StarMatchList const &starMatchList, Gtransfo const &shiftToCenter,
+                          bool withDerivatives, FitDesign &design) const;
+
+    /**
+     * One least-squares pass: offset the coefficients by the solution of the normal equations of design.
+     *
+     * The normal matrix is accumulated by symmetric rank-k updates over blocks of matches. If useErrors,
+     * the matches are weighted by the inverse of the sum of the point2 covariance and the point1 covariance
+     * propagated through the current coefficients. If normal is given, it receives the equations solved.
+     *
+     * @return The chi2 of the fit, or -1 if the normal equations could not be factorized.
+     */
+    double computeFit(FitDesign const &design, bool useErrors, NormalEquations *normal = nullptr);
 
     unsigned _order;              // The highest sum of exponents of the largest monomial.
     unsigned _nterms;             // number of parameters per coordinate
@@ -459,6 +559,8 @@ public:
     GtransfoLinShift(double ox = 0., double oy = 0.) : GtransfoLin(ox, oy, 1., 0., 0., 1.) {}
     GtransfoLinShift(Point const &point) : GtransfoLin(point.x, point.y, 1., 0., 0., 1.){};
     double fit(StarMatchList const &starMatchList);
+    //! not the general polynomial refit of GtransfoPoly.
+    double refit(StarMatchList const &starMatchList) override { return fit(starMatchList); }
 
     int getNpar() const { return 2; }
 };
@@ -472,6 +574,8 @@ public:
     GtransfoLinRot() : GtransfoLin(){};
     GtransfoLinRot(const double angleRad, const Point *center = nullptr, const double scaleFactor = 1.0);
     double fit(StarMatchList const &starMatchList);
+    //! not the general polynomial refit of GtransfoPoly.
+    double refit(StarMatchList const &starMatchList) override { return fit(starMatchList); }
 
     int getNpar() const { return 4; }
 };
@@ -2,9 +2,13 @@
 #ifndef LSST_JOINTCAL_LIST_MATCH_H
 #define LSST_JOINTCAL_LIST_MATCH_H
 
+#include <list>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/Frame.h"
 #include "lsst/jointcal/StarMatch.h"
 
 namespace lsst {
@@ -12,6 +16,9 @@ namespace jointcal {
 
 class Gtransfo;
 class GtransfoLin;
+class CcdImage;
+// as in CcdImage.h, which the list matching routines do not otherwise need.
+typedef std::list<std::shared_ptr<CcdImage>> CcdImageList;
 
 //! Parameters to be provided to combinatorial searches
 struct MatchConditions {
@@ -83,11 +90,122 @@ std::unique_ptr<StarMatchList> listMatchCollect(const BaseStarList &list1, const
 std::unique_ptr<GtransfoLin> listMatchupShift(const BaseStarList &list1, const BaseStarList &list2,
                                               const Gtransfo &gtransfo, double maxShift, double binSize = 0);
 
+/**
+ * Search for a 2 dimensional shift by cross-correlating images of the two lists, coarse to fine.
+ *
+ * list2 and list1 mapped through gtransfo are binned (with linear interpolation) onto a common grid, as
+ * fine as binSize allows within a bounded grid size, and their cross-correlation is computed by FFT: its 4
+ * highest peaks within maxShift are the candidate shifts. Each is then refined by a histogram of the pair
+ * separations at binSize within one coarse bin of it, and fitted as in listMatchupShift. Unlike the pair
+ * histogram of listMatchupShift, the cost does not grow as the star density times maxShift^2.
+ *
+ * @param list1     The stars to map onto list2.
+ * @param list2     The reference stars.
+ * @param gtransfo  The initial guess, mapping list1 onto list2.
+ * @param maxShift  The largest shift searched for, along each axis.
+ * @param binSize   The bin size of the fine search, 0 to choose it as listMatchupShift does.
+ *
+ * @return The linear transfo that maps list1, once mapped through gtransfo, onto list2, as listMatchupShift;
+ *         nullptr if a list is empty.
+ */
+std::unique_ptr<GtransfoLin> listMatchupShiftByCorrelation(const BaseStarList &list1,
+                                                           const BaseStarList &list2,
+                                                           const Gtransfo &gtransfo, double maxShift,
+                                                           double binSize = 0);
+
 std::unique_ptr<Gtransfo> listMatchCombinatorial(const BaseStarList &list1, const BaseStarList &list2,
                                                  const MatchConditions &conditions = MatchConditions());
 std::unique_ptr<Gtransfo> listMatchRefine(const BaseStarList &list1, const BaseStarList &list2,
                                           std::unique_ptr<Gtransfo> transfo, const int maxOrder = 3);
 
+/**
+ * A reference catalog prepared once for the blind matching of many lists against parts of it.
+ *
+ * The stars are copied, with their coordinates divided by scale so that they are in units of about one
+ * pixel of the lists to match (the distances of listMatchRefine are in pixels), ranked by decreasing flux,
+ * and bucketed in a coarse grid. Extracting the stars within a footprint then costs about the number of
+ * stars returned, and yields them already in flux order: the lists to match against need neither a copy
+ * of the catalog nor a sort of their own.
+ */
+class ReferenceMatchIndex {
+public:
+    /**
+     * @param stars         The reference stars, e.g. in the common tangent plane.
+     * @param scale         The size of a pixel of the lists to match, in the units of stars.
+     * @param starsPerCell  The average number of stars per cell of the grid.
+     */
+    ReferenceMatchIndex(BaseStarList const &stars, double scale, std::size_t starsPerCell = 64);
+
+    /// No copy or move: the index can be large, and is meant to be shared.
+    ReferenceMatchIndex(ReferenceMatchIndex const &) = delete;
+    ReferenceMatchIndex(ReferenceMatchIndex &&) = delete;
+    ReferenceMatchIndex &operator=(ReferenceMatchIndex const &) = delete;
+    ReferenceMatchIndex &operator=(ReferenceMatchIndex &&) = delete;
+
+    /**
+     * Append to out the stars within frame, brightest first.
+     *
+     * @param frame  The footprint, in the units of the stars given to the constructor.
+     * @param out    Receives the (shared, scaled) stars; it must not modify them.
+     */
+    void extract(Frame const &frame, BaseStarList &out) const;
+
+    double getScale() const { return _scale; }
+
+    std::size_t size() const { return _stars.size(); }
+
+private:
+    double _scale;
+    // the scaled stars, brightest first.
+    std::vector<std::shared_ptr<BaseStar>> _stars;
+    // the grid, in scaled units, and the ranks in _stars of the stars of each cell, in increasing order.
+    double _xMin, _yMin, _cellSize;
+    int _nx, _ny;
+    std::vector<std::vector<std::size_t>> _cells;
+};
+
+/**
+ * Blindly match many star lists to a reference, e.g. to recover the WCSs of all the CCDs of an exposure set.
+ *
+ * For each list, the reference stars within its footprint are extracted from the shared index, and the list
+ * is matched to them as by listMatchCombinatorial then listMatchRefine, on lists flux-sorted once without
+ * copying any star. The lists are split by size over nProcesses worker processes (see
+ * runInChildProcesses), each matching its lists with no state shared with the others.
+ *
+ * @param lists       The lists to match, in pixels.
+ * @param footprints  Where to look for each list in the reference, in the units of the reference catalog;
+ *                    it must include the margin for the errors of the guess it comes from.
+ * @param reference   The reference catalog.
+ * @param conditions  The conditions of the combinatorial search. sizeRatio is relative to the scaled
+ *                    reference, i.e. 1 if the scale of the index is the pixel size.
+ * @param maxOrder    The maximum order of the refined transfos.
+ * @param nProcesses  The number of worker processes; the matching runs in the caller if 1.
+ *
+ * @return For each list, the transfo from its pixels to the reference catalog, or nullptr if the search
+ *         failed, including by an exception: that of one list is logged, and does not stop the others.
+ *
+ * @throws pex::exceptions::LengthError if there are not as many footprints as lists.
+ */
+std::vector<std::shared_ptr<Gtransfo>> listMatchBlind(std::vector<BaseStarList const *> const &lists,
+                                                      std::vector<Frame> const &footprints,
+                                                      ReferenceMatchIndex const &reference,
+                                                      MatchConditions const &conditions, int maxOrder = 1,
+                                                      unsigned nProcesses = 1);
+
+/**
+ * Blindly match the whole catalogs of ccdImages to a reference in their common tangent plane.
+ *
+ * The footprint of each ccdImage is its image frame mapped through its (possibly bad) pixel to common
+ * tangent plane transfo, enlarged by searchMargin on all sides. See listMatchBlind for the other parameters.
+ *
+ * @return For each ccdImage, in order, the transfo from its pixels to the common tangent plane, or nullptr.
+ */
+std::vector<std::shared_ptr<Gtransfo>> matchCcdImagesBlind(CcdImageList const &ccdImages,
+                                                           ReferenceMatchIndex const &reference,
+                                                           MatchConditions const &conditions,
+                                                           double searchMargin, int maxOrder = 1,
+                                                           unsigned nProcesses = 1);
+
 #ifdef DO_WE_NEED_THAT
 inline Gtransfo *ListMatch(const BaseStarList &list1, const BaseStarList &list2, const int maxOrder = 3) {
     Gtransfo *transfo = listMatchCombinatorial(list1, list2);
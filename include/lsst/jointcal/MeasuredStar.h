@@ -3,6 +3,7 @@
 #define LSST_JOINTCAL_MEASURED_STAR_H
 
 #include <iostream>
+#include <vector>
 
 #include "lsst/afw/table/misc.h"
 #include "lsst/jointcal/BaseStar.h"
@@ -120,6 +121,40 @@ public:
 typedef MeasuredStarList::const_iterator MeasuredStarCIterator;
 typedef MeasuredStarList::iterator MeasuredStarIterator;
 
+/**
+ * The data of a valid MeasuredStar read by the inner loops of the astrometric fit, in single precision.
+ *
+ * Centroids and their variances, in pixels, keep ample precision in float (the rounding of a coordinate
+ * of a few thousand pixels is below 1e-3 pixel); the transformed positions, residuals and accumulators
+ * stay in double.
+ *
+ * The records come in addition to the MeasuredStars, which the associations and the outlier bookkeeping
+ * keep using: they add 32 bytes per valid measurement to the memory of the fit. What they save is the
+ * traversal: a loop over a MeasuredStarList follows a list node and a shared_ptr to each MeasuredStar,
+ * scattered over the heap, and copies the shared_ptr of its FittedStar, while the records are read in
+ * sequence. tests/benchmark_kernels.cc times both loops ("AstrometryFit::measurementLoop").
+ */
+struct CompactMeasurement {
+    FittedStar const *fittedStar;
+    float x, y;
+    float vx, vy, vxy;
+
+    explicit CompactMeasurement(MeasuredStar const &measuredStar)
+            : fittedStar(measuredStar.getFittedStar().get()),
+              x(measuredStar.x),
+              y(measuredStar.y),
+              vx(measuredStar.vx),
+              vy(measuredStar.vy),
+              vxy(measuredStar.vxy) {}
+
+    FatPoint getPosition() const { return FatPoint(x, y, vx, vy, vxy); }
+};
+
+/// The CompactMeasurements of the valid stars of a MeasuredStarList, in the same order.
+typedef std::vector<CompactMeasurement> CompactMeasurementList;
+
+CompactMeasurementList makeCompactMeasurementList(MeasuredStarList const &measuredStarList);
+
 BaseStarList &Measured2Base(MeasuredStarList &This);
 BaseStarList *Measured2Base(MeasuredStarList *This);
 const BaseStarList &Measured2Base(const MeasuredStarList &This);
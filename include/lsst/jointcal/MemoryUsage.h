@@ -0,0 +1,95 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_MEMORY_USAGE_H
+#define LSST_JOINTCAL_MEMORY_USAGE_H
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+
+#include "lsst/jointcal/CcdImage.h"
+#include "lsst/jointcal/Eigenstuff.h"
+#include "lsst/jointcal/FittedStar.h"
+#include "lsst/jointcal/MeasuredStar.h"
+#include "lsst/jointcal/RefStar.h"
+#include "lsst/jointcal/StarList.h"
+#include "lsst/jointcal/Tripletlist.h"
+
+namespace lsst {
+namespace jointcal {
+
+/*
+ * Approximate heap bytes held by the large containers of a fit.
+ *
+ * These count the payloads and the per-element bookkeeping of the standard containers (list nodes,
+ * shared_ptr control blocks), but not allocator rounding; they are meant for sizing, not for auditing.
+ */
+
+/// Bytes per element of a StarList, beyond the star itself: list node and make_shared control block.
+constexpr std::size_t STAR_LIST_OVERHEAD = 2 * sizeof(void *) + sizeof(std::shared_ptr<int>) + 16;
+
+template <class Star>
+std::size_t computeMemoryUsage(StarList<Star> const &starList) {
+    return starList.size() * (sizeof(Star) + STAR_LIST_OVERHEAD);
+}
+
+/// Both the whole catalog and the catalog for fit.
+std::size_t computeMemoryUsage(CcdImage const &ccdImage);
+
+std::size_t computeMemoryUsage(CcdImageList const &ccdImageList);
+
+/// Triplets are counted by capacity, as that is what is allocated.
+inline std::size_t computeMemoryUsage(TripletList const &tripletList) { return tripletList.getMemoryUsage(); }
+
+/// Compressed column storage: one value and one row index per non-zero, one index per column.
+inline std::size_t computeMemoryUsage(SpMat const &matrix) {
+    return matrix.nonZeros() * (sizeof(SpMat::Scalar) + sizeof(SpMat::StorageIndex)) +
+           (matrix.outerSize() + 1) * sizeof(SpMat::StorageIndex);
+}
+
+/**
+ * Predicted memory of one minimize() call, from the size of the problem.
+ *
+ * All sizes are in bytes. "peak" is the largest total held at once: in minimize(), the triplets (which
+ * keep their capacity until the end), the Jacobian and the Hessian coexist when forming the Hessian; the
+ * Hessian, the triplets and the factor (with its workspace) coexist after the factorization.
+ */
+struct MemoryEstimate {
+    std::size_t stars;
+    std::size_t triplets;
+    std::size_t jacobian;
+    std::size_t hessian;
+    std::size_t factor;
+    std::size_t peak;
+
+    MemoryEstimate() : stars(0), triplets(0), jacobian(0), hessian(0), factor(0), peak(0) {}
+
+    friend std::ostream &operator<<(std::ostream &s, MemoryEstimate const &estimate);
+};
+
+/**
+ * Predict the memory a fit will need, before running it.
+ *
+ * The Hessian estimate assumes that each star is measured at most once per CcdImage, and the factor
+ * estimate that the fill-in from eliminating the star parameters makes the model block dense, as happens
+ * with CHOLMOD's fill-reducing ordering on these problems.
+ *
+ * @param nMeasurements                 Number of valid measurements (MeasuredStars) in the fit.
+ * @param nFittedStars                  Number of FittedStars.
+ * @param nRefStars                     Number of FittedStars with an associated RefStar.
+ * @param nCcdImages                    Number of CcdImages in the fit.
+ * @param nModelParameters              Total number of model (e.g. distortion) parameters.
+ * @param nModelParametersPerMeasurement  Model parameters each measurement depends on.
+ * @param nParametersPerStar            Fitted parameters per star (2 for astrometry, 1 for photometry).
+ * @param nResidualsPerMeasurement      Residuals per measurement (2 for astrometry, 1 for photometry).
+ *
+ * @return The predicted memory per component and at peak.
+ */
+MemoryEstimate estimateFitMemory(std::size_t nMeasurements, std::size_t nFittedStars, std::size_t nRefStars,
+                                 std::size_t nCcdImages, std::size_t nModelParameters,
+                                 std::size_t nModelParametersPerMeasurement, std::size_t nParametersPerStar,
+                                 std::size_t nResidualsPerMeasurement);
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_MEMORY_USAGE_H
@@ -0,0 +1,53 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_PARAMETER_LAYOUT_H
+#define LSST_JOINTCAL_PARAMETER_LAYOUT_H
+
+#include <cstdint>
+
+#include "lsst/jointcal/CcdImage.h"
+#include "lsst/jointcal/FittedStar.h"
+#include "lsst/jointcal/Frame.h"
+
+namespace lsst {
+namespace jointcal {
+
+/*
+ * Ordering of the objects that carry fit parameters.
+ *
+ * The fitters number the FittedStar parameters in fittedStarList order and visit the measurements in
+ * ccdImageList order, so ordering these lists fixes the layout of the Jacobian and Hessian. Sorting the
+ * stars along a space-filling curve keeps stars measured on the same CcdImage close in parameter space,
+ * and sorting the images by (visit, ccd) makes the layout independent of the input order.
+ */
+
+/// Number of bits per axis of the Hilbert curve used by sortFittedStarsSpatially.
+constexpr unsigned HILBERT_ORDER = 16;
+
+/**
+ * Position of (x, y) along a Hilbert curve covering frame.
+ *
+ * Points outside of frame are clamped onto its boundary.
+ *
+ * @param x, y   The point to locate.
+ * @param frame  The area covered by the curve.
+ * @param order  Number of bits per axis (at most 32): the curve has 4^order cells.
+ *
+ * @return The cell index along the curve, in [0, 4^order).
+ */
+std::uint64_t hilbertIndex(double x, double y, Frame const &frame, unsigned order = HILBERT_ORDER);
+
+/**
+ * Sort fittedStars along a Hilbert curve covering their bounding box.
+ *
+ * Stars falling into the same cell keep their relative order, so the result only depends on the input
+ * positions and order.
+ */
+void sortFittedStarsSpatially(FittedStarList &fittedStars);
+
+/// Sort ccdImages by visit, then ccd.
+void sortCcdImagesByKey(CcdImageList &ccdImages);
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_PARAMETER_LAYOUT_H
@@ -28,7 +28,9 @@ public:
               _fittingFluxes(false),
               _photometryModel(photometryModel),
               _nParModel(0),
-              _nParFluxes(0) {
+              _nParFluxes(0),
+              _multiBand(false),
+              _nBands(1) {
         _log = LOG_GET("jointcal.PhotometryFit");
     }
 
@@ -53,8 +55,27 @@ public:
      */
     void assignIndices(std::string const &whatToFit) override;
 
+    /// @copydoc FitterBase::getNModelParameters
+    unsigned getNModelParameters() const override { return _nParModel; }
+
     void offsetParams(Eigen::VectorXd const &delta) override;
 
+    /**
+     * Fit the images of all filters together, each FittedStar having one flux per filter.
+     *
+     * The fluxes of band i are FittedStar::getBandFluxes()[i], constrained by the measurements of the
+     * images in the filter of index i (Associations::getFilterIndex) and by the reference fluxes
+     * RefStar::getFlux(i), if the RefStar has a flux in that filter. The photometry model is shared:
+     * whatever its mappings have in common across filters (e.g. the chip mappings of a
+     * ConstrainedPhotometryModel, keyed by ccd) is constrained by all bands at once. Enabling it
+     * initializes the band fluxes from the mean measured flux in each band.
+     *
+     * @throws pex::exceptions::LogicError if enabled before Associations::collectRefStars, or with more
+     *         filters than a FittedStar band mask can hold.
+     */
+    void setMultiBand(bool multiBand);
+    bool getMultiBand() const { return _multiBand; }
+
     /// @copydoc FitterBase::saveChi2MeasContributions
     void saveChi2MeasContributions(std::string const &baseName) const override;
 
@@ -69,6 +90,35 @@ private:
     unsigned int _nParModel;
     unsigned int _nParFluxes;
 
+    bool _multiBand;
+    std::size_t _nBands;
+
+    /// Band of the measurements of this image (always 0 unless fitting multiple bands).
+    std::size_t getBand(CcdImage const &ccdImage) const {
+        return (_multiBand) ? _associations->getFilterIndex(ccdImage.getFilter()) : 0;
+    }
+
+    double getFittedFlux(FittedStar const &fittedStar, std::size_t band) const {
+        return (_multiBand) ? fittedStar.getBandFluxes()[band] : fittedStar.getFlux();
+    }
+
+    unsigned getFluxIndex(FittedStar const &fittedStar, std::size_t band) const {
+        return (_multiBand) ? fittedStar.getBandIndexInMatrix(band) : fittedStar.getIndexInMatrix();
+    }
+
+    /**
+     * Call f(std::shared_ptr<FittedStar>, band, refFlux, refFluxErr) for each reference term of
+     * fittedStarList.
+     *
+     * There is one term per star with a RefStar, or in multi-band fits one per fitted band of such a star
+     * with a usable reference flux error.
+     */
+    template <typename Function>
+    void forEachReferenceFlux(FittedStarList const &fittedStarList, Function f) const;
+
+    /// Set the band masks and, where missing, the band fluxes of the fitted stars from the measurements.
+    void initializeBandFluxes();
+
     void accumulateStatImageList(CcdImageList const &ccdImageList, Chi2Accumulator &accum) const override;
 
     void accumulateStatRefStars(Chi2Accumulator &accum) const override;
@@ -84,6 +134,10 @@ private:
     void leastSquareDerivativesReference(FittedStarList const &fittedStarList, TripletList &tripletList,
                                          Eigen::VectorXd &grad) const override;
 
+    std::size_t countTripletsMeasurement(CcdImage const &ccdImage) const override;
+
+    std::size_t countTripletsReference(FittedStarList const &fittedStarList) const override;
+
 #ifdef STORAGE
     Point transformFittedStar(FittedStar const &fittedStar, Gtransfo const *sky2TP,
                               Point const &refractionVector, double refractionCoeff, double mjd) const;
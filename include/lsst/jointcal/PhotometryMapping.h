@@ -3,6 +3,7 @@
 #define LSST_JOINTCAL_PHOTOMETRY_MAPPING_H
 
 #include <memory>
+#include <unordered_map>
 
 #include "lsst/afw/image/PhotoCalib.h"
 
@@ -257,6 +258,209 @@ private:
     std::shared_ptr<PhotometryMapping> _visitMapping;
 };
 
+/**
+ * The Chebyshev basis functions of a focal plane polynomial, evaluated at the focal plane positions of the
+ * measured stars.
+ *
+ * The focal plane position of a measurement does not change during a fit, so its basis functions are
+ * evaluated once by cache() and only looked up afterwards, one column of nTerms values per measurement.
+ * The terms are ordered as the derivatives of PhotometryTransfoChebyshev, the constant term first.
+ */
+class FocalPlaneBasis {
+public:
+    FocalPlaneBasis(size_t order, afw::geom::Box2D const &focalPlaneBBox)
+            : _chebyshev(order, focalPlaneBBox), _nTerms(_chebyshev.getNpar()) {}
+
+    /// No copy or move: the cache is shared by all the star flats evaluated on it.
+    FocalPlaneBasis(FocalPlaneBasis const &) = delete;
+    FocalPlaneBasis(FocalPlaneBasis &&) = delete;
+    FocalPlaneBasis &operator=(FocalPlaneBasis const &) = delete;
+    FocalPlaneBasis &operator=(FocalPlaneBasis &&) = delete;
+
+    /// Evaluate and store the basis functions of all the measurements to fit in ccdImageList.
+    void cache(CcdImageList const &ccdImageList);
+
+    /**
+     * Return the basis functions at measuredStar's focal plane position.
+     *
+     * They come from the cache when it holds them for this star at this position; otherwise (e.g. for a
+     * star loaded after cache()) they are evaluated into work, which is resized if needed.
+     */
+    Eigen::Ref<Eigen::VectorXd const> getValues(MeasuredStar const &measuredStar,
+                                                Eigen::VectorXd &work) const;
+
+    /// Whether getValues() reads measuredStar's basis functions from the cache.
+    bool isCached(MeasuredStar const &measuredStar) const { return findColumn(measuredStar) >= 0; }
+
+    /// Number of basis functions, including the constant term.
+    unsigned getNTerms() const { return _nTerms; }
+
+    /// Number of measurements in the cache.
+    std::size_t getCacheSize() const { return _columns.size(); }
+
+    size_t getOrder() const { return _chebyshev.getOrder(); }
+
+    afw::geom::Box2D getBBox() const { return _chebyshev.getBBox(); }
+
+private:
+    // an identity transfo of the right order and domain, whose derivatives are the basis functions.
+    PhotometryTransfoChebyshev _chebyshev;
+    unsigned _nTerms;
+    // the basis functions of the cached measurements, one column each
+    Eigen::MatrixXd _values;
+    // the focal plane positions they were evaluated at: a star at a recycled address must not match.
+    Eigen::Matrix2Xd _positions;
+    std::unordered_map<MeasuredStar const *, Eigen::Index> _columns;
+
+    // the cache column of measuredStar at its current position, or -1 if there is none.
+    Eigen::Index findColumn(MeasuredStar const &measuredStar) const;
+};
+
+/**
+ * A focal plane response (star flat) @f$S(u,v) = 1 + \sum_{k>0} a_k B_k(u,v)@f$ over the basis functions
+ * of a FocalPlaneBasis.
+ *
+ * The constant term is held at 1: it is degenerate with the visit zero points, and is not a parameter.
+ */
+class PhotometryStarFlat {
+public:
+    explicit PhotometryStarFlat(std::shared_ptr<FocalPlaneBasis const> basis)
+            : _basis(std::move(basis)),
+              _coefficients(Eigen::VectorXd::Unit(_basis->getNTerms(), 0)),
+              _errorCoefficients(_coefficients),
+              _frozen(false),
+              _index(-1) {}
+
+    /// No copy or move: a star flat is shared by all the mappings of its epoch.
+    PhotometryStarFlat(PhotometryStarFlat const &) = delete;
+    PhotometryStarFlat(PhotometryStarFlat &&) = delete;
+    PhotometryStarFlat &operator=(PhotometryStarFlat const &) = delete;
+    PhotometryStarFlat &operator=(PhotometryStarFlat &&) = delete;
+
+    /// Number of parameters: the non-constant coefficients.
+    unsigned getNpar() const { return _coefficients.size() - 1; }
+
+    /// The response for the basis function values of a measurement (from getBasis().getValues()).
+    double evaluate(Eigen::Ref<Eigen::VectorXd const> values) const { return values.dot(_coefficients); }
+
+    /// The response used to propagate errors: identical to evaluate() until freezeErrorTransform().
+    double evaluateError(Eigen::Ref<Eigen::VectorXd const> values) const {
+        return values.dot(_frozen ? _errorCoefficients : _coefficients);
+    }
+
+    /// @copydoc PhotometryMappingBase::freezeErrorTransform
+    void freezeErrorTransform() {
+        _errorCoefficients = _coefficients;
+        _frozen = true;
+    }
+
+    /// Offset the non-constant coefficients by -delta.
+    void offsetParams(Eigen::VectorXd const &delta) { _coefficients.tail(getNpar()) -= delta; }
+
+    /// Get a copy of the non-constant coefficients, in the same order as offsetParams.
+    Eigen::VectorXd getParameters() const { return _coefficients.tail(getNpar()); }
+
+    /// Return the response as a Chebyshev transfo over the focal plane.
+    std::shared_ptr<PhotometryTransfoChebyshev> toTransfo() const;
+
+    FocalPlaneBasis const &getBasis() const { return *_basis; }
+
+    unsigned getIndex() const { return _index; }
+    void setIndex(unsigned i) { _index = i; }
+
+    void dump(std::ostream &stream = std::cout) const {
+        stream << "index: " << _index << " star flat coefficients: " << _coefficients.transpose();
+    }
+
+private:
+    std::shared_ptr<FocalPlaneBasis const> _basis;
+    // all the coefficients, including the constant one.
+    Eigen::VectorXd _coefficients;
+    Eigen::VectorXd _errorCoefficients;
+    bool _frozen;
+    // Start index of the parameters in the "grand" fit
+    unsigned _index;
+};
+
+/**
+ * A three-level photometric transform: one for the ccd, one for the visit, and a focal plane response
+ * (star flat) shared by the visits of an epoch.
+ *
+ * The ccd and visit transforms are spatially invariant zero points; the spatial dependence comes from the
+ * star flat, whose basis functions are looked up in its FocalPlaneBasis instead of being evaluated for
+ * every measurement.
+ */
+class StarFlatPhotometryMapping : public PhotometryMappingBase {
+public:
+    StarFlatPhotometryMapping(std::shared_ptr<PhotometryMapping> chipMapping,
+                              std::shared_ptr<PhotometryMapping> visitMapping,
+                              std::shared_ptr<PhotometryStarFlat> starFlat)
+            : PhotometryMappingBase(),
+              _chipMapping(std::move(chipMapping)),
+              _visitMapping(std::move(visitMapping)),
+              _starFlat(std::move(starFlat)) {}
+
+    /// @copydoc PhotometryMappingBase::getNpar
+    unsigned getNpar() const override {
+        return _chipMapping->getNpar() + _visitMapping->getNpar() + _starFlat->getNpar();
+    }
+
+    /// @copydoc PhotometryMappingBase::transform
+    double transform(MeasuredStar const &measuredStar, double instFlux) const override;
+
+    /// @copydoc PhotometryMappingBase::transformError
+    double transformError(MeasuredStar const &measuredStar, double instFluxErr) const override;
+
+    /// @copydoc PhotometryMappingBase::freezeErrorTransform
+    void freezeErrorTransform() override {
+        _chipMapping->freezeErrorTransform();
+        _visitMapping->freezeErrorTransform();
+        _starFlat->freezeErrorTransform();
+    }
+
+    /// @copydoc PhotometryMappingBase::computeParameterDerivatives
+    void computeParameterDerivatives(MeasuredStar const &measuredStar, double instFlux,
+                                     Eigen::Ref<Eigen::VectorXd> derivatives) const override;
+
+    /// @copydoc PhotometryMappingBase::offsetParams
+    void offsetParams(Eigen::VectorXd const &delta) override {
+        unsigned const nChip = _chipMapping->getNpar();
+        unsigned const nVisit = _visitMapping->getNpar();
+        _chipMapping->offsetParams(delta.segment(0, nChip));
+        _visitMapping->offsetParams(delta.segment(nChip, nVisit));
+        _starFlat->offsetParams(delta.segment(nChip + nVisit, _starFlat->getNpar()));
+    }
+
+    /// @copydoc PhotometryMappingBase::getParameters
+    Eigen::VectorXd getParameters() override {
+        Eigen::VectorXd joined(getNpar());
+        joined << _chipMapping->getParameters(), _visitMapping->getParameters(), _starFlat->getParameters();
+        return joined;
+    }
+
+    /// @copydoc PhotometryMappingBase::getMappingIndices
+    void getMappingIndices(std::vector<unsigned> &indices) const override;
+
+    /// @copydoc PhotometryMappingBase::dump
+    void dump(std::ostream &stream = std::cout) const override {
+        stream << "index: " << index << " chipMapping: ";
+        _chipMapping->dump(stream);
+        stream << " visitMapping: ";
+        _visitMapping->dump(stream);
+        stream << " starFlat: ";
+        _starFlat->dump(stream);
+    }
+
+    std::shared_ptr<PhotometryMapping> getChipMapping() const { return _chipMapping; }
+    std::shared_ptr<PhotometryMapping> getVisitMapping() const { return _visitMapping; }
+    std::shared_ptr<PhotometryStarFlat> getStarFlat() const { return _starFlat; }
+
+private:
+    std::shared_ptr<PhotometryMapping> _chipMapping;
+    std::shared_ptr<PhotometryMapping> _visitMapping;
+    std::shared_ptr<PhotometryStarFlat> _starFlat;
+};
+
 }  // namespace jointcal
 }  // namespace lsst
 
@@ -190,6 +190,9 @@ public:
     /// Get a copy of the coefficients of the polynomials, as a 2d array (NOTE: layout is [y][x])
     ndarray::Array<double, 2, 2> getCoefficients() { return ndarray::copy(_coefficients); }
 
+    /// Get the coefficients as the rows (a_ij, 1, i, j), for out += a_ij*T_i(x)*T_j(y), of an ast::ChebyMap.
+    ndarray::Array<double, 2, 2> getChebyMapCoefficients() const;
+
     /// @copydoc PhotometryTransfo::getParameters
     Eigen::VectorXd getParameters() const override;
 
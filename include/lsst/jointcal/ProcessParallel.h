@@ -0,0 +1,151 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_PROCESS_PARALLEL_H
+#define LSST_JOINTCAL_PROCESS_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace lsst {
+namespace jointcal {
+
+/*
+ * Running parts of a fit in forked worker processes.
+ *
+ * A forked child sees the address space of its parent as it was at the fork (copy on write), so the
+ * catalogs, the measured stars and the current model parameters need no serialization: the workers read
+ * them in place. The workers return their results through SharedBuffers, which are mapped in the parent
+ * before the fork and hence shared with all children. The pages of a SharedBuffer are allocated where
+ * they are first written, i.e. on the NUMA node of the worker that fills them when the workers are pinned
+ * to cores (see runInChildProcesses).
+ *
+ * This only works on POSIX systems, and the children must not rely on threads of the parent: they only run
+ * the computation they were given and exit, without returning to Python.
+ *
+ * Forking a multithreaded process is hazardous: the child only has a copy of the forking thread, and a lock
+ * another thread held at the fork stays locked in the child for good. The Python interpreter that drives
+ * jointcal may have such threads, e.g. behind the log4cxx appenders of lsst.log, and the StarArena of the
+ * Associations serializes its allocations with a mutex. A child that logs (as the blind matcher does) or
+ * allocates stars from a StarArena then deadlocks if another thread of the parent was doing the same at
+ * the fork. The fit tasks only read the shared state and write to SharedBuffers; callers must not run
+ * these functions while other threads of theirs may log or allocate stars.
+ *
+ * A fork costs a copy of the page tables of the parent, and then of every page either process writes:
+ * for a fit, that is comparable to one evaluation of the derivatives. runInChildProcesses pays it at
+ * every call; a WorkerPool pays it once for a sequence of calls.
+ */
+
+/**
+ * An anonymous memory mapping shared between a process and the children it forks afterwards.
+ */
+class SharedBuffer {
+public:
+    /// Map size bytes, initialized to zero.
+    explicit SharedBuffer(std::size_t size);
+
+    ~SharedBuffer();
+
+    /// No copy or move: the mapping is unmapped by its owner.
+    SharedBuffer(SharedBuffer const &) = delete;
+    SharedBuffer(SharedBuffer &&) = delete;
+    SharedBuffer &operator=(SharedBuffer const &) = delete;
+    SharedBuffer &operator=(SharedBuffer &&) = delete;
+
+    std::size_t size() const { return _size; }
+
+    /// The buffer as an array of T, starting offset bytes into it.
+    template <typename T>
+    T *data(std::size_t offset = 0) const {
+        return reinterpret_cast<T *>(static_cast<char *>(_data) + offset);
+    }
+
+private:
+    void *_data;
+    std::size_t _size;
+};
+
+/**
+ * Run task(0) ... task(nProcesses-1), each in its own forked child process, and wait for all of them.
+ *
+ * The children exit as soon as their task returns; only what they wrote to SharedBuffers is visible to the
+ * caller.
+ *
+ * @param nProcesses  Number of children to fork.
+ * @param task        The work of a child, given its index.
+ * @param pinWorkers  Pin each child to one of the cores the caller may run on, spread evenly over them, so
+ *                    that the memory each child first touches is local to its NUMA node.
+ *
+ * @throws pex::exceptions::RuntimeError if a child could not be forked, or did not complete its task
+ *         (it threw, or was killed). The message includes what each failed child threw, truncated to a
+ *         few hundred characters, or the signal that killed it.
+ */
+void runInChildProcesses(unsigned nProcesses, std::function<void(unsigned)> const &task,
+                         bool pinWorkers = true);
+
+/**
+ * Worker processes forked once, that run a task on command until the pool is destroyed.
+ *
+ * The workers keep the state of the parent as it was when the pool was constructed: the parent must
+ * replay every later change the task depends on through commands of its own, e.g. by writing the change
+ * to a SharedBuffer and running a command that applies it in the workers. Likewise, the SharedBuffers the
+ * workers use must be mapped before the pool is constructed.
+ */
+class WorkerPool {
+public:
+    /**
+     * Fork the workers.
+     *
+     * @param nProcesses  Number of workers.
+     * @param task        The work of a worker for one command, given its index and the command.
+     * @param pinWorkers  Pin each worker to one of the cores the caller may run on, as runInChildProcesses.
+     *
+     * @throws pex::exceptions::RuntimeError if a worker could not be forked.
+     */
+    WorkerPool(unsigned nProcesses, std::function<void(unsigned, unsigned)> task, bool pinWorkers = true);
+
+    /// Tell the workers to exit, and wait for them.
+    ~WorkerPool();
+
+    /// No copy or move: the workers are stopped by their owner.
+    WorkerPool(WorkerPool const &) = delete;
+    WorkerPool(WorkerPool &&) = delete;
+    WorkerPool &operator=(WorkerPool const &) = delete;
+    WorkerPool &operator=(WorkerPool &&) = delete;
+
+    unsigned size() const { return _workers.size(); }
+
+    /**
+     * Run task(i, command) in every worker i, and wait for all of them.
+     *
+     * @throws pex::exceptions::RuntimeError if a worker did not complete the command (it threw, or died),
+     *         with the same message as runInChildProcesses. The pool cannot run any command after that.
+     */
+    void run(unsigned command);
+
+private:
+    struct Worker {
+        pid_t pid;   // -1 once waited for
+        int socket;  // our end of the socket pair the worker receives its commands on
+    };
+
+    /// Close the sockets, which makes the workers exit, and wait for them.
+    void stop();
+
+    std::vector<Worker> _workers;
+    SharedBuffer _messages;  // what each worker threw
+    bool _failed;
+};
+
+/**
+ * Split [0, weights.size()) into at most nParts contiguous ranges of about equal total weight.
+ *
+ * @return The nParts+1 boundaries of the ranges: part i is [bounds[i], bounds[i+1]), and may be empty.
+ */
+std::vector<std::size_t> partitionByWeight(std::vector<std::size_t> const &weights, unsigned nParts);
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_PROCESS_PARALLEL_H
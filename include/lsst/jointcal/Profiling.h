@@ -0,0 +1,157 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_PROFILING_H
+#define LSST_JOINTCAL_PROFILING_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "lsst/jointcal/AllocationTracking.h"
+
+namespace lsst {
+namespace jointcal {
+
+/**
+ * Accumulated wall-clock and CPU time spent in one named phase.
+ *
+ * The allocation counts are only collected when jointcal is built with JOINTCAL_ALLOC_TRACKING
+ * (see AllocationTracking.h), and are 0 otherwise.
+ */
+struct PhaseTiming {
+    double wallTime;  // seconds
+    double cpuTime;   // seconds of process CPU time (all threads)
+    unsigned calls;
+    std::uint64_t allocations;     // heap allocations by the thread running the phase
+    std::uint64_t allocatedBytes;  // bytes requested by those allocations
+
+    PhaseTiming() : wallTime(0), cpuTime(0), calls(0), allocations(0), allocatedBytes(0) {}
+
+    friend std::ostream &operator<<(std::ostream &s, PhaseTiming const &timing) {
+        s << "wall: " << timing.wallTime << "s cpu: " << timing.cpuTime << "s calls: " << timing.calls;
+        if (timing.allocations != 0) {
+            s << " allocations: " << timing.allocations << " (" << timing.allocatedBytes << " bytes)";
+        }
+        return s;
+    }
+};
+
+/**
+ * Timings, counters and memory collected while running the associations or the fitters.
+ *
+ * Phases are identified by name (e.g. "associateCatalogs", "factorization") and accumulate over repeated
+ * calls, until reset() is called. Counters hold the last value set (e.g. "hessianNonZeros"), or a running
+ * total when incremented with addCounter. Memory entries hold the high-water mark, in bytes, of the
+ * named containers (e.g. "hessian", "fittedStarList").
+ */
+class Profile {
+public:
+    using TimingMap = std::map<std::string, PhaseTiming>;
+    using CounterMap = std::map<std::string, double>;
+    using MemoryMap = std::map<std::string, std::size_t>;
+
+    Profile() = default;
+
+    /// Add the time spent, and the allocations made, in one call of a phase.
+    void addTiming(std::string const &phase, double wallTime, double cpuTime,
+                   AllocationCount const &allocations = AllocationCount());
+
+    /// Set a counter to value, replacing the previous value.
+    void setCounter(std::string const &name, double value) { _counters[name] = value; }
+
+    /// Add value to a counter (starting from 0).
+    void addCounter(std::string const &name, double value) { _counters[name] += value; }
+
+    /// Record the bytes held by a named container, keeping the largest value seen.
+    void updateMemory(std::string const &name, std::size_t bytes) {
+        auto &highWater = _memory[name];
+        highWater = std::max(highWater, bytes);
+    }
+
+    TimingMap const &getTimings() const { return _timings; }
+
+    CounterMap const &getCounters() const { return _counters; }
+
+    MemoryMap const &getMemory() const { return _memory; }
+
+    /// Forget all timings, counters and memory.
+    void reset() {
+        _timings.clear();
+        _counters.clear();
+        _memory.clear();
+    }
+
+    friend std::ostream &operator<<(std::ostream &s, Profile const &profile);
+
+private:
+    TimingMap _timings;
+    CounterMap _counters;
+    MemoryMap _memory;
+};
+
+/**
+ * Times the scope it lives in, and adds the result to a Profile as the given phase when it goes out of
+ * scope (or when stop() is called).
+ *
+ * @code
+ *     {
+ *         ScopedPhase phase(_profile, "factorization");
+ *         ...
+ *     }
+ * @endcode
+ */
+class ScopedPhase {
+public:
+    ScopedPhase(Profile &profile, std::string phase)
+            : _profile(profile),
+              _phase(std::move(phase)),
+              _wallStart(std::chrono::steady_clock::now()),
+              _cpuStart(std::clock()),
+              _allocationStart(getThreadAllocations()),
+              _running(true) {}
+
+    ScopedPhase(ScopedPhase const &) = delete;
+    ScopedPhase(ScopedPhase &&) = delete;
+    ScopedPhase &operator=(ScopedPhase const &) = delete;
+    ScopedPhase &operator=(ScopedPhase &&) = delete;
+
+    /**
+     * Record the time spent so far, and return its wall time in seconds.
+     *
+     * Further calls (including from the destructor) do nothing and return 0.
+     */
+    double stop() {
+        if (!_running) return 0;
+        _running = false;
+        double wallTime =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - _wallStart).count();
+        double cpuTime = double(std::clock() - _cpuStart) / CLOCKS_PER_SEC;
+        AllocationCount allocations = getThreadAllocations();
+        allocations.count -= _allocationStart.count;
+        allocations.bytes -= _allocationStart.bytes;
+        _profile.addTiming(_phase, wallTime, cpuTime, allocations);
+        return wallTime;
+    }
+
+    ~ScopedPhase() { stop(); }
+
+private:
+    Profile &_profile;
+    std::string _phase;
+    std::chrono::steady_clock::time_point _wallStart;
+    std::clock_t _cpuStart;
+    // counts the allocations of the phase: constructed before _allocationStart is read.
+    AllocationTrackingScope _trackingScope;
+    AllocationCount _allocationStart;
+    bool _running;
+};
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_PROFILING_H
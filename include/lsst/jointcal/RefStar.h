@@ -2,8 +2,10 @@
 #ifndef LSST_JOINTCAL_REF_STAR_H
 #define LSST_JOINTCAL_REF_STAR_H
 
+#include <array>
 #include <vector>
 #include <fstream>
+#include <limits>
 
 #include "lsst/jointcal/FittedStar.h"
 #include "lsst/jointcal/StarList.h"
@@ -19,7 +21,14 @@ public:
             std::vector<double>& refFluxErrList)
             : BaseStar(xx, yy, defaultFlux, defaultFluxErr),
               _refFluxList(refFluxList),
-              _refFluxErrList(refFluxErrList) {}
+              _refFluxErrList(refFluxErrList),
+              _hasProperMotion(false),
+              _pmRa(0),
+              _pmDec(0),
+              _pmRaErr(0),
+              _pmDecErr(0),
+              _parallax(0),
+              _epoch(std::numeric_limits<double>::quiet_NaN()) {}
 
     /// No move or copy: each RefStar is unique, and should be accessed/managed via shared_ptr.
     RefStar(RefStar const&) = delete;
@@ -42,13 +51,68 @@ public:
     double getFlux(size_t filter) const { return _refFluxList[filter]; }
     /// reference fluxErr in a given filter
     double getFluxErr(size_t filter) const { return _refFluxErrList[filter]; }
+    /// number of filters with a reference flux; 0 if the star only has its default flux.
+    size_t getNFilters() const { return _refFluxList.size(); }
+
+    /**
+     * Set the proper motion and its errors, in degrees per day along ra*cos(dec) and dec.
+     */
+    void setProperMotion(double pmRa, double pmDec, double pmRaErr, double pmDecErr) {
+        _hasProperMotion = true;
+        _pmRa = pmRa;
+        _pmDec = pmDec;
+        _pmRaErr = pmRaErr;
+        _pmDecErr = pmDecErr;
+    }
+    bool hasProperMotion() const { return _hasProperMotion; }
+    double getPmRa() const { return _pmRa; }
+    double getPmDec() const { return _pmDec; }
+    double getPmRaErr() const { return _pmRaErr; }
+    double getPmDecErr() const { return _pmDecErr; }
+
+    /// Parallax in degrees; 0 if unknown.
+    double getParallax() const { return _parallax; }
+    void setParallax(double parallax) { _parallax = parallax; }
+
+    /// Epoch (MJD) of the position; NaN if unknown.
+    double getEpoch() const { return _epoch; }
+    void setEpoch(double epoch) { _epoch = epoch; }
+
+    /**
+     * Move the position (ra, dec in degrees) from its epoch to mjd with the proper motion, and add the
+     * uncertainty of the proper motion over that time to the position variances.
+     *
+     * Does nothing without a proper motion or a known epoch.
+     */
+    void propagateToEpoch(double mjd);
 
 private:
     // on-sky flux, in Maggies, per filter
     std::vector<double> _refFluxList;
     std::vector<double> _refFluxErrList;
+
+    bool _hasProperMotion;
+    double _pmRa, _pmDec, _pmRaErr, _pmDecErr;
+    double _parallax;
+    double _epoch;
 };
 
+/**
+ * Geocentric equatorial position of the Sun at mjd, in AU.
+ *
+ * Low precision (about 0.01 degree, Astronomical Almanac), which is plenty for parallax displacements.
+ */
+std::array<double, 3> computeSunPosition(double mjd);
+
+/**
+ * Parallactic displacement of a star at (ra, dec) seen from the Earth, along ra*cos(dec) and dec.
+ *
+ * @param ra, dec      Barycentric position of the star, in degrees.
+ * @param sunPosition  Geocentric position of the Sun, from computeSunPosition().
+ * @param parallax     Parallax of the star; the displacement is in the same unit.
+ */
+Point computeParallaxShift(double ra, double dec, std::array<double, 3> const &sunPosition, double parallax);
+
 /****** RefStarList ***********/
 
 class Frame;
@@ -126,7 +126,9 @@ public:
     /*! The transformation will be initialized to gtransfo, so that the effective transformation
       reads gtransfo*CenterAndScale */
     SimplePolyMapping(GtransfoLin const &CenterAndScale, GtransfoPoly const &gtransfo)
-            : SimpleGtransfoMapping(gtransfo), _centerAndScale(CenterAndScale) {
+            : SimpleGtransfoMapping(gtransfo),
+              _centerAndScale(CenterAndScale),
+              _actualResultIsCurrent(false) {
         // We assume that the initialization was done properly, for example that
         // gtransfo = pix2TP*CenterAndScale.invert(), so we do not touch transfo.
         /* store the (spatial) derivative of _centerAndScale. For the extra
@@ -195,11 +197,20 @@ public:
         outPoint.vxy = tmp.vxy;
     }
 
-    //! Access to the (fitted) transfo
+    //! Also invalidates the combination returned by getTransfo.
+    void offsetParams(Eigen::VectorXd const &delta) {
+        SimpleGtransfoMapping::offsetParams(delta);
+        _actualResultIsCurrent = false;
+    }
+
+    //! Access to the (fitted) transfo, composed again only if the parameters changed since the last call.
     Gtransfo const &getTransfo() const {
-        // Cannot fail given the contructor:
-        const GtransfoPoly *fittedPoly = dynamic_cast<const GtransfoPoly *>(&(*transfo));
-        actualResult = (*fittedPoly) * _centerAndScale;
+        if (!_actualResultIsCurrent) {
+            // Cannot fail given the contructor:
+            const GtransfoPoly *fittedPoly = dynamic_cast<const GtransfoPoly *>(&(*transfo));
+            actualResult = (*fittedPoly) * _centerAndScale;
+            _actualResultIsCurrent = true;
+        }
         return actualResult;
     }
 
@@ -210,8 +221,9 @@ private:
     GtransfoLin _centerAndScale;
     Eigen::Matrix2d preDer;
 
-    /* Where we store the combination. */
+    /* Where we store the combination, and whether it is that of the current parameters. */
     mutable GtransfoPoly actualResult;
+    mutable bool _actualResultIsCurrent;
 };
 
 #ifdef STORAGE
@@ -28,10 +28,18 @@ separate transfrom per CcdImage. One could chose other setups.
 /* This modeling of distortions can even accommodate images set mixing instruments */
 class SimpleAstrometryModel : public AstrometryModel {
 public:
-    //! Sky2TP is just a name, it can be anything
+    /**
+     * Sky2TP is just a name, it can be anything
+     *
+     * @param orderCriterion  If empty, all the CcdImages get polynomials of the given order (fewer if they
+     *                        have too few measurements). Otherwise ("BIC" or "AIC", see
+     *                        GtransfoPoly::compareOrders), order is the highest order allowed and each
+     *                        CcdImage gets the order, from 1 up, that minimizes this criterion for the
+     *                        mapping of its measurements onto the positions of their FittedStars.
+     */
     SimpleAstrometryModel(CcdImageList const &ccdImageList,
                           const std::shared_ptr<ProjectionHandler const> projectionHandler, bool initFromWCS,
-                          unsigned nNotFit = 0, unsigned order = 3);
+                          unsigned nNotFit = 0, unsigned order = 3, std::string const &orderCriterion = "");
 
     /// No copy or move: there is only ever one instance of a given model (i.e.. per ccd+visit)
     SimpleAstrometryModel(SimpleAstrometryModel const &) = delete;
@@ -68,6 +76,10 @@ public:
     ~SimpleAstrometryModel(){};
 
 private:
+    /// The order that orderCriterion selects for ccdImage, or 0 if its measurements constrain none.
+    unsigned selectOrder(CcdImage const &ccdImage, unsigned maxOrder,
+                         std::string const &orderCriterion) const;
+
     std::map<CcdImageKey, std::unique_ptr<SimpleGtransfoMapping>> _myMap;
     const std::shared_ptr<ProjectionHandler const> _sky2TP;
 
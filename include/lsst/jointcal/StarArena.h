@@ -0,0 +1,136 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_STAR_ARENA_H
+#define LSST_JOINTCAL_STAR_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace lsst {
+namespace jointcal {
+
+/**
+ * A pool of fixed-size blocks for the stars that are rebuilt at each association.
+ *
+ * Every associateCatalogs() creates a copy of each MeasuredStar and new FittedStars, and every
+ * collectRefStars() new RefStars, which are only freed at the next association. Allocating them one by one
+ * from the general heap scatters them among the longer-lived allocations of the fit, which fragments the
+ * heap over long runs. The arena instead carves the stars (and their shared_ptr control blocks) out of
+ * large chunks, recycles freed blocks for objects of the same size, and releases all its chunks at once
+ * when no block is in use.
+ *
+ * Blocks are sorted in size classes of BLOCK_ALIGNMENT bytes; requests larger than MAX_BLOCK_SIZE go to
+ * the general heap. The arena is thread-safe.
+ */
+class StarArena {
+public:
+    /// Granularity and alignment of the blocks.
+    static constexpr std::size_t BLOCK_ALIGNMENT = 16;
+    /// Largest block served from the chunks.
+    static constexpr std::size_t MAX_BLOCK_SIZE = 1024;
+    /// Size of the chunks the blocks are carved from.
+    static constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+
+    StarArena() : _pools(MAX_BLOCK_SIZE / BLOCK_ALIGNMENT), _nLiveBlocks(0), _nReleases(0) {}
+
+    /// No copy or move: blocks point back to their arena.
+    StarArena(StarArena const &) = delete;
+    StarArena(StarArena &&) = delete;
+    StarArena &operator=(StarArena const &) = delete;
+    StarArena &operator=(StarArena &&) = delete;
+
+    /// Return a block of at least size bytes, aligned to BLOCK_ALIGNMENT.
+    void *allocate(std::size_t size);
+
+    /// Give back a block returned by allocate(size).
+    void deallocate(void *block, std::size_t size) noexcept;
+
+    /**
+     * Free all chunks if no block is in use.
+     *
+     * @return true if the chunks were freed (or there were none).
+     */
+    bool release();
+
+    /// Number of blocks currently handed out.
+    std::size_t getNLiveBlocks() const;
+
+    /// Number of chunks currently held.
+    std::size_t getNChunks() const;
+
+    /// Bytes currently held in chunks.
+    std::size_t getCapacity() const { return getNChunks() * CHUNK_SIZE; }
+
+    /// Number of times release() freed the chunks.
+    std::size_t getNReleases() const;
+
+private:
+    // The blocks of one size class: a free list threaded through the freed blocks, and the unused end
+    // of the last chunk given to this class.
+    struct Pool {
+        void *freeList = nullptr;
+        char *next = nullptr;
+        char *end = nullptr;
+    };
+
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<char[]>> _chunks;
+    std::vector<Pool> _pools;
+    std::size_t _nLiveBlocks;
+    std::size_t _nReleases;
+};
+
+/**
+ * Standard allocator drawing from a StarArena, for std::allocate_shared and containers.
+ *
+ * Holds a reference to the arena, so that objects allocated from it can outlive their Associations.
+ * Without an arena, it uses the general heap.
+ */
+template <class T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(std::shared_ptr<StarArena> arena) : _arena(std::move(arena)) {}
+
+    template <class U>
+    ArenaAllocator(ArenaAllocator<U> const &other) : _arena(other.getArena()) {}
+
+    T *allocate(std::size_t n) {
+        if (!_arena) return static_cast<T *>(::operator new(n * sizeof(T)));
+        return static_cast<T *>(_arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *pointer, std::size_t n) noexcept {
+        if (!_arena) return ::operator delete(pointer);
+        _arena->deallocate(pointer, n * sizeof(T));
+    }
+
+    std::shared_ptr<StarArena> const &getArena() const { return _arena; }
+
+    template <class U>
+    bool operator==(ArenaAllocator<U> const &other) const {
+        return _arena == other.getArena();
+    }
+
+    template <class U>
+    bool operator!=(ArenaAllocator<U> const &other) const {
+        return _arena != other.getArena();
+    }
+
+private:
+    std::shared_ptr<StarArena> _arena;
+};
+
+/// std::make_shared, drawing the object from arena if there is one.
+template <class T, class... Args>
+std::shared_ptr<T> makeArenaShared(std::shared_ptr<StarArena> const &arena, Args &&... args) {
+    if (!arena) return std::make_shared<T>(std::forward<Args>(args)...);
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+}
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_STAR_ARENA_H
@@ -0,0 +1,111 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_STAR_FLAT_PHOTOMETRY_MODEL_H
+#define LSST_JOINTCAL_STAR_FLAT_PHOTOMETRY_MODEL_H
+
+#include <map>
+#include <vector>
+
+#include "lsst/jointcal/CcdImage.h"
+#include "lsst/jointcal/PhotometryModel.h"
+#include "lsst/jointcal/PhotometryMapping.h"
+
+namespace lsst {
+namespace jointcal {
+
+/**
+ * Photometry model with a focal plane response, @f$M(x,y) = M_CCD*M_visit*S_epoch(u,v)@f$
+ *
+ * This model consists of the following components:
+ *   - A spatially invariant zero point per CCD, constrained across all visits, @f$M_CCD@f$.
+ *   - A spatially invariant zero point per visit, constrained across all CCDs, @f$M_visit@f$.
+ *   - A Chebyshev polynomial of the focal plane position @f$(u,v)@f$ (a "star flat"), constrained across
+ *     all the visits of an epoch, @f$S_epoch@f$.
+ *
+ * The basis functions of the star flat are evaluated once at the focal plane position of every measurement
+ * and cached, so that the derivatives cost little more than those of the visit zero points.
+ *
+ * As in ConstrainedPhotometryModel, one CCD's zero point is held fixed to remove the degeneracy under
+ * multiplication by a constant; the constant term of each star flat is held at 1 for the same reason.
+ */
+class StarFlatPhotometryModel : public PhotometryModel {
+public:
+    /**
+     * Construct a star flat photometry model.
+     *
+     * @param      ccdImageList    The list of CCDImages to construct the model for.
+     * @param      focalPlaneBBox  The bounding box of the camera's focal plane, defining the domain of the
+     *                             star flat polynomial.
+     * @param[in]  starFlatOrder   The order of the star flat polynomial.
+     * @param[in]  epochBoundaries Increasing MJDs separating the epochs, each with its own star flat;
+     *                             empty for a single star flat shared by all visits. Epochs without
+     *                             any ccdImage get no star flat.
+     */
+    StarFlatPhotometryModel(CcdImageList const &ccdImageList, afw::geom::Box2D const &focalPlaneBBox,
+                            int starFlatOrder = 4,
+                            std::vector<double> const &epochBoundaries = std::vector<double>());
+
+    /// No copy or move: there is only ever one instance of a given model (i.e. per ccd+visit)
+    StarFlatPhotometryModel(StarFlatPhotometryModel const &) = delete;
+    StarFlatPhotometryModel(StarFlatPhotometryModel &&) = delete;
+    StarFlatPhotometryModel &operator=(StarFlatPhotometryModel const &) = delete;
+    StarFlatPhotometryModel &operator=(StarFlatPhotometryModel &&) = delete;
+
+    /// @copydoc PhotometryModel::assignIndices
+    unsigned assignIndices(std::string const &whatToFit, unsigned firstIndex) override;
+
+    /// @copydoc PhotometryModel::offsetParams
+    void offsetParams(Eigen::VectorXd const &delta) override;
+
+    /// @copydoc PhotometryModel::transform
+    double transform(CcdImage const &ccdImage, MeasuredStar const &measuredStar,
+                     double instFlux) const override;
+
+    /// @copydoc PhotometryModel::transformError
+    double transformError(CcdImage const &ccdImage, MeasuredStar const &measuredStar,
+                          double instFluxErr) const override;
+
+    /// @copydoc PhotometryModel::freezeErrorTransform
+    void freezeErrorTransform() override;
+
+    /// @copydoc PhotometryModel::getMappingIndices
+    void getMappingIndices(CcdImage const &ccdImage, std::vector<unsigned> &indices) const override;
+
+    /// @copydoc PhotometryModel::computeParameterDerivatives
+    void computeParameterDerivatives(MeasuredStar const &measuredStar, CcdImage const &ccdImage,
+                                     Eigen::VectorXd &derivatives) const override;
+
+    /// @copydoc PhotometryModel::toPhotoCalib
+    std::shared_ptr<afw::image::PhotoCalib> toPhotoCalib(CcdImage const &ccdImage) const override;
+
+    /// @copydoc PhotometryModel::dump
+    void dump(std::ostream &stream = std::cout) const override;
+
+    /// Number of star flats in this model: one per epoch with data.
+    std::size_t getNEpochs() const { return _starFlats.size(); }
+
+    /// Number of measurements whose star flat basis functions are cached.
+    std::size_t getCacheSize() const { return _basis->getCacheSize(); }
+
+    /// Whether the star flat basis functions of measuredStar are read from the cache.
+    bool isCached(MeasuredStar const &measuredStar) const { return _basis->isCached(measuredStar); }
+
+private:
+    PhotometryMappingBase *findMapping(CcdImage const &ccdImage) const override;
+
+    std::shared_ptr<FocalPlaneBasis> _basis;
+
+    typedef std::unordered_map<CcdImageKey, std::unique_ptr<StarFlatPhotometryMapping>> MapType;
+    MapType _myMap;
+
+    typedef std::map<VisitIdType, std::shared_ptr<PhotometryMapping>> VisitMapType;
+    VisitMapType _visitMap;
+    typedef std::map<CcdIdType, std::shared_ptr<PhotometryMapping>> ChipMapType;
+    ChipMapType _chipMap;
+    // one star flat per epoch with data, in increasing MJD.
+    std::vector<std::shared_ptr<PhotometryStarFlat>> _starFlats;
+};
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_STAR_FLAT_PHOTOMETRY_MODEL_H
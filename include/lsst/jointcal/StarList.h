@@ -8,6 +8,7 @@
 #include <memory>
 
 #include "lsst/jointcal/Point.h"
+#include "lsst/jointcal/StarArena.h"
 
 namespace lsst {
 namespace jointcal {
@@ -62,8 +63,8 @@ public:
     //! copy the part of the std::list which is included in the frame at the end of another std::list
     void extractInFrame(StarList<Star> &out, const Frame &frame) const;
 
-    //! clears copy and makes a copy of the std::list to copy
-    void copyTo(StarList<Star> &copy) const;
+    //! clears copy and makes a copy of the std::list to copy, drawing the new stars from arena if given
+    void copyTo(StarList<Star> &copy, std::shared_ptr<StarArena> const &arena = nullptr) const;
 
     //! Clears the std::list
     void clearList() { cutTail(0); };
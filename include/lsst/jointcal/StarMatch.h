@@ -125,7 +125,17 @@ std::ostream &operator<<(std::ostream &stream, const StarMatchList &starMatchLis
 
 class StarMatchList : public std::list<StarMatch> {
 public:
-    void refineTransfo(double nSigmas);
+    /**
+     * Fit the transfo and iteratively discard the pairs beyond nSigmas, until no pair is discarded.
+     *
+     * @param nSigmas      The clipping threshold, in units of the square root of the median chi2.
+     * @param incremental  For polynomial transfos (other than GtransfoLinShift and GtransfoLinRot), fit once
+     *                     and downdate the solution for the discarded pairs (see
+     *                     GtransfoPoly::fitWithClipping) instead of refitting at each round. The weights
+     *                     are frozen after the first fit, so the result can differ slightly from the
+     *                     default: the matching routines of ListMatch keep the default.
+     */
+    void refineTransfo(double nSigmas, bool incremental = false);
 
     //! enables to get a transformed StarMatchList. Only positions are transformed, not attached stars. const
     //! routine: "this" remains unchanged.
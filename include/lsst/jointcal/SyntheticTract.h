@@ -0,0 +1,210 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_SYNTHETIC_TRACT_H
+#define LSST_JOINTCAL_SYNTHETIC_TRACT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lsst/afw/cameraGeom/Detector.h"
+#include "lsst/afw/table/Simple.h"
+#include "lsst/afw/table/Source.h"
+
+#include "lsst/jointcal/Associations.h"
+#include "lsst/jointcal/JointcalControl.h"
+#include "lsst/jointcal/Point.h"
+
+namespace lsst {
+namespace jointcal {
+
+/**
+ * Parameters of a synthetic tract: how many visits and CCDs, how dense the sky is,
+ * how distorted the focal plane is and how noisy/contaminated the measurements are.
+ *
+ * The defaults produce a small (~1 second to fit) tract; scale nVisits, the number of
+ * detectors and starDensity to produce benchmark-size problems.
+ */
+struct SyntheticTractControl {
+    int nVisits;                ///< number of visits (dithered exposures)
+    double raCenter;            ///< tract center, degrees
+    double decCenter;           ///< tract center, degrees
+    double ditherRadius;        ///< maximum boresight offset from the tract center, degrees
+    double plateScale;          ///< focal plane scale, arcseconds per focal plane unit (mm)
+    double distortion;          ///< cubic radial distortion coefficient, per focal plane unit squared
+    double starDensity;         ///< true stars per square arcminute
+    double magMin, magMax;      ///< range of true AB magnitudes (number counts grow as 10^(0.3 m))
+    double positionNoise;       ///< centroid noise (pixels) of a star at magMin
+    double fluxNoise;           ///< relative flux noise of a star at magMin
+    double outlierFraction;     ///< fraction of measurements displaced by outlierOffset
+    double outlierOffset;       ///< typical displacement of an outlier measurement, pixels
+    double refFraction;         ///< fraction of true stars present in the reference catalog
+    double refPositionNoise;    ///< reference catalog position noise, arcseconds
+    double wcsError;            ///< r.m.s. error of the input WCS zero points, arcseconds
+    double visitZeroPointSpread;  ///< r.m.s. of the per-visit photometric zero point, magnitudes
+    double colorSpread;         ///< r.m.s. of the (zero mean) true star colors, magnitudes
+    /// the magnitude of a star in filter is its magnitude plus colorSlope times its color: with 0 in one
+    /// filter and -1 in another, the color is the first magnitude minus the second.
+    double colorSlope;
+    /// chromatic term of filter, degrees per magnitude of color: measurements are displaced on the tangent
+    /// plane by the refraction vector of their visit (as CcdImage computes it) times color times this.
+    double refractionCoefficient;
+    /// relative flux response at the edge of the focal plane: the instrumental fluxes are multiplied by
+    /// 1 + focalPlaneResponse (r/R)^2, r the focal plane radius of the measurement and R that of the
+    /// farthest detector corner.
+    double focalPlaneResponse;
+    std::string filter;         ///< filter name given to all CcdImages
+    /// identifier of the first visit, the others following: a tract with the same seed in another filter
+    /// observes the same stars, and can be added to the same Associations with other visit identifiers.
+    int firstVisit;
+    unsigned seed;              ///< random seed: the same control and detectors give the same tract
+
+    SyntheticTractControl()
+            : nVisits(5),
+              raCenter(150.),
+              decCenter(2.),
+              ditherRadius(0.05),
+              plateScale(13.85),
+              distortion(1e-8),
+              starDensity(2.),
+              magMin(17.),
+              magMax(23.),
+              positionNoise(0.01),
+              fluxNoise(0.002),
+              outlierFraction(0.01),
+              outlierOffset(5.),
+              refFraction(0.3),
+              refPositionNoise(0.02),
+              wcsError(0.2),
+              visitZeroPointSpread(0.05),
+              colorSpread(0.),
+              colorSlope(0.),
+              refractionCoefficient(0.),
+              focalPlaneResponse(0.),
+              filter("r"),
+              firstVisit(1),
+              seed(1) {}
+};
+
+/**
+ * Generate a synthetic tract, and feed it to jointcal without going through the butler.
+ *
+ * A true star field is drawn uniformly over the area covered by all the dithered visits. Each
+ * measurement is the true star observed through the detector geometry, a cubic radial optical
+ * distortion, a per-visit zero point and a radial focal plane response, with Gaussian noise and a
+ * fraction of outliers. The input WCS given to each CcdImage is the undistorted linear approximation
+ * with a random zero point error, so that both the astrometric and photometric fits have something
+ * to correct.
+ *
+ * The detector geometry (bounding boxes and PIXELS->FOCAL_PLANE transforms) is taken from real
+ * cameraGeom detectors, so that the CcdImage focal plane coordinates are meaningful.
+ */
+class SyntheticTract {
+public:
+    /**
+     * Draw the true star field.
+     *
+     * @param control    The tract parameters.
+     * @param detectors  The detectors making the focal plane of each visit.
+     */
+    SyntheticTract(SyntheticTractControl const &control,
+                   std::vector<std::shared_ptr<afw::cameraGeom::Detector>> const &detectors);
+
+    /// No copy or move: a tract can be large, and it is only ever read.
+    SyntheticTract(SyntheticTract const &) = delete;
+    SyntheticTract(SyntheticTract &&) = delete;
+    SyntheticTract &operator=(SyntheticTract const &) = delete;
+    SyntheticTract &operator=(SyntheticTract &&) = delete;
+
+    /**
+     * Build the source catalogs of all (visit, detector) pairs, and add them as CcdImages to
+     * associations.
+     *
+     * @param associations     The Associations to add CcdImages to.
+     * @param control          The JointcalControl whose sourceFluxField is used to read the catalogs.
+     * @param detectorIndices  The indices of the detectors to add, in each visit; all if empty. Fitting
+     *                         subsets of the detectors makes overlapping regions of one tract.
+     */
+    void addCcdImages(Associations &associations, JointcalControl const &control,
+                      std::vector<std::size_t> const &detectorIndices = {}) const;
+
+    /// Return a new Associations holding all the CcdImages of this tract.
+    std::shared_ptr<Associations> makeAssociations(JointcalControl const &control) const;
+
+    /**
+     * Make the source catalog of one (visit, detector) pair, with the schema expected by CcdImage.
+     *
+     * The flux slot "slot_CalibFlux" points to the generated instrumental fluxes.
+     */
+    afw::table::SourceCatalog makeSourceCatalog(int visit, int detectorIndex) const;
+
+    /// Make a reference catalog (coord, getRefFluxField() in Jansky, and its "Sigma") for collectRefStars.
+    afw::table::SimpleCatalog makeRefCatalog() const;
+
+    /// Name of the reference flux field in makeRefCatalog().
+    std::string getRefFluxField() const { return _control.filter + "_flux"; }
+
+    /// Number of true stars.
+    std::size_t getNStars() const { return _stars.size(); }
+
+    /// Number of visits.
+    int getNVisits() const { return _control.nVisits; }
+
+    /// Number of CCDs per visit.
+    std::size_t getNDetectors() const { return _detectors.size(); }
+
+    /// The (ra, dec) boresight of a visit, degrees.
+    Point getBoresight(int visit) const { return _boresights.at(visit); }
+
+    /// The true (ra, dec) of a star, degrees. The ids of the source and reference records are star indices.
+    Point getStarPosition(std::size_t star) const { return Point(_stars.at(star).ra, _stars.at(star).dec); }
+
+    /// The true AB magnitude of a star.
+    double getStarMag(std::size_t star) const { return _stars.at(star).mag; }
+
+    /// The true color of a star, magnitudes.
+    double getStarColor(std::size_t star) const { return _stars.at(star).color; }
+
+    /// The zero point offset of a visit, magnitudes: its stars are 10^(-0.4 offset) times brighter.
+    double getVisitZeroPoint(int visit) const { return _zeroPoints.at(visit); }
+
+    /// The factor applied to the instrumental fluxes of the stars at a focal plane position (mm).
+    double getFocalPlaneResponse(double xFocal, double yFocal) const;
+
+    /// The flux (maggies) of one instrumental count with a zero point offset of 0: the input calibration.
+    double getCalibrationMean() const;
+
+    SyntheticTractControl const &getControl() const { return _control; }
+
+private:
+    struct TrueStar {
+        double ra, dec;  // degrees
+        double mag;      // AB
+        double color;    // magnitudes
+    };
+
+    SyntheticTractControl _control;
+    std::vector<std::shared_ptr<afw::cameraGeom::Detector>> _detectors;
+    std::vector<TrueStar> _stars;
+    std::vector<Point> _boresights;     // per visit, degrees
+    std::vector<double> _zeroPoints;    // per visit, magnitude offsets
+    std::vector<Point> _wcsOffsets;     // per (visit, detector), degrees on the tangent plane
+    double _focalPlaneRadius;           // of the farthest detector corner, mm
+
+    // focal plane (mm) -> tangent plane (degrees) including the radial distortion
+    Point focalToTangentPlane(Point const &focal) const;
+    // the inverse of the above, by fixed point iteration
+    Point tangentPlaneToFocal(Point const &tangentPlane) const;
+
+    std::shared_ptr<afw::geom::SkyWcs> makeInputWcs(int visit, int detectorIndex) const;
+    std::shared_ptr<afw::image::VisitInfo> makeVisitInfo(int visit) const;
+    // the hour angle of a visit, radians
+    double hourAngle(int visit) const;
+    // the refraction vector of a visit, as CcdImage computes it from makeVisitInfo(visit)
+    Point refractionVector(int visit) const;
+    // the visit identifier given to CcdImages
+    int visitId(int visit) const { return _control.firstVisit + visit; }
+};
+}  // namespace jointcal
+}  // namespace lsst
+
+#endif  // LSST_JOINTCAL_SYNTHETIC_TRACT_H
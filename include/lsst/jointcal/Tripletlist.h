@@ -4,27 +4,124 @@
 
 #include "Eigen/Sparse"
 
+#include <cstddef>
+#include <string>
 #include <vector>
 
+#include "lsst/pex/exceptions.h"
+
 namespace lsst {
 namespace jointcal {
 
 typedef Eigen::Triplet<double> Trip;
 
-// at the moment this class implements the eigen format.
-// it would be wise to implement it differently if talking to cholmod
-class TripletList : public std::vector<Trip> {
+/**
+ * The entries of a sparse Jacobian, as (row, column, value) triplets, before they are turned into
+ * a sparse matrix.
+ *
+ * Two storages are available:
+ *   - Storage::Triplets keeps Eigen triplets (two indices and a value per entry), and builds the matrix
+ *     with setFromTriplets, which accepts entries in any order.
+ *   - Storage::Compact requires the entries to be added column by column: all the entries of a column
+ *     before any entry of a later column, rows in any order. addTriplet throws if a column index goes
+ *     backwards. It stores only the row index and value of each entry plus one offset per column, i.e.
+ *     the compressed column layout of the final matrix, which is then built without the intermediate
+ *     copies of setFromTriplets.
+ *
+ * The fitters emit the entries of each measurement (one or two columns) column by column, and the
+ * measurements in column order, so that either storage can be used.
+ *
+ * clear() keeps the allocated storage, so that a TripletList owned by a fitter can be reused from one
+ * minimization to the next without reallocating.
+ */
+class TripletList {
 public:
-    TripletList(int count) : _nextFreeIndex(0) { reserve(count); };
+    enum class Storage { Triplets, Compact };
+
+    using Index = Eigen::SparseMatrix<double>::StorageIndex;
+
+    explicit TripletList(std::size_t count = 0, Storage storage = Storage::Triplets)
+            : _storage(storage), _nextFreeIndex(0) {
+        reserve(count);
+    }
+
+    /**
+     * Add the entry (i, j) of the matrix.
+     *
+     * @throws pex::exceptions::LogicError if the storage is Compact and column j comes before the column
+     *         of the previous entry.
+     */
+    void addTriplet(const unsigned i, const unsigned j, double val) {
+        if (_storage == Storage::Triplets) {
+            _triplets.push_back(Trip(i, j, val));
+        } else {
+            if (j + 1 < _columnStarts.size()) {
+                throw LSST_EXCEPT(pex::exceptions::LogicError,
+                                  "Compact TripletList: entry in column " + std::to_string(j) +
+                                          " after column " + std::to_string(_columnStarts.size() - 1));
+            }
+            // open the (possibly empty) columns up to j.
+            while (_columnStarts.size() <= j) _columnStarts.push_back(_rows.size());
+            _rows.push_back(i);
+            _values.push_back(val);
+        }
+    }
+
+    /// Number of entries added since construction or the last clear().
+    std::size_t size() const { return (_storage == Storage::Triplets) ? _triplets.size() : _rows.size(); }
+
+    /// Make room for count entries.
+    void reserve(std::size_t count);
+
+    /// Remove all entries and reset the next free index, but keep the allocated storage.
+    void clear();
 
-    void addTriplet(const unsigned i, const unsigned j, double val) { push_back(Trip(i, j, val)); }
+    /// Remove all entries and free the allocated storage.
+    void release();
+
+    /// Change the storage; only allowed while the list is empty.
+    void setStorage(Storage storage);
+
+    Storage getStorage() const { return _storage; }
+
+    /// Bytes currently allocated for the entries.
+    std::size_t getMemoryUsage() const;
+
+    /// Call f(row, column, value) for each entry, in the order they were added.
+    template <typename F>
+    void forEachEntry(F f) const {
+        if (_storage == Storage::Triplets) {
+            for (auto const &triplet : _triplets) f(triplet.row(), triplet.col(), triplet.value());
+            return;
+        }
+        for (std::size_t j = 0; j < _columnStarts.size(); ++j) {
+            std::size_t end = (j + 1 < _columnStarts.size()) ? _columnStarts[j + 1] : _rows.size();
+            for (std::size_t k = _columnStarts[j]; k < end; ++k) f(_rows[k], j, _values[k]);
+        }
+    }
 
     unsigned getNextFreeIndex() const { return _nextFreeIndex; }
 
     void setNextFreeIndex(unsigned index) { _nextFreeIndex = index; }
 
+    /**
+     * Build the sparse matrix of the entries, with nRows rows and getNextFreeIndex() columns.
+     *
+     * Duplicate (row, column) entries are summed.
+     */
+    void toSparseMatrix(Eigen::SparseMatrix<double> &matrix, unsigned nRows) const;
+
 private:
+    Storage _storage;
     unsigned _nextFreeIndex;
+
+    // Storage::Triplets
+    std::vector<Trip> _triplets;
+
+    // Storage::Compact: the entries of column j are [_columnStarts[j], _columnStarts[j+1]).
+    std::vector<Index> _rows;
+    std::vector<double> _values;
+    std::vector<Index> _columnStarts;
 };
 }  // namespace jointcal
 }  // namespace lsst
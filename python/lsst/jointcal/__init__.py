@@ -9,9 +9,12 @@ from .gtransfo import *
 from .jointcal import *
 from .jointcalCoadd import *
 from .jointcalControl import *
+from .listMatch import *
 from .photometryMappings import *
 from .photometryModels import *
 from .photometryTransfo import *
+from .profiling import *
 from .projectionHandler import *
+from .syntheticTract import *
 from .version import *
 __path__ = pkgutil.extend_path(__path__, __name__)
@@ -47,8 +47,13 @@ void declareAssociations(py::module &mod) {
             "refFluxMap"_a = RefFluxMapType(), "refFluxErrMap"_a = RefFluxMapType(),
             "rejectBadFluxes"_a = false);
     cls.def("deprojectFittedStars", &Associations::deprojectFittedStars);
+    cls.def("computeFittedStarColors", &Associations::computeFittedStarColors, "blueFilter"_a,
+            "redFilter"_a);
     cls.def("nCcdImagesValidForFit", &Associations::nCcdImagesValidForFit);
     cls.def("nFittedStarsWithAssociatedRefStar", &Associations::nFittedStarsWithAssociatedRefStar);
+    cls.def("getNFilters", &Associations::getNFilters);
+    cls.def("getEpoch", &Associations::getEpoch);
+    cls.def("getFilterIndex", &Associations::getFilterIndex, "filter"_a);
 
     cls.def("createCcdImage", &Associations::createCcdImage);
     cls.def("prepareFittedStars", &Associations::prepareFittedStars);
@@ -63,10 +68,24 @@ void declareAssociations(py::module &mod) {
     cls.def("getCommonTangentPoint", &Associations::getCommonTangentPoint);
     cls.def("setCommonTangentPoint", &Associations::setCommonTangentPoint);
     cls.def("computeCommonTangentPoint", &Associations::computeCommonTangentPoint);
+
+    cls.def("getProfile", &Associations::getProfile, py::return_value_policy::reference_internal);
+    cls.def("resetProfile", &Associations::resetProfile);
+
+    cls.def("setUseStarArena", &Associations::setUseStarArena, "useStarArena"_a);
+    cls.def("getUseStarArena", &Associations::getUseStarArena);
+
+    cls.def("makeFittedStarCatalog", &Associations::makeFittedStarCatalog);
+    cls.def("setFittedStarPriors", &Associations::setFittedStarPriors, "indices"_a, "ra"_a, "dec"_a,
+            "positionErr"_a, "flux"_a, "fluxErr"_a);
+    cls.def("clearFittedStarPriors", &Associations::clearFittedStarPriors);
+    cls.def("getNFittedStarPriors", &Associations::getNFittedStarPriors);
 }
 
 PYBIND11_PLUGIN(associations) {
+    py::module::import("lsst.afw.table");
     py::module::import("lsst.jointcal.ccdImage");
+    py::module::import("lsst.jointcal.profiling");
     py::module mod("associations");
 
     declareAssociations(mod);
@@ -24,6 +24,7 @@
 
 #include "lsst/jointcal/Gtransfo.h"
 #include "lsst/jointcal/AstrometryMapping.h"
+#include "lsst/jointcal/SimpleAstrometryMapping.h"
 #include "lsst/jointcal/TwoTransfoMapping.h"
 
 namespace py = pybind11;
@@ -67,6 +68,7 @@ void declareSimpleGtransfoMapping(py::module &mod) {
 void declareSimplePolyMapping(py::module &mod) {
     py::class_<SimplePolyMapping, std::shared_ptr<SimplePolyMapping>, SimpleGtransfoMapping> cls(
             mod, "SimplePolyMapping");
+    cls.def("getTransfo", &SimplePolyMapping::getTransfo, py::return_value_policy::reference_internal);
 }
 
 PYBIND11_PLUGIN(astrometryMappings) {
@@ -56,8 +56,9 @@ void declareSimpleAstrometryModel(py::module &mod) {
             mod, "SimpleAstrometryModel");
 
     cls.def(py::init<CcdImageList const &, const std::shared_ptr<ProjectionHandler const>, bool, unsigned,
-                     unsigned>(),
-            "ccdImageList"_a, "projectionHandler"_a, "initFromWcs"_a, "nNotFit"_a = 0, "order"_a = 3);
+                     unsigned, std::string const &>(),
+            "ccdImageList"_a, "projectionHandler"_a, "initFromWcs"_a, "nNotFit"_a = 0, "order"_a = 3,
+            "orderCriterion"_a = "");
 
     cls.def("getTransfo", &SimpleAstrometryModel::getTransfo, py::return_value_policy::reference_internal);
 }
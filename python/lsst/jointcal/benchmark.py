@@ -0,0 +1,413 @@
+# See COPYRIGHT file at the top of the source tree.
+"""
+End-to-end timing of jointcal on synthetic tracts.
+
+The tracts are generated in C++ by `lsst.jointcal.SyntheticTract`, so that no
+butler repository or validation package is needed. Each run times catalog
+loading, association, reference star collection, every ``minimize`` call of the
+astrometric and photometric fits, and output generation, and returns a flat
+dict that can be serialized as one JSON record, to track performance across
+versions. Repeated runs in one process also show how the resident memory grows
+from one tract to the next.
+"""
+import collections
+import json
+import os
+import platform
+import resource
+import time
+
+import numpy as np
+
+import lsst.log
+import lsst.utils
+import lsst.afw.cameraGeom
+import lsst.afw.geom
+import lsst.daf.persistence
+
+import lsst.jointcal
+from lsst.jointcal import MinimizeResult
+
+__all__ = ['SCALES', 'getBenchmarkDetectors', 'makeSyntheticTract', 'makeSyntheticAssociations',
+           'runBenchmark', 'getResidentMemory', 'writeRecords']
+
+# Named problem sizes: (number of visits, number of detectors, stars per square arcminute).
+Scale = collections.namedtuple('Scale', ('nVisits', 'nDetectors', 'starDensity'))
+SCALES = collections.OrderedDict([('tiny', Scale(3, 4, 0.5)),
+                                  ('small', Scale(5, 9, 1.)),
+                                  ('medium', Scale(10, 36, 2.)),
+                                  ('large', Scale(20, 36, 5.))])
+
+
+class _Timer:
+    """Accumulate wall and CPU times of named steps into a dict."""
+
+    def __init__(self, timings, name):
+        self.timings = timings
+        self.name = name
+
+    def __enter__(self):
+        self.wall = time.perf_counter()
+        self.cpu = time.process_time()
+        return self
+
+    def __exit__(self, *args):
+        self.timings[self.name + '_wall'] = time.perf_counter() - self.wall
+        self.timings[self.name + '_cpu'] = time.process_time() - self.cpu
+
+
+def getBenchmarkDetectors(nDetectors):
+    """Return the first nDetectors detectors of the camera in tests/data/cfht_minimal.
+
+    Parameters
+    ----------
+    nDetectors : `int`
+        Number of detectors to return (at most 36 for Megacam).
+
+    Returns
+    -------
+    detectors : `list` of `lsst.afw.cameraGeom.Detector`
+    """
+    inputDir = os.path.join(lsst.utils.getPackageDir('jointcal'), 'tests/data/cfht_minimal')
+    butler = lsst.daf.persistence.Butler(inputDir)
+    camera = butler.get('camera', visit=849375, ccd=12)
+    detectors = [detector for detector in camera]
+    return detectors[:nDetectors]
+
+
+def makeSyntheticTract(scale, seed=1, **kwargs):
+    """Make a SyntheticTract of the requested size.
+
+    Parameters
+    ----------
+    scale : `Scale` or `str`
+        The problem size, or the name of one of `SCALES`.
+    seed : `int`, optional
+        Random seed for the tract.
+    **kwargs
+        Other `lsst.jointcal.SyntheticTractControl` fields to override.
+
+    Returns
+    -------
+    tract : `lsst.jointcal.SyntheticTract`
+    """
+    if isinstance(scale, str):
+        scale = SCALES[scale]
+    control = lsst.jointcal.SyntheticTractControl()
+    control.nVisits = scale.nVisits
+    control.starDensity = scale.starDensity
+    control.seed = seed
+    for key, value in kwargs.items():
+        setattr(control, key, value)
+    return lsst.jointcal.SyntheticTract(control, getBenchmarkDetectors(scale.nDetectors))
+
+
+def makeSyntheticAssociations(tracts, detectorIndices=(), refTract=None, refCat=None, withRefStars=True,
+                              bandFluxes=False, rejectBadFluxes=True, matchCut=3.0, minMeasurements=2):
+    """Associate the catalogs of synthetic tracts and collect their reference stars, as JointcalTask does.
+
+    Parameters
+    ----------
+    tracts : `lsst.jointcal.SyntheticTract` or `list` of them
+        The tracts whose catalogs to load, in that order.
+    detectorIndices : `list` of `int`, optional
+        The detectors to load in each visit; all if empty.
+    refTract : `lsst.jointcal.SyntheticTract`, optional
+        The tract whose reference catalog and flux field to use; the first of tracts if None.
+    refCat : `lsst.afw.table.SimpleCatalog`, optional
+        The reference catalog, in place of that of refTract.
+    withRefStars : `bool`, optional
+        Collect the reference stars; without, the Associations have none.
+    bandFluxes : `bool`, optional
+        Also give the reference stars the fluxes of the reference catalog of each tract, per filter, for
+        multi-band photometry. The tracts must observe the same stars.
+    rejectBadFluxes : `bool`, optional
+        Reject the reference stars with bad fluxes.
+    matchCut : `float`, optional
+        Association and reference star match radius, in arcseconds.
+    minMeasurements : `int`, optional
+        Minimum number of measurements of a fitted star.
+
+    Returns
+    -------
+    associations : `lsst.jointcal.Associations`
+    """
+    if isinstance(tracts, lsst.jointcal.SyntheticTract):
+        tracts = [tracts]
+    if refTract is None:
+        refTract = tracts[0]
+    control = lsst.jointcal.JointcalControl("slot_CalibFlux")
+    associations = lsst.jointcal.Associations()
+    for tract in tracts:
+        tract.addCcdImages(associations, control, list(detectorIndices))
+    associations.computeCommonTangentPoint()
+    associations.associateCatalogs(matchCut)
+    if withRefStars:
+        if refCat is None:
+            refCat = refTract.makeRefCatalog()
+        refFluxes = {}
+        refFluxErrs = {}
+        if bandFluxes:
+            for tract in tracts:
+                field = tract.getRefFluxField()
+                catalog = tract.makeRefCatalog()
+                refFluxes[field[:-len("_flux")]] = catalog.get(field)
+                refFluxErrs[field[:-len("_flux")]] = catalog.get(field + "Sigma")
+        associations.collectRefStars(refCat, matchCut*lsst.afw.geom.arcseconds, refTract.getRefFluxField(),
+                                     refFluxes, refFluxErrs, rejectBadFluxes=rejectBadFluxes)
+    associations.prepareFittedStars(minMeasurements)
+    return associations
+
+
+def _minimize(fit, whatToFit, timings, name, nSigmaCut=0):
+    """Time one minimize call and return its result."""
+    with _Timer(timings, '{}_minimize_{}'.format(name, whatToFit.replace(' ', ''))):
+        result = fit.minimize(whatToFit, nSigmaCut)
+    return result
+
+
+def _iterate(fit, whatToFit, timings, name, maxSteps=20):
+    """Mimic JointcalTask._iterate_fit, returning the number of minimize calls."""
+    with _Timer(timings, '{}_iterate'.format(name)):
+        for step in range(maxSteps):
+            result = fit.minimize(whatToFit, 5)
+            if result == MinimizeResult.Converged:
+                fit.minimize(whatToFit, 5)
+                break
+            elif result == MinimizeResult.Failed:
+                raise RuntimeError("Chi2 minimization failure, cannot complete {} fit.".format(name))
+    return step + 1
+
+
+def _associate(tract, associations, timings, name, matchCut=3.0):
+    """Associate the catalogs and collect reference stars, as JointcalTask does.
+
+    Returns the number of measured stars selected for the fit.
+    """
+    with _Timer(timings, '{}_associateCatalogs'.format(name)):
+        associations.associateCatalogs(matchCut)
+    refCat = tract.makeRefCatalog()
+    with _Timer(timings, '{}_collectRefStars'.format(name)):
+        associations.collectRefStars(refCat, matchCut*lsst.afw.geom.arcseconds, tract.getRefFluxField(),
+                                     rejectBadFluxes=(name == 'photometry'))
+    with _Timer(timings, '{}_prepareFittedStars'.format(name)):
+        associations.prepareFittedStars(2)
+    return sum(ccdImage.countStars()[0] for ccdImage in associations.getCcdImageList())
+
+
+def runBenchmark(tract, doAstrometry=True, doPhotometry=True, astrometryModel="simple",
+                 photometryModel="simple", compactJacobian=False, useStarArena=True, nProcesses=1,
+                 compactMeasurements=False):
+    """Run the jointcal fit sequence on a synthetic tract, timing each step.
+
+    Parameters
+    ----------
+    tract : `lsst.jointcal.SyntheticTract`
+        The tract to fit.
+    doAstrometry, doPhotometry : `bool`, optional
+        Which fits to run.
+    astrometryModel : `str`, optional
+        "simple" or "constrained", as JointcalConfig.astrometryModel.
+    photometryModel : `str`, optional
+        "simple", "constrained" or "starFlat", as JointcalConfig.photometryModel.
+    compactJacobian : `bool`, optional
+        Accumulate the Jacobians in compact storage, as JointcalConfig.compactJacobian.
+    useStarArena : `bool`, optional
+        Allocate the associated stars from a pool, as JointcalConfig.useStarArena.
+    nProcesses : `int`, optional
+        Number of worker processes of each fit, as JointcalConfig.nFitProcesses.
+    compactMeasurements : `bool`, optional
+        Read single precision copies of the measurements in the astrometric fit, as
+        JointcalConfig.compactMeasurements.
+
+    Returns
+    -------
+    record : `dict`
+        Problem size, ``*_wall`` and ``*_cpu`` timings in seconds, final chi2s,
+        and peak and final resident memory; suitable for `json.dump`.
+    """
+    control = tract.getControl()
+    record = collections.OrderedDict()
+    record['nVisits'] = tract.getNVisits()
+    record['nDetectors'] = tract.getNDetectors()
+    record['nStars'] = tract.getNStars()
+    record['starDensity'] = control.starDensity
+    record['astrometryModel'] = astrometryModel
+    record['photometryModel'] = photometryModel
+    record['compactJacobian'] = compactJacobian
+    record['useStarArena'] = useStarArena
+    record['nProcesses'] = nProcesses
+    record['compactMeasurements'] = compactMeasurements
+    if compactJacobian:
+        storage = lsst.jointcal.TripletStorage.Compact
+    else:
+        storage = lsst.jointcal.TripletStorage.Triplets
+
+    timings = collections.OrderedDict()
+    jointcalControl = lsst.jointcal.JointcalControl("slot_CalibFlux")
+    with _Timer(timings, 'load'):
+        associations = tract.makeAssociations(jointcalControl)
+        associations.setUseStarArena(useStarArena)
+        associations.computeCommonTangentPoint()
+
+    if doAstrometry:
+        record['astrometry_nMeasurements'] = _associate(tract, associations, timings, 'astrometry')
+        record['astrometry_nFittedStars'] = associations.fittedStarListSize()
+        record['astrometry_nRefStars'] = associations.nFittedStarsWithAssociatedRefStar()
+        associations.deprojectFittedStars()
+        with _Timer(timings, 'astrometry_setup'):
+            projection = lsst.jointcal.OneTPPerVisitHandler(associations.getCcdImageList())
+            if astrometryModel == "constrained":
+                model = lsst.jointcal.ConstrainedAstrometryModel(associations.getCcdImageList(), projection,
+                                                                 chipOrder=1, visitOrder=5)
+            else:
+                model = lsst.jointcal.SimpleAstrometryModel(associations.getCcdImageList(), projection,
+                                                            True, nNotFit=0, order=3)
+            fit = lsst.jointcal.AstrometryFit(associations, model, 0.02)
+            fit.setTripletStorage(storage)
+            fit.setNProcesses(nProcesses)
+            fit.setUseCompactMeasurements(compactMeasurements)
+        if astrometryModel == "constrained":
+            _minimize(fit, "DistortionsVisit", timings, 'astrometry')
+        for whatToFit in ("Distortions", "Positions", "Distortions Positions"):
+            _minimize(fit, whatToFit, timings, 'astrometry')
+        record['astrometry_steps'] = _iterate(fit, "Distortions Positions", timings, 'astrometry')
+        chi2 = fit.computeChi2()
+        record['astrometry_chi2'] = chi2.chi2
+        record['astrometry_ndof'] = chi2.ndof
+        with _Timer(timings, 'astrometry_output'):
+            for ccdImage in associations.getCcdImageList():
+                model.makeSkyWcs(ccdImage)
+
+    if doPhotometry:
+        record['photometry_nMeasurements'] = _associate(tract, associations, timings, 'photometry')
+        record['photometry_nFittedStars'] = associations.fittedStarListSize()
+        record['photometry_nRefStars'] = associations.nFittedStarsWithAssociatedRefStar()
+        with _Timer(timings, 'photometry_setup'):
+            if photometryModel in ("constrained", "starFlat"):
+                detectors = [ccdImage.getDetector() for ccdImage in associations.getCcdImageList()]
+                focalPlaneBBox = lsst.afw.geom.Box2D()
+                for detector in detectors:
+                    for corner in detector.getCorners(lsst.afw.cameraGeom.FOCAL_PLANE):
+                        focalPlaneBBox.include(corner)
+            if photometryModel == "constrained":
+                model = lsst.jointcal.ConstrainedPhotometryModel(associations.getCcdImageList(),
+                                                                 focalPlaneBBox, visitOrder=7)
+            elif photometryModel == "starFlat":
+                model = lsst.jointcal.StarFlatPhotometryModel(associations.getCcdImageList(),
+                                                              focalPlaneBBox, starFlatOrder=4)
+            else:
+                model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
+            fit = lsst.jointcal.PhotometryFit(associations, model)
+            fit.setTripletStorage(storage)
+            fit.setNProcesses(nProcesses)
+        if photometryModel in ("constrained", "starFlat"):
+            _minimize(fit, "ModelVisit", timings, 'photometry')
+        for whatToFit in ("Model", "Fluxes", "Model Fluxes"):
+            _minimize(fit, whatToFit, timings, 'photometry')
+        model.freezeErrorTransform()
+        record['photometry_steps'] = _iterate(fit, "Model Fluxes", timings, 'photometry')
+        chi2 = fit.computeChi2()
+        record['photometry_chi2'] = chi2.chi2
+        record['photometry_ndof'] = chi2.ndof
+        with _Timer(timings, 'photometry_output'):
+            for ccdImage in associations.getCcdImageList():
+                model.toPhotoCalib(ccdImage)
+
+    record.update(timings)
+    # ru_maxrss is in kilobytes on Linux, bytes on macOS.
+    maxrss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    record['maxrss_bytes'] = maxrss if platform.system() == 'Darwin' else maxrss*1024
+    rss = getResidentMemory()
+    if rss is not None:
+        record['rss_bytes'] = rss
+    return record
+
+
+def getResidentMemory():
+    """Return the current resident memory of the process in bytes, or None if unknown.
+
+    Unlike the peak, this goes down when memory is given back to the system, so
+    comparing it between repeated runs shows whether the heap keeps growing.
+    """
+    try:
+        with open('/proc/self/statm') as statm:
+            return int(statm.read().split()[1])*resource.getpagesize()
+    except (IOError, OSError, IndexError, ValueError):
+        return None
+
+
+def writeRecords(records, stream):
+    """Write benchmark records as JSON lines, each tagged with the environment.
+
+    Parameters
+    ----------
+    records : `list` of `dict`
+        Records returned by `runBenchmark`.
+    stream : file-like
+        Where to write the records.
+    """
+    environment = collections.OrderedDict()
+    environment['version'] = getattr(lsst.jointcal, '__version__', 'unknown')
+    environment['host'] = platform.node()
+    environment['python'] = platform.python_version()
+    environment['time'] = time.strftime('%Y-%m-%dT%H:%M:%S%z')
+    for record in records:
+        output = collections.OrderedDict(environment)
+        output.update((key, float(value) if isinstance(value, np.floating) else value)
+                      for key, value in record.items())
+        stream.write(json.dumps(output) + '\n')
+    stream.flush()
+
+
+def main(argv=None):
+    """Command line entry point: see bin/jointcalBenchmark.py --help."""
+    import argparse
+    import sys
+
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--scales", nargs='+', default=['tiny', 'small'], choices=list(SCALES.keys()),
+                        help="Problem sizes to run.")
+    parser.add_argument("--repeat", type=int, default=1, help="Number of runs per scale.")
+    parser.add_argument("--seed", type=int, default=1, help="Random seed of the synthetic tracts.")
+    parser.add_argument("--astrometryModel", default="simple", choices=("simple", "constrained"))
+    parser.add_argument("--photometryModel", default="simple", choices=("simple", "constrained", "starFlat"))
+    parser.add_argument("--compactJacobian", action="store_true",
+                        help="Accumulate the Jacobians in compact storage.")
+    parser.add_argument("--noStarArena", action="store_true",
+                        help="Allocate the associated stars one by one from the heap.")
+    parser.add_argument("--nProcesses", type=int, default=1,
+                        help="Number of worker processes computing the derivatives and chi2 of each fit.")
+    parser.add_argument("--compactMeasurements", action="store_true",
+                        help="Read single precision copies of the measurements in the astrometric fit.")
+    parser.add_argument("--noAstrometry", action="store_true", help="Skip the astrometric fit.")
+    parser.add_argument("--noPhotometry", action="store_true", help="Skip the photometric fit.")
+    parser.add_argument("--output", default=None, help="JSON lines file to append to (default: stdout).")
+    parser.add_argument("--verbose", action="store_true", help="Show jointcal's INFO log messages.")
+    args = parser.parse_args(argv)
+
+    if not args.verbose:
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+
+    records = []
+    for name in args.scales:
+        tract = makeSyntheticTract(name, seed=args.seed)
+        for i in range(args.repeat):
+            record = runBenchmark(tract, doAstrometry=not args.noAstrometry,
+                                  doPhotometry=not args.noPhotometry,
+                                  astrometryModel=args.astrometryModel,
+                                  photometryModel=args.photometryModel,
+                                  compactJacobian=args.compactJacobian,
+                                  useStarArena=not args.noStarArena,
+                                  nProcesses=args.nProcesses,
+                                  compactMeasurements=args.compactMeasurements)
+            record['scale'] = name
+            record['repeat'] = i
+            records.append(record)
+
+    if args.output is None:
+        writeRecords(records, sys.stdout)
+    else:
+        with open(args.output, 'a') as stream:
+            writeRecords(records, stream)
@@ -23,6 +23,9 @@
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
 
+#include <memory>
+#include <vector>
+
 #include "lsst/jointcal/CcdImage.h"
 
 namespace py = pybind11;
@@ -46,7 +49,12 @@ void declareCcdImage(py::module &mod) {
 
     cls.def("countStars", &CcdImage::countStars);
 
-    cls.def("resetCatalogForFit", &CcdImage::resetCatalogForFit);
+    cls.def("resetCatalogForFit", [](CcdImage &self) { self.resetCatalogForFit(); });
+    // the measurements to fit themselves, shared with the CcdImage.
+    cls.def("getCatalogForFit", [](CcdImage const &self) {
+        auto const &catalog = self.getCatalogForFit();
+        return std::vector<std::shared_ptr<MeasuredStar>>(catalog.begin(), catalog.end());
+    });
 
     cls.def("getBoresightRaDec", &CcdImage::getBoresightRaDec);
     cls.def_property_readonly("boresightRaDec", &CcdImage::getBoresightRaDec);
@@ -64,6 +72,9 @@ void declareCcdImage(py::module &mod) {
     cls.def("getVisit", &CcdImage::getVisit);
     cls.def_property_readonly("visit", &CcdImage::getVisit);
 
+    cls.def("getMjd", &CcdImage::getMjd);
+    cls.def_property_readonly("mjd", &CcdImage::getMjd);
+
     cls.def("getDetector", &CcdImage::getDetector, py::return_value_policy::reference_internal);
 
     cls.def("getCommonTangentPoint", &CcdImage::getCommonTangentPoint,
@@ -77,6 +88,7 @@ void declareCcdImage(py::module &mod) {
 }
 
 PYBIND11_PLUGIN(ccdImage) {
+    py::module::import("lsst.jointcal.star");
     py::module mod("ccdImage");
 
     declareCcdImage(mod);
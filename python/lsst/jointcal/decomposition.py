@@ -0,0 +1,396 @@
+# See COPYRIGHT file at the top of the source tree.
+"""
+Domain-decomposed fitting: split the sky into overlapping regions, fit each
+region in a process of its own, and bring the fits to a consensus on the stars
+they share.
+
+Each region is fit with the usual jointcal machinery. The stars fitted in more
+than one region are then reconciled with the scaled form of consensus ADMM
+(Boyd et al. 2011, "Distributed Optimization and Statistical Learning via the
+Alternating Direction Method of Multipliers", section 7.1): the consensus value
+of a shared star is the mean of its fitted values plus their scaled duals, and
+each region is refit with a Gaussian prior pulling its copy of the star toward
+the consensus minus its dual (see `lsst.jointcal.Associations.setFittedStarPriors`).
+The regions agree on their shared stars, and therefore on the images they
+share, once the fitted values stop moving.
+"""
+import collections
+import multiprocessing
+import traceback
+
+import numpy as np
+
+import lsst.pex.config as pexConfig
+import lsst.pipe.base as pipeBase
+import lsst.afw.table
+
+__all__ = ["DecompositionConfig", "Region", "partitionRegions", "findNeighbours", "matchSharedStars",
+           "ConsensusSolver", "RegionProcess", "callAll"]
+
+
+class DecompositionConfig(pexConfig.Config):
+    """Config for domain-decomposed fitting."""
+    nRegions = pexConfig.Field(
+        dtype=int,
+        doc="Number of regions to split the data into, each fit in a process of its own. "
+            "With 1, each tract is fit as a whole.",
+        default=1,
+    )
+    overlap = pexConfig.Field(
+        dtype=float,
+        doc="Width, in degrees, of the band by which each region extends into its neighbours: images "
+            "centered in that band are fit in both regions. Should be at least the size of a detector.",
+        default=0.25,
+    )
+    maxRounds = pexConfig.Field(
+        dtype=int,
+        doc="Maximum number of consensus rounds after the independent fits of the regions.",
+        default=10,
+    )
+    matchRadius = pexConfig.Field(
+        dtype=float,
+        doc="Radius, in arcseconds, within which stars fit in neighbouring regions are the same star.",
+        default=0.5,
+    )
+    positionSigma = pexConfig.Field(
+        dtype=float,
+        doc="Width, in arcseconds, of the priors pulling shared stars toward their consensus positions. "
+            "Smaller values enforce the agreement more strongly, but take more rounds to converge.",
+        default=0.01,
+    )
+    fluxSigma = pexConfig.Field(
+        dtype=float,
+        doc="Relative width of the priors pulling shared stars toward their consensus fluxes.",
+        default=0.005,
+    )
+    positionTolerance = pexConfig.Field(
+        dtype=float,
+        doc="Consensus is reached when the shared star positions differ from, and the consensus positions "
+            "move by, less than this many arcseconds.",
+        default=0.001,
+    )
+    fluxTolerance = pexConfig.Field(
+        dtype=float,
+        doc="Consensus is reached when the shared star fluxes differ from, and the consensus fluxes move "
+            "by, less than this fraction.",
+        default=1e-4,
+    )
+
+
+Region = collections.namedtuple('Region', ('owned', 'members'))
+Region.__doc__ = """Images of one region, as indices in the list given to `partitionRegions`.
+
+owned : `numpy.ndarray` of `int`
+    The images whose results this region provides; each image is owned by one region.
+members : `numpy.ndarray` of `int`
+    The images fit in this region: the owned ones and those of the neighbouring regions that lie within
+    the overlap.
+"""
+
+
+def _unitVectors(ra, dec):
+    """Unit vectors of positions in degrees, one per row."""
+    ra = np.radians(np.asarray(ra, dtype=float))
+    dec = np.radians(np.asarray(dec, dtype=float))
+    return np.column_stack((np.cos(dec)*np.cos(ra), np.cos(dec)*np.sin(ra), np.sin(dec)))
+
+
+def partitionRegions(ra, dec, nRegions, overlap):
+    """Split images into compact regions of similar size that overlap.
+
+    The images, given by their centers, are split by recursive bisection: the
+    region with the most images is cut in two at the median of its widest
+    coordinate, until there are nRegions. Working on unit vectors, rather than
+    on a projection, makes this valid over any part of the sky.
+
+    Parameters
+    ----------
+    ra, dec : array-like of `float`
+        Centers of the images, in degrees.
+    nRegions : `int`
+        Number of regions to make; fewer if there are fewer images.
+    overlap : `float`
+        Width, in degrees, of the band by which each region extends into its
+        neighbours.
+
+    Returns
+    -------
+    regions : `list` of `Region`
+        The regions.
+    """
+    vectors = _unitVectors(ra, dec)
+    parts = [np.arange(len(vectors))]
+    while len(parts) < nRegions:
+        largest = max(range(len(parts)), key=lambda i: len(parts[i]))
+        part = parts[largest]
+        if len(part) < 2:
+            break
+        axis = np.argmax(vectors[part].max(axis=0) - vectors[part].min(axis=0))
+        order = part[np.argsort(vectors[part, axis], kind='mergesort')]
+        half = len(order)//2
+        parts[largest:largest + 1] = [order[:half], order[half:]]
+
+    # the chord subtending the overlap, as the boxes are in unit vector space.
+    margin = 2*np.sin(np.radians(overlap)/2)
+    regions = []
+    for part in parts:
+        lower = vectors[part].min(axis=0) - margin
+        upper = vectors[part].max(axis=0) + margin
+        inside = np.all((vectors >= lower) & (vectors <= upper), axis=1)
+        regions.append(Region(owned=np.sort(part), members=np.flatnonzero(inside)))
+    return regions
+
+
+def findNeighbours(regions):
+    """Return the pairs (i, j), i < j, of regions that fit some images in common."""
+    neighbours = []
+    for i in range(len(regions)):
+        for j in range(i + 1, len(regions)):
+            if len(np.intersect1d(regions[i].members, regions[j].members)) > 0:
+                neighbours.append((i, j))
+    return neighbours
+
+
+def matchSharedStars(catalogs, matchRadius, neighbours):
+    """Find the stars fit in more than one region.
+
+    Parameters
+    ----------
+    catalogs : `list` of `lsst.afw.table.SimpleCatalog`
+        The fitted stars of each region, from
+        `lsst.jointcal.Associations.makeFittedStarCatalog`.
+    matchRadius : `lsst.afw.geom.Angle`
+        Stars of neighbouring regions closer than this are the same star.
+    neighbours : `list` of `tuple` of `int`
+        The pairs of regions to match, from `findNeighbours`.
+
+    Returns
+    -------
+    groups : `list` of `list` of `tuple` of `int`
+        For each shared star, its (region, star id) in each region that fits
+        it. Stars matched to two stars of the same region are ambiguous, and
+        left out.
+    """
+    parent = {}
+
+    def find(node):
+        parent.setdefault(node, node)
+        root = node
+        while parent[root] != root:
+            root = parent[root]
+        while parent[node] != root:
+            parent[node], node = root, parent[node]
+        return root
+
+    control = lsst.afw.table.MatchControl()
+    control.findOnlyClosest = True
+    for i, j in neighbours:
+        for match in lsst.afw.table.matchRaDec(catalogs[i], catalogs[j], matchRadius, control):
+            first = find((i, match.first.getId()))
+            second = find((j, match.second.getId()))
+            if first != second:
+                parent[second] = first
+
+    members = collections.defaultdict(list)
+    for node in list(parent):
+        members[find(node)].append(node)
+    groups = []
+    for nodes in members.values():
+        regions = [region for region, _ in nodes]
+        if len(set(regions)) == len(regions):
+            groups.append(sorted(nodes))
+    return sorted(groups)
+
+
+class ConsensusSolver:
+    """Consensus ADMM on the stars shared by overlapping regions.
+
+    Parameters
+    ----------
+    groups : `list` of `list` of `tuple` of `int`
+        The shared stars, from `matchSharedStars`.
+    nRegions : `int`
+        Number of regions.
+
+    Notes
+    -----
+    Each call to `update` takes the values fitted in each region, and returns
+    the targets of the priors for the next fits. Positions are handled as
+    offsets in arcseconds on the tangent plane of each shared star, and fluxes
+    as offsets relative to the star's first fitted flux, so that the
+    tolerances and prior widths are the same for all stars.
+    """
+
+    def __init__(self, groups, nRegions):
+        self.nRegions = nRegions
+        self.nGroups = len(groups)
+        self.group = np.array([g for g, nodes in enumerate(groups) for _ in nodes], dtype=int)
+        self.region = np.array([region for nodes in groups for region, _ in nodes], dtype=int)
+        self.id = np.array([starId for nodes in groups for _, starId in nodes], dtype=int)
+        self.counts = np.bincount(self.group, minlength=self.nGroups)
+        self._reference = None
+        self._dual = None
+        self._consensus = None
+
+    def _values(self, catalogs, kind):
+        """Fitted values of the shared stars, one row per (group, region), in the solver's units."""
+        if kind == "astrometry":
+            ra = np.empty(len(self.id))
+            dec = np.empty(len(self.id))
+            for r, catalog in enumerate(catalogs):
+                selected = self.region == r
+                ra[selected] = catalog['coord_ra'][self.id[selected]]
+                dec[selected] = catalog['coord_dec'][self.id[selected]]
+            if self._reference is None:
+                first = np.unique(self.group, return_index=True)[1]
+                self._reference = (ra[first], dec[first])
+            ra0 = self._reference[0][self.group]
+            dec0 = self._reference[1][self.group]
+            dra = np.remainder(ra - ra0 + np.pi, 2*np.pi) - np.pi
+            return np.degrees(np.column_stack((dra*np.cos(dec0), dec - dec0)))*3600
+        else:
+            flux = np.empty(len(self.id))
+            for r, catalog in enumerate(catalogs):
+                selected = self.region == r
+                flux[selected] = catalog['flux'][self.id[selected]]
+            if self._reference is None:
+                first = np.unique(self.group, return_index=True)[1]
+                self._reference = (flux[first],)
+            return (flux/self._reference[0][self.group] - 1).reshape(-1, 1)
+
+    def update(self, catalogs, kind):
+        """Take the values fitted in each region, and compute the next priors.
+
+        Parameters
+        ----------
+        catalogs : `list` of `lsst.afw.table.SimpleCatalog`
+            The fitted stars of each region, from
+            `lsst.jointcal.Associations.makeFittedStarCatalog`, with the same
+            ids as when the groups were matched.
+        kind : `str`
+            "astrometry" to reconcile the positions, "photometry" the fluxes.
+
+        Returns
+        -------
+        result : `lsst.pipe.base.Struct`
+            - ``primal``: largest difference between a fitted value and its
+              consensus (arcseconds, or relative flux).
+            - ``dual``: largest change of a consensus value since the previous
+              update, or infinity at the first update.
+            - ``targets``: for each region, a tuple (ids, values) of the star
+              ids and the prior targets: (ra, dec) in degrees for astrometry,
+              fluxes for photometry.
+        """
+        values = self._values(catalogs, kind)
+        if self._dual is None:
+            self._dual = np.zeros_like(values)
+        consensus = np.column_stack([np.bincount(self.group, weights=(values + self._dual)[:, k],
+                                                 minlength=self.nGroups)/self.counts
+                                     for k in range(values.shape[1])])
+        perStar = consensus[self.group]
+        primal = np.max(np.abs(values - perStar)) if len(values) > 0 else 0.
+        if self._consensus is None:
+            dual = np.inf
+        else:
+            dual = np.max(np.abs(consensus - self._consensus)) if len(consensus) > 0 else 0.
+        self._consensus = consensus
+        self._dual += values - perStar
+        targetOffsets = perStar - self._dual
+
+        targets = []
+        for r in range(self.nRegions):
+            selected = self.region == r
+            offsets = targetOffsets[selected]
+            group = self.group[selected]
+            if kind == "astrometry":
+                ra0, dec0 = self._reference[0][group], self._reference[1][group]
+                dec = dec0 + np.radians(offsets[:, 1]/3600)
+                ra = ra0 + np.radians(offsets[:, 0]/3600)/np.cos(dec0)
+                targets.append((self.id[selected], (np.degrees(ra), np.degrees(dec))))
+            else:
+                targets.append((self.id[selected], (self._reference[0][group]*(1 + offsets[:, 0]),)))
+        return pipeBase.Struct(primal=primal, dual=dual, targets=targets)
+
+
+def _serve(connection, factory, args):
+    """Body of a RegionProcess: build the handler, then answer requests until told to stop."""
+    try:
+        handler = factory(*args)
+        connection.send((True, None))
+    except Exception:
+        connection.send((False, traceback.format_exc()))
+        return
+    while True:
+        request = connection.recv()
+        if request is None:
+            break
+        name, args, kwargs = request
+        try:
+            connection.send((True, getattr(handler, name)(*args, **kwargs)))
+        except Exception:
+            connection.send((False, traceback.format_exc()))
+
+
+class RegionProcess:
+    """An object living in a child process, whose methods are called by messages.
+
+    The object keeps its state (e.g. a loaded and fit `lsst.jointcal.Associations`)
+    from one call to the next, so that each consensus round only refits.
+
+    Parameters
+    ----------
+    factory : callable
+        Builds the object in the child, from args.
+    *args
+        Arguments of factory; they are pickled unless processes are forked.
+    """
+
+    def __init__(self, factory, *args):
+        self._connection, child = multiprocessing.Pipe()
+        self._process = multiprocessing.Process(target=_serve, args=(child, factory, args))
+        self._process.daemon = True
+        self._process.start()
+        child.close()
+        self._pending = True  # the construction acknowledgement
+
+    def send(self, name, *args, **kwargs):
+        """Start calling method name of the object; get the result with `receive`."""
+        self._connection.send((name, args, kwargs))
+        self._pending = True
+
+    def receive(self):
+        """Wait for the result of the last call (or construction), raising RuntimeError on failure."""
+        ok, result = self._connection.recv()
+        self._pending = False
+        if not ok:
+            raise RuntimeError("Region process failed:\n%s" % result)
+        return result
+
+    def close(self):
+        """Stop the process, interrupting the current call if there is one."""
+        if self._process.is_alive():
+            if self._pending:
+                self._process.terminate()
+            else:
+                self._connection.send(None)
+            self._process.join(10)
+            if self._process.is_alive():
+                self._process.terminate()
+        self._connection.close()
+
+
+def callAll(processes, name, argsList=None):
+    """Call method name on all processes concurrently, and return their results in order.
+
+    Parameters
+    ----------
+    processes : `list` of `RegionProcess`
+        The processes to call.
+    name : `str`
+        The method to call.
+    argsList : `list` of `tuple`, optional
+        The arguments of each call; none by default.
+    """
+    for i, process in enumerate(processes):
+        process.send(name, *(argsList[i] if argsList is not None else ()))
+    return [process.receive() for process in processes]
@@ -21,11 +21,18 @@
  */
 
 #include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include <map>
+#include <utility>
+
+#include "lsst/utils/python.h"
 
 #include "lsst/jointcal/Associations.h"
 #include "lsst/jointcal/AstrometryFit.h"
 #include "lsst/jointcal/AstrometryModel.h"
 #include "lsst/jointcal/Chi2.h"
+#include "lsst/jointcal/FitHistory.h"
 #include "lsst/jointcal/FitterBase.h"
 #include "lsst/jointcal/PhotometryFit.h"
 #include "lsst/jointcal/PhotometryModel.h"
@@ -37,12 +44,65 @@ namespace lsst {
 namespace jointcal {
 namespace {
 
+void declareIterationRecord(py::module &mod) {
+    py::class_<IterationRecord, std::shared_ptr<IterationRecord>> cls(mod, "IterationRecord");
+
+    utils::python::addOutputOp(cls, "__str__");
+
+    cls.def_readonly("call", &IterationRecord::call);
+    cls.def_readonly("whatToFit", &IterationRecord::whatToFit);
+    cls.def_readonly("iteration", &IterationRecord::iteration);
+    cls.def_readonly("nParameters", &IterationRecord::nParameters);
+    cls.def_readonly("chi2", &IterationRecord::chi2);
+    cls.def_readonly("ndof", &IterationRecord::ndof);
+    cls.def_readonly("stepNorm", &IterationRecord::stepNorm);
+    cls.def_readonly("nMeasOutliers", &IterationRecord::nMeasOutliers);
+    cls.def_readonly("nRefOutliers", &IterationRecord::nRefOutliers);
+    cls.def_readonly("factorizationTime", &IterationRecord::factorizationTime);
+    cls.def_readonly("nDowndates", &IterationRecord::nDowndates);
+    cls.def_readonly("visitChi2", &IterationRecord::visitChi2);
+}
+
+void declareFitHistory(py::module &mod) {
+    py::class_<FitHistory, std::shared_ptr<FitHistory>> cls(mod, "FitHistory");
+
+    cls.def("getRecords", &FitHistory::getRecords);
+    cls.def("getNCalls", &FitHistory::getNCalls);
+    cls.def("save", &FitHistory::save, "baseName"_a);
+    cls.def("__len__", [](FitHistory const &self) { return self.getRecords().size(); });
+}
+
 void declareFitterBase(py::module &mod) {
     py::class_<FitterBase, std::shared_ptr<FitterBase>> cls(mod, "FitterBase");
 
     cls.def("minimize", &FitterBase::minimize, "whatToFit"_a, "nSigRejCut"_a = 0);
     cls.def("computeChi2", &FitterBase::computeChi2);
+    cls.def("computeChi2PerVisit", [](FitterBase const &self) {
+        std::map<VisitIdType, Chi2Statistic> visitChi2;
+        Chi2Statistic chi2 = self.computeChi2PerVisit(visitChi2);
+        return std::make_pair(chi2, visitChi2);
+    });
+    cls.def("assignIndices", &FitterBase::assignIndices, "whatToFit"_a);
+    cls.def("getNParameters", &FitterBase::getNParameters);
+    cls.def("getNModelParameters", &FitterBase::getNModelParameters);
     cls.def("saveChi2Contributions", &FitterBase::saveChi2Contributions);
+    cls.def("getProfile", &FitterBase::getProfile, py::return_value_policy::reference_internal);
+    cls.def("resetProfile", &FitterBase::resetProfile);
+    cls.def("countTriplets", &FitterBase::countTriplets);
+    cls.def("setTripletStorage", &FitterBase::setTripletStorage, "storage"_a);
+    cls.def("getTripletStorage", &FitterBase::getTripletStorage);
+    cls.def("releaseTripletStorage", &FitterBase::releaseTripletStorage);
+    cls.def("setNProcesses", &FitterBase::setNProcesses, "nProcesses"_a);
+    cls.def("getNProcesses", &FitterBase::getNProcesses);
+    cls.def("setRobustLoss", &FitterBase::setRobustLoss, "loss"_a, "scale"_a = 0, "maxIterations"_a = 10);
+    cls.def("getRobustLoss", &FitterBase::getRobustLoss);
+    cls.def("getRobustScale", &FitterBase::getRobustScale);
+    cls.def("fitErrorModel", &FitterBase::fitErrorModel, "grouping"_a);
+    cls.def("getErrorTerm", &FitterBase::getErrorTerm, "ccdImage"_a);
+    cls.def("clearErrorModel", &FitterBase::clearErrorModel);
+    cls.def("getHistory", &FitterBase::getHistory, py::return_value_policy::reference_internal);
+    cls.def("resetHistory", &FitterBase::resetHistory);
+    cls.def("saveHistory", &FitterBase::saveHistory, "baseName"_a);
 }
 
 void declareAstrometryFit(py::module &mod) {
@@ -50,6 +110,10 @@ void declareAstrometryFit(py::module &mod) {
 
     cls.def(py::init<std::shared_ptr<Associations>, std::shared_ptr<AstrometryModel>, double>(),
             "associations"_a, "astrometryModel"_a, "posError"_a);
+    cls.def("setUseCompactMeasurements", &AstrometryFit::setUseCompactMeasurements,
+            "useCompactMeasurements"_a);
+    cls.def("getUseCompactMeasurements", &AstrometryFit::getUseCompactMeasurements);
+    cls.def("getRefractionCoefficients", &AstrometryFit::getRefractionCoefficients);
 }
 
 void declarePhotometryFit(py::module &mod) {
@@ -57,6 +121,8 @@ void declarePhotometryFit(py::module &mod) {
 
     cls.def(py::init<std::shared_ptr<Associations>, std::shared_ptr<PhotometryModel>>(), "associations"_a,
             "photometryModel"_a);
+    cls.def("setMultiBand", &PhotometryFit::setMultiBand, "multiBand"_a);
+    cls.def("getMultiBand", &PhotometryFit::getMultiBand);
 }
 
 PYBIND11_PLUGIN(fitter) {
@@ -64,6 +130,7 @@ PYBIND11_PLUGIN(fitter) {
     py::module::import("lsst.jointcal.astrometryModels");
     py::module::import("lsst.jointcal.chi2");
     py::module::import("lsst.jointcal.photometryModels");
+    py::module::import("lsst.jointcal.profiling");
     py::module mod("fitter");
 
     py::enum_<MinimizeResult>(mod, "MinimizeResult")
@@ -71,6 +138,17 @@ PYBIND11_PLUGIN(fitter) {
             .value("Chi2Increased", MinimizeResult::Chi2Increased)
             .value("Failed", MinimizeResult::Failed);
 
+    py::enum_<RobustLoss>(mod, "RobustLoss")
+            .value("Squared", RobustLoss::Squared)
+            .value("Huber", RobustLoss::Huber)
+            .value("Cauchy", RobustLoss::Cauchy);
+
+    py::enum_<TripletList::Storage>(mod, "TripletStorage")
+            .value("Triplets", TripletList::Storage::Triplets)
+            .value("Compact", TripletList::Storage::Compact);
+
+    declareIterationRecord(mod);
+    declareFitHistory(mod);
     declareFitterBase(mod);
     declareAstrometryFit(mod);
     declarePhotometryFit(mod);
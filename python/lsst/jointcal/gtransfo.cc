@@ -65,6 +65,7 @@ void declareGtransfoPoly(py::module &mod) {
     cls.def("getOrder", &GtransfoPoly::getOrder);
     cls.def("coeff", (double (GtransfoPoly::*)(unsigned const, unsigned const, unsigned const) const) &
                              GtransfoPoly::coeff);
+    cls.def("compose", &GtransfoPoly::compose, "right"_a, "maxOrder"_a);
     cls.def("write", [](GtransfoPoly const &self) {
         std::stringstream result;
         self.write(result);
@@ -1,6 +1,7 @@
 # See COPYRIGHT file at the top of the source tree.
 import collections
 import numpy as np
+import astropy.units as u
 
 import lsst.utils
 import lsst.pex.config as pexConfig
@@ -10,12 +11,14 @@ import lsst.afw.geom as afwGeom
 import lsst.pex.exceptions as pexExceptions
 import lsst.afw.table
 import lsst.meas.algorithms
-from lsst.verify import Job, Measurement
+from lsst.verify import Job, Measurement, Metric
 
 from lsst.meas.algorithms import LoadIndexedReferenceObjectsTask
 from lsst.meas.algorithms.sourceSelector import sourceSelectorRegistry
 
 from .dataIds import PerTractCcdDataIdContainer
+from .decomposition import (DecompositionConfig, RegionProcess, partitionRegions, findNeighbours,
+                            matchSharedStars, ConsensusSolver, callAll)
 
 import lsst.jointcal
 from lsst.jointcal import MinimizeResult
@@ -32,6 +35,49 @@ def add_measurement(job, name, value):
     job.measurements.insert(meas)
 
 
+def add_profile_measurements(job, prefix, profile):
+    """Record the timings and counters of a lsst.jointcal.Profile as measurements.
+
+    Each phase gives ``<prefix>_<phase>_wallTime`` and ``<prefix>_<phase>_cpuTime`` (seconds), each
+    counter ``<prefix>_<counter>``, and each memory entry ``<prefix>_<name>_memory`` (bytes). In builds
+    with allocation tracking, each phase also gives ``<prefix>_<phase>_allocations`` and
+    ``<prefix>_<phase>_allocatedBytes``.
+    Metrics that are not defined by the metrics package are created on the fly, tagged "profile", so
+    that new phases and counters are recorded without a metrics package update.
+
+    Parameters
+    ----------
+    job : lsst.verify.Job
+        The job to add the measurements to.
+    prefix : str
+        Metric name prefix, including the package (e.g. "jointcal.astrometry_fit").
+    profile : lsst.jointcal.Profile
+        The profile to record.
+    """
+    def add(name, value, unit, description):
+        try:
+            metric = job.metrics[name]
+        except KeyError:
+            metric = Metric(name, description, unit, tags=['profile'])
+            job.metrics.insert(metric)
+        job.measurements.insert(Measurement(metric, value*unit))
+
+    for phase, timing in profile.getTimings().items():
+        add('%s_%s_wallTime' % (prefix, phase), timing.wallTime, u.second,
+            'Wall clock time spent in %s.' % phase)
+        add('%s_%s_cpuTime' % (prefix, phase), timing.cpuTime, u.second,
+            'Process CPU time spent in %s.' % phase)
+        if lsst.jointcal.isAllocationTrackingEnabled():
+            add('%s_%s_allocations' % (prefix, phase), timing.allocations, u.dimensionless_unscaled,
+                'Heap allocations made in %s.' % phase)
+            add('%s_%s_allocatedBytes' % (prefix, phase), timing.allocatedBytes, u.byte,
+                'Bytes allocated in %s.' % phase)
+    for counter, value in profile.getCounters().items():
+        add('%s_%s' % (prefix, counter), value, u.dimensionless_unscaled, counter)
+    for name, value in profile.getMemory().items():
+        add('%s_%s_memory' % (prefix, name), value, u.byte, 'Largest memory held by %s.' % name)
+
+
 class JointcalRunner(pipeBase.ButlerInitializedTaskRunner):
     """Subclass of TaskRunner for jointcalTask
 
@@ -49,11 +95,14 @@ class JointcalRunner(pipeBase.ButlerInitializedTaskRunner):
         """
         Return a list of tuples per tract, each containing (dataRefs, kwargs).
 
-        Jointcal operates on lists of dataRefs simultaneously.
+        Jointcal operates on lists of dataRefs simultaneously. With domain decomposition
+        (config.decomposition.nRegions > 1), all dataRefs are fit together, whatever their tract.
         """
         kwargs['profile_jointcal'] = parsedCmd.profile_jointcal
         kwargs['butler'] = parsedCmd.butler
 
+        if parsedCmd.config.decomposition.nRegions > 1:
+            return [(parsedCmd.id.refList, kwargs)]
         # organize data IDs by tract
         refListDict = {}
         for ref in parsedCmd.id.refList:
@@ -157,6 +206,17 @@ class JointcalConfig(pexConfig.Config):
         dtype=int,
         default=3,
     )
+    astrometrySimpleOrderCriterion = pexConfig.ChoiceField(
+        doc="Select the polynomial order of each ccdImage of the simple astrometry model, up to "
+            "astrometrySimpleOrder, by minimizing this information criterion.",
+        dtype=str,
+        default=None,
+        optional=True,
+        allowed={
+            "BIC": "Bayesian information criterion: chi2 + nPar*ln(nData).",
+            "AIC": "Akaike information criterion: chi2 + 2*nPar; favors higher orders than BIC.",
+        }
+    )
     astrometryChipOrder = pexConfig.Field(
         doc="Order of the per-chip transform for the constrained astrometry model.",
         dtype=int,
@@ -184,13 +244,48 @@ class JointcalConfig(pexConfig.Config):
         dtype=str,
         default="simple",
         allowed={"simple": "One constant zeropoint per ccd and visit",
-                 "constrained": "Constrained zeropoint per ccd, and one polynomial per visit"}
+                 "constrained": "Constrained zeropoint per ccd, and one polynomial per visit",
+                 "starFlat": "Constrained zeropoint per ccd and per visit, and one focal plane polynomial "
+                             "(star flat) per epoch"}
     )
     photometryVisitOrder = pexConfig.Field(
         doc="Order of the per-visit polynomial transform for the constrained photometry model.",
         dtype=int,
         default=7,
     )
+    photometryStarFlatOrder = pexConfig.Field(
+        doc="Order of the focal plane polynomial of the starFlat photometry model.",
+        dtype=int,
+        default=4,
+    )
+    photometryStarFlatEpochs = pexConfig.ListField(
+        doc="Increasing MJDs separating the epochs of the starFlat photometry model, each fit with its own "
+            "focal plane polynomial; empty for one polynomial shared by all visits.",
+        dtype=float,
+        default=[],
+    )
+    astrometryColorFilters = pexConfig.ListField(
+        doc="Two filters (blue, red) whose measured fluxes give the star colors for the chromatic "
+            "(refraction) terms of the astrometric fit, one coefficient per filter fit together with the "
+            "shared distortions and star positions. Empty, or a filter with no data, disables these terms.",
+        dtype=str,
+        default=[],
+        listCheck=lambda x: len(x) in (0, 2),
+    )
+    fitProperMotions = pexConfig.Field(
+        doc="Fit the proper motions of the stars matched to reference stars with proper motions, tied to "
+            "them, in the final astrometric fits. The reference proper motions and parallaxes are used to "
+            "place the stars at the epoch of each image either way.",
+        dtype=bool,
+        default=False,
+    )
+    photometryMultiBand = pexConfig.Field(
+        doc="Fit the photometry of all filters in one system, with one flux per filter for each star: the "
+            "chip part of the constrained model is then constrained by every filter. Without it, each star "
+            "has a single flux, compared to the reference flux of the most common filter.",
+        dtype=bool,
+        default=False,
+    )
     astrometryRefObjLoader = pexConfig.ConfigurableField(
         target=LoadIndexedReferenceObjectsTask,
         doc="Reference object loader for astrometric fit",
@@ -213,6 +308,103 @@ class JointcalConfig(pexConfig.Config):
         doc="Source flux field to use in source selection and to get fluxes from the catalog.",
         default='Calib'
     )
+    writeFitHistoryFiles = pexConfig.Field(
+        dtype=bool,
+        doc="Write files with the per-iteration history of each fit (chi2, step norm, outliers, "
+            "factorization time, chi2 per visit).",
+        default=False
+    )
+    compactJacobian = pexConfig.Field(
+        dtype=bool,
+        doc="Accumulate the Jacobian in compressed column form instead of a list of triplets: "
+            "about 25% less memory for the derivatives and no intermediate copy when building the Jacobian.",
+        default=False
+    )
+    useStarArena = pexConfig.Field(
+        dtype=bool,
+        doc="Allocate the stars rebuilt at each association from a pool that is released wholesale at the "
+            "next association, instead of one by one from the heap, to limit heap fragmentation.",
+        default=True
+    )
+    compactMeasurements = pexConfig.Field(
+        dtype=bool,
+        doc="Read the measured positions from contiguous single precision copies in the astrometric fit "
+            "loops, instead of following the list of double precision MeasuredStars. The copies add 32 "
+            "bytes per measurement to the memory of the fit.",
+        default=False
+    )
+    astrometryRobustLoss = pexConfig.ChoiceField(
+        dtype=str,
+        doc="Loss function of the astrometric fit. The robust ones downweight the large residuals by "
+            "iteratively reweighted least squares, instead of rejecting outliers at 5 sigma.",
+        default="none",
+        allowed={
+            "none": "Least squares, with outlier rejection.",
+            "huber": "Quadratic up to robustScale sigma, linear beyond.",
+            "cauchy": "Logarithmic beyond robustScale sigma: large residuals lose all influence.",
+        }
+    )
+    photometryRobustLoss = pexConfig.ChoiceField(
+        dtype=str,
+        doc="Loss function of the photometric fit; see astrometryRobustLoss.",
+        default="none",
+        allowed={
+            "none": "Least squares, with outlier rejection.",
+            "huber": "Quadratic up to robustScale sigma, linear beyond.",
+            "cauchy": "Logarithmic beyond robustScale sigma: large residuals lose all influence.",
+        }
+    )
+    robustScale = pexConfig.Field(
+        dtype=float,
+        doc="Scale of the robust loss functions, in sigma. 0 selects their usual 95% efficiency values "
+            "(1.345 for huber, 2.385 for cauchy).",
+        default=0.0,
+        check=lambda x: x >= 0
+    )
+    robustMaxIterations = pexConfig.Field(
+        dtype=int,
+        doc="Maximum number of reweighted steps in each minimization with a robust loss function.",
+        default=10,
+        check=lambda x: x >= 1
+    )
+    astrometryErrorModel = pexConfig.ChoiceField(
+        dtype=str,
+        doc="Once the astrometric fit has converged, fit an additional position variance per group of "
+            "ccdImages from the residuals, and fit again with it.",
+        default=None,
+        optional=True,
+        allowed={
+            "visit": "One variance per visit.",
+            "ccd": "One variance per chip.",
+        }
+    )
+    photometryErrorModel = pexConfig.ChoiceField(
+        dtype=str,
+        doc="Once the photometric fit has converged, fit an additional fractional flux variance per group "
+            "of ccdImages from the residuals, and fit again with it.",
+        default=None,
+        optional=True,
+        allowed={
+            "visit": "One variance per visit.",
+            "ccd": "One variance per chip.",
+        }
+    )
+    nFitProcesses = pexConfig.Field(
+        dtype=int,
+        doc="Number of worker processes computing the derivatives and chi2 of the measurements in each fit. "
+            "They are forked once per minimization and read the data in place; the factorization stays in "
+            "the main process. A fork costs a copy of the page tables of the main process, then of every "
+            "page written afterwards by either side: about one evaluation of the derivatives for a large "
+            "fit, paid by each minimization, so only fits with many measurements gain from more than one "
+            "process. 1 computes everything in the main process.",
+        default=1,
+        check=lambda x: x >= 1
+    )
+    decomposition = pexConfig.ConfigField(
+        dtype=DecompositionConfig,
+        doc="Fit the data as overlapping regions in separate processes, reconciled on their shared stars, "
+            "instead of tract by tract.",
+    )
 
     def setDefaults(self):
         sourceSelector = self.sourceSelector["astrometry"]
@@ -357,45 +549,23 @@ class JointcalTask(pipeBase.CmdLineTask):
         if len(dataRefs) == 0:
             raise ValueError('Need a non-empty list of data references!')
 
+        if self.config.decomposition.nRegions > 1:
+            return self._run_decomposed(dataRefs, profile_jointcal)
+
         exitStatus = 0  # exit status for shell
 
         sourceFluxField = "slot_%sFlux" % (self.config.sourceFluxType,)
         jointcalControl = lsst.jointcal.JointcalControl(sourceFluxField)
         associations = lsst.jointcal.Associations()
+        associations.setUseStarArena(self.config.useStarArena)
 
-        visit_ccd_to_dataRef = {}
-        oldWcsList = []
-        filters = []
-        load_cat_prof_file = 'jointcal_build_ccdImage.prof' if profile_jointcal else ''
-        with pipeBase.cmdLineTask.profile(load_cat_prof_file):
-            # We need the bounding-box of the focal plane for photometry visit models.
-            # NOTE: we only need to read it once, because its the same for all exposures of a camera.
-            camera = dataRefs[0].get('camera', immediate=True)
-            self.focalPlaneBBox = camera.getFpBBox()
-            for ref in dataRefs:
-                result = self._build_ccdImage(ref, associations, jointcalControl)
-                oldWcsList.append(result.wcs)
-                visit_ccd_to_dataRef[result.key] = ref
-                filters.append(result.filter)
-        filters = collections.Counter(filters)
+        loaded = self._load_data(dataRefs, associations, jointcalControl, profile_jointcal)
+        oldWcsList = loaded.oldWcsList
+        filters = loaded.filters
+        visit_ccd_to_dataRef = dict(zip(loaded.keys, dataRefs))
 
         associations.computeCommonTangentPoint()
-
-        # Use external reference catalogs handled by LSST stack mechanism
-        # Get the bounding box overlapping all associated images
-        # ==> This is probably a bad idea to do it this way <== To be improved
-        bbox = associations.getRaDecBBox()
-        # with Python 3 this can be simplified to afwGeom.SpherePoint(*bbox.getCenter(), afwGeom.degrees)
-        bboxCenter = bbox.getCenter()
-        center = afwGeom.SpherePoint(bboxCenter[0], bboxCenter[1], afwGeom.degrees)
-        bboxMax = bbox.getMax()
-        corner = afwGeom.SpherePoint(bboxMax[0], bboxMax[1], afwGeom.degrees)
-        radius = center.separation(corner).asRadians()
-
-        # Get astrometry_net_data path
-        anDir = lsst.utils.getPackageDir('astrometry_net_data')
-        if anDir is None:
-            raise RuntimeError("astrometry_net_data is not setup")
+        center, radius = self._get_refcat_circle(associations)
 
         # Determine a default filter associated with the catalog. See DM-9093
         defaultFilter = filters.most_common(1)[0][0]
@@ -428,11 +598,173 @@ class JointcalTask(pipeBase.CmdLineTask):
         else:
             photometry = Photometry(None, None)
 
+        if lsst.jointcal.isAllocationTrackingEnabled():
+            self.log.info("Top allocation sites of the profiled phases:\n%s",
+                          "\n".join(str(site) for site in lsst.jointcal.getTopAllocationSites(20)))
+
         return pipeBase.Struct(dataRefs=dataRefs,
                                oldWcsList=oldWcsList,
                                job=self.job,
                                exitStatus=exitStatus)
 
+    def _run_decomposed(self, dataRefs, profile_jointcal=False):
+        """
+        Fit the dataRefs as overlapping regions, each in a process of its own, brought to a consensus on
+        the stars they share.
+
+        See lsst.jointcal.decomposition for the method. Each region writes the results of the exposures
+        it owns. Takes the same parameters and returns the same struct as run().
+        """
+        config = self.config.decomposition
+        oldWcsList = []
+        ra = []
+        dec = []
+        for ref in dataRefs:
+            wcs = ref.get('calexp_wcs')
+            center = wcs.pixelToSky(afwGeom.Box2D(ref.get('calexp_bbox')).getCenter())
+            oldWcsList.append(wcs)
+            ra.append(center.getLongitude().asDegrees())
+            dec.append(center.getLatitude().asDegrees())
+        regions = partitionRegions(ra, dec, config.nRegions, config.overlap)
+        neighbours = findNeighbours(regions)
+        self.log.info("Fitting %d exposures as %d regions of %s exposures", len(dataRefs), len(regions),
+                      [len(region.members) for region in regions])
+
+        butler = dataRefs[0].getButler()
+        profile = lsst.jointcal.Profile()
+        processes = []
+        try:
+            for i, region in enumerate(regions):
+                owned = np.in1d(region.members, region.owned)
+                processes.append(RegionProcess(JointcalRegionFitter, self.config, butler,
+                                               [dataRefs[j] for j in region.members], owned.tolist(),
+                                               "region%d" % i, profile_jointcal))
+            for process in processes:
+                process.receive()  # wait for all regions to be loaded
+            if self.config.doAstrometry:
+                self._fit_decomposed(processes, neighbours, "astrometry", profile)
+            if self.config.doPhotometry:
+                self._fit_decomposed(processes, neighbours, "photometry", profile)
+        finally:
+            for process in processes:
+                process.close()
+        add_profile_measurements(self.job, 'jointcal.decomposition', profile)
+
+        return pipeBase.Struct(dataRefs=dataRefs,
+                               oldWcsList=oldWcsList,
+                               job=self.job,
+                               exitStatus=0)
+
+    def _fit_decomposed(self, processes, neighbours, name, profile):
+        """Fit each region, then refit them with consensus priors until they agree, and write the results.
+
+        Parameters
+        ----------
+        processes : list of lsst.jointcal.decomposition.RegionProcess
+            The processes of the JointcalRegionFitter of each region.
+        neighbours : list of tuple of int
+            The pairs of regions that share exposures.
+        name : str
+            Name of thing being fit: "astrometry" or "photometry".
+        profile : lsst.jointcal.Profile
+            Profile to record the consensus statistics in.
+        """
+        config = self.config.decomposition
+        nRegions = len(processes)
+        catalogs = callAll(processes, "fit", [(name,)]*nRegions)
+        groups = matchSharedStars(catalogs, config.matchRadius*afwGeom.arcseconds, neighbours)
+        self.log.info("%d %s stars are shared between regions", len(groups), name)
+        solver = ConsensusSolver(groups, nRegions)
+        tolerance = config.positionTolerance if name == "astrometry" else config.fluxTolerance
+
+        nRounds = 0
+        while True:
+            update = solver.update(catalogs, name)
+            self.log.info("%s consensus after %d rounds: largest disagreement %g, largest change %g",
+                          name, nRounds, update.primal, update.dual)
+            if update.primal < tolerance and update.dual < tolerance:
+                break
+            if nRounds == config.maxRounds:
+                self.log.warn("%s regions did not reach a consensus after %d rounds", name, nRounds)
+                break
+            argsList = []
+            for ids, values in update.targets:
+                ids = [int(i) for i in ids]
+                if name == "astrometry":
+                    positionErr = [config.positionSigma/3600.]*len(ids)
+                    argsList.append((name, ids, values[0].tolist(), values[1].tolist(), positionErr, [], []))
+                else:
+                    fluxErr = (np.abs(values[0])*config.fluxSigma).tolist()
+                    argsList.append((name, ids, [], [], [], values[0].tolist(), fluxErr))
+            catalogs = callAll(processes, "refit", argsList)
+            nRounds += 1
+
+        profile.setCounter("%s_nSharedStars" % name, len(groups))
+        profile.setCounter("%s_nRounds" % name, nRounds)
+        profile.setCounter("%s_disagreement" % name, update.primal)
+        for i, (chi2, ndof) in enumerate(callAll(processes, "write", [(name,)]*nRegions)):
+            profile.setCounter("%s_region%d_final_chi2" % (name, i), chi2)
+            profile.setCounter("%s_region%d_final_ndof" % (name, i), ndof)
+
+    def _load_data(self, dataRefs, associations, jointcalControl, profile_jointcal=False):
+        """Build a ccdImage in associations from each dataRef.
+
+        Parameters
+        ----------
+        dataRefs : list of lsst.daf.persistence.ButlerDataRef
+            List of data references to the exposures to be fit.
+        associations : lsst.jointcal.Associations
+            Object to add the ccdImages to.
+        jointcalControl : jointcal.JointcalControl
+            Control object for associations management.
+        profile_jointcal : bool, optional
+            Profile the loading of the catalogs.
+
+        Returns
+        -------
+        pipe.base.Struct
+            struct containing:
+            * oldWcsList: the original WCS of each dataRef
+            * keys: the (visit, ccd) key of each dataRef
+            * filters: collections.Counter of the filter names
+        """
+        oldWcsList = []
+        keys = []
+        filters = []
+        load_cat_prof_file = 'jointcal_build_ccdImage.prof' if profile_jointcal else ''
+        with pipeBase.cmdLineTask.profile(load_cat_prof_file):
+            # We need the bounding-box of the focal plane for photometry visit models.
+            # NOTE: we only need to read it once, because its the same for all exposures of a camera.
+            camera = dataRefs[0].get('camera', immediate=True)
+            self.focalPlaneBBox = camera.getFpBBox()
+            for ref in dataRefs:
+                result = self._build_ccdImage(ref, associations, jointcalControl)
+                oldWcsList.append(result.wcs)
+                keys.append(result.key)
+                filters.append(result.filter)
+        add_profile_measurements(self.job, 'jointcal.load', associations.getProfile())
+        associations.resetProfile()
+        return pipeBase.Struct(oldWcsList=oldWcsList, keys=keys, filters=collections.Counter(filters))
+
+    def _get_refcat_circle(self, associations):
+        """Return the (center, radius in radians) of the sky circle to load the reference catalogs in."""
+        # Use external reference catalogs handled by LSST stack mechanism
+        # Get the bounding box overlapping all associated images
+        # ==> This is probably a bad idea to do it this way <== To be improved
+        bbox = associations.getRaDecBBox()
+        # with Python 3 this can be simplified to afwGeom.SpherePoint(*bbox.getCenter(), afwGeom.degrees)
+        bboxCenter = bbox.getCenter()
+        center = afwGeom.SpherePoint(bboxCenter[0], bboxCenter[1], afwGeom.degrees)
+        bboxMax = bbox.getMax()
+        corner = afwGeom.SpherePoint(bboxMax[0], bboxMax[1], afwGeom.degrees)
+        radius = center.separation(corner).asRadians()
+
+        # Get astrometry_net_data path
+        anDir = lsst.utils.getPackageDir('astrometry_net_data')
+        if anDir is None:
+            raise RuntimeError("astrometry_net_data is not setup")
+        return center, radius
+
     def _do_load_refcat_and_fit(self, associations, defaultFilter, center, radius,
                                 name="", refObjLoader=None, filters=[], fit_function=None,
                                 tract=None, profile_jointcal=False, match_cut=3.0,
@@ -511,16 +843,21 @@ class JointcalTask(pipeBase.CmdLineTask):
                         associations.fittedStarListSize())
         add_measurement(self.job, 'jointcal.selected_%s_ccdImages' % name,
                         associations.nCcdImagesValidForFit())
+        add_profile_measurements(self.job, 'jointcal.%s_associations' % name, associations.getProfile())
+        associations.resetProfile()
 
         load_cat_prof_file = 'jointcal_fit_%s.prof'%name if profile_jointcal else ''
         dataName = "{}_{}".format(tract, defaultFilter)
         with pipeBase.cmdLineTask.profile(load_cat_prof_file):
             result = fit_function(associations, dataName)
+        add_profile_measurements(self.job, 'jointcal.%s_fit' % name, result.fit.getProfile())
         # TODO DM-12446: turn this into a "butler save" somehow.
         # Save reference and measurement chi2 contributions for this data
         if self.config.writeChi2ContributionFiles:
             baseName = "{}_final_chi2-{}.csv".format(name, dataName)
             result.fit.saveChi2Contributions(baseName)
+        if self.config.writeFitHistoryFiles:
+            result.fit.saveHistory("{}_fit_history-{}".format(name, dataName))
 
         return result
 
@@ -560,10 +897,20 @@ class JointcalTask(pipeBase.CmdLineTask):
             model = lsst.jointcal.ConstrainedPhotometryModel(associations.getCcdImageList(),
                                                              self.focalPlaneBBox,
                                                              visitOrder=self.config.photometryVisitOrder)
+        elif self.config.photometryModel == "starFlat":
+            model = lsst.jointcal.StarFlatPhotometryModel(
+                associations.getCcdImageList(), self.focalPlaneBBox,
+                starFlatOrder=self.config.photometryStarFlatOrder,
+                epochBoundaries=list(self.config.photometryStarFlatEpochs))
         elif self.config.photometryModel == "simple":
             model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
 
         fit = lsst.jointcal.PhotometryFit(associations, model)
+        self._configure_fit(fit, "photometry")
+        if self.config.photometryMultiBand and associations.getNFilters() > 1:
+            self.log.info("Fitting %d filters together", associations.getNFilters())
+            fit.setMultiBand(True)
+        self._estimate_memory(associations, model, fit, "photometry", "Model Fluxes", 1)
         chi2 = fit.computeChi2()
         # TODO DM-12446: turn this into a "butler save" somehow.
         # Save reference and measurement chi2 contributions for this data
@@ -576,7 +923,7 @@ class JointcalTask(pipeBase.CmdLineTask):
         self.log.info("Initialized: %s", str(chi2))
         # The constrained model needs the visit transfo fit first; the chip
         # transfo is initialized from the singleFrame PhotoCalib, so it's close.
-        if self.config.photometryModel == "constrained":
+        if self.config.photometryModel in ("constrained", "starFlat"):
             # TODO: (related to DM-8046): implement Visit/Chip choice
             fit.minimize("ModelVisit")
             chi2 = fit.computeChi2()
@@ -597,6 +944,7 @@ class JointcalTask(pipeBase.CmdLineTask):
         self.log.debug("Photometry error scales are frozen.")
 
         chi2 = self._iterate_fit(associations, fit, model, 20, "photometry", "Model Fluxes")
+        chi2 = self._refit_with_error_model(associations, fit, model, "photometry", "Model Fluxes", chi2)
 
         add_measurement(self.job, 'jointcal.photometry_final_chi2', chi2.chi2)
         add_measurement(self.job, 'jointcal.photometry_final_ndof', chi2.ndof)
@@ -640,13 +988,26 @@ class JointcalTask(pipeBase.CmdLineTask):
                                                              chipOrder=self.config.astrometryChipOrder,
                                                              visitOrder=self.config.astrometryVisitOrder)
         elif self.config.astrometryModel == "simple":
+            orderCriterion = self.config.astrometrySimpleOrderCriterion or ""
             model = lsst.jointcal.SimpleAstrometryModel(associations.getCcdImageList(),
                                                         sky_to_tan_projection,
                                                         self.config.useInputWcs,
                                                         nNotFit=0,
-                                                        order=self.config.astrometrySimpleOrder)
+                                                        order=self.config.astrometrySimpleOrder,
+                                                        orderCriterion=orderCriterion)
+
+        # The colors must be set before the fit, which takes its color lever arm from them.
+        fitRefraction = False
+        if self.config.astrometryColorFilters:
+            blue, red = self.config.astrometryColorFilters
+            fitRefraction = associations.computeFittedStarColors(blue, red) > 0
+            if not fitRefraction:
+                self.log.warn("No star measured in both %s and %s: not fitting chromatic terms.", blue, red)
 
         fit = lsst.jointcal.AstrometryFit(associations, model, self.config.posError)
+        self._configure_fit(fit, "astrometry")
+        fit.setUseCompactMeasurements(self.config.compactMeasurements)
+        self._estimate_memory(associations, model, fit, "astrometry", "Distortions Positions", 2)
         chi2 = fit.computeChi2()
         # TODO DM-12446: turn this into a "butler save" somehow.
         # Save reference and measurement chi2 contributions for this data
@@ -672,17 +1033,90 @@ class JointcalTask(pipeBase.CmdLineTask):
         fit.minimize("Distortions Positions")
         chi2 = fit.computeChi2()
         self.log.info(str(chi2))
+        whatToFit = "Distortions Positions"
+        if self.config.fitProperMotions:
+            whatToFit += " PM"
+        if fitRefraction:
+            whatToFit += " Refrac"
+        if whatToFit != "Distortions Positions":
+            fit.minimize(whatToFit)
+            chi2 = fit.computeChi2()
+            self.log.info(str(chi2))
+        if fitRefraction:
+            self.log.info("Chromatic coefficients: %s", fit.getRefractionCoefficients())
         if not np.isfinite(chi2.chi2):
             raise FloatingPointError('Pre-iteration chi2 is invalid: %s'%chi2)
         self.log.info("Fit prepared with %s", str(chi2))
 
-        chi2 = self._iterate_fit(associations, fit, model, 20, "astrometry", "Distortions Positions")
+        chi2 = self._iterate_fit(associations, fit, model, 20, "astrometry", whatToFit)
+        chi2 = self._refit_with_error_model(associations, fit, model, "astrometry", whatToFit, chi2)
 
         add_measurement(self.job, 'jointcal.astrometry_final_chi2', chi2.chi2)
         add_measurement(self.job, 'jointcal.astrometry_final_ndof', chi2.ndof)
 
         return Astrometry(fit, model, sky_to_tan_projection)
 
+    def _configure_fit(self, fit, name):
+        """Configure how fit accumulates its Jacobian, how many processes compute it, and the loss
+        function of the "astrometry" or "photometry" fit it is."""
+        if self.config.compactJacobian:
+            fit.setTripletStorage(lsst.jointcal.TripletStorage.Compact)
+        else:
+            fit.setTripletStorage(lsst.jointcal.TripletStorage.Triplets)
+        fit.setNProcesses(self.config.nFitProcesses)
+        loss = getattr(self.config, name + "RobustLoss")
+        robustLoss = {"none": lsst.jointcal.RobustLoss.Squared,
+                      "huber": lsst.jointcal.RobustLoss.Huber,
+                      "cauchy": lsst.jointcal.RobustLoss.Cauchy}[loss]
+        fit.setRobustLoss(robustLoss, self.config.robustScale, self.config.robustMaxIterations)
+
+    def _estimate_memory(self, associations, model, fit, name, whatToFit, nResiduals):
+        """Log and record the predicted peak memory of fitting whatToFit with this model.
+
+        Parameters
+        ----------
+        associations : lsst.jointcal.Associations
+            The star/reference star associations to fit.
+        model : lsst.jointcal.AstrometryModel or lsst.jointcal.PhotometryModel
+            The model to fit.
+        fit : lsst.jointcal.AstrometryFit or lsst.jointcal.PhotometryFit
+            The fitter, configured as it will be run. Its parameter layout is set for whatToFit, as the
+            first minimize() would; the model is only modified through the fitter.
+        name : str
+            Name of thing being fit: "astrometry" or "photometry".
+        whatToFit : str
+            The largest set of parameters that will be fit together.
+        nResiduals : int
+            Residuals per measurement.
+
+        Returns
+        -------
+        lsst.jointcal.MemoryEstimate
+            The predicted memory use.
+        """
+        ccdImageList = associations.getCcdImageList()
+        nMeasurements = sum(ccdImage.countStars()[0] for ccdImage in ccdImageList)
+        fit.assignIndices(whatToFit)
+        nModelParameters = fit.getNModelParameters()
+        nFittedStars = associations.fittedStarListSize()
+        # proper motions (astrometry) and extra bands (photometry) give some stars more parameters.
+        nStarParameters = fit.getNParameters() - nModelParameters
+        nParametersPerStar = -(-nStarParameters // nFittedStars) if nFittedStars > 0 else 0
+        nParametersPerMeasurement = max(model.getNpar(ccdImage) for ccdImage in ccdImageList)
+        estimate = lsst.jointcal.estimateFitMemory(nMeasurements,
+                                                   nFittedStars,
+                                                   associations.nFittedStarsWithAssociatedRefStar(),
+                                                   len(ccdImageList),
+                                                   nModelParameters,
+                                                   nParametersPerMeasurement,
+                                                   nParametersPerStar,
+                                                   nResiduals)
+        self.log.info("Predicted %s fit memory: %s", name, estimate)
+        profile = lsst.jointcal.Profile()
+        profile.updateMemory("estimatedPeak", estimate.peak)
+        add_profile_measurements(self.job, 'jointcal.%s_fit' % name, profile)
+        return estimate
+
     def _check_stars(self, associations):
         """Count measured and reference stars per ccd and warn/log them."""
         for ccdImage in associations.getCcdImageList():
@@ -725,6 +1159,23 @@ class JointcalTask(pipeBase.CmdLineTask):
 
         return chi2
 
+    def _refit_with_error_model(self, associations, fit, model, name, whatToFit, chi2):
+        """Fit the error model configured for the "astrometry" or "photometry" fit, if any, and iterate
+        the fit again with it, returning the final chi2.
+
+        The refit factorizes the normal equations anew rather than updating the factor of the last
+        minimize: the error terms change the weight of every measurement of their group, and a rank
+        update per reweighted measurement would cost more than one factorization. (The rank updates of
+        minimize pay off for removing a few outliers.) Starting from the converged parameters, the refit
+        usually takes one or two factorizations.
+        """
+        grouping = getattr(self.config, name + "ErrorModel")
+        if grouping is None:
+            return chi2
+        terms = fit.fitErrorModel(grouping)
+        self.log.info("%s error terms per %s: %s", name, grouping, terms)
+        return self._iterate_fit(associations, fit, model, 20, name, whatToFit)
+
     def _write_astrometry_results(self, associations, model, visit_ccd_to_dataRef):
         """
         Write the fitted astrometric results to a new 'jointcal_wcs' dataRef.
@@ -736,7 +1187,8 @@ class JointcalTask(pipeBase.CmdLineTask):
         model : lsst.jointcal.AstrometryModel
             The astrometric model that was fit.
         visit_ccd_to_dataRef : dict of Key: lsst.daf.persistence.ButlerDataRef
-            dict of ccdImage identifiers to dataRefs that were fit
+            dict of ccdImage identifiers to dataRefs that were fit; ccdImages
+            that are not in it are not written.
         """
 
         ccdImageList = associations.getCcdImageList()
@@ -744,7 +1196,9 @@ class JointcalTask(pipeBase.CmdLineTask):
             # TODO: there must be a better way to identify this ccdImage than a visit,ccd pair?
             ccd = ccdImage.ccdId
             visit = ccdImage.visit
-            dataRef = visit_ccd_to_dataRef[(visit, ccd)]
+            dataRef = visit_ccd_to_dataRef.get((visit, ccd))
+            if dataRef is None:
+                continue  # fit as part of a neighbouring region, which writes it.
             self.log.info("Updating WCS for visit: %d, ccd: %d", visit, ccd)
             skyWcs = model.makeSkyWcs(ccdImage)
             try:
@@ -764,7 +1218,8 @@ class JointcalTask(pipeBase.CmdLineTask):
         model : lsst.jointcal.PhotometryModel
             The photoometric model that was fit.
         visit_ccd_to_dataRef : dict of Key: lsst.daf.persistence.ButlerDataRef
-            dict of ccdImage identifiers to dataRefs that were fit
+            dict of ccdImage identifiers to dataRefs that were fit; ccdImages
+            that are not in it are not written.
         """
 
         ccdImageList = associations.getCcdImageList()
@@ -772,7 +1227,9 @@ class JointcalTask(pipeBase.CmdLineTask):
             # TODO: there must be a better way to identify this ccdImage than a visit,ccd pair?
             ccd = ccdImage.ccdId
             visit = ccdImage.visit
-            dataRef = visit_ccd_to_dataRef[(visit, ccd)]
+            dataRef = visit_ccd_to_dataRef.get((visit, ccd))
+            if dataRef is None:
+                continue  # fit as part of a neighbouring region, which writes it.
             self.log.info("Updating PhotoCalib for visit: %d, ccd: %d", visit, ccd)
             photoCalib = model.toPhotoCalib(ccdImage)
             try:
@@ -780,3 +1237,80 @@ class JointcalTask(pipeBase.CmdLineTask):
             except pexExceptions.Exception as e:
                 self.log.fatal('Failed to write updated PhotoCalib: %s', str(e))
                 raise e
+
+
+class JointcalRegionFitter:
+    """Fit one region of a domain-decomposed jointcal run, keeping the fits from one consensus round to
+    the next.
+
+    Lives in a process of its own (see lsst.jointcal.decomposition.RegionProcess), driven by
+    JointcalTask._run_decomposed.
+
+    Parameters
+    ----------
+    config : JointcalConfig
+        The configuration of the run.
+    butler : lsst.daf.persistence.Butler
+        Used to initialize the reference object loaders.
+    dataRefs : list of lsst.daf.persistence.ButlerDataRef
+        The exposures of the region, including those of the overlaps with its neighbours.
+    owned : list of bool
+        For each dataRef, whether this region writes its results.
+    name : str
+        Name of the region, for the debugging files.
+    profile_jointcal : bool
+        Profile the loading and fitting steps.
+    """
+    whatToFit = {"astrometry": "Distortions Positions", "photometry": "Model Fluxes"}
+
+    def __init__(self, config, butler, dataRefs, owned, name, profile_jointcal=False):
+        self.task = JointcalTask(config=config, butler=butler)
+        self.name = name
+        self.profile_jointcal = profile_jointcal
+        jointcalControl = lsst.jointcal.JointcalControl("slot_%sFlux" % (config.sourceFluxType,))
+        self.associations = lsst.jointcal.Associations()
+        self.associations.setUseStarArena(config.useStarArena)
+        loaded = self.task._load_data(dataRefs, self.associations, jointcalControl, profile_jointcal)
+        self.visit_ccd_to_dataRef = {key: ref for key, ref, isOwned in zip(loaded.keys, dataRefs, owned)
+                                     if isOwned}
+        self.filters = loaded.filters
+        self.defaultFilter = self.filters.most_common(1)[0][0]
+        self.associations.computeCommonTangentPoint()
+        self.center, self.radius = self.task._get_refcat_circle(self.associations)
+        self.results = {}
+
+    def fit(self, name):
+        """Associate, load the reference catalog and fit as JointcalTask.run does; return the fitted
+        stars (see Associations.makeFittedStarCatalog)."""
+        if name == "astrometry":
+            kwargs = dict(refObjLoader=self.task.astrometryRefObjLoader,
+                          fit_function=self.task._fit_astrometry)
+        else:
+            kwargs = dict(refObjLoader=self.task.photometryRefObjLoader,
+                          fit_function=self.task._fit_photometry,
+                          filters=self.filters,
+                          reject_bad_fluxes=True)
+        self.results[name] = self.task._do_load_refcat_and_fit(self.associations, self.defaultFilter,
+                                                               self.center, self.radius, name=name,
+                                                               tract=self.name,
+                                                               profile_jointcal=self.profile_jointcal,
+                                                               **kwargs)
+        return self.associations.makeFittedStarCatalog()
+
+    def refit(self, name, indices, ra, dec, positionErr, flux, fluxErr):
+        """Iterate the fit with priors on the shared stars (see Associations.setFittedStarPriors);
+        return the fitted stars."""
+        self.associations.setFittedStarPriors(indices, ra, dec, positionErr, flux, fluxErr)
+        result = self.results[name]
+        self.task._iterate_fit(self.associations, result.fit, result.model, 20, name, self.whatToFit[name])
+        return self.associations.makeFittedStarCatalog()
+
+    def write(self, name):
+        """Write the results of the owned exposures; return the final (chi2, ndof) of the region."""
+        result = self.results[name]
+        if name == "astrometry":
+            self.task._write_astrometry_results(self.associations, result.model, self.visit_ccd_to_dataRef)
+        else:
+            self.task._write_photometry_results(self.associations, result.model, self.visit_ccd_to_dataRef)
+        chi2 = result.fit.computeChi2()
+        return chi2.chi2, chi2.ndof
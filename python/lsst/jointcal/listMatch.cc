@@ -0,0 +1,120 @@
+/*
+ * LSST Data Management System
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ * See the COPYRIGHT file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <https://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include <memory>
+#include <vector>
+
+#include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/CcdImage.h"
+#include "lsst/jointcal/Frame.h"
+#include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/ListMatch.h"
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace lsst {
+namespace jointcal {
+namespace {
+
+// The star lists are passed as Python lists of BaseStars, which share the stars.
+using StarVector = std::vector<std::shared_ptr<BaseStar>>;
+
+BaseStarList makeBaseStarList(StarVector const &stars) {
+    BaseStarList result;
+    result.insert(result.end(), stars.begin(), stars.end());
+    return result;
+}
+
+void declareMatchConditions(py::module &mod) {
+    py::class_<MatchConditions, std::shared_ptr<MatchConditions>> cls(mod, "MatchConditions");
+
+    cls.def(py::init<>());
+
+    cls.def_readwrite("nStarsList1", &MatchConditions::nStarsList1);
+    cls.def_readwrite("nStarsList2", &MatchConditions::nStarsList2);
+    cls.def_readwrite("maxTrialCount", &MatchConditions::maxTrialCount);
+    cls.def_readwrite("nSigmas", &MatchConditions::nSigmas);
+    cls.def_readwrite("maxShiftX", &MatchConditions::maxShiftX);
+    cls.def_readwrite("maxShiftY", &MatchConditions::maxShiftY);
+    cls.def_readwrite("sizeRatio", &MatchConditions::sizeRatio);
+    cls.def_readwrite("deltaSizeRatio", &MatchConditions::deltaSizeRatio);
+    cls.def_readwrite("minMatchRatio", &MatchConditions::minMatchRatio);
+    cls.def_readwrite("algorithm", &MatchConditions::algorithm);
+}
+
+void declareReferenceMatchIndex(py::module &mod) {
+    py::class_<ReferenceMatchIndex, std::shared_ptr<ReferenceMatchIndex>> cls(mod, "ReferenceMatchIndex");
+
+    cls.def(py::init([](StarVector const &stars, double scale, std::size_t starsPerCell) {
+                return std::make_shared<ReferenceMatchIndex>(makeBaseStarList(stars), scale, starsPerCell);
+            }),
+            "stars"_a, "scale"_a, "starsPerCell"_a = 64);
+
+    cls.def("extract", [](ReferenceMatchIndex const &self, Frame const &frame) {
+        BaseStarList extracted;
+        self.extract(frame, extracted);
+        return StarVector(extracted.begin(), extracted.end());
+    });
+    cls.def("getScale", &ReferenceMatchIndex::getScale);
+    cls.def_property_readonly("scale", &ReferenceMatchIndex::getScale);
+    cls.def("size", &ReferenceMatchIndex::size);
+    cls.def("__len__", &ReferenceMatchIndex::size);
+}
+
+void declareListMatchBlind(py::module &mod) {
+    mod.def("listMatchBlind",
+            [](std::vector<StarVector> const &lists, std::vector<Frame> const &footprints,
+               ReferenceMatchIndex const &reference, MatchConditions const &conditions, int maxOrder,
+               unsigned nProcesses) {
+                std::vector<BaseStarList> starLists;
+                starLists.reserve(lists.size());
+                for (auto const &stars : lists) starLists.push_back(makeBaseStarList(stars));
+                std::vector<BaseStarList const *> pointers;
+                pointers.reserve(starLists.size());
+                for (auto const &starList : starLists) pointers.push_back(&starList);
+                return listMatchBlind(pointers, footprints, reference, conditions, maxOrder, nProcesses);
+            },
+            "lists"_a, "footprints"_a, "reference"_a, "conditions"_a, "maxOrder"_a = 1, "nProcesses"_a = 1);
+    mod.def("matchCcdImagesBlind", &matchCcdImagesBlind, "ccdImages"_a, "reference"_a, "conditions"_a,
+            "searchMargin"_a, "maxOrder"_a = 1, "nProcesses"_a = 1);
+}
+
+PYBIND11_PLUGIN(listMatch) {
+    py::module::import("lsst.jointcal.ccdImage");
+    py::module::import("lsst.jointcal.frame");
+    py::module::import("lsst.jointcal.gtransfo");
+    py::module::import("lsst.jointcal.star");
+    py::module mod("listMatch");
+
+    declareMatchConditions(mod);
+    declareReferenceMatchIndex(mod);
+    declareListMatchBlind(mod);
+
+    return mod.ptr();
+}
+}  // namespace
+}  // namespace jointcal
+}  // namespace lsst
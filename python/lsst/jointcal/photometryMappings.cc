@@ -84,6 +84,14 @@ void declareChipVisitPhotometryMapping(py::module &mod) {
     cls.def("getVisitMapping", &ChipVisitPhotometryMapping::getVisitMapping);
 }
 
+void declareStarFlatPhotometryMapping(py::module &mod) {
+    py::class_<StarFlatPhotometryMapping, std::shared_ptr<StarFlatPhotometryMapping>, PhotometryMappingBase>
+            cls(mod, "StarFlatPhotometryMapping");
+
+    cls.def("getChipMapping", &StarFlatPhotometryMapping::getChipMapping);
+    cls.def("getVisitMapping", &StarFlatPhotometryMapping::getVisitMapping);
+}
+
 PYBIND11_PLUGIN(photometryMappings) {
     py::module::import("lsst.jointcal.star");
     py::module::import("lsst.jointcal.photometryTransfo");
@@ -97,6 +105,7 @@ PYBIND11_PLUGIN(photometryMappings) {
     declarePhotometryMappingBase(mod);
     declarePhotometryMapping(mod);
     declareChipVisitPhotometryMapping(mod);
+    declareStarFlatPhotometryMapping(mod);
 
     return mod.ptr();
 }
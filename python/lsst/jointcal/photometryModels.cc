@@ -34,6 +34,7 @@
 #include "lsst/jointcal/Point.h"
 #include "lsst/jointcal/SimplePhotometryModel.h"
 #include "lsst/jointcal/ConstrainedPhotometryModel.h"
+#include "lsst/jointcal/StarFlatPhotometryModel.h"
 
 namespace py = pybind11;
 using namespace pybind11::literals;
@@ -50,7 +51,11 @@ void declarePhotometryModel(py::module &mod) {
     cls.def("offsetParams", &PhotometryModel::offsetParams);
     cls.def("transform", &PhotometryModel::transform);
     cls.def("transformError", &PhotometryModel::transformError);
-    cls.def("getMappingIndices", &PhotometryModel::getMappingIndices);
+    cls.def("getMappingIndices", [](PhotometryModel const &self, CcdImage const &ccdImage) {
+        std::vector<unsigned> indices(0);
+        self.getMappingIndices(ccdImage, indices);
+        return indices;
+    });
     cls.def("computeParameterDerivatives",
             [](PhotometryModel const &self, MeasuredStar const &star, CcdImage const &ccdImage) {
                 Eigen::VectorXd derivatives(self.getNpar(ccdImage));
@@ -77,6 +82,16 @@ void declareConstrainedPhotometryModel(py::module &mod) {
             "visitOrder"_a = 7);
 }
 
+void declareStarFlatPhotometryModel(py::module &mod) {
+    py::class_<StarFlatPhotometryModel, std::shared_ptr<StarFlatPhotometryModel>, PhotometryModel> cls(
+            mod, "StarFlatPhotometryModel");
+    cls.def(py::init<CcdImageList const &, afw::geom::Box2D const &, int, std::vector<double> const &>(),
+            "CcdImageList"_a, "bbox"_a, "starFlatOrder"_a = 4, "epochBoundaries"_a = std::vector<double>());
+    cls.def("getNEpochs", &StarFlatPhotometryModel::getNEpochs);
+    cls.def("getCacheSize", &StarFlatPhotometryModel::getCacheSize);
+    cls.def("isCached", &StarFlatPhotometryModel::isCached, "measuredStar"_a);
+}
+
 PYBIND11_PLUGIN(photometryModels) {
     py::module::import("lsst.jointcal.ccdImage");
     py::module::import("lsst.jointcal.photometryTransfo");
@@ -91,6 +106,7 @@ PYBIND11_PLUGIN(photometryModels) {
     declarePhotometryModel(mod);
     declareSimplePhotometryModel(mod);
     declareConstrainedPhotometryModel(mod);
+    declareStarFlatPhotometryModel(mod);
 
     return mod.ptr();
 }
@@ -0,0 +1,122 @@
+/*
+ * LSST Data Management System
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ * See the COPYRIGHT file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <https://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include "lsst/utils/python.h"
+
+#include "lsst/jointcal/AllocationTracking.h"
+#include "lsst/jointcal/MemoryUsage.h"
+#include "lsst/jointcal/Profiling.h"
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace lsst {
+namespace jointcal {
+namespace {
+
+void declarePhaseTiming(py::module &mod) {
+    py::class_<PhaseTiming, std::shared_ptr<PhaseTiming>> cls(mod, "PhaseTiming");
+
+    cls.def(py::init<>());
+
+    utils::python::addOutputOp(cls, "__str__");
+
+    cls.def_readwrite("wallTime", &PhaseTiming::wallTime);
+    cls.def_readwrite("cpuTime", &PhaseTiming::cpuTime);
+    cls.def_readwrite("calls", &PhaseTiming::calls);
+    cls.def_readwrite("allocations", &PhaseTiming::allocations);
+    cls.def_readwrite("allocatedBytes", &PhaseTiming::allocatedBytes);
+}
+
+void declareProfile(py::module &mod) {
+    py::class_<Profile, std::shared_ptr<Profile>> cls(mod, "Profile");
+
+    cls.def(py::init<>());
+
+    utils::python::addOutputOp(cls, "__str__");
+
+    cls.def("addTiming", &Profile::addTiming, "phase"_a, "wallTime"_a, "cpuTime"_a,
+            "allocations"_a = AllocationCount());
+    cls.def("setCounter", &Profile::setCounter, "name"_a, "value"_a);
+    cls.def("addCounter", &Profile::addCounter, "name"_a, "value"_a);
+    cls.def("getTimings", &Profile::getTimings);
+    cls.def("updateMemory", &Profile::updateMemory, "name"_a, "bytes"_a);
+    cls.def("getCounters", &Profile::getCounters);
+    cls.def("getMemory", &Profile::getMemory);
+    cls.def("reset", &Profile::reset);
+}
+
+void declareAllocationTracking(py::module &mod) {
+    py::class_<AllocationCount, std::shared_ptr<AllocationCount>> countCls(mod, "AllocationCount");
+    countCls.def(py::init<>());
+    countCls.def(py::init<std::uint64_t, std::uint64_t>(), "count"_a, "bytes"_a);
+    countCls.def_readwrite("count", &AllocationCount::count);
+    countCls.def_readwrite("bytes", &AllocationCount::bytes);
+
+    py::class_<AllocationSite, std::shared_ptr<AllocationSite>> siteCls(mod, "AllocationSite");
+    utils::python::addOutputOp(siteCls, "__str__");
+    siteCls.def_readonly("frames", &AllocationSite::frames);
+    siteCls.def_readonly("count", &AllocationSite::count);
+    siteCls.def_readonly("bytes", &AllocationSite::bytes);
+
+    mod.def("isAllocationTrackingEnabled", &isAllocationTrackingEnabled);
+    mod.def("getThreadAllocations", &getThreadAllocations);
+    mod.def("getTopAllocationSites", &getTopAllocationSites, "nSites"_a = 20);
+    mod.def("resetAllocationSites", &resetAllocationSites);
+}
+
+void declareMemoryEstimate(py::module &mod) {
+    py::class_<MemoryEstimate, std::shared_ptr<MemoryEstimate>> cls(mod, "MemoryEstimate");
+
+    cls.def(py::init<>());
+
+    utils::python::addOutputOp(cls, "__str__");
+
+    cls.def_readwrite("stars", &MemoryEstimate::stars);
+    cls.def_readwrite("triplets", &MemoryEstimate::triplets);
+    cls.def_readwrite("jacobian", &MemoryEstimate::jacobian);
+    cls.def_readwrite("hessian", &MemoryEstimate::hessian);
+    cls.def_readwrite("factor", &MemoryEstimate::factor);
+    cls.def_readwrite("peak", &MemoryEstimate::peak);
+
+    mod.def("estimateFitMemory", &estimateFitMemory, "nMeasurements"_a, "nFittedStars"_a, "nRefStars"_a,
+            "nCcdImages"_a, "nModelParameters"_a, "nModelParametersPerMeasurement"_a,
+            "nParametersPerStar"_a, "nResidualsPerMeasurement"_a);
+}
+
+PYBIND11_PLUGIN(profiling) {
+    py::module mod("profiling");
+
+    // AllocationCount first: it is the default value of an argument of Profile.addTiming.
+    declareAllocationTracking(mod);
+    declarePhaseTiming(mod);
+    declareProfile(mod);
+    declareMemoryEstimate(mod);
+
+    return mod.ptr();
+}
+}  // namespace
+}  // namespace jointcal
+}  // namespace lsst
@@ -78,6 +78,13 @@ void declareRefStar(py::module &mod) {
 
     cls.def(py::init<double, double, double, double, std::vector<double> &, std::vector<double> &>(), "xx"_a,
             "yy"_a, "defaultFlux"_a, "defaultFluxErr"_a, "refFluxList"_a, "refFluxErrList"_a);
+    cls.def("setProperMotion", &RefStar::setProperMotion, "pmRa"_a, "pmDec"_a, "pmRaErr"_a, "pmDecErr"_a);
+    cls.def("hasProperMotion", &RefStar::hasProperMotion);
+    cls.def("getParallax", &RefStar::getParallax);
+    cls.def("setParallax", &RefStar::setParallax, "parallax"_a);
+    cls.def("getEpoch", &RefStar::getEpoch);
+    cls.def("setEpoch", &RefStar::setEpoch, "epoch"_a);
+    cls.def("propagateToEpoch", &RefStar::propagateToEpoch, "mjd"_a);
 }
 
 void declareFittedStar(py::module &mod) {
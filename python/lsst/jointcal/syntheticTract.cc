@@ -0,0 +1,108 @@
+/*
+ * LSST Data Management System
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ * See the COPYRIGHT file
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <https://www.lsstcorp.org/LegalNotices/>.
+ */
+
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include "lsst/jointcal/Associations.h"
+#include "lsst/jointcal/SyntheticTract.h"
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace lsst {
+namespace jointcal {
+namespace {
+
+void declareSyntheticTractControl(py::module &mod) {
+    py::class_<SyntheticTractControl, std::shared_ptr<SyntheticTractControl>> cls(mod,
+                                                                                  "SyntheticTractControl");
+    cls.def(py::init<>());
+
+    cls.def_readwrite("nVisits", &SyntheticTractControl::nVisits);
+    cls.def_readwrite("raCenter", &SyntheticTractControl::raCenter);
+    cls.def_readwrite("decCenter", &SyntheticTractControl::decCenter);
+    cls.def_readwrite("ditherRadius", &SyntheticTractControl::ditherRadius);
+    cls.def_readwrite("plateScale", &SyntheticTractControl::plateScale);
+    cls.def_readwrite("distortion", &SyntheticTractControl::distortion);
+    cls.def_readwrite("starDensity", &SyntheticTractControl::starDensity);
+    cls.def_readwrite("magMin", &SyntheticTractControl::magMin);
+    cls.def_readwrite("magMax", &SyntheticTractControl::magMax);
+    cls.def_readwrite("positionNoise", &SyntheticTractControl::positionNoise);
+    cls.def_readwrite("fluxNoise", &SyntheticTractControl::fluxNoise);
+    cls.def_readwrite("outlierFraction", &SyntheticTractControl::outlierFraction);
+    cls.def_readwrite("outlierOffset", &SyntheticTractControl::outlierOffset);
+    cls.def_readwrite("refFraction", &SyntheticTractControl::refFraction);
+    cls.def_readwrite("refPositionNoise", &SyntheticTractControl::refPositionNoise);
+    cls.def_readwrite("wcsError", &SyntheticTractControl::wcsError);
+    cls.def_readwrite("visitZeroPointSpread", &SyntheticTractControl::visitZeroPointSpread);
+    cls.def_readwrite("colorSpread", &SyntheticTractControl::colorSpread);
+    cls.def_readwrite("colorSlope", &SyntheticTractControl::colorSlope);
+    cls.def_readwrite("refractionCoefficient", &SyntheticTractControl::refractionCoefficient);
+    cls.def_readwrite("focalPlaneResponse", &SyntheticTractControl::focalPlaneResponse);
+    cls.def_readwrite("filter", &SyntheticTractControl::filter);
+    cls.def_readwrite("firstVisit", &SyntheticTractControl::firstVisit);
+    cls.def_readwrite("seed", &SyntheticTractControl::seed);
+}
+
+void declareSyntheticTract(py::module &mod) {
+    py::class_<SyntheticTract, std::shared_ptr<SyntheticTract>> cls(mod, "SyntheticTract");
+
+    cls.def(py::init<SyntheticTractControl const &,
+                     std::vector<std::shared_ptr<afw::cameraGeom::Detector>> const &>(),
+            "control"_a, "detectors"_a);
+
+    cls.def("addCcdImages", &SyntheticTract::addCcdImages, "associations"_a, "control"_a,
+            "detectorIndices"_a = std::vector<std::size_t>());
+    cls.def("makeAssociations", &SyntheticTract::makeAssociations, "control"_a);
+    cls.def("makeSourceCatalog", &SyntheticTract::makeSourceCatalog, "visit"_a, "detectorIndex"_a);
+    cls.def("makeRefCatalog", &SyntheticTract::makeRefCatalog);
+    cls.def("getRefFluxField", &SyntheticTract::getRefFluxField);
+    cls.def("getNStars", &SyntheticTract::getNStars);
+    cls.def("getNVisits", &SyntheticTract::getNVisits);
+    cls.def("getNDetectors", &SyntheticTract::getNDetectors);
+    cls.def("getBoresight", &SyntheticTract::getBoresight, "visit"_a);
+    cls.def("getStarPosition", &SyntheticTract::getStarPosition, "star"_a);
+    cls.def("getStarMag", &SyntheticTract::getStarMag, "star"_a);
+    cls.def("getStarColor", &SyntheticTract::getStarColor, "star"_a);
+    cls.def("getVisitZeroPoint", &SyntheticTract::getVisitZeroPoint, "visit"_a);
+    cls.def("getFocalPlaneResponse", &SyntheticTract::getFocalPlaneResponse, "xFocal"_a, "yFocal"_a);
+    cls.def("getCalibrationMean", &SyntheticTract::getCalibrationMean);
+    cls.def("getControl", &SyntheticTract::getControl, py::return_value_policy::reference_internal);
+}
+
+PYBIND11_PLUGIN(syntheticTract) {
+    py::module::import("lsst.afw.cameraGeom");
+    py::module::import("lsst.afw.table");
+    py::module::import("lsst.jointcal.associations");
+    py::module::import("lsst.jointcal.jointcalControl");
+    py::module::import("lsst.jointcal.star");
+    py::module mod("syntheticTract");
+
+    declareSyntheticTractControl(mod);
+    declareSyntheticTract(mod);
+
+    return mod.ptr();
+}
+}  // namespace
+}  // namespace jointcal
+}  // namespace lsst
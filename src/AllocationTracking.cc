@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef JOINTCAL_ALLOC_TRACKING
+#include <cxxabi.h>
+#include <execinfo.h>
+#endif
+
+#include "lsst/jointcal/AllocationTracking.h"
+
+namespace lsst {
+namespace jointcal {
+
+std::ostream &operator<<(std::ostream &s, AllocationSite const &site) {
+    s << site.count << " allocations, " << site.bytes << " bytes:";
+    for (std::size_t i = 0; i < site.frames.size(); ++i) {
+        s << (i == 0 ? " " : " <- ") << site.frames[i];
+    }
+    return s;
+}
+
+void printAllocationReport(std::ostream &s, std::size_t nSites) {
+    if (!isAllocationTrackingEnabled()) {
+        s << "Allocation tracking is disabled: build jointcal with JOINTCAL_ALLOC_TRACKING." << std::endl;
+        return;
+    }
+    for (auto const &site : getTopAllocationSites(nSites)) {
+        s << site << std::endl;
+    }
+}
+
+#ifndef JOINTCAL_ALLOC_TRACKING
+
+bool isAllocationTrackingEnabled() { return false; }
+
+AllocationCount getThreadAllocations() { return AllocationCount(); }
+
+AllocationTrackingScope::AllocationTrackingScope() {}
+
+AllocationTrackingScope::~AllocationTrackingScope() {}
+
+std::vector<AllocationSite> getTopAllocationSites(std::size_t) { return std::vector<AllocationSite>(); }
+
+void resetAllocationSites() {}
+
+#else
+
+namespace {
+
+// Allocations of the current thread. Trivially constructible, so that operator new can use it at any time.
+thread_local std::uint64_t threadCount = 0;
+thread_local std::uint64_t threadBytes = 0;
+// Number of AllocationTrackingScopes open in the current thread: nothing is tracked while it is 0.
+thread_local unsigned trackingDepth = 0;
+// Set while recording a site, so that allocations made by backtrace() itself are not recorded.
+thread_local bool recordingSite = false;
+
+/*
+ * Fixed-size, lock-free hash table of the allocation sites: operator new cannot allocate to record them.
+ * A slot is claimed by setting its key with a compare-and-swap; allocations whose site does not fit in
+ * the table are only counted in the overflow slot.
+ */
+constexpr std::size_t N_SLOTS = 1 << 14;
+constexpr std::size_t MAX_PROBES = 64;
+
+struct Slot {
+    std::atomic<std::uintptr_t> key;
+    void *frames[ALLOCATION_SITE_DEPTH];
+    std::atomic<std::uint64_t> count;
+    std::atomic<std::uint64_t> bytes;
+};
+
+Slot slots[N_SLOTS];
+Slot overflow;
+
+__attribute__((noinline)) void recordSite(std::size_t size) {
+    // frame 0 is recordSite, frame 1 operator new: keep their callers.
+    void *buffer[ALLOCATION_SITE_DEPTH + 2] = {};
+    int depth = backtrace(buffer, ALLOCATION_SITE_DEPTH + 2);
+    void **frames = buffer + 2;
+    std::size_t nFrames = (depth > 2) ? std::size_t(depth - 2) : 0;
+
+    std::uintptr_t key = 1469598103934665603ULL;  // FNV-1a over the frame addresses
+    for (std::size_t i = 0; i < nFrames; ++i) {
+        key = (key ^ reinterpret_cast<std::uintptr_t>(frames[i])) * 1099511628211ULL;
+    }
+    if (key == 0) key = 1;  // 0 marks an empty slot
+
+    for (std::size_t probe = 0; probe < MAX_PROBES; ++probe) {
+        Slot &slot = slots[(key + probe) % N_SLOTS];
+        std::uintptr_t current = slot.key.load(std::memory_order_acquire);
+        if (current == 0) {
+            if (slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                std::copy(frames, frames + nFrames, slot.frames);
+                current = key;
+            }
+        }
+        if (current == key) {
+            slot.count.fetch_add(1, std::memory_order_relaxed);
+            slot.bytes.fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+    }
+    overflow.count.fetch_add(1, std::memory_order_relaxed);
+    overflow.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+/// "function+offset" for a code address (or "object+offset" without symbol), from backtrace_symbols.
+std::string describeFrame(void *address) {
+    if (address == nullptr) return "?";
+    char **symbols = backtrace_symbols(&address, 1);
+    if (symbols == nullptr) return "?";
+    std::string description(symbols[0]);
+    std::free(symbols);
+    // The format is "object(symbol+offset) [address]", where symbol may be empty.
+    auto open = description.find('(');
+    auto plus = description.find('+', open);
+    auto close = description.find(')', plus);
+    if (open == std::string::npos || plus == std::string::npos || close == std::string::npos) {
+        return description;
+    }
+    std::string offset = description.substr(plus, close - plus);
+    if (plus == open + 1) return description.substr(0, open) + offset;
+    std::string symbol = description.substr(open + 1, plus - open - 1);
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(symbol.c_str(), nullptr, nullptr, &status);
+    if (status == 0 && demangled != nullptr) {
+        symbol = demangled;
+    }
+    std::free(demangled);
+    return symbol + offset;
+}
+
+}  // namespace
+
+bool isAllocationTrackingEnabled() { return true; }
+
+AllocationCount getThreadAllocations() { return AllocationCount(threadCount, threadBytes); }
+
+AllocationTrackingScope::AllocationTrackingScope() { ++trackingDepth; }
+
+AllocationTrackingScope::~AllocationTrackingScope() { --trackingDepth; }
+
+std::vector<AllocationSite> getTopAllocationSites(std::size_t nSites) {
+    std::vector<Slot const *> used;
+    for (auto const &slot : slots) {
+        if (slot.key.load(std::memory_order_acquire) != 0 && slot.count.load() != 0) used.push_back(&slot);
+    }
+    std::sort(used.begin(), used.end(),
+              [](Slot const *a, Slot const *b) { return a->count.load() > b->count.load(); });
+    if (used.size() > nSites) used.resize(nSites);
+
+    std::vector<AllocationSite> sites;
+    for (auto slot : used) {
+        AllocationSite site;
+        for (auto frame : slot->frames) {
+            if (frame != nullptr) site.frames.push_back(describeFrame(frame));
+        }
+        // Drop the standard library internals (allocators, containers) between operator new and the
+        // code that asked for the allocation, but keep the innermost of them to tell what was allocated.
+        auto isInternal = [](std::string const &frame) {
+            return frame.compare(0, 5, "std::") == 0 || frame.compare(0, 11, "__gnu_cxx::") == 0 ||
+                   frame.compare(0, 12, "operator new") == 0;
+        };
+        auto firstCaller = std::find_if_not(site.frames.begin(), site.frames.end(), isInternal);
+        if (firstCaller != site.frames.end() && firstCaller - site.frames.begin() > 1) {
+            site.frames.erase(site.frames.begin() + 1, firstCaller);
+        }
+        site.count = slot->count.load();
+        site.bytes = slot->bytes.load();
+        sites.push_back(std::move(site));
+    }
+    if (overflow.count.load() != 0) {
+        AllocationSite site;
+        site.frames.push_back("(sites that did not fit in the table)");
+        site.count = overflow.count.load();
+        site.bytes = overflow.bytes.load();
+        sites.push_back(std::move(site));
+    }
+    return sites;
+}
+
+void resetAllocationSites() {
+    // Keep the keys, so that concurrent allocations never see a half-reset slot.
+    for (auto &slot : slots) {
+        slot.count.store(0);
+        slot.bytes.store(0);
+    }
+    overflow.count.store(0);
+    overflow.bytes.store(0);
+}
+
+#endif  // JOINTCAL_ALLOC_TRACKING
+
+}  // namespace jointcal
+}  // namespace lsst
+
+#ifdef JOINTCAL_ALLOC_TRACKING
+
+// The replacement global allocation functions. operator new[] and the nothrow variants call this one.
+void *operator new(std::size_t size) {
+    if (lsst::jointcal::trackingDepth != 0 && !lsst::jointcal::recordingSite) {
+        ++lsst::jointcal::threadCount;
+        lsst::jointcal::threadBytes += size;
+        lsst::jointcal::recordingSite = true;
+        lsst::jointcal::recordSite(size);
+        lsst::jointcal::recordingSite = false;
+    }
+    if (void *pointer = std::malloc(size ? size : 1)) return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept { std::free(pointer); }
+
+#endif  // JOINTCAL_ALLOC_TRACKING
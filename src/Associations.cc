@@ -3,6 +3,7 @@
 #include <iostream>
 #include <limits>
 #include <sstream>
+#include <unordered_map>
 
 #include "lsst/log/Log.h"
 #include "lsst/jointcal/Associations.h"
@@ -12,6 +13,8 @@
 #include "lsst/jointcal/Frame.h"
 #include "lsst/jointcal/FatPoint.h"
 #include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/MemoryUsage.h"
+#include "lsst/jointcal/ParameterLayout.h"
 #include "lsst/afw/image/Image.h"
 #include "lsst/afw/image/VisitInfo.h"
 #include "lsst/daf/base/PropertySet.h"
@@ -30,6 +33,9 @@ LOG_LOGGER _log = LOG_GET("jointcal.Associations");
 // TODO: Remove this once RFC-356 is implemented and all refcats give fluxes in Maggies.
 const double JanskyToMaggy = 3631.0;
 
+// reference catalog proper motions are per Julian year, jointcal's per day.
+const double DaysPerYear = 365.25;
+
 namespace lsst {
 namespace jointcal {
 
@@ -40,9 +46,13 @@ void Associations::createCcdImage(afw::table::SourceCatalog &catalog,
                                   std::shared_ptr<afw::image::PhotoCalib> photoCalib,
                                   std::shared_ptr<afw::cameraGeom::Detector> detector, int visit, int ccd,
                                   lsst::jointcal::JointcalControl const &control) {
+    ScopedPhase phase(_profile, "createCcdImage");
     auto ccdImage = std::make_shared<CcdImage>(catalog, wcs, visitInfo, bbox, filter, photoCalib, detector,
                                                visit, ccd, control.sourceFluxField);
     ccdImageList.push_back(ccdImage);
+    _profile.addCounter("nCcdImages", 1);
+    _profile.addCounter("nInputSources", ccdImage->getWholeCatalog().size());
+    recordMemory();
     LOGLS_DEBUG(_log, "Catalog " << ccdImage->getName() << " has " << ccdImage->getWholeCatalog().size()
                                  << " objects.");
 }
@@ -65,7 +75,9 @@ void Associations::setCommonTangentPoint(lsst::afw::geom::Point2D const &commonT
 
 void Associations::associateCatalogs(const double matchCutInArcSec, const bool useFittedList,
                                      const bool enlargeFittedList) {
+    ScopedPhase phase(_profile, "associateCatalogs");
     // clear reference stars
+    clearFittedStarPriors();
     refStarList.clear();
 
     // clear measurement counts and associations to refstars, but keep fittedStars themselves.
@@ -74,13 +86,20 @@ void Associations::associateCatalogs(const double matchCutInArcSec, const bool u
     }
     // clear fitted stars
     if (!useFittedList) fittedStarList.clear();
+    // Clear all catalogs to fit before refilling any, so that the arena can start afresh.
+    for (auto &ccdImage : ccdImageList) {
+        ccdImage->getCatalogForFit().clear();
+    }
+    if (_starArena && _starArena->release()) {
+        LOGLS_DEBUG(_log, "Released the star arena before associating.");
+    }
 
     for (auto &ccdImage : ccdImageList) {
         const Gtransfo *toCommonTangentPlane = ccdImage->getPix2CommonTangentPlane();
 
-        // Clear the catalog to fit and copy the whole catalog into it.
+        // Copy the whole catalog into the catalog to fit.
         // This allows reassociating from scratch after a fit.
-        ccdImage->resetCatalogForFit();
+        ccdImage->resetCatalogForFit(_starArena);
         MeasuredStarList &catalog = ccdImage->getCatalogForFit();
 
         // Associate with previous lists.
@@ -128,7 +147,7 @@ void Associations::associateCatalogs(const double matchCutInArcSec, const bool u
             // to check if it was matched, just check if it has a fittedStar Pointer assigned
             if (mstar->getFittedStar()) continue;
             if (enlargeFittedList) {
-                auto fs = std::make_shared<FittedStar>(*mstar);
+                auto fs = makeArenaShared<FittedStar>(_starArena, *mstar);
                 // transform coordinates to CommonTangentPlane
                 toCommonTangentPlane->transformPosAndErrors(*fs, *fs);
                 fittedStarList.push_back(fs);
@@ -140,6 +159,27 @@ void Associations::associateCatalogs(const double matchCutInArcSec, const bool u
     }  // end of loop on CcdImages
 
     assignMags();
+    _profile.setCounter("nAssociatedFittedStars", fittedStarList.size());
+    recordMemory();
+}
+
+namespace {
+/// The key of an optional field of the reference catalog: invalid if the catalog does not have it.
+template <typename T>
+afw::table::Key<T> findOptionalKey(afw::table::Schema const &schema, std::string const &name) {
+    try {
+        return schema.find<T>(name).key;
+    } catch (pex::exceptions::NotFoundError &) {
+        return afw::table::Key<T>();
+    }
+}
+}  // namespace
+
+double Associations::getEpoch() const {
+    if (ccdImageList.empty()) return 0;
+    double sum = 0;
+    for (auto const &ccdImage : ccdImageList) sum += ccdImage->getMjd();
+    return sum / ccdImageList.size();
 }
 
 void Associations::collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom::Angle matchCut,
@@ -147,6 +187,7 @@ void Associations::collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom:
                                    std::map<std::string, std::vector<double>> const &refFluxMap,
                                    std::map<std::string, std::vector<double>> const &refFluxErrMap,
                                    bool rejectBadFluxes) {
+    ScopedPhase phase(_profile, "collectRefStars");
     if (refCat.size() == 0) {
         throw(LSST_EXCEPT(pex::exceptions::InvalidParameterError,
                           " reference catalog is empty : stop here "));
@@ -163,6 +204,21 @@ void Associations::collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom:
                                  << fluxField << "Sigma"
                                  << ") not found in reference catalog. Not using ref flux errors.");
     }
+    auto const &schema = refCat.getSchema();
+    auto pmRaKey = findOptionalKey<afw::geom::Angle>(schema, "pm_ra");
+    auto pmDecKey = findOptionalKey<afw::geom::Angle>(schema, "pm_dec");
+    auto pmRaErrKey = findOptionalKey<afw::geom::Angle>(schema, "pm_raErr");
+    auto pmDecErrKey = findOptionalKey<afw::geom::Angle>(schema, "pm_decErr");
+    auto parallaxKey = findOptionalKey<afw::geom::Angle>(schema, "parallax");
+    auto epochKey = findOptionalKey<double>(schema, "epoch");
+    bool const hasProperMotions = pmRaKey.isValid() && pmDecKey.isValid() && epochKey.isValid();
+    double const epoch = getEpoch();
+    if (hasProperMotions) {
+        LOGLS_INFO(_log, "Moving the reference stars to the mean epoch of the data, MJD " << epoch);
+    } else if (pmRaKey.isValid()) {
+        LOGLS_WARN(_log, "Reference catalog has proper motions but no epoch: not using them.");
+    }
+
     _filterMap.clear();
     _filterMap.reserve(refFluxMap.size());
     size_t nFilters = 0;
@@ -171,6 +227,7 @@ void Associations::collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom:
         nFilters++;
     }
 
+    clearFittedStarPriors();
     refStarList.clear();
     for (size_t i = 0; i < refCat.size(); i++) {
         auto const &record = refCat.get(i);
@@ -191,7 +248,8 @@ void Associations::collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom:
         }
         double ra = lsst::afw::geom::radToDeg(coord.getLongitude());
         double dec = lsst::afw::geom::radToDeg(coord.getLatitude());
-        auto star = std::make_shared<RefStar>(ra, dec, defaultFlux, defaultFluxErr, fluxList, fluxErrList);
+        auto star = makeArenaShared<RefStar>(_starArena, ra, dec, defaultFlux, defaultFluxErr, fluxList,
+                                             fluxErrList);
 
         // TODO DM-10826: RefCats aren't guaranteed to have position errors.
         // TODO: Need to devise a way to check whether the refCat has position errors
@@ -201,6 +259,23 @@ void Associations::collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom:
         star->vy = std::pow(0.1 / 3600, 2);
         star->vxy = 0.;
 
+        if (hasProperMotions) {
+            double pmRa = record->get(pmRaKey).asDegrees() / DaysPerYear;
+            double pmDec = record->get(pmDecKey).asDegrees() / DaysPerYear;
+            // unknown errors do not constrain the fitted proper motions.
+            double pmRaErr = 0, pmDecErr = 0;
+            if (pmRaErrKey.isValid()) pmRaErr = record->get(pmRaErrKey).asDegrees() / DaysPerYear;
+            if (pmDecErrKey.isValid()) pmDecErr = record->get(pmDecErrKey).asDegrees() / DaysPerYear;
+            if (std::isfinite(pmRa) && std::isfinite(pmDec)) {
+                star->setProperMotion(pmRa, pmDec, pmRaErr, pmDecErr);
+                star->setEpoch(record->get(epochKey));
+                star->propagateToEpoch(epoch);
+            }
+        }
+        if (parallaxKey.isValid() && std::isfinite(record->get(parallaxKey).asDegrees())) {
+            star->setParallax(record->get(parallaxKey).asDegrees());
+        }
+
         // Reject sources with non-finite fluxes and flux errors, and fluxErr=0 (which gives chi2=inf).
         if (rejectBadFluxes &&
             (!std::isfinite(defaultFlux) || !std::isfinite(defaultFluxErr) || defaultFluxErr == 0))
@@ -208,11 +283,19 @@ void Associations::collectRefStars(afw::table::SimpleCatalog &refCat, afw::geom:
         refStarList.push_back(star);
     }
 
+    // the proper motions of the fitted stars come from their new reference stars, if any.
+    for (auto &fittedStar : fittedStarList) {
+        fittedStar->mightMove = false;
+        fittedStar->pmx = fittedStar->pmy = 0;
+    }
+
     // project on CTP (i.e. RaDec2CTP), in degrees
     GtransfoLin identity;
     TanRaDec2Pix raDec2CTP(identity, _commonTangentPoint);
 
     associateRefStars(matchCut.asArcseconds(), &raDec2CTP);
+    _profile.setCounter("nRefStars", refStarList.size());
+    recordMemory();
 }
 
 const lsst::afw::geom::Box2D Associations::getRaDecBBox() {
@@ -259,15 +342,211 @@ void Associations::associateRefStars(double matchCutInArcSec, const Gtransfo *gt
         FittedStar &fs = const_cast<FittedStar &>(fs_const);
         // rs->setFittedStar(*fs);
         fs.setRefStar(&rs);
+        // the proper motions without errors only move the reference star: they cannot constrain a fit.
+        if (rs.hasProperMotion() && rs.getPmRaErr() > 0 && rs.getPmDecErr() > 0) {
+            fs.mightMove = true;
+            fs.pmx = rs.getPmRa();
+            fs.pmy = rs.getPmDec();
+        }
     }
 
     LOGLS_INFO(_log,
                "Associated " << starMatchList->size() << " reference stars among " << refStarList.size());
 }
 
+namespace {
+/// Replace (value, variance) by the inverse-variance weighted mean of it and (otherValue, otherVariance).
+void combineEstimates(double &value, double &variance, double otherValue, double otherVariance) {
+    if (!std::isfinite(otherValue) || !(otherVariance > 0) || !std::isfinite(otherVariance)) return;
+    double weight = 1. / variance;
+    double otherWeight = 1. / otherVariance;
+    value = (value * weight + otherValue * otherWeight) / (weight + otherWeight);
+    variance = 1. / (weight + otherWeight);
+}
+}  // namespace
+
+afw::table::SimpleCatalog Associations::makeFittedStarCatalog() const {
+    auto schema = afw::table::SimpleTable::makeMinimalSchema();
+    auto fluxKey = schema.addField<double>("flux", "fitted flux");
+    auto fluxErrKey = schema.addField<double>("fluxErr", "fitted flux error");
+    auto nMeasurementsKey = schema.addField<int>("nMeasurements", "number of measurements of the star");
+    std::vector<afw::table::Key<double>> bandFluxKeys(_filterMap.size());
+    for (auto const &filter : _filterMap) {
+        bandFluxKeys[filter.second] =
+                schema.addField<double>(filter.first + "_flux", "fitted flux in " + filter.first);
+    }
+    afw::table::SimpleCatalog catalog(schema);
+    catalog.reserve(fittedStarList.size());
+
+    TanPix2RaDec ctp2Sky(GtransfoLin(), getCommonTangentPoint());
+    std::size_t index = 0;
+    for (auto const &fittedStar : fittedStarList) {
+        Point position(fittedStar->x, fittedStar->y);
+        if (fittedStarList.inTangentPlaneCoordinates) position = ctp2Sky.apply(position);
+        auto record = catalog.addNew();
+        record->setId(index++);
+        record->setCoord(afw::geom::SpherePoint(position.x, position.y, afw::geom::degrees));
+        record->set(fluxKey, fittedStar->getFlux());
+        record->set(fluxErrKey, fittedStar->getFluxErr());
+        record->set(nMeasurementsKey, fittedStar->getMeasurementCount());
+        auto const &bandFluxes = fittedStar->getBandFluxes();
+        for (std::size_t band = 0; band < bandFluxKeys.size(); ++band) {
+            double bandFlux = std::numeric_limits<double>::quiet_NaN();
+            if (band < bandFluxes.size() && (fittedStar->getBandMask() & (std::uint32_t(1) << band)) != 0) {
+                bandFlux = bandFluxes[band];
+            }
+            record->set(bandFluxKeys[band], bandFlux);
+        }
+    }
+    return catalog;
+}
+
+void Associations::setFittedStarPriors(std::vector<std::size_t> const &indices, std::vector<double> const &ra,
+                                       std::vector<double> const &dec, std::vector<double> const &positionErr,
+                                       std::vector<double> const &flux, std::vector<double> const &fluxErr) {
+    std::size_t const nPriors = indices.size();
+    bool const hasPositions = !ra.empty();
+    bool const hasFluxes = !flux.empty();
+    if ((hasPositions && (ra.size() != nPriors || dec.size() != nPriors || positionErr.size() != nPriors)) ||
+        (hasFluxes && (flux.size() != nPriors || fluxErr.size() != nPriors))) {
+        throw LSST_EXCEPT(pex::exceptions::LengthError,
+                          "setFittedStarPriors: each non-empty list must have one entry per index.");
+    }
+    if (hasPositions && fittedStarList.inTangentPlaneCoordinates) {
+        throw LSST_EXCEPT(pex::exceptions::LogicError,
+                          "setFittedStarPriors: position priors need deprojected fitted stars.");
+    }
+    clearFittedStarPriors();
+
+    std::vector<FittedStar *> stars;
+    stars.reserve(fittedStarList.size());
+    for (auto const &fittedStar : fittedStarList) stars.push_back(fittedStar.get());
+
+    for (std::size_t i = 0; i < nPriors; ++i) {
+        if (indices[i] >= stars.size()) {
+            throw LSST_EXCEPT(pex::exceptions::OutOfRangeError,
+                              "setFittedStarPriors: no fitted star with index " + std::to_string(indices[i]));
+        }
+        FittedStar &fittedStar = *stars[indices[i]];
+        if (_priorBaseRefStars.count(&fittedStar) != 0) {
+            throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                              "setFittedStarPriors: duplicate index " + std::to_string(indices[i]));
+        }
+        RefStar const *base = fittedStar.getRefStar();
+
+        // Without a prior or a RefStar, a quantity keeps the fitted star's own value and error.
+        double x = fittedStar.x, y = fittedStar.y, vx = fittedStar.vx, vy = fittedStar.vy;
+        if (hasPositions) {
+            x = ra[i];
+            y = dec[i];
+            vy = std::pow(positionErr[i], 2);
+            vx = vy / std::pow(std::cos(dec[i] * M_PI / 180.), 2);
+            if (base != nullptr) {
+                // bring the target within 180 degrees of the RefStar, to average across ra=0.
+                x = base->x + std::remainder(x - base->x, 360.);
+                combineEstimates(x, vx, base->x, base->vx);
+                combineEstimates(y, vy, base->y, base->vy);
+            }
+        } else if (base != nullptr) {
+            x = base->x, y = base->y, vx = base->vx, vy = base->vy;
+        }
+        double priorFlux = fittedStar.getFlux();
+        double priorFluxVariance = std::pow(fittedStar.getFluxErr(), 2);
+        if (hasFluxes) {
+            priorFlux = flux[i];
+            priorFluxVariance = std::pow(fluxErr[i], 2);
+            if (base != nullptr) {
+                combineEstimates(priorFlux, priorFluxVariance, base->getFlux(),
+                                 std::pow(base->getFluxErr(), 2));
+            }
+        } else if (base != nullptr) {
+            priorFlux = base->getFlux();
+            priorFluxVariance = std::pow(base->getFluxErr(), 2);
+        }
+
+        // the fluxes per filter of the RefStar, for the multi-band photometric fit.
+        std::vector<double> refFluxes, refFluxErrs;
+        if (base != nullptr) {
+            for (std::size_t filter = 0; filter < base->getNFilters(); ++filter) {
+                refFluxes.push_back(base->getFlux(filter));
+                refFluxErrs.push_back(base->getFluxErr(filter));
+            }
+        }
+        auto prior = makeArenaShared<RefStar>(_starArena, x, y, priorFlux, std::sqrt(priorFluxVariance),
+                                              refFluxes, refFluxErrs);
+        prior->vx = vx;
+        prior->vy = vy;
+        prior->vxy = 0.;
+        // the fit moves the star with the proper motion and parallax of its RefStar: keep them.
+        if (base != nullptr) {
+            if (base->hasProperMotion()) {
+                prior->setProperMotion(base->getPmRa(), base->getPmDec(), base->getPmRaErr(),
+                                       base->getPmDecErr());
+            }
+            prior->setParallax(base->getParallax());
+            prior->setEpoch(base->getEpoch());
+        }
+        _priorStarList.push_back(prior);
+        fittedStar.setRefStar(nullptr);
+        fittedStar.setRefStar(prior.get());
+        _priorBaseRefStars[&fittedStar] = PriorRefStars{base, prior.get()};
+    }
+    LOGLS_DEBUG(_log, "Set priors on " << nPriors << " fitted stars.");
+}
+
+void Associations::clearFittedStarPriors() {
+    for (auto const &item : _priorBaseRefStars) {
+        FittedStar &fittedStar = *item.first;
+        // A prior rejected as an outlier stays rejected.
+        if (fittedStar.getRefStar() != item.second.prior) continue;
+        fittedStar.setRefStar(nullptr);
+        fittedStar.setRefStar(item.second.base);
+    }
+    _priorBaseRefStars.clear();
+    _priorStarList.clear();
+}
+
+void Associations::recordMemory() {
+    std::size_t wholeCatalogs = 0;
+    std::size_t catalogsForFit = 0;
+    for (auto const &ccdImage : ccdImageList) {
+        wholeCatalogs += computeMemoryUsage(ccdImage->getWholeCatalog());
+        catalogsForFit += computeMemoryUsage(ccdImage->getCatalogForFit());
+    }
+    _profile.updateMemory("wholeCatalogs", wholeCatalogs);
+    _profile.updateMemory("catalogsForFit", catalogsForFit);
+    _profile.updateMemory("fittedStarList", computeMemoryUsage(fittedStarList));
+    _profile.updateMemory("refStarList", computeMemoryUsage(refStarList));
+    if (_starArena) {
+        _profile.updateMemory("starArena", _starArena->getCapacity());
+        _profile.setCounter("starArenaReleases", _starArena->getNReleases());
+    }
+    double const MB = 1024. * 1024.;
+    LOGLS_DEBUG(_log, "Memory held by whole catalogs: " << wholeCatalogs / MB << " MB, catalogs for fit: "
+                                                        << catalogsForFit / MB << " MB, fittedStarList: "
+                                                        << computeMemoryUsage(fittedStarList) / MB
+                                                        << " MB, refStarList: "
+                                                        << computeMemoryUsage(refStarList) / MB << " MB");
+}
+
+void Associations::setUseStarArena(bool useStarArena) {
+    if (!useStarArena) {
+        _starArena.reset();
+    } else if (!_starArena) {
+        _starArena = std::make_shared<StarArena>();
+    }
+}
+
 void Associations::prepareFittedStars(int minMeasurements) {
+    ScopedPhase phase(_profile, "prepareFittedStars");
     selectFittedStars(minMeasurements);
     normalizeFittedStars();
+    // The fitters number parameters in list order: give the layout spatial locality and make it
+    // independent of the order in which catalogs were loaded and associated.
+    sortCcdImagesByKey(ccdImageList);
+    sortFittedStarsSpatially(fittedStarList);
+    _profile.setCounter("nFittedStars", fittedStarList.size());
+    recordMemory();
 }
 
 void Associations::selectFittedStars(int minMeasurements) {
@@ -368,6 +647,57 @@ void Associations::deprojectFittedStars() {
     fittedStarList.inTangentPlaneCoordinates = false;
 }
 
+std::size_t Associations::getFilterIndex(std::string const &filter) const {
+    auto found = _filterMap.find(filter);
+    if (found == _filterMap.end()) {
+        throw LSST_EXCEPT(pex::exceptions::NotFoundError,
+                          "No reference flux for filter " + filter + " (call collectRefStars first?)");
+    }
+    return found->second;
+}
+
+std::size_t Associations::computeFittedStarColors(std::string const &blueFilter,
+                                                  std::string const &redFilter) {
+    // sums of the blue and red measured fluxes, and their counts, per fitted star.
+    struct ColorSums {
+        double flux[2] = {0, 0};
+        unsigned count[2] = {0, 0};
+    };
+    std::unordered_map<FittedStar const *, ColorSums> sums;
+    for (auto const &ccdImage : ccdImageList) {
+        int which = (ccdImage->getFilter() == blueFilter) ? 0 : (ccdImage->getFilter() == redFilter) ? 1 : -1;
+        if (which < 0) continue;
+        for (auto const &measuredStar : ccdImage->getCatalogForFit()) {
+            if (!measuredStar->isValid() || !(measuredStar->getFlux() > 0)) continue;
+            auto &sum = sums[measuredStar->getFittedStar().get()];
+            sum.flux[which] += measuredStar->getFlux();
+            sum.count[which]++;
+        }
+    }
+
+    std::size_t nColored = 0;
+    double meanColor = 0;
+    for (auto &fittedStar : fittedStarList) {
+        auto sum = sums.find(fittedStar.get());
+        if (sum == sums.end() || sum->second.count[0] == 0 || sum->second.count[1] == 0) {
+            fittedStar->color = std::numeric_limits<double>::quiet_NaN();
+            continue;
+        }
+        double blueFlux = sum->second.flux[0] / sum->second.count[0];
+        double redFlux = sum->second.flux[1] / sum->second.count[1];
+        fittedStar->color = -2.5 * std::log10(blueFlux / redFlux);
+        meanColor += fittedStar->color;
+        nColored++;
+    }
+    if (nColored > 0) meanColor /= nColored;
+    for (auto &fittedStar : fittedStarList) {
+        if (std::isnan(fittedStar->color)) fittedStar->color = meanColor;
+    }
+    LOGLS_INFO(_log, "Computed " << blueFilter << "-" << redFilter << " colors of " << nColored << "/"
+                                 << fittedStarList.size() << " fittedStars; mean color: " << meanColor);
+    return nColored;
+}
+
 int Associations::nCcdImagesValidForFit() const {
     return std::count_if(ccdImageList.begin(), ccdImageList.end(), [](std::shared_ptr<CcdImage> const &item) {
         return item->getCatalogForFit().size() > 0;
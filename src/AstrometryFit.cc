@@ -22,17 +22,30 @@ namespace jointcal {
 AstrometryFit::AstrometryFit(std::shared_ptr<Associations> associations,
                              std::shared_ptr<AstrometryModel> astrometryModel, double posError)
         : FitterBase(associations),
+          _fittingDistortions(false),
+          _fittingPos(false),
+          _fittingRefrac(false),
+          _fittingPM(false),
           _astrometryModel(astrometryModel),
-          _refractionCoefficient(0),
           _nParDistortions(0),
           _nParPositions(0),
-          _nParRefrac(_associations->getNFilters()),
-          _posError(posError) {
+          _nParRefrac(0),
+          _posError(posError),
+          _useCompactMeasurements(false) {
     _log = LOG_GET("jointcal.AstrometryFit");
-    _JDRef = 0;
+    // the fitted positions are at the epoch the reference stars were moved to.
+    _JDRef = _associations->getEpoch();
 
     _posError = posError;
 
+    // one refraction coefficient per filter of the images to fit, whether or not the reference
+    // catalog has fluxes in it.
+    for (auto const &ccdImage : _associations->getCcdImageList()) {
+        _refractionFilters.emplace(ccdImage->getFilter(), 0);
+    }
+    for (auto &filter : _refractionFilters) filter.second = _nParRefrac++;
+    _refractionCoefficients.assign(_nParRefrac, 0.);
+
     _referenceColor = 0;
     _sigCol = 0;
     unsigned count = 0;
@@ -54,13 +67,20 @@ AstrometryFit::AstrometryFit(std::shared_ptr<Associations> associations,
 the derivatives, when computing the Chi2, when filling a tuple.
 */
 Point AstrometryFit::transformFittedStar(FittedStar const &fittedStar, Gtransfo const &sky2TP,
-                                         Point const &refractionVector, double refractionCoeff,
-                                         double mjd) const {
+                                         Point const &refractionVector, double refractionCoeff, double mjd,
+                                         std::array<double, 3> const &sunPosition) const {
     Point fittedStarInTP = sky2TP.apply(fittedStar);
     if (fittedStar.mightMove) {
         fittedStarInTP.x += fittedStar.pmx * mjd;
         fittedStarInTP.y += fittedStar.pmy * mjd;
     }
+    // the parallax of the reference star, if any, is not fitted: it displaces the star at each epoch.
+    RefStar const *refStar = fittedStar.getRefStar();
+    if (refStar != nullptr && refStar->getParallax() != 0) {
+        Point shift = computeParallaxShift(fittedStar.x, fittedStar.y, sunPosition, refStar->getParallax());
+        fittedStarInTP.x += shift.x;
+        fittedStarInTP.y += shift.y;
+    }
     // account for atmospheric refraction: does nothing if color
     // have not been assigned
     // the color definition shouldbe the same when computing derivatives
@@ -70,20 +90,63 @@ Point AstrometryFit::transformFittedStar(FittedStar const &fittedStar, Gtransfo
     return fittedStarInTP;
 }
 
-/*! This is the first implementation of an error "model".  We'll
-  certainly have to upgrade it. MeasuredStar provides the mag in case
-  we need it.  */
-static void tweakAstromMeasurementErrors(FatPoint &P, MeasuredStar const &Ms, double error) {
-    static bool called = false;
-    static double increment = 0;
-    if (!called) {
-        increment = std::pow(error, 2);  // was in Preferences
-        called = true;
-    }
+/*! This is the error "model": a variance added to both coordinates of the measurements, from posError and
+  the term of their CcdImage fitted by FitterBase::fitErrorModel.  */
+static void tweakAstromMeasurementErrors(FatPoint &P, double increment) {
     P.vx += increment;
     P.vy += increment;
 }
 
+template <typename F>
+void AstrometryFit::forEachMeasurement(CcdImage const &ccdImage, MeasuredStarList const *msList,
+                                       bool withStars, F f) const {
+    if (msList == nullptr && !withStars && _useCompactMeasurements) {
+        auto compactCatalog = _compactCatalogs.find(&ccdImage);
+        if (compactCatalog != _compactCatalogs.end()) {
+            std::shared_ptr<MeasuredStar> const noStar;
+            for (auto const &measurement : compactCatalog->second) {
+                f(measurement.getPosition(), *measurement.fittedStar, noStar);
+            }
+            return;
+        }
+    }
+    MeasuredStarList const &catalog = (msList) ? *msList : ccdImage.getCatalogForFit();
+    for (auto const &measuredStar : catalog) {
+        if (!measuredStar->isValid()) continue;
+        if (_useCompactMeasurements) {
+            // outliers and chi2 lists: their terms must be those of the compact records, to cancel in the
+            // downdate.
+            CompactMeasurement const measurement(*measuredStar);
+            f(measurement.getPosition(), *measurement.fittedStar, measuredStar);
+        } else {
+            f(FatPoint(*measuredStar), *measuredStar->getFittedStar(), measuredStar);
+        }
+    }
+}
+
+void AstrometryFit::setUseCompactMeasurements(bool useCompactMeasurements) {
+    _useCompactMeasurements = useCompactMeasurements;
+    if (_useCompactMeasurements) {
+        std::vector<CcdImage const *> ccdImages;
+        for (auto const &ccdImage : _associations->getCcdImageList()) ccdImages.push_back(ccdImage.get());
+        updateMeasurementCache(ccdImages);
+    } else {
+        _compactCatalogs.clear();
+    }
+}
+
+void AstrometryFit::updateMeasurementCache(std::vector<CcdImage const *> const &ccdImages) {
+    if (!_useCompactMeasurements) return;
+    for (auto const ccdImage : ccdImages) {
+        _compactCatalogs[ccdImage] = makeCompactMeasurementList(ccdImage->getCatalogForFit());
+    }
+    std::size_t bytes = 0;
+    for (auto const &compactCatalog : _compactCatalogs) {
+        bytes += compactCatalog.second.capacity() * sizeof(CompactMeasurement);
+    }
+    recordMemory("compactMeasurements", bytes);
+}
+
 // we could consider computing the chi2 here.
 // (although it is not extremely useful)
 void AstrometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage, TripletList &tripletList,
@@ -116,10 +179,14 @@ void AstrometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage,
 
     // proper motion stuff
     double mjd = ccdImage.getMjd() - _JDRef;
+    auto const sunPosition = computeSunPosition(ccdImage.getMjd());
     // refraction stuff
     Point refractionVector = ccdImage.getRefractionVector();
+    unsigned const refractionIndex = getRefractionIndex(ccdImage);
+    double const refractionCoefficient = _refractionCoefficients[refractionIndex];
     // transformation from sky to TP
     auto sky2TP = _astrometryModel->getSky2TP(ccdImage);
+    double const errorIncrement = std::pow(_posError, 2) + getErrorTerm(ccdImage);
     // reserve matrices once for all measurements
     GtransfoLin dypdy;
     // the shape of H (et al) is required this way in order to be able to
@@ -130,14 +197,12 @@ void AstrometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage,
     Eigen::VectorXd grad(npar_tot);
     // current position in the Jacobian
     unsigned kTriplets = tripletList.getNextFreeIndex();
-    const MeasuredStarList &catalog = (msList) ? *msList : ccdImage.getCatalogForFit();
 
-    for (auto &i : catalog) {
-        const MeasuredStar &ms = *i;
-        if (!ms.isValid()) continue;
+    forEachMeasurement(ccdImage, msList, false, [&](FatPoint const &measuredPos, FittedStar const &fs,
+                                                    std::shared_ptr<MeasuredStar> const &) {
         // tweak the measurement errors
-        FatPoint inPos = ms;
-        tweakAstromMeasurementErrors(inPos, ms, _posError);
+        FatPoint inPos = measuredPos;
+        tweakAstromMeasurementErrors(inPos, errorIncrement);
         H.setZero();  // we cannot be sure that all entries will be overwritten.
         FatPoint outPos;
         // should *not* fill H if whatToFit excludes mapping parameters.
@@ -150,8 +215,8 @@ void AstrometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage,
         double det = outPos.vx * outPos.vy - std::pow(outPos.vxy, 2);
         if (det <= 0 || outPos.vx <= 0 || outPos.vy <= 0) {
             LOGLS_WARN(_log, "Inconsistent measurement errors: drop measurement at "
-                                     << Point(ms) << " in image " << ccdImage.getName());
-            continue;
+                                     << Point(inPos) << " in image " << ccdImage.getName());
+            return;
         }
         transW(0, 0) = outPos.vy / det;
         transW(1, 1) = outPos.vx / det;
@@ -166,64 +231,70 @@ void AstrometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage,
         alpha(1, 1) = 1. / sqrt(det * transW(0, 0));
         alpha(0, 1) = 0;
 
-        std::shared_ptr<FittedStar const> const fs = ms.getFittedStar();
-
         Point fittedStarInTP =
-                transformFittedStar(*fs, *sky2TP, refractionVector, _refractionCoefficient, mjd);
+                transformFittedStar(fs, *sky2TP, refractionVector, refractionCoefficient, mjd, sunPosition);
 
         // compute derivative of TP position w.r.t sky position ....
         if (npar_pos > 0)  // ... if actually fitting FittedStar position
         {
-            sky2TP->computeDerivative(*fs, dypdy, 1e-3);
+            sky2TP->computeDerivative(fs, dypdy, 1e-3);
             // sign checked
             // TODO Still have to check with non trivial non-diagonal terms
             H(npar_mapping, 0) = -dypdy.A11();
             H(npar_mapping + 1, 0) = -dypdy.A12();
             H(npar_mapping, 1) = -dypdy.A21();
             H(npar_mapping + 1, 1) = -dypdy.A22();
-            indices[npar_mapping] = fs->getIndexInMatrix();
-            indices.at(npar_mapping + 1) = fs->getIndexInMatrix() + 1;
+            indices[npar_mapping] = fs.getIndexInMatrix();
+            indices.at(npar_mapping + 1) = fs.getIndexInMatrix() + 1;
             ipar += npar_pos;
         }
         /* only consider proper motions of objects allowed to move,
         unless the fit is going to be degenerate */
-        if (_fittingPM && fs->mightMove) {
+        if (fitsProperMotion(fs)) {
             H(ipar, 0) = -mjd;  // Sign unchecked but consistent with above
             H(ipar + 1, 1) = -mjd;
-            indices[ipar] = fs->getIndexInMatrix() + 2;
-            indices[ipar + 1] = fs->getIndexInMatrix() + 3;
+            indices[ipar] = fs.getIndexInMatrix() + 2;
+            indices[ipar + 1] = fs.getIndexInMatrix() + 3;
             ipar += npar_pm;
         }
         if (_fittingRefrac) {
             /* if the definition of color changes, it has to remain
                consistent with transformFittedStar */
-            double color = fs->color - _referenceColor;
+            double color = fs.color - _referenceColor;
             // sign checked
             H(ipar, 0) = -refractionVector.x * color;
             H(ipar, 1) = -refractionVector.y * color;
-            indices[ipar] = _refracPosInMatrix;
+            indices[ipar] = _refracPosInMatrix + refractionIndex;
             ipar += 1;
         }
 
         // We can now compute the residual
         Eigen::Vector2d res(fittedStarInTP.x - outPos.x, fittedStarInTP.y - outPos.y);
+        if (_robustLoss != RobustLoss::Squared) {
+            double weight = robustWeight(res.transpose() * transW * res);
+            alpha *= std::sqrt(weight);
+            transW *= weight;
+        }
 
         // do not write grad = H*transW*res to avoid
         // dynamic allocation of a temporary
         halpha = H * alpha;
         HW = H * transW;
         grad = HW * res;
-        // now feed in triplets and fullGrad
-        for (unsigned ipar = 0; ipar < npar_tot; ++ipar) {
-            for (unsigned ic = 0; ic < 2; ++ic) {
+        // now feed in triplets and fullGrad, for the parameters of this measurement only: the proper
+        // motion slots of a star that cannot move hold no index. The triplets go column by column, as
+        // a compact TripletList requires.
+        unsigned const nparUsed = ipar;
+        for (unsigned ic = 0; ic < 2; ++ic) {
+            for (unsigned ipar = 0; ipar < nparUsed; ++ipar) {
                 double val = halpha(ipar, ic);
                 if (val == 0) continue;
                 tripletList.addTriplet(indices[ipar], kTriplets + ic, val);
             }
-            fullGrad(indices[ipar]) += grad(ipar);
         }
+        for (unsigned ipar = 0; ipar < nparUsed; ++ipar) fullGrad(indices[ipar]) += grad(ipar);
         kTriplets += 2;  // each measurement contributes 2 columns in the Jacobian
-    }                    // end loop on measurements
+    });                  // end loop on measurements
     tripletList.setNextFreeIndex(kTriplets);
 }
 
@@ -240,8 +311,9 @@ void AstrometryFit::leastSquareDerivativesReference(FittedStarList const &fitted
        are fitting positions: */
     if (!_fittingPos) return;
     /* the other case where the accumulation of derivatives stops
-       here is when there are no RefStars */
-    if (_associations->refStarList.size() == 0) return;
+       here is when there are no RefStars, neither from the reference
+       catalog nor from the priors of setFittedStarPriors */
+    if (_associations->refStarList.empty() && _associations->getNFittedStarPriors() == 0) return;
     Eigen::Matrix2d W(2, 2);
     Eigen::Matrix2d alpha(2, 2);
     Eigen::Matrix2d H(2, 2), halpha(2, 2), HW(2, 2);
@@ -271,7 +343,7 @@ void AstrometryFit::leastSquareDerivativesReference(FittedStarList const &fitted
         H(1, 0) = -der.A12();
         H(0, 1) = -der.A21();
         H(1, 1) = -der.A22();
-        // TO DO : account for proper motions.
+        // The RefStar was moved to the epoch of the fitted positions when it was collected.
         double det = rsProj.vx * rsProj.vy - std::pow(rsProj.vxy, 2);
         if (rsProj.vx <= 0 || rsProj.vy <= 0 || det <= 0) {
             LOGLS_WARN(_log, "RefStar error matrix not positive definite for:  " << *rs);
@@ -290,34 +362,81 @@ void AstrometryFit::leastSquareDerivativesReference(FittedStarList const &fitted
         indices[0] = fs.getIndexInMatrix();
         indices[1] = fs.getIndexInMatrix() + 1;
         unsigned npar_tot = 2;
-        /* TODO: account here for proper motions in the reference
-        catalog. We can code the effect and set the value to 0. Most
-        (all?)  catalogs do not even come with a reference epoch. Gaia
-        will change that. When refraction enters into the game, one should
+        /* When refraction enters into the game, one should
         pay attention to the orientation of the frame */
 
         /* The residual should be Proj(fs)-Proj(*rs) in order to be consistent
         with the measurement terms. Since P(fs) = 0, we have: */
         res[0] = -rsProj.x;
         res[1] = -rsProj.y;
+        if (_robustLoss != RobustLoss::Squared) {
+            double weight = robustWeight(res.transpose() * W * res);
+            alpha *= std::sqrt(weight);
+            W *= weight;
+        }
         halpha = H * alpha;
         // grad = H*W*res
         HW = H * W;
         grad = HW * res;
-        // now feed in triplets and fullGrad
-        for (unsigned ipar = 0; ipar < npar_tot; ++ipar) {
-            for (unsigned ic = 0; ic < 2; ++ic) {
+        // now feed in triplets (column by column) and fullGrad
+        for (unsigned ic = 0; ic < 2; ++ic) {
+            for (unsigned ipar = 0; ipar < npar_tot; ++ipar) {
                 double val = halpha(ipar, ic);
                 if (val == 0) continue;
                 tripletList.addTriplet(indices[ipar], kTriplets + ic, val);
             }
-            fullGrad(indices[ipar]) += grad(ipar);
         }
+        for (unsigned ipar = 0; ipar < npar_tot; ++ipar) fullGrad(indices[ipar]) += grad(ipar);
         kTriplets += 2;  // each measurement contributes 2 columns in the Jacobian
+        if (fitsProperMotion(fs) && rs->hasProperMotion()) {
+            // the reference proper motion constrains the fitted one, in 2 more columns.
+            // Residual is fs.pm - rs.pm, and H = -dR/dpm == -1, as for the other terms.
+            unsigned const pmIndex = fs.getIndexInMatrix() + 2;
+            double const resRa = fs.pmx - rs->getPmRa();
+            double const resDec = fs.pmy - rs->getPmDec();
+            double const weight = robustWeight(std::pow(resRa / rs->getPmRaErr(), 2) +
+                                               std::pow(resDec / rs->getPmDecErr(), 2));
+            double const inverseSigmaRa = std::sqrt(weight) / rs->getPmRaErr();
+            double const inverseSigmaDec = std::sqrt(weight) / rs->getPmDecErr();
+            tripletList.addTriplet(pmIndex, kTriplets, -inverseSigmaRa);
+            tripletList.addTriplet(pmIndex + 1, kTriplets + 1, -inverseSigmaDec);
+            fullGrad(pmIndex) -= std::pow(inverseSigmaRa, 2) * resRa;
+            fullGrad(pmIndex + 1) -= std::pow(inverseSigmaDec, 2) * resDec;
+            kTriplets += 2;
+        }
     }
     tripletList.setNextFreeIndex(kTriplets);
 }
 
+bool AstrometryFit::fitsProperMotion(FittedStar const &fittedStar) const {
+    // the proper motions are laid out with the positions.
+    return _fittingPos && _fittingPM && fittedStar.mightMove;
+}
+
+std::size_t AstrometryFit::countTripletsMeasurement(CcdImage const &ccdImage) const {
+    // must match the parameter count of leastSquareDerivativesMeasurement.
+    unsigned npar_mapping = (_fittingDistortions) ? _astrometryModel->getMapping(ccdImage)->getNpar() : 0;
+    unsigned npar_pos = (_fittingPos) ? 2 : 0;
+    unsigned npar_refrac = (_fittingRefrac) ? 1 : 0;
+    unsigned npar_pm = (_fittingPM) ? NPAR_PM : 0;
+    unsigned npar_tot = npar_mapping + npar_pos + npar_refrac + npar_pm;
+    // each valid measurement gives 2 columns, with up to npar_tot entries each.
+    return std::size_t(2) * npar_tot * ccdImage.countStars().first;
+}
+
+std::size_t AstrometryFit::countTripletsReference(FittedStarList const &fittedStarList) const {
+    if (!_fittingPos) return 0;
+    std::size_t nRefStars = 0;
+    std::size_t nPmPriors = 0;
+    for (auto const &fittedStar : fittedStarList) {
+        if (fittedStar->getRefStar() != nullptr) nRefStars++;
+        auto refStar = fittedStar->getRefStar();
+        if (refStar != nullptr && refStar->hasProperMotion() && fitsProperMotion(*fittedStar)) nPmPriors++;
+    }
+    // 2 position parameters in 2 columns per reference star, and 2 proper motions in 2 more columns.
+    return 4 * nRefStars + 2 * nPmPriors;
+}
+
 void AstrometryFit::accumulateStatImage(CcdImage const &ccdImage, Chi2Accumulator &accum) const {
     /**********************************************************************/
     /** @note the math in this method and leastSquareDerivativesMeasurement() must be kept consistent,
@@ -328,19 +447,22 @@ void AstrometryFit::accumulateStatImage(CcdImage const &ccdImage, Chi2Accumulato
     const AstrometryMapping *mapping = _astrometryModel->getMapping(ccdImage);
     // proper motion stuff
     double mjd = ccdImage.getMjd() - _JDRef;
+    auto const sunPosition = computeSunPosition(ccdImage.getMjd());
     // refraction stuff
     Point refractionVector = ccdImage.getRefractionVector();
+    double const refractionCoefficient = _refractionCoefficients[getRefractionIndex(ccdImage)];
     // transformation from sky to TP
     auto sky2TP = _astrometryModel->getSky2TP(ccdImage);
+    double const errorIncrement = std::pow(_posError, 2) + getErrorTerm(ccdImage);
     // reserve matrix once for all measurements
     Eigen::Matrix2Xd transW(2, 2);
 
-    auto &catalog = ccdImage.getCatalogForFit();
-    for (auto const &ms : catalog) {
-        if (!ms->isValid()) continue;
+    forEachMeasurement(ccdImage, nullptr, accum.needsStars(), [&](FatPoint const &measuredPos,
+                                                                  FittedStar const &fs,
+                                                                  std::shared_ptr<MeasuredStar> const &ms) {
         // tweak the measurement errors
-        FatPoint inPos = *ms;
-        tweakAstromMeasurementErrors(inPos, *ms, _posError);
+        FatPoint inPos = measuredPos;
+        tweakAstromMeasurementErrors(inPos, errorIncrement);
 
         FatPoint outPos;
         // should *not* fill H if whatToFit excludes mapping parameters.
@@ -348,22 +470,21 @@ void AstrometryFit::accumulateStatImage(CcdImage const &ccdImage, Chi2Accumulato
         double det = outPos.vx * outPos.vy - std::pow(outPos.vxy, 2);
         if (det <= 0 || outPos.vx <= 0 || outPos.vy <= 0) {
             LOGLS_WARN(_log, " Inconsistent measurement errors :drop measurement at "
-                                     << Point(*ms) << " in image " << ccdImage.getName());
-            continue;
+                                     << Point(inPos) << " in image " << ccdImage.getName());
+            return;
         }
         transW(0, 0) = outPos.vy / det;
         transW(1, 1) = outPos.vx / det;
         transW(0, 1) = transW(1, 0) = -outPos.vxy / det;
 
-        std::shared_ptr<FittedStar const> const fs = ms->getFittedStar();
         Point fittedStarInTP =
-                transformFittedStar(*fs, *sky2TP, refractionVector, _refractionCoefficient, mjd);
+                transformFittedStar(fs, *sky2TP, refractionVector, refractionCoefficient, mjd, sunPosition);
 
         Eigen::Vector2d res(fittedStarInTP.x - outPos.x, fittedStarInTP.y - outPos.y);
         double chi2Val = res.transpose() * transW * res;
 
-        accum.addEntry(chi2Val, 2, ms);
-    }  // end of loop on measurements
+        accum.addEntry(robustChi2(chi2Val), 2, ms);
+    });  // end of loop on measurements
 }
 
 void AstrometryFit::accumulateStatImageList(CcdImageList const &ccdImageList, Chi2Accumulator &accum) const {
@@ -389,7 +510,6 @@ void AstrometryFit::accumulateStatRefStars(Chi2Accumulator &accum) const {
         // fs projects to (0,0), no need to compute its transform.
         FatPoint rsProj;
         proj.transformPosAndErrors(*rs, rsProj);
-        // TO DO : account for proper motions.
         double rx = rsProj.x;  // -fsProj.x (which is 0)
         double ry = rsProj.y;
         double det = rsProj.vx * rsProj.vy - std::pow(rsProj.vxy, 2);
@@ -397,7 +517,12 @@ void AstrometryFit::accumulateStatRefStars(Chi2Accumulator &accum) const {
         double wyy = rsProj.vx / det;
         double wxy = -rsProj.vxy / det;
         double chi2 = wxx * std::pow(rx, 2) + 2 * wxy * rx * ry + wyy * std::pow(ry, 2);
-        accum.addEntry(chi2, 2, fs);
+        accum.addEntry(robustChi2(chi2), 2, fs);
+        if (fitsProperMotion(*fs) && rs->hasProperMotion()) {
+            double pmChi2 = std::pow((fs->pmx - rs->getPmRa()) / rs->getPmRaErr(), 2) +
+                            std::pow((fs->pmy - rs->getPmDec()) / rs->getPmDecErr(), 2);
+            accum.addEntry(robustChi2(pmChi2), 2, fs);
+        }
     }
 }
 
@@ -417,7 +542,7 @@ void AstrometryFit::getIndicesOfMeasuredStar(MeasuredStar const &measuredStar,
         indices.push_back(fsIndex + 1);
     }
     // For securing the outlier removal, the next block is just useless
-    if (_fittingPM) {
+    if (fitsProperMotion(*fs)) {
         for (unsigned k = 0; k < NPAR_PM; ++k) indices.push_back(fsIndex + 2 + k);
     }
     /* Should not put the index of refaction stuff or we will not be
@@ -451,7 +576,7 @@ void AstrometryFit::assignIndices(std::string const &whatToFit) {
             // - in GetMeasuredStarIndices
             fittedStar->setIndexInMatrix(ipar);
             ipar += 2;
-            if ((_fittingPM)&fittedStar->mightMove) ipar += NPAR_PM;
+            if (fitsProperMotion(*fittedStar)) ipar += NPAR_PM;
         }
     }
     _nParPositions = ipar - _nParDistortions;
@@ -479,15 +604,25 @@ void AstrometryFit::offsetParams(Eigen::VectorXd const &delta) {
             unsigned index = fs.getIndexInMatrix();
             fs.x += delta(index);
             fs.y += delta(index + 1);
-            if ((_fittingPM)&fs.mightMove) {
+            if (fitsProperMotion(fs)) {
                 fs.pmx += delta(index + 2);
                 fs.pmy += delta(index + 3);
             }
         }
     }
     if (_fittingRefrac) {
-        _refractionCoefficient += delta(_refracPosInMatrix);
+        for (unsigned k = 0; k < _nParRefrac; ++k) {
+            _refractionCoefficients[k] += delta(_refracPosInMatrix + k);
+        }
+    }
+}
+
+std::map<std::string, double> AstrometryFit::getRefractionCoefficients() const {
+    std::map<std::string, double> coefficients;
+    for (auto const &filter : _refractionFilters) {
+        coefficients[filter.first] = _refractionCoefficients[filter.second];
     }
+    return coefficients;
 }
 
 // should not be too large !
@@ -581,12 +716,15 @@ void AstrometryFit::saveChi2MeasContributions(std::string const &baseName) const
         const AstrometryMapping *mapping = _astrometryModel->getMapping(*ccdImage);
         const auto readTransfo = ccdImage->readWCS();
         const Point &refractionVector = ccdImage->getRefractionVector();
+        double const refractionCoefficient = _refractionCoefficients[getRefractionIndex(*ccdImage)];
         double mjd = ccdImage->getMjd() - _JDRef;
+        auto const sunPosition = computeSunPosition(ccdImage->getMjd());
+        double const errorIncrement = std::pow(_posError, 2) + getErrorTerm(*ccdImage);
         for (auto const &ms : cat) {
             if (!ms->isValid()) continue;
             FatPoint tpPos;
             FatPoint inPos = *ms;
-            tweakAstromMeasurementErrors(inPos, *ms, _posError);
+            tweakAstromMeasurementErrors(inPos, *ms, errorIncrement);
             mapping->transformPosAndErrors(inPos, tpPos);
             auto sky2TP = _astrometryModel->getSky2TP(*ccdImage);
             const std::unique_ptr<Gtransfo> readPix2TP = gtransfoCompose(*sky2TP, *readTransfo);
@@ -594,7 +732,8 @@ void AstrometryFit::saveChi2MeasContributions(std::string const &baseName) const
             std::shared_ptr<FittedStar const> const fs = ms->getFittedStar();
 
             Point fittedStarInTP =
-                    transformFittedStar(*fs, *sky2TP, refractionVector, _refractionCoefficient, mjd);
+                    transformFittedStar(*fs, *sky2TP, refractionVector, refractionCoefficient, mjd,
+                                        sunPosition);
             Point res = tpPos - fittedStarInTP;
             Point inputRes = inputTpPos - fittedStarInTP;
             double det = tpPos.vx * tpPos.vy - std::pow(tpPos.vxy, 2);
@@ -139,27 +139,6 @@ void ConstrainedPhotometryModel::computeParameterDerivatives(MeasuredStar const
     mapping->computeParameterDerivatives(measuredStar, measuredStar.getInstFlux(), derivatives);
 }
 
-namespace {
-// Convert photoTransfo's way of storing Chebyshev coefficients into the format wanted by ChebyMap.
-ndarray::Array<double, 2, 2> toChebyMapCoeffs(std::shared_ptr<PhotometryTransfoChebyshev> transfo) {
-    auto coeffs = transfo->getCoefficients();
-    // 4 x nPar: ChebyMap wants rows that look like (a_ij, 1, i, j) for out += a_ij*T_i(x)*T_j(y)
-    ndarray::Array<double, 2, 2> chebyCoeffs = allocate(ndarray::makeVector(transfo->getNpar(), 4));
-    Eigen::VectorXd::Index k = 0;
-    auto order = transfo->getOrder();
-    for (ndarray::Size j = 0; j <= order; ++j) {
-        ndarray::Size const iMax = order - j;  // to save re-computing `i+j <= order` every inner step.
-        for (ndarray::Size i = 0; i <= iMax; ++i, ++k) {
-            chebyCoeffs[k][0] = coeffs[j][i];
-            chebyCoeffs[k][1] = 1;
-            chebyCoeffs[k][2] = i;
-            chebyCoeffs[k][3] = j;
-        }
-    }
-    return chebyCoeffs;
-}
-}  // namespace
-
 std::shared_ptr<afw::image::PhotoCalib> ConstrainedPhotometryModel::toPhotoCalib(
         CcdImage const &ccdImage) const {
     auto oldPhotoCalib = ccdImage.getPhotoCalib();
@@ -177,8 +156,7 @@ std::shared_ptr<afw::image::PhotoCalib> ConstrainedPhotometryModel::toPhotoCalib
     auto focalBBox = visitTransfo->getBBox();
 
     // Unravel our chebyshev coefficients to build an astshim::ChebyMap.
-    auto coeff_f = toChebyMapCoeffs(
-            std::dynamic_pointer_cast<PhotometryTransfoChebyshev>(mapping->getVisitMapping()->getTransfo()));
+    auto coeff_f = visitTransfo->getChebyMapCoefficients();
     // Bounds are the bbox
     std::vector<double> lowerBound = {focalBBox.getMinX(), focalBBox.getMinY()};
     std::vector<double> upperBound = {focalBBox.getMaxX(), focalBBox.getMaxY()};
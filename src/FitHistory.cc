@@ -0,0 +1,51 @@
+#include <fstream>
+#include <limits>
+
+#include "lsst/pex/exceptions.h"
+#include "lsst/jointcal/FitHistory.h"
+
+namespace lsst {
+namespace jointcal {
+
+std::ostream &operator<<(std::ostream &s, IterationRecord const &record) {
+    s << "call " << record.call << " (" << record.whatToFit << ") iteration " << record.iteration
+      << ": chi2/ndof " << record.chi2 << '/' << record.ndof << " step " << record.stepNorm << " outliers "
+      << record.nMeasOutliers << '+' << record.nRefOutliers << " factorization " << record.factorizationTime
+      << "s downdates " << record.nDowndates;
+    return s;
+}
+
+void FitHistory::save(std::string const &baseName) const {
+    std::string const iterationsName = baseName + "-iterations.csv";
+    std::ofstream iterations(iterationsName);
+    if (!iterations) {
+        throw LSST_EXCEPT(pex::exceptions::IoError, "Cannot open " + iterationsName);
+    }
+    iterations.precision(std::numeric_limits<double>::max_digits10);
+    iterations << "call,whatToFit,iteration,nParameters,chi2,ndof,stepNorm,nMeasOutliers,nRefOutliers,"
+                  "factorizationTime,nDowndates"
+               << std::endl;
+    for (auto const &record : _records) {
+        iterations << record.call << ',' << record.whatToFit << ',' << record.iteration << ','
+                   << record.nParameters << ',' << record.chi2 << ',' << record.ndof << ','
+                   << record.stepNorm << ',' << record.nMeasOutliers << ',' << record.nRefOutliers << ','
+                   << record.factorizationTime << ',' << record.nDowndates << std::endl;
+    }
+
+    std::string const visitsName = baseName + "-visits.csv";
+    std::ofstream visits(visitsName);
+    if (!visits) {
+        throw LSST_EXCEPT(pex::exceptions::IoError, "Cannot open " + visitsName);
+    }
+    visits.precision(std::numeric_limits<double>::max_digits10);
+    visits << "call,iteration,visit,chi2,ndof" << std::endl;
+    for (auto const &record : _records) {
+        for (auto const &visit : record.visitChi2) {
+            visits << record.call << ',' << record.iteration << ',' << visit.first << ','
+                   << visit.second.chi2 << ',' << visit.second.ndof << std::endl;
+        }
+    }
+}
+
+}  // namespace jointcal
+}  // namespace lsst
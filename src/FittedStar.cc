@@ -23,7 +23,8 @@ FittedStar::FittedStar(const MeasuredStar &measuredStar)
           _wmag(measuredStar.getMagWeight()),
           _indexInMatrix(-1),
           _measurementCount(0),
-          _refStar(nullptr) {
+          _refStar(nullptr),
+          _bandMask(0) {
     _fluxErr = measuredStar.getInstFluxErr();
 }
 
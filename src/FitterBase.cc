@@ -1,6 +1,13 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <numeric>
 #include <vector>
 
 #include "lsst/log/Log.h"
+#include "lsst/pex/exceptions.h"
 
 #include "lsst/jointcal/Chi2.h"
 #include "lsst/jointcal/CcdImage.h"
@@ -8,13 +15,355 @@
 #include "lsst/jointcal/FitterBase.h"
 #include "lsst/jointcal/FittedStar.h"
 #include "lsst/jointcal/MeasuredStar.h"
+#include "lsst/jointcal/MemoryUsage.h"
+#include "lsst/jointcal/ProcessParallel.h"
 
 namespace lsst {
 namespace jointcal {
 
+namespace {
+
+/// Number of outliers sent to the workers in one command.
+constexpr std::size_t maxOutliersPerCommand = 4096;
+
+}  // namespace
+
+/**
+ * Worker processes computing the measurement terms, and the shared buffers they return them in.
+ *
+ * The workers are forked by the constructor, and keep their copy of the fit from then on: offsetParams and
+ * removeOutliers replay in them the changes made to the fit by this process. The CcdImages are split over
+ * the workers once, by number of Jacobian entries for the derivatives and by number of measurements for the
+ * chi2; the triplet counts are upper bounds, which only decrease as outliers are removed.
+ */
+class FitterBase::Workers {
+public:
+    explicit Workers(FitterBase &fitter);
+
+    /// Append the derivatives of the measurement terms to tripletList, and add them to grad.
+    void leastSquareDerivatives(TripletList &tripletList, Eigen::VectorXd &grad);
+
+    /// The chi2 of the measurement terms of each CcdImage.
+    std::vector<Chi2Statistic> computeImageChi2();
+
+    /// Apply the offsetParams(delta) of this process to the fits of the workers.
+    void offsetParams(Eigen::VectorXd const &delta);
+
+    /// Apply the removeMeasOutliers and removeRefOutliers of this process to the fits of the workers.
+    void removeOutliers(MeasuredStarList const &msOutliers, FittedStarList const &fsOutliers);
+
+private:
+    enum class Command : unsigned { Derivatives, Chi2, OffsetParams, RemoveOutliers };
+
+    /// The work of worker for one command, in its own process.
+    void runCommand(unsigned worker, Command command);
+
+    FitterBase &_fitter;
+    std::vector<std::shared_ptr<CcdImage>> _ccdImages;
+    unsigned _nParTot;
+    std::vector<std::size_t> _derivativeBounds;    // the CcdImages of each worker, for the derivatives
+    std::vector<std::size_t> _firstEntry;          // the slice of Jacobian entries of each worker
+    std::vector<std::size_t> _firstGradientEntry;  // the slice of gradient entries of each worker
+    std::vector<std::size_t> _chi2Bounds;          // the CcdImages of each worker, for the chi2
+
+    std::unique_ptr<SharedBuffer> _rows;
+    std::unique_ptr<SharedBuffer> _columns;
+    std::unique_ptr<SharedBuffer> _values;
+    // The gradient comes back sparse: the index and value of its non-zero entries.
+    std::unique_ptr<SharedBuffer> _gradientIndices;
+    std::unique_ptr<SharedBuffer> _gradientValues;
+    // number of Jacobian entries, of columns and of gradient entries filled by each worker.
+    std::unique_ptr<SharedBuffer> _sizes;
+    std::unique_ptr<SharedBuffer> _chi2s;
+    std::unique_ptr<SharedBuffer> _ndofs;
+    std::unique_ptr<SharedBuffer> _delta;
+    // number of measurement outliers, of reference outliers, then their addresses.
+    std::unique_ptr<SharedBuffer> _outliers;
+
+    // The derivatives of a worker, reused from one command to the next in its process.
+    TripletList _workerTriplets;
+    Eigen::VectorXd _workerGrad;
+
+    // last: forked once everything above is set.
+    std::unique_ptr<WorkerPool> _pool;
+};
+
+FitterBase::Workers::Workers(FitterBase &fitter)
+        : _fitter(fitter), _nParTot(fitter._nParTot), _workerTriplets(0, fitter._tripletList.getStorage()) {
+    unsigned const nProcesses = fitter._nProcesses;
+    auto const &ccdImageList = fitter._associations->getCcdImageList();
+    _ccdImages.assign(ccdImageList.begin(), ccdImageList.end());
+    std::vector<std::size_t> counts;
+    std::vector<std::size_t> sizes;
+    counts.reserve(_ccdImages.size());
+    sizes.reserve(_ccdImages.size());
+    for (auto const &ccdImage : _ccdImages) {
+        counts.push_back(fitter.countTripletsMeasurement(*ccdImage));
+        sizes.push_back(ccdImage->getCatalogForFit().size());
+    }
+    _derivativeBounds = partitionByWeight(counts, nProcesses);
+    _chi2Bounds = partitionByWeight(sizes, nProcesses);
+    // Each worker writes its entries in its own slice of the shared arrays, sized by the counts. Each of its
+    // gradient entries comes with at least one Jacobian entry in its row, so it has no more of those.
+    _firstEntry.assign(nProcesses + 1, 0);
+    _firstGradientEntry.assign(nProcesses + 1, 0);
+    for (unsigned worker = 0; worker < nProcesses; ++worker) {
+        std::size_t const nEntries = std::accumulate(counts.begin() + _derivativeBounds[worker],
+                                                     counts.begin() + _derivativeBounds[worker + 1],
+                                                     std::size_t(0));
+        _firstEntry[worker + 1] = _firstEntry[worker] + nEntries;
+        _firstGradientEntry[worker + 1] =
+                _firstGradientEntry[worker] + std::min<std::size_t>(nEntries, _nParTot);
+    }
+    std::size_t const nEntries = _firstEntry.back();
+    std::size_t const nGradientEntries = _firstGradientEntry.back();
+    _rows.reset(new SharedBuffer(nEntries * sizeof(unsigned)));
+    _columns.reset(new SharedBuffer(nEntries * sizeof(unsigned)));
+    _values.reset(new SharedBuffer(nEntries * sizeof(double)));
+    _gradientIndices.reset(new SharedBuffer(nGradientEntries * sizeof(unsigned)));
+    _gradientValues.reset(new SharedBuffer(nGradientEntries * sizeof(double)));
+    _sizes.reset(new SharedBuffer(3 * nProcesses * sizeof(std::uint64_t)));
+    _chi2s.reset(new SharedBuffer(_ccdImages.size() * sizeof(double)));
+    _ndofs.reset(new SharedBuffer(_ccdImages.size() * sizeof(unsigned)));
+    _delta.reset(new SharedBuffer(_nParTot * sizeof(double)));
+    _outliers.reset(
+            new SharedBuffer(2 * sizeof(std::uint64_t) + maxOutliersPerCommand * sizeof(std::uintptr_t)));
+
+    _pool.reset(new WorkerPool(nProcesses, [this](unsigned worker, unsigned command) {
+        runCommand(worker, Command(command));
+    }));
+}
+
+void FitterBase::Workers::leastSquareDerivatives(TripletList &tripletList, Eigen::VectorXd &grad) {
+    _pool->run(unsigned(Command::Derivatives));
+
+    // The workers numbered their columns from 0: shift them after those of the previous workers.
+    unsigned columnOffset = tripletList.getNextFreeIndex();
+    auto const *sizes = _sizes->data<std::uint64_t>();
+    for (unsigned worker = 0; worker < _pool->size(); ++worker) {
+        std::size_t const end = _firstEntry[worker] + sizes[3 * worker];
+        for (std::size_t entry = _firstEntry[worker]; entry < end; ++entry) {
+            unsigned const column = columnOffset + _columns->data<unsigned>()[entry];
+            tripletList.addTriplet(_rows->data<unsigned>()[entry], column, _values->data<double>()[entry]);
+        }
+        columnOffset += sizes[3 * worker + 1];
+        std::size_t const gradientEnd = _firstGradientEntry[worker] + sizes[3 * worker + 2];
+        for (std::size_t entry = _firstGradientEntry[worker]; entry < gradientEnd; ++entry) {
+            grad(_gradientIndices->data<unsigned>()[entry]) += _gradientValues->data<double>()[entry];
+        }
+    }
+    tripletList.setNextFreeIndex(columnOffset);
+}
+
+std::vector<Chi2Statistic> FitterBase::Workers::computeImageChi2() {
+    _pool->run(unsigned(Command::Chi2));
+    std::vector<Chi2Statistic> result(_ccdImages.size());
+    for (std::size_t i = 0; i < _ccdImages.size(); ++i) {
+        result[i].chi2 = _chi2s->data<double>()[i];
+        result[i].ndof = _ndofs->data<unsigned>()[i];
+    }
+    return result;
+}
+
+void FitterBase::Workers::offsetParams(Eigen::VectorXd const &delta) {
+    Eigen::VectorXd::Map(_delta->data<double>(), _nParTot) = delta;
+    _pool->run(unsigned(Command::OffsetParams));
+}
+
+void FitterBase::Workers::removeOutliers(MeasuredStarList const &msOutliers,
+                                         FittedStarList const &fsOutliers) {
+    // The workers find the stars at the same addresses, in their copy of the associations.
+    auto *counts = _outliers->data<std::uint64_t>();
+    auto *addresses = _outliers->data<std::uintptr_t>(2 * sizeof(std::uint64_t));
+    auto measuredStar = msOutliers.begin();
+    auto fittedStar = fsOutliers.begin();
+    while (measuredStar != msOutliers.end() || fittedStar != fsOutliers.end()) {
+        std::size_t n = 0;
+        for (; measuredStar != msOutliers.end() && n < maxOutliersPerCommand; ++measuredStar) {
+            addresses[n++] = reinterpret_cast<std::uintptr_t>(measuredStar->get());
+        }
+        counts[0] = n;
+        for (; fittedStar != fsOutliers.end() && n < maxOutliersPerCommand; ++fittedStar) {
+            addresses[n++] = reinterpret_cast<std::uintptr_t>(fittedStar->get());
+        }
+        counts[1] = n - counts[0];
+        _pool->run(unsigned(Command::RemoveOutliers));
+    }
+}
+
+void FitterBase::Workers::runCommand(unsigned worker, Command command) {
+    switch (command) {
+        case Command::Derivatives: {
+            std::size_t const maxEntries = _firstEntry[worker + 1] - _firstEntry[worker];
+            _workerTriplets.clear();
+            _workerTriplets.reserve(maxEntries);
+            _workerGrad.setZero(_nParTot);
+            for (std::size_t i = _derivativeBounds[worker]; i < _derivativeBounds[worker + 1]; ++i) {
+                _fitter.leastSquareDerivativesMeasurement(*_ccdImages[i], _workerTriplets, _workerGrad);
+            }
+            if (_workerTriplets.size() > maxEntries) {
+                throw LSST_EXCEPT(pex::exceptions::LengthError, "More Jacobian entries than counted");
+            }
+            // With the storage of the fit, the entries come back column by column when it is Compact, and
+            // the replay keeps them in that order.
+            std::size_t entry = _firstEntry[worker];
+            _workerTriplets.forEachEntry([&](unsigned row, unsigned column, double value) {
+                _rows->data<unsigned>()[entry] = row;
+                _columns->data<unsigned>()[entry] = column;
+                _values->data<double>()[entry] = value;
+                ++entry;
+            });
+            std::size_t const maxGradientEntries =
+                    _firstGradientEntry[worker + 1] - _firstGradientEntry[worker];
+            std::size_t nGradientEntries = 0;
+            for (unsigned index = 0; index < _nParTot; ++index) {
+                if (_workerGrad(index) == 0) continue;
+                if (nGradientEntries == maxGradientEntries) {
+                    throw LSST_EXCEPT(pex::exceptions::LengthError,
+                                      "More gradient entries than Jacobian rows");
+                }
+                std::size_t const gradientEntry = _firstGradientEntry[worker] + nGradientEntries++;
+                _gradientIndices->data<unsigned>()[gradientEntry] = index;
+                _gradientValues->data<double>()[gradientEntry] = _workerGrad(index);
+            }
+            auto *sizes = _sizes->data<std::uint64_t>();
+            sizes[3 * worker] = _workerTriplets.size();
+            sizes[3 * worker + 1] = _workerTriplets.getNextFreeIndex();
+            sizes[3 * worker + 2] = nGradientEntries;
+            break;
+        }
+        case Command::Chi2: {
+            CcdImageList single(1);
+            for (std::size_t i = _chi2Bounds[worker]; i < _chi2Bounds[worker + 1]; ++i) {
+                single.front() = _ccdImages[i];
+                Chi2Statistic imageChi2;
+                _fitter.accumulateStatImageList(single, imageChi2);
+                _chi2s->data<double>()[i] = imageChi2.chi2;
+                _ndofs->data<unsigned>()[i] = imageChi2.ndof;
+            }
+            break;
+        }
+        case Command::OffsetParams:
+            _fitter.offsetParams(Eigen::VectorXd::Map(_delta->data<double>(), _nParTot));
+            break;
+        case Command::RemoveOutliers: {
+            auto const *counts = _outliers->data<std::uint64_t>();
+            auto const *addresses = _outliers->data<std::uintptr_t>(2 * sizeof(std::uint64_t));
+            // Non-owning pointers: the stars belong to the associations of this process.
+            MeasuredStarList measuredStars;
+            for (std::size_t i = 0; i < counts[0]; ++i) {
+                measuredStars.push_back(std::shared_ptr<MeasuredStar>(
+                        std::shared_ptr<MeasuredStar>(), reinterpret_cast<MeasuredStar *>(addresses[i])));
+            }
+            FittedStarList fittedStars;
+            for (std::size_t i = counts[0]; i < counts[0] + counts[1]; ++i) {
+                fittedStars.push_back(std::shared_ptr<FittedStar>(
+                        std::shared_ptr<FittedStar>(), reinterpret_cast<FittedStar *>(addresses[i])));
+            }
+            _fitter.removeMeasOutliers(measuredStars);
+            _fitter.removeRefOutliers(fittedStars);
+            break;
+        }
+    }
+}
+
+FitterBase::~FitterBase() = default;
+
+void FitterBase::recordMemory(std::string const &name, std::size_t bytes) {
+    _profile.updateMemory(name, bytes);
+    LOGLS_DEBUG(_log, "Memory held by " << name << ": " << bytes / (1024. * 1024.) << " MB");
+}
+
+void FitterBase::setNProcesses(unsigned nProcesses) {
+    if (nProcesses == 0) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError, "Need at least one process to fit");
+    }
+    _nProcesses = nProcesses;
+}
+
+void FitterBase::setRobustLoss(RobustLoss loss, double scale, unsigned maxIterations) {
+    if (scale < 0) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "Robust loss scale must not be negative: " + std::to_string(scale));
+    }
+    if (maxIterations == 0) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "Need at least one reweighted iteration");
+    }
+    _robustLoss = loss;
+    if (scale == 0) scale = (loss == RobustLoss::Cauchy) ? 2.385 : 1.345;
+    _robustScale = scale;
+    _robustMaxIterations = maxIterations;
+}
+
+std::map<int, double> FitterBase::fitErrorModel(std::string const &grouping) {
+    bool const byVisit = (grouping == "visit");
+    if (!byVisit && grouping != "ccd") {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "Unknown error model grouping: " + grouping + "; expected visit or ccd");
+    }
+    std::map<int, CcdImageList> groups;
+    for (auto const &ccdImage : _associations->getCcdImageList()) {
+        groups[byVisit ? ccdImage->getVisit() : ccdImage->getCcdId()].push_back(ccdImage);
+    }
+    // The terms match the Gaussian chi2: evaluate it with the squared loss, and restore the fit's on exit.
+    struct LossRestorer {
+        RobustLoss &loss;
+        RobustLoss const saved;
+        ~LossRestorer() { loss = saved; }
+    } restorer{_robustLoss, _robustLoss};
+    _robustLoss = RobustLoss::Squared;
+
+    // The fitted parameters take the same share of the degrees of freedom of every group.
+    Chi2Statistic all;
+    accumulateStatImageList(_associations->getCcdImageList(), all);
+    accumulateStatRefStars(all);
+    double const dofFraction = (all.ndof > _nParTot) ? 1 - double(_nParTot) / all.ndof : 1;
+
+    std::map<int, double> result;
+    for (auto const &group : groups) {
+        auto computeGroupChi2 = [this, &group](double term) {
+            for (auto const &ccdImage : group.second) _errorTerms[ccdImage.get()] = term;
+            Chi2Statistic chi2;
+            accumulateStatImageList(group.second, chi2);
+            return chi2;
+        };
+        Chi2Statistic chi2 = computeGroupChi2(0);
+        double const target = dofFraction * chi2.ndof;
+        double term = 0;
+        if (chi2.ndof > 0 && chi2.chi2 > target) {
+            // The chi2 decreases with the term: bracket the target, then bisect to 0.1%.
+            double low = 0;
+            double high = 1e-8;
+            while (computeGroupChi2(high).chi2 > target && high < 1e10) {
+                low = high;
+                high *= 4;
+            }
+            while (high - low > 1e-3 * high) {
+                double middle = 0.5 * (low + high);
+                if (computeGroupChi2(middle).chi2 > target) {
+                    low = middle;
+                } else {
+                    high = middle;
+                }
+            }
+            term = high;
+        }
+        computeGroupChi2(term);
+        result[group.first] = term;
+        LOGLS_DEBUG(_log, "Error term of " << grouping << " " << group.first << ": " << term << " (chi2 "
+                                           << chi2.chi2 << " for " << chi2.ndof << " measurement terms)");
+    }
+    return result;
+}
+
 Chi2Statistic FitterBase::computeChi2() const {
     Chi2Statistic chi2;
-    accumulateStatImageList(_associations->getCcdImageList(), chi2);
+    if (_nProcesses > 1) {
+        for (auto const &imageChi2 : computeImageChi2InProcesses()) chi2 += imageChi2;
+    } else {
+        accumulateStatImageList(_associations->getCcdImageList(), chi2);
+    }
     accumulateStatRefStars(chi2);
     // chi2.ndof contains the number of squares.
     // So subtract the number of parameters.
@@ -22,6 +371,30 @@ Chi2Statistic FitterBase::computeChi2() const {
     return chi2;
 }
 
+Chi2Statistic FitterBase::computeChi2PerVisit(std::map<VisitIdType, Chi2Statistic> &visitChi2) const {
+    Chi2Statistic chi2;
+    if (_nProcesses > 1) {
+        auto const imageChi2 = computeImageChi2InProcesses();
+        auto chi2Iter = imageChi2.begin();
+        for (auto const &ccdImage : _associations->getCcdImageList()) {
+            visitChi2[ccdImage->getVisit()] += *chi2Iter;
+            chi2 += *chi2Iter++;
+        }
+    } else {
+        CcdImageList single(1);
+        for (auto const &ccdImage : _associations->getCcdImageList()) {
+            single.front() = ccdImage;
+            Chi2Statistic imageChi2;
+            accumulateStatImageList(single, imageChi2);
+            visitChi2[ccdImage->getVisit()] += imageChi2;
+            chi2 += imageChi2;
+        }
+    }
+    accumulateStatRefStars(chi2);
+    chi2.ndof -= _nParTot;
+    return chi2;
+}
+
 unsigned FitterBase::findOutliers(double nSigmaCut, MeasuredStarList &msOutliers,
                                   FittedStarList &fsOutliers) const {
     // collect chi2 contributions
@@ -117,81 +490,149 @@ unsigned FitterBase::findOutliers(double nSigmaCut, MeasuredStarList &msOutliers
 }
 
 MinimizeResult FitterBase::minimize(std::string const &whatToFit, double nSigmaCut) {
+    ScopedPhase minimizePhase(_profile, "minimize");
     assignIndices(whatToFit);
+    {
+        std::vector<CcdImage const *> ccdImages;
+        for (auto const &ccdImage : _associations->getCcdImageList()) ccdImages.push_back(ccdImage.get());
+        updateMeasurementCache(ccdImages);
+    }
+    // Fork the workers once for the whole minimization; they exit when it returns.
+    struct WorkersStopper {
+        std::unique_ptr<Workers> &workers;
+        ~WorkersStopper() { workers.reset(); }
+    } stopper{_workers};
+    if (_nProcesses > 1) {
+        _workers.reset(new Workers(*this));
+        _profile.addCounter("workerForks", _nProcesses);
+    }
 
     MinimizeResult returnCode = MinimizeResult::Converged;
+    bool const robust = (_robustLoss != RobustLoss::Squared);
+    if (robust && nSigmaCut != 0) {
+        LOGLS_DEBUG(_log, "Robust loss in use: ignoring the outlier rejection cut of " << nSigmaCut);
+        nSigmaCut = 0;
+    }
 
-    // TODO : write a guesser for the number of triplets
-    unsigned nTrip = (_lastNTrip) ? _lastNTrip : 1e6;
-    TripletList tripletList(nTrip);
     Eigen::VectorXd grad(_nParTot);
-    grad.setZero();
-
-    // Fill the triplets
-    leastSquareDerivatives(tripletList, grad);
-    _lastNTrip = tripletList.size();
-
-    LOGLS_DEBUG(_log, "End of triplet filling, ntrip = " << tripletList.size());
-
     SpMat hessian;
-    {
-        SpMat jacobian(_nParTot, tripletList.getNextFreeIndex());
-        jacobian.setFromTriplets(tripletList.begin(), tripletList.end());
-        // release memory shrink_to_fit is C++11
-        tripletList.clear();  // tripletList.shrink_to_fit();
-        hessian = jacobian * jacobian.transpose();
-    }  // release the Jacobian
+    computeHessianAndGradient(hessian, grad);
 
     LOGLS_DEBUG(_log, "Starting factorization, hessian: dim="
                               << hessian.rows() << " non-zeros=" << hessian.nonZeros()
                               << " filling-frac = " << hessian.nonZeros() / std::pow(hessian.rows(), 2));
 
+    ScopedPhase factorizationPhase(_profile, "factorization");
     CholmodSimplicialLDLT2<SpMat> chol(hessian);
+    double factorizationTime = factorizationPhase.stop();
     if (chol.info() != Eigen::Success) {
         LOGLS_ERROR(_log, "minimize: factorization failed ");
         return MinimizeResult::Failed;
     }
+    _profile.setCounter("factorNonZeros", chol.getFactorNonZeros());
+    _profile.setCounter("factorFlops", chol.getFactorFlops());
+    recordMemory("cholmod", chol.getMemoryInUse());
+    recordMemory("cholmodPeak", chol.getMemoryPeak());
+    LOGLS_DEBUG(_log, "Factor non-zeros=" << chol.getFactorNonZeros()
+                                          << " fill-in=" << chol.getFactorNonZeros() / hessian.nonZeros());
 
+    unsigned const call = _history.startCall();
+    unsigned nDowndates = 0;
     unsigned totalMeasOutliers = 0;
     unsigned totalRefOutliers = 0;
-    double oldChi2 = computeChi2().chi2;
+    double oldChi2;
+    {
+        ScopedPhase phase(_profile, "chi2");
+        oldChi2 = computeChi2().chi2;
+    }
 
-    while (true) {
-        Eigen::VectorXd delta = chol.solve(grad);
-        offsetParams(delta);
-        Chi2Statistic currentChi2(computeChi2());
+    for (unsigned iteration = 0;; ++iteration) {
+        _profile.addCounter("nIterations", 1);
+        IterationRecord &record = _history.add(IterationRecord());
+        record.call = call;
+        record.whatToFit = whatToFit;
+        record.iteration = iteration;
+        record.nParameters = _nParTot;
+        record.factorizationTime = factorizationTime;
+        record.nDowndates = nDowndates;
+        Eigen::VectorXd delta;
+        {
+            ScopedPhase phase(_profile, "solve");
+            delta = chol.solve(grad);
+            offsetParams(delta);
+            if (_workers) _workers->offsetParams(delta);
+        }
+        record.stepNorm = delta.norm();
+        ScopedPhase chi2Phase(_profile, "chi2");
+        Chi2Statistic currentChi2(computeChi2PerVisit(record.visitChi2));
+        chi2Phase.stop();
+        record.chi2 = currentChi2.chi2;
+        record.ndof = currentChi2.ndof;
         LOGLS_DEBUG(_log, currentChi2);
         if (currentChi2.chi2 > oldChi2 && totalMeasOutliers + totalRefOutliers != 0) {
             LOGL_WARN(_log, "chi2 went up, skipping outlier rejection loop");
             returnCode = MinimizeResult::Chi2Increased;
             break;
         }
+        if (robust) {
+            bool const converged = std::abs(oldChi2 - currentChi2.chi2) < 1e-4 * currentChi2.chi2;
+            if (!converged && iteration > 0 && currentChi2.chi2 > oldChi2) {
+                LOGL_WARN(_log, "chi2 went up, stopping the reweighted iterations");
+                returnCode = MinimizeResult::Chi2Increased;
+                break;
+            }
+            oldChi2 = currentChi2.chi2;
+            LOGLS_DEBUG(_log, record);
+            if (converged || iteration + 1 >= _robustMaxIterations) break;
+            // The weights changed with the parameters.
+            computeHessianAndGradient(hessian, grad);
+            ScopedPhase refactorizationPhase(_profile, "factorization");
+            chol.compute(hessian);
+            factorizationTime = refactorizationPhase.stop();
+            if (chol.info() != Eigen::Success) {
+                LOGLS_ERROR(_log, "minimize: factorization of the reweighted hessian failed");
+                return MinimizeResult::Failed;
+            }
+            continue;
+        }
         oldChi2 = currentChi2.chi2;
 
         if (nSigmaCut == 0) break;  // no rejection step to perform
         MeasuredStarList msOutliers;
         FittedStarList fsOutliers;
         // keep nOutliers so we don't have to sum msOutliers.size()+fsOutliers.size() twice below.
+        ScopedPhase outliersPhase(_profile, "outliers");
         int nOutliers = findOutliers(nSigmaCut, msOutliers, fsOutliers);
+        outliersPhase.stop();
         totalMeasOutliers += msOutliers.size();
         totalRefOutliers += fsOutliers.size();
+        record.nMeasOutliers = msOutliers.size();
+        record.nRefOutliers = fsOutliers.size();
+        LOGLS_DEBUG(_log, record);
         if (nOutliers == 0) break;
-        TripletList tripletList(nOutliers);
+        ScopedPhase downdatePhase(_profile, "downdate");
+        _outlierTripletList.clear();
         grad.setZero();  // recycle the gradient
         // compute the contributions of outliers to derivatives
-        outliersContributions(msOutliers, fsOutliers, tripletList, grad);
+        outliersContributions(msOutliers, fsOutliers, _outlierTripletList, grad);
         // Remove significant outliers
         removeMeasOutliers(msOutliers);
         removeRefOutliers(fsOutliers);
+        if (_workers) _workers->removeOutliers(msOutliers, fsOutliers);
         // convert triplet list to eigen internal format
-        SpMat H(_nParTot, tripletList.getNextFreeIndex());
-        H.setFromTriplets(tripletList.begin(), tripletList.end());
+        SpMat H;
+        _outlierTripletList.toSparseMatrix(H, _nParTot);
         int update_status = chol.update(H, false /* means downdate */);
         LOGLS_DEBUG(_log, "cholmod update_status " << update_status);
+        factorizationTime = downdatePhase.stop();
+        nDowndates++;
+        recordMemory("cholmodPeak", chol.getMemoryPeak());
         // The contribution of outliers to the gradient is the opposite
         // of the contribution of all other terms, because they add up to 0
         grad *= -1;
     }
+    _profile.addCounter("nMeasOutliers", totalMeasOutliers);
+    _profile.addCounter("nRefOutliers", totalRefOutliers);
 
     // only print the outlier summary if outlier rejection was turned on.
     if (nSigmaCut != 0) {
@@ -202,6 +643,37 @@ MinimizeResult FitterBase::minimize(std::string const &whatToFit, double nSigmaC
     return returnCode;
 }
 
+void FitterBase::computeHessianAndGradient(SpMat &hessian, Eigen::VectorXd &grad) {
+    // Reuse the triplet storage from the previous call, sized for this parameter layout.
+    _tripletList.clear();
+    _tripletList.reserve(countTriplets());
+    grad.setZero();
+
+    // Fill the triplets
+    {
+        ScopedPhase phase(_profile, "derivatives");
+        leastSquareDerivatives(_tripletList, grad);
+    }
+    recordMemory("tripletList", computeMemoryUsage(_tripletList));
+    _profile.setCounter("nParameters", _nParTot);
+    _profile.setCounter("nTriplets", _tripletList.size());
+    _profile.setCounter("jacobianColumns", _tripletList.getNextFreeIndex());
+
+    LOGLS_DEBUG(_log, "End of triplet filling, ntrip = " << _tripletList.size());
+
+    {
+        ScopedPhase phase(_profile, "hessian");
+        SpMat jacobian;
+        _tripletList.toSparseMatrix(jacobian, _nParTot);
+        recordMemory("jacobian", computeMemoryUsage(jacobian));
+        // the storage is kept for the next call.
+        _tripletList.clear();
+        hessian = jacobian * jacobian.transpose();
+    }  // release the Jacobian
+    recordMemory("hessian", computeMemoryUsage(hessian));
+    _profile.setCounter("hessianNonZeros", hessian.nonZeros());
+}
+
 void FitterBase::outliersContributions(MeasuredStarList &msOutliers, FittedStarList &fsOutliers,
                                        TripletList &tripletList, Eigen::VectorXd &grad) {
     for (auto &outlier : msOutliers) {
@@ -214,11 +686,16 @@ void FitterBase::outliersContributions(MeasuredStarList &msOutliers, FittedStarL
 }
 
 void FitterBase::removeMeasOutliers(MeasuredStarList &outliers) {
+    std::vector<CcdImage const *> ccdImages;
     for (auto &measuredStar : outliers) {
         auto fittedStar = measuredStar->getFittedStar();
         measuredStar->setValid(false);
         fittedStar->getMeasurementCount()--;  // could be put in setValid
+        ccdImages.push_back(&measuredStar->getCcdImage());
     }
+    std::sort(ccdImages.begin(), ccdImages.end());
+    ccdImages.erase(std::unique(ccdImages.begin(), ccdImages.end()), ccdImages.end());
+    updateMeasurementCache(ccdImages);
 }
 
 void FitterBase::removeRefOutliers(FittedStarList &outliers) {
@@ -228,13 +705,39 @@ void FitterBase::removeRefOutliers(FittedStarList &outliers) {
 }
 
 void FitterBase::leastSquareDerivatives(TripletList &tripletList, Eigen::VectorXd &grad) const {
-    auto ccdImageList = _associations->getCcdImageList();
-    for (auto const &ccdImage : ccdImageList) {
-        leastSquareDerivativesMeasurement(*ccdImage, tripletList, grad);
+    if (_nProcesses > 1) {
+        leastSquareDerivativesInProcesses(tripletList, grad);
+    } else {
+        for (auto const &ccdImage : _associations->getCcdImageList()) {
+            leastSquareDerivativesMeasurement(*ccdImage, tripletList, grad);
+        }
     }
     leastSquareDerivativesReference(_associations->fittedStarList, tripletList, grad);
 }
 
+void FitterBase::leastSquareDerivativesInProcesses(TripletList &tripletList, Eigen::VectorXd &grad) const {
+    if (_workers) {
+        _workers->leastSquareDerivatives(tripletList, grad);
+    } else {
+        // Workers only modify the fit on the offsetParams and removeOutliers commands, not used here.
+        Workers(const_cast<FitterBase &>(*this)).leastSquareDerivatives(tripletList, grad);
+    }
+}
+
+std::vector<Chi2Statistic> FitterBase::computeImageChi2InProcesses() const {
+    if (_workers) return _workers->computeImageChi2();
+    return Workers(const_cast<FitterBase &>(*this)).computeImageChi2();
+}
+
+std::size_t FitterBase::countTriplets() const {
+    std::size_t count = 0;
+    for (auto const &ccdImage : _associations->getCcdImageList()) {
+        count += countTripletsMeasurement(*ccdImage);
+    }
+    count += countTripletsReference(_associations->fittedStarList);
+    return count;
+}
+
 void FitterBase::saveChi2Contributions(std::string const &baseName) const {
     /* cook-up 2 different file names by inserting something just before
    the dot (if any), and within the actual file name. */
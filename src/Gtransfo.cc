@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <iomanip>
 #include <iterator> /* for ostream_iterator */
 #include <limits>
+#include <cmath>
 #include <math.h>  // for sin and cos and may be others
 #include <fstream>
+#include <numeric>
 #include "assert.h"
 #include <sstream>
 
@@ -794,52 +798,187 @@ static GtransfoLin shiftAndNormalize(StarMatchList const &starMatchList) {
 
 static double sq(double x) { return x * x; }
 
-double GtransfoPoly::computeFit(StarMatchList const &starMatchList, Gtransfo const &shiftToCenter,
-                                const bool useErrors) {
-    Eigen::MatrixXd A(2 * _nterms, 2 * _nterms);
-    A.setZero();
-    Eigen::VectorXd B(2 * _nterms);
-    B.setZero();
-    double sumr2 = 0;
-    double monomials[_nterms];
-    for (auto it = starMatchList.begin(); it != starMatchList.end(); ++it) {
-        const StarMatch &a_match = *it;
-        Point tmp = shiftToCenter.apply(a_match.point1);
-        FatPoint point1(tmp, a_match.point1.vx, a_match.point1.vy, a_match.point1.vxy);
-        FatPoint const &point2 = a_match.point2;
-        double wxx, wyy, wxy;
-        FatPoint tr1;
-        computeMonomials(point1.x, point1.y, monomials);
-        if (useErrors) {
-            transformPosAndErrors(point1, tr1);  // we might consider recycling the monomials
-            double vxx = (tr1.vx + point2.vx);
-            double vyy = (tr1.vy + point2.vy);
-            double vxy = (tr1.vxy + point2.vxy);
-            double det = vxx * vyy - vxy * vxy;
-            wxx = vyy / det;
-            wyy = vxx / det;
-            wxy = -vxy / det;
-        } else {
-            wxx = wyy = 1;
-            wxy = 0;
-            apply(point1.x, point1.y, tr1.x, tr1.y);
+struct GtransfoPoly::FitDesign {
+    // the monomials of the shifted point1 of each match, one column per match.
+    Eigen::MatrixXd monomials;
+    // their derivatives w.r.t. x and y, to propagate the point1 errors (weighted passes only).
+    Eigen::MatrixXd xDerivatives;
+    Eigen::MatrixXd yDerivatives;
+    // (x, y) of point2, and (vx, vy, vxy) of point1 and point2.
+    Eigen::Matrix2Xd position2;
+    Eigen::Matrix3Xd variance1;
+    Eigen::Matrix3Xd variance2;
+};
+
+struct GtransfoPoly::NormalEquations {
+    // the lower triangle of the normal matrix.
+    Eigen::MatrixXd A;
+    // the weight matrix of each match.
+    Eigen::ArrayXd wxx, wyy, wxy;
+};
+
+namespace {
+// The derivatives of the monomials of GtransfoPoly::computeMonomials, as in
+// GtransfoPoly::transformPosAndErrors.
+void computeMonomialDerivatives(unsigned order, double xIn, double yIn, double *dermx, double *dermy) {
+    double xx = 1;
+    double xxm1 = 1;  // xx^(ix-1)
+    for (unsigned ix = 0; ix <= order; ++ix) {
+        unsigned k = (ix) * (ix + 1) / 2;
+        // iy = 0
+        dermx[k] = ix * xxm1;
+        dermy[k] = 0;
+        k += ix + 2;
+        double yy = yIn;
+        double yym1 = 1;  // yy^(iy-1)
+        for (unsigned iy = 1; iy <= order - ix; ++iy) {
+            dermx[k] = ix * xxm1 * yy;
+            dermy[k] = iy * xx * yym1;
+            yym1 *= yIn;
+            yy *= yIn;
+            k += ix + iy + 2;
         }
-        double resx = point2.x - tr1.x;
-        double resy = point2.y - tr1.y;
-        sumr2 += wxx * sq(resx) + wyy * sq(resy) + 2 * wxy * resx * resy;
-
-        double bxcoeff = wxx * resx + wxy * resy;
-        double bycoeff = wyy * resy + wxy * resx;
-        for (unsigned j = 0; j < _nterms; ++j) {
-            for (unsigned i = j; i < _nterms; ++i) {
-                A(i, j) += wxx * monomials[i] * monomials[j];
-                A(i + _nterms, j + _nterms) += wyy * monomials[i] * monomials[j];
-                A(j, i + _nterms) = A(i, j + _nterms) += wxy * monomials[i] * monomials[j];
-            }
-            B(j) += bxcoeff * monomials[j];
-            B(j + _nterms) += bycoeff * monomials[j];
+        xx *= xIn;
+        if (ix >= 1) xxm1 *= xIn;
+    }
+}
+
+// Number of matches per rank-k update of the normal matrix: their scaled monomials stay in cache.
+Eigen::Index const fitBlockSize = 256;
+
+// The weight matrix of each residual, the inverse of the sum of the point2 covariance and the point1
+// covariance propagated through the jacobian (a11 a12, a21 a22) of the transfo at point1.
+void computeResidualWeights(Eigen::ArrayXd const &a11, Eigen::ArrayXd const &a12, Eigen::ArrayXd const &a21,
+                            Eigen::ArrayXd const &a22, Eigen::Matrix3Xd const &variance1,
+                            Eigen::Matrix3Xd const &variance2, Eigen::ArrayXd &wxx, Eigen::ArrayXd &wyy,
+                            Eigen::ArrayXd &wxy) {
+    Eigen::ArrayXd vx1 = variance1.row(0).transpose();
+    Eigen::ArrayXd vy1 = variance1.row(1).transpose();
+    Eigen::ArrayXd vxy1 = variance1.row(2).transpose();
+    Eigen::ArrayXd vxx =
+            a11 * (a11 * vx1 + 2 * a12 * vxy1) + a12 * a12 * vy1 + variance2.row(0).transpose().array();
+    Eigen::ArrayXd vyy =
+            a21 * a21 * vx1 + a22 * a22 * vy1 + 2. * a21 * a22 * vxy1 + variance2.row(1).transpose().array();
+    Eigen::ArrayXd vxy = a21 * a11 * vx1 + a22 * a12 * vy1 + (a21 * a12 + a11 * a22) * vxy1 +
+                         variance2.row(2).transpose().array();
+    Eigen::ArrayXd det = vxx * vyy - vxy * vxy;
+    wxx = vyy / det;
+    wyy = vxx / det;
+    wxy = -vxy / det;
+}
+
+// Add alpha times the normal matrix of the matches whose monomials are the columns of monomials to the lower
+// triangle of A. The x-x and y-y blocks are symmetric rank-k updates of the monomials scaled by the square
+// roots of the weights; the x-y block is only there with correlated errors.
+void updateNormalMatrix(Eigen::Ref<Eigen::MatrixXd const> const &monomials, Eigen::ArrayXd const &wxx,
+                        Eigen::ArrayXd const &wyy, Eigen::ArrayXd const &wxy, double alpha,
+                        Eigen::MatrixXd &A) {
+    Eigen::Index const nterms = monomials.rows();
+    Eigen::Index const nMatches = monomials.cols();
+    bool const crossTerms = (wxy != 0).any();
+    Eigen::ArrayXd sqrtWxx = wxx.sqrt();
+    Eigen::ArrayXd sqrtWyy = wyy.sqrt();
+    Eigen::MatrixXd scaled(nterms, std::min(fitBlockSize, nMatches));
+    for (Eigen::Index start = 0; start < nMatches; start += fitBlockSize) {
+        Eigen::Index const count = std::min(fitBlockSize, nMatches - start);
+        auto block = monomials.middleCols(start, count);
+        scaled.leftCols(count).noalias() = block * sqrtWxx.segment(start, count).matrix().asDiagonal();
+        A.topLeftCorner(nterms, nterms)
+                .selfadjointView<Eigen::Lower>()
+                .rankUpdate(scaled.leftCols(count), alpha);
+        scaled.leftCols(count).noalias() = block * sqrtWyy.segment(start, count).matrix().asDiagonal();
+        A.bottomRightCorner(nterms, nterms)
+                .selfadjointView<Eigen::Lower>()
+                .rankUpdate(scaled.leftCols(count), alpha);
+        if (crossTerms) {
+            scaled.leftCols(count).noalias() = block * wxy.segment(start, count).matrix().asDiagonal();
+            A.bottomLeftCorner(nterms, nterms).noalias() +=
+                    alpha * scaled.leftCols(count) * block.transpose();
+        }
+    }
+}
+
+// The median of values, which are reordered.
+double computeMedian(std::vector<double> &values) {
+    std::size_t const half = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + half, values.end());
+    if (values.size() & 1) return values[half];
+    // the lower middle value is the largest of the lower half.
+    return 0.5 * (*std::max_element(values.begin(), values.begin() + half) + values[half]);
+}
+
+// The groups of (at least 2) indices of the elements of stars that point to the same star.
+std::vector<std::vector<Eigen::Index>> findSharedStars(std::vector<BaseStar const *> const &stars) {
+    std::vector<Eigen::Index> order(stars.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&stars](Eigen::Index i, Eigen::Index j) {
+        return std::less<BaseStar const *>()(stars[i], stars[j]);
+    });
+    std::vector<std::vector<Eigen::Index>> groups;
+    for (std::size_t first = 0, last; first < order.size(); first = last) {
+        for (last = first + 1; last < order.size() && stars[order[last]] == stars[order[first]]; ++last)
+            ;
+        if (last - first > 1) groups.emplace_back(order.begin() + first, order.begin() + last);
+    }
+    return groups;
+}
+}  // namespace
+
+void GtransfoPoly::computeFitDesign(StarMatchList const &starMatchList, Gtransfo const &shiftToCenter,
+                                    bool withDerivatives, FitDesign &design) const {
+    Eigen::Index const nMatches = starMatchList.size();
+    design.monomials.resize(_nterms, nMatches);
+    if (withDerivatives) {
+        design.xDerivatives.resize(_nterms, nMatches);
+        design.yDerivatives.resize(_nterms, nMatches);
+    }
+    design.position2.resize(2, nMatches);
+    design.variance1.resize(3, nMatches);
+    design.variance2.resize(3, nMatches);
+    Eigen::Index k = 0;
+    for (auto const &match : starMatchList) {
+        // NOTE: the point1 errors are not transformed by shiftToCenter, as they never were.
+        Point point1 = shiftToCenter.apply(match.point1);
+        computeMonomials(point1.x, point1.y, design.monomials.col(k).data());
+        if (withDerivatives) {
+            computeMonomialDerivatives(_order, point1.x, point1.y, design.xDerivatives.col(k).data(),
+                                       design.yDerivatives.col(k).data());
         }
-    }  // end loop on points
+        design.position2.col(k) << match.point2.x, match.point2.y;
+        design.variance1.col(k) << match.point1.vx, match.point1.vy, match.point1.vxy;
+        design.variance2.col(k) << match.point2.vx, match.point2.vy, match.point2.vxy;
+        ++k;
+    }
+}
+
+double GtransfoPoly::computeFit(FitDesign const &design, bool useErrors, NormalEquations *normal) {
+    Eigen::Index const nMatches = design.monomials.cols();
+    Eigen::Map<Eigen::VectorXd const> xCoeffs(_coeffs.data(), _nterms);
+    Eigen::Map<Eigen::VectorXd const> yCoeffs(_coeffs.data() + _nterms, _nterms);
+
+    // The residuals to the current coefficients, and the weight matrix of each match.
+    Eigen::ArrayXd resx = design.position2.row(0).transpose() - design.monomials.transpose() * xCoeffs;
+    Eigen::ArrayXd resy = design.position2.row(1).transpose() - design.monomials.transpose() * yCoeffs;
+    Eigen::ArrayXd wxx, wyy, wxy;
+    if (useErrors) {
+        // the jacobian of the current transfo at each point1, to propagate its errors.
+        Eigen::ArrayXd a11 = design.xDerivatives.transpose() * xCoeffs;
+        Eigen::ArrayXd a12 = design.yDerivatives.transpose() * xCoeffs;
+        Eigen::ArrayXd a21 = design.xDerivatives.transpose() * yCoeffs;
+        Eigen::ArrayXd a22 = design.yDerivatives.transpose() * yCoeffs;
+        computeResidualWeights(a11, a12, a21, a22, design.variance1, design.variance2, wxx, wyy, wxy);
+    } else {
+        wxx = wyy = Eigen::ArrayXd::Ones(nMatches);
+        wxy = Eigen::ArrayXd::Zero(nMatches);
+    }
+    double sumr2 = (wxx * resx.square() + wyy * resy.square() + 2 * wxy * resx * resy).sum();
+
+    Eigen::VectorXd B(2 * _nterms);
+    B.head(_nterms).noalias() = design.monomials * (wxx * resx + wxy * resy).matrix();
+    B.tail(_nterms).noalias() = design.monomials * (wyy * resy + wxy * resx).matrix();
+
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(2 * _nterms, 2 * _nterms);
+    updateNormalMatrix(design.monomials, wxx, wyy, wxy, 1., A);
     Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> factor(A);
     // should probably throw
     if (factor.info() != Eigen::Success) {
@@ -849,8 +988,15 @@ double GtransfoPoly::computeFit(StarMatchList const &starMatchList, Gtransfo con
 
     Eigen::VectorXd sol = factor.solve(B);
     for (unsigned k = 0; k < 2 * _nterms; ++k) _coeffs[k] += sol(k);
-    if (starMatchList.size() == _nterms) return 0;
-    return (sumr2 - B.dot(sol));
+    double chi2 = sumr2 - B.dot(sol);
+    if (normal != nullptr) {
+        normal->A = std::move(A);
+        normal->wxx = std::move(wxx);
+        normal->wyy = std::move(wyy);
+        normal->wxy = std::move(wxy);
+    }
+    if (nMatches == _nterms) return 0;
+    return chi2;
 }
 
 double GtransfoPoly::fit(StarMatchList const &starMatchList) {
@@ -861,16 +1007,265 @@ double GtransfoPoly::fit(StarMatchList const &starMatchList) {
     }
 
     GtransfoPoly conditionner = shiftAndNormalize(starMatchList);
+    // The monomials do not depend on the coefficients: all the passes share them.
+    FitDesign design;
+    computeFitDesign(starMatchList, conditionner, true, design);
 
-    computeFit(starMatchList, conditionner, false);               // get a rough solution
-    computeFit(starMatchList, conditionner, true);                // weight with it
-    double chi2 = computeFit(starMatchList, conditionner, true);  // once more
+    computeFit(design, false);               // get a rough solution
+    computeFit(design, true);                // weight with it
+    double chi2 = computeFit(design, true);  // once more
 
     (*this) = (*this) * conditionner;
     if (starMatchList.size() == _nterms) return 0;
     return chi2;
 }
 
+double GtransfoPoly::refit(StarMatchList const &starMatchList) {
+    if (starMatchList.size() < _nterms) {
+        LOGLS_FATAL(_log, "GtransfoPoly::refit trying to fit a polynomial transfo of order "
+                                  << _order << " with only " << starMatchList.size() << " matches.");
+        return -1;
+    }
+
+    GtransfoLin conditionner = shiftAndNormalize(starMatchList);
+    FitDesign design;
+    computeFitDesign(starMatchList, conditionner, true, design);
+
+    // The current coefficients, expressed in the conditioned coordinates, replace the rough solution.
+    (*this) = (*this) * conditionner.invert();
+    computeFit(design, true);
+    double chi2 = computeFit(design, true);
+
+    (*this) = (*this) * conditionner;
+    if (starMatchList.size() == _nterms) return 0;
+    return chi2;
+}
+
+double GtransfoPoly::fitWithClipping(StarMatchList const &starMatchList, double nSigmas,
+                                     std::vector<bool> &kept, std::vector<double> &chi2s) {
+    Eigen::Index const nMatches = starMatchList.size();
+    kept.assign(nMatches, true);
+    chi2s.assign(nMatches, -1);
+    if (nMatches <= 2) return -1;
+    if (starMatchList.size() < _nterms) {
+        LOGLS_FATAL(_log, "GtransfoPoly::fitWithClipping trying to fit a polynomial transfo of order "
+                                  << _order << " with only " << starMatchList.size() << " matches.");
+        return -1;
+    }
+
+    GtransfoLin conditionner = shiftAndNormalize(starMatchList);
+    FitDesign design;
+    computeFitDesign(starMatchList, conditionner, true, design);
+    std::vector<BaseStar const *> stars1, stars2;
+    stars1.reserve(nMatches);
+    stars2.reserve(nMatches);
+    for (auto const &match : starMatchList) {
+        stars1.push_back(match.s1.get());
+        stars2.push_back(match.s2.get());
+    }
+    // the groups of matches among which only the closest one may be kept, as in removeAmbiguities().
+    std::vector<std::vector<Eigen::Index>> ambiguities1 = findSharedStars(stars1);
+    std::vector<std::vector<Eigen::Index>> ambiguities2 = findSharedStars(stars2);
+
+    computeFit(design, false);
+    computeFit(design, true);
+    NormalEquations normal;
+    double chi2 = computeFit(design, true, &normal);
+    if (chi2 < 0) {
+        // the normal equations could not be factorized, and were not kept.
+        (*this) = (*this) * conditionner;
+        return chi2;
+    }
+
+    // From now on the weights stay those of the last pass, so that the normal equations of the coefficients
+    // themselves (rather than of their offsets) are sums over the matches, from which the discarded ones are
+    // subtracted.
+    Eigen::Map<Eigen::VectorXd> coeffs(_coeffs.data(), 2 * _nterms);
+    Eigen::Map<Eigen::VectorXd const> xCoeffs(_coeffs.data(), _nterms);
+    Eigen::Map<Eigen::VectorXd const> yCoeffs(_coeffs.data() + _nterms, _nterms);
+    Eigen::VectorXd rhs = normal.A.selfadjointView<Eigen::Lower>() * coeffs;
+
+    Eigen::Index nKept = nMatches;
+    bool downdated = false;
+    std::vector<double> keptChi2s;
+    keptChi2s.reserve(nMatches);
+    std::vector<Eigen::Index> discarded;
+    Eigen::ArrayXd resx, resy, wxx, wyy, wxy;
+    // The residuals and the chi2s of StarMatch::computeChi2 of the kept matches to the current coefficients:
+    // the point1 errors are propagated through the jacobian of the transfo applied to unconditioned
+    // coordinates.
+    bool chi2sCurrent = false;
+    auto computeMatchChi2s = [&]() {
+        resx = design.position2.row(0).transpose() - design.monomials.transpose() * xCoeffs;
+        resy = design.position2.row(1).transpose() - design.monomials.transpose() * yCoeffs;
+        double const xScale = conditionner.A11();
+        double const yScale = conditionner.A22();
+        Eigen::ArrayXd a11 = (design.xDerivatives.transpose() * xCoeffs).array() * xScale;
+        Eigen::ArrayXd a12 = (design.yDerivatives.transpose() * xCoeffs).array() * yScale;
+        Eigen::ArrayXd a21 = (design.xDerivatives.transpose() * yCoeffs).array() * xScale;
+        Eigen::ArrayXd a22 = (design.yDerivatives.transpose() * yCoeffs).array() * yScale;
+        computeResidualWeights(a11, a12, a21, a22, design.variance1, design.variance2, wxx, wyy, wxy);
+        for (Eigen::Index i = 0; i < nMatches; ++i) {
+            if (!kept[i]) continue;
+            chi2s[i] = wxx[i] * sq(resx[i]) + wyy[i] * sq(resy[i]) + 2 * wxy[i] * resx[i] * resy[i];
+        }
+        chi2sCurrent = true;
+    };
+    while (chi2 > 0) {
+        computeMatchChi2s();
+        if (downdated) {
+            chi2 = 0;
+            for (Eigen::Index i = 0; i < nMatches; ++i) {
+                if (!kept[i]) continue;
+                chi2 += normal.wxx[i] * sq(resx[i]) + normal.wyy[i] * sq(resy[i]) +
+                        2 * normal.wxy[i] * resx[i] * resy[i];
+            }
+            if (chi2 <= 0) break;
+        }
+        keptChi2s.clear();
+        for (Eigen::Index i = 0; i < nMatches; ++i) {
+            if (kept[i]) keptChi2s.push_back(chi2s[i]);
+        }
+        double const cut = sq(nSigmas) * computeMedian(keptChi2s);
+
+        // as chi2_cleanup in StarMatch.cc: the ambiguities go first, then the outliers.
+        discarded.clear();
+        auto discard = [&](Eigen::Index i) {
+            kept[i] = false;
+            chi2s[i] = -1;
+            discarded.push_back(i);
+        };
+        for (auto const *groups : {&ambiguities1, &ambiguities2}) {
+            for (auto const &group : *groups) {
+                Eigen::Index closest = -1;
+                for (Eigen::Index i : group) {
+                    if (!kept[i]) continue;
+                    if (closest < 0 || sq(resx[i]) + sq(resy[i]) < sq(resx[closest]) + sq(resy[closest])) {
+                        closest = i;
+                    }
+                }
+                for (Eigen::Index i : group) {
+                    if (kept[i] && i != closest) discard(i);
+                }
+            }
+        }
+        for (Eigen::Index i = 0; i < nMatches; ++i) {
+            if (kept[i] && chi2s[i] > cut) discard(i);
+        }
+        if (discarded.empty()) break;
+        nKept -= discarded.size();
+        if (nKept <= 2 || nKept < _nterms) {
+            chi2 = -1;
+            break;
+        }
+
+        // Downdate the normal equations with the packed terms of the discarded matches, and solve again.
+        Eigen::Index const nDiscarded = discarded.size();
+        Eigen::MatrixXd monomials(_nterms, nDiscarded);
+        Eigen::ArrayXd dwxx(nDiscarded), dwyy(nDiscarded), dwxy(nDiscarded), x2(nDiscarded), y2(nDiscarded);
+        for (Eigen::Index j = 0; j < nDiscarded; ++j) {
+            Eigen::Index const i = discarded[j];
+            monomials.col(j) = design.monomials.col(i);
+            dwxx[j] = normal.wxx[i];
+            dwyy[j] = normal.wyy[i];
+            dwxy[j] = normal.wxy[i];
+            x2[j] = design.position2(0, i);
+            y2[j] = design.position2(1, i);
+        }
+        updateNormalMatrix(monomials, dwxx, dwyy, dwxy, -1., normal.A);
+        rhs.head(_nterms).noalias() -= monomials * (dwxx * x2 + dwxy * y2).matrix();
+        rhs.tail(_nterms).noalias() -= monomials * (dwyy * y2 + dwxy * x2).matrix();
+        Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> factor(normal.A);
+        if (factor.info() != Eigen::Success) {
+            LOGL_ERROR(_log, "GtransfoPoly::fitWithClipping could not factorize");
+            chi2 = -1;
+            break;
+        }
+        coeffs = factor.solve(rhs);
+        chi2sCurrent = false;
+        if (nKept == _nterms) {
+            chi2 = 0;
+            break;
+        }
+        downdated = true;
+    }
+    // whichever way the clipping stopped, the chi2s are those of the returned transfo.
+    if (!chi2sCurrent) computeMatchChi2s();
+
+    (*this) = (*this) * conditionner;
+    return chi2;
+}
+
+std::vector<PolyOrderScore> GtransfoPoly::compareOrders(StarMatchList const &starMatchList,
+                                                        unsigned minOrder, unsigned maxOrder,
+                                                        std::string const &criterion) {
+    if (criterion != "BIC" && criterion != "AIC") {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "Unknown information criterion: " + criterion + "; expected BIC or AIC");
+    }
+    if (minOrder == 0 || minOrder > maxOrder) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "Invalid order range: [" + std::to_string(minOrder) + ", " +
+                                  std::to_string(maxOrder) + "]");
+    }
+    std::vector<PolyOrderScore> scores;
+    if (starMatchList.size() < 3) return scores;
+
+    GtransfoLin conditionner = shiftAndNormalize(starMatchList);
+    // The targets are taken relative to their best linear fit, which all the compared polynomials contain:
+    // this leaves the chi2s unchanged, and avoids computing them as differences of large numbers.
+    GtransfoPoly linear(1);
+    FitDesign linearDesign;
+    linear.computeFitDesign(starMatchList, conditionner, false, linearDesign);
+    linear.computeFit(linearDesign, false);
+
+    GtransfoPoly poly(maxOrder);
+    unsigned const nterms = poly._nterms;
+    Eigen::MatrixXd ax = Eigen::MatrixXd::Zero(nterms, nterms);
+    Eigen::MatrixXd ay = Eigen::MatrixXd::Zero(nterms, nterms);
+    Eigen::VectorXd bx = Eigen::VectorXd::Zero(nterms);
+    Eigen::VectorXd by = Eigen::VectorXd::Zero(nterms);
+    double cx = 0;
+    double cy = 0;
+    Eigen::VectorXd monomials(nterms);
+    for (auto const &match : starMatchList) {
+        Point point1 = conditionner.apply(match.point1);
+        FatPoint const &point2 = match.point2;
+        poly.computeMonomials(point1.x, point1.y, monomials.data());
+        Point linearFit = linear.apply(point1);
+        double resx = point2.x - linearFit.x;
+        double resy = point2.y - linearFit.y;
+        double wx = (point2.vx > 0) ? 1. / point2.vx : 1.;
+        double wy = (point2.vy > 0) ? 1. / point2.vy : 1.;
+        ax.selfadjointView<Eigen::Lower>().rankUpdate(monomials, wx);
+        ay.selfadjointView<Eigen::Lower>().rankUpdate(monomials, wy);
+        bx += (wx * resx) * monomials;
+        by += (wy * resy) * monomials;
+        cx += wx * sq(resx);
+        cy += wy * sq(resy);
+    }
+
+    double const nData = 2. * starMatchList.size();
+    for (unsigned order = minOrder; order <= maxOrder; ++order) {
+        unsigned n = (order + 1) * (order + 2) / 2;
+        if (n > starMatchList.size()) break;
+        Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> factorX(ax.topLeftCorner(n, n));
+        Eigen::LDLT<Eigen::MatrixXd, Eigen::Lower> factorY(ay.topLeftCorner(n, n));
+        if (factorX.info() != Eigen::Success || factorY.info() != Eigen::Success) {
+            LOGLS_WARN(_log, "GtransfoPoly::compareOrders could not factorize the normal equations of order "
+                                     << order);
+            break;
+        }
+        double chi2 = cx - bx.head(n).dot(factorX.solve(bx.head(n))) + cy -
+                      by.head(n).dot(factorY.solve(by.head(n)));
+        unsigned nPar = 2 * n;
+        double penalty = (criterion == "BIC") ? nPar * std::log(nData) : 2. * nPar;
+        chi2 = std::max(chi2, 0.);
+        scores.push_back({order, nPar, chi2, chi2 + penalty});
+    }
+    return scores;
+}
+
 std::unique_ptr<Gtransfo> GtransfoPoly::composeAndReduce(GtransfoPoly const &right) const {
     if (getOrder() == 1 && right.getOrder() == 1)
         return std::make_unique<GtransfoLin>((*this) * (right));  // does the composition
@@ -878,123 +1273,116 @@ std::unique_ptr<Gtransfo> GtransfoPoly::composeAndReduce(GtransfoPoly const &rig
         return std::make_unique<GtransfoPoly>((*this) * (right));  // does the composition
 }
 
-/*  PolyXY the class used to perform polynomial algebra (and in
-    particular composition) at the coefficient level. This class
-    handles a single polynomial, while a GtransfoPoly is a couple of
-    polynomials. This class does not have any routine to evaluate
-    polynomials. Efficiency is not a concern since these routines are
-    seldom used.  There is no need to expose this tool class to
-    Gtransfo users.
+/*  Polynomial algebra at the coefficient level, for the composition of GtransfoPoly's. A polynomial of
+    (x,y) is a flat array of its coefficients, in the order of the monomials of GtransfoPoly (by total degree,
+    then by power of y), in long double. There is no need to expose this to Gtransfo users.
 */
+namespace {
 
-class PolyXY {
-    unsigned order;
-    unsigned nterms;
-    vector<long double> coeffs;
+// The number of monomials of total degree up to order.
+unsigned nTermsOfOrder(unsigned order) { return (order + 1) * (order + 2) / 2; }
 
+// Products of polynomials, truncated to the monomials of total degree up to maxOrder, whose exponents are
+// tabulated once.
+class TruncatedPolyAlgebra {
 public:
-    PolyXY(const int order) : order(order), nterms((order + 1) * (order + 2) / 2) {
-        coeffs.reserve(nterms);
-        coeffs.insert(coeffs.begin(), nterms, 0L);  // fill & initialize to 0.
+    explicit TruncatedPolyAlgebra(unsigned maxOrder) : _maxOrder(maxOrder) {
+        _degree.reserve(nTermsOfOrder(maxOrder));
+        _powY.reserve(nTermsOfOrder(maxOrder));
+        for (unsigned degree = 0; degree <= maxOrder; ++degree) {
+            for (unsigned py = 0; py <= degree; ++py) {
+                _degree.push_back(degree);
+                _powY.push_back(py);
+            }
+        }
     }
 
-    unsigned getOrder() const { return order; }
-
-    PolyXY(GtransfoPoly const &gtransfoPoly, const unsigned whichCoord)
-            : order(gtransfoPoly.getOrder()), nterms((order + 1) * (order + 2) / 2), coeffs(nterms, 0L) {
-        for (unsigned px = 0; px <= order; ++px)
-            for (unsigned py = 0; py <= order - px; ++py)
-                coeff(px, py) = gtransfoPoly.coeff(px, py, whichCoord);
+    // The order of the product of polynomials of orders order1 and order2.
+    unsigned productOrder(unsigned order1, unsigned order2) const {
+        return std::min(order1 + order2, _maxOrder);
     }
 
-    long double coeff(const unsigned powX, const unsigned powY) const {
-        assert(powX + powY <= order);
-        return coeffs.at((powX + powY) * (powX + powY + 1) / 2 + powY);
+    // result = p1*p2, p1 and p2 being of orders order1 and order2 (at most maxOrder).
+    void multiply(vector<long double> const &p1, unsigned order1, vector<long double> const &p2,
+                  unsigned order2, vector<long double> &result) const {
+        unsigned const order = productOrder(order1, order2);
+        result.assign(nTermsOfOrder(order), 0);
+        unsigned const nTerms1 = nTermsOfOrder(std::min(order1, order));
+        for (unsigned k1 = 0; k1 < nTerms1; ++k1) {
+            long double const c1 = p1[k1];
+            if (c1 == 0) continue;
+            unsigned const degree1 = _degree[k1];
+            unsigned const powY1 = _powY[k1];
+            // only the monomials of p2 that keep the product within order.
+            unsigned const nTerms2 = nTermsOfOrder(std::min(order2, order - degree1));
+            for (unsigned k2 = 0; k2 < nTerms2; ++k2) {
+                unsigned const degree = degree1 + _degree[k2];
+                result[degree * (degree + 1) / 2 + powY1 + _powY[k2]] += c1 * p2[k2];
+            }
+        }
     }
 
-    long double &coeff(const unsigned powX, const unsigned powY) {
-        assert(powX + powY <= order);
-        return coeffs.at((powX + powY) * (powX + powY + 1) / 2 + powY);
-    }
+private:
+    unsigned _maxOrder;
+    vector<unsigned> _degree;  // total degree of each monomial
+    vector<unsigned> _powY;    // power of y of each monomial
 };
 
-/* =====================  PolyXY Algebra routines ================== */
+}  // namespace
 
-static void operator+=(PolyXY &left, const PolyXY &right) {
-    unsigned rdeg = right.getOrder();
-    assert(left.getOrder() >= rdeg);
-    for (unsigned i = 0; i <= rdeg; ++i)
-        for (unsigned j = 0; j <= rdeg - i; ++j) left.coeff(i, j) += right.coeff(i, j);
-}
+GtransfoPoly GtransfoPoly::compose(GtransfoPoly const &right, unsigned maxOrder) const {
+    unsigned const order = std::min(maxOrder, _order * right._order);
+    TruncatedPolyAlgebra algebra(order);
 
-/* multiplication by a scalar */
-static PolyXY operator*(const long double &a, const PolyXY &polyXY) {
-    PolyXY result(polyXY);
-    // no direct access to coefficients: do it the soft way
-    unsigned order = polyXY.getOrder();
-    for (unsigned i = 0; i <= order; ++i)
-        for (unsigned j = 0; j <= order - i; ++j) result.coeff(i, j) *= a;
-    return result;
-}
+    // the powers of both polynomials of right, up to _order: powers[0][k] = rx^k, powers[1][k] = ry^k.
+    unsigned const rightOrder = std::min(right._order, order);
+    vector<unsigned> powerOrders(_order + 1, 0);
+    for (unsigned k = 1; k <= _order; ++k) {
+        powerOrders[k] = algebra.productOrder(powerOrders[k - 1], rightOrder);
+    }
+    vector<vector<long double>> powers[2];
+    for (unsigned which = 0; which < 2; ++which) {
+        auto begin = right._coeffs.begin() + which * right._nterms;
+        vector<long double> rightPoly(begin, begin + nTermsOfOrder(rightOrder));
+        powers[which].resize(_order + 1);
+        powers[which][0].assign(1, 1.L);
+        for (unsigned k = 1; k <= _order; ++k) {
+            algebra.multiply(powers[which][k - 1], powerOrders[k - 1], rightPoly, rightOrder,
+                             powers[which][k]);
+        }
+    }
 
-/*! result(x,y) = p1(x,y)*p2(x,y) */
-static PolyXY product(const PolyXY &p1, const PolyXY &p2) {
-    unsigned deg1 = p1.getOrder();
-    unsigned deg2 = p2.getOrder();
-    PolyXY result(deg1 + deg2);
-    for (unsigned i1 = 0; i1 <= deg1; ++i1)
-        for (unsigned j1 = 0; j1 <= deg1 - i1; ++j1)
-            for (unsigned i2 = 0; i2 <= deg2; ++i2)
-                for (unsigned j2 = 0; j2 <= deg2 - i2; ++j2)
-                    result.coeff(i1 + i2, j1 + j2) += p1.coeff(i1, j1) * p2.coeff(i2, j2);
-    return result;
-}
+    // this(rx, ry) = sum_px rx^px * (sum_py c(px, py) ry^py): the inner sums are linear combinations of the
+    // powers of ry, which leaves a single product per power of rx and coordinate.
+    vector<long double> composed[2] = {vector<long double>(nTermsOfOrder(order), 0),
+                                       vector<long double>(nTermsOfOrder(order), 0)};
+    vector<long double> inner, product;
+    for (unsigned px = 0; px <= _order; ++px) {
+        unsigned const innerOrder = powerOrders[_order - px];
+        for (unsigned which = 0; which < 2; ++which) {
+            inner.assign(nTermsOfOrder(innerOrder), 0);
+            for (unsigned py = 0; py <= _order - px; ++py) {
+                long double const c = coeff(px, py, which);
+                if (c == 0) continue;
+                auto const &power = powers[1][py];
+                for (std::size_t k = 0; k < power.size(); ++k) inner[k] += c * power[k];
+            }
+            algebra.multiply(powers[0][px], powerOrders[px], inner, innerOrder, product);
+            for (std::size_t k = 0; k < product.size(); ++k) composed[which][k] += product[k];
+        }
+    }
 
-/* powers[k](x,y) = polyXY(x,y)**k, 0 <= k <= maxP */
-static void computePowers(const PolyXY &polyXY, const unsigned maxP, vector<PolyXY> &powers) {
-    powers.reserve(maxP + 1);
-    powers.push_back(PolyXY(0));
-    powers[0].coeff(0, 0) = 1L;
-    for (unsigned k = 1; k <= maxP; ++k) powers.push_back(product(powers[k - 1], polyXY));
-}
-
-/*! result(x,y) = polyXY(polyX(x,y),polyY(x,y)) */
-static PolyXY composition(const PolyXY &polyXY, const PolyXY &polyX, const PolyXY &polyY) {
-    unsigned pdeg = polyXY.getOrder();
-    PolyXY result(pdeg * max(polyX.getOrder(), polyY.getOrder()));
-    vector<PolyXY> pXPowers;
-    vector<PolyXY> pYPowers;
-    computePowers(polyX, pdeg, pXPowers);
-    computePowers(polyY, pdeg, pYPowers);
-    for (unsigned px = 0; px <= pdeg; ++px)
-        for (unsigned py = 0; py <= pdeg - px; ++py)
-            result += polyXY.coeff(px, py) * product(pXPowers.at(px), pYPowers.at(py));
+    GtransfoPoly result(order);
+    for (unsigned which = 0; which < 2; ++which) {
+        for (unsigned k = 0; k < result._nterms; ++k) {
+            result._coeffs[k + which * result._nterms] = composed[which][k];
+        }
+    }
     return result;
 }
 
-/* ===================== end of  PolyXY Algebra routines ============= */
-
-/* reducing polynomial composition is the reason for PolyXY stuff : */
-
 GtransfoPoly GtransfoPoly::operator*(GtransfoPoly const &right) const {
-    // split each transfo into 2d polynomials
-    PolyXY plx(*this, 0);
-    PolyXY ply(*this, 1);
-    PolyXY prx(right, 0);
-    PolyXY pry(right, 1);
-
-    // compute the compositions
-    PolyXY rx(composition(plx, prx, pry));
-    PolyXY ry(composition(ply, prx, pry));
-
-    // copy the results the hard way.
-    GtransfoPoly result(_order * right._order);
-    for (unsigned px = 0; px <= result._order; ++px)
-        for (unsigned py = 0; py <= result._order - px; ++py) {
-            result.coeff(px, py, 0) = rx.coeff(px, py);
-            result.coeff(px, py, 1) = ry.coeff(px, py);
-        }
-    return result;
+    return compose(right, _order * right._order);
 }
 
 GtransfoPoly GtransfoPoly::operator+(GtransfoPoly const &right) const {
@@ -1,20 +1,26 @@
 #include <iostream>
 #include <cmath>
+#include <complex>
 #include <list>
 #include <memory>
 #include <algorithm>
+#include <vector>
 #ifndef M_PI
 #define M_PI 3.14159265358979323846 /* pi */
 #endif
 
 #include "lsst/log/Log.h"
+#include "lsst/pex/exceptions.h"
 #include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/CcdImage.h"
+#include "lsst/jointcal/MeasuredStar.h"
 #include "lsst/jointcal/StarMatch.h"
 #include "lsst/jointcal/Gtransfo.h"
 #include "lsst/jointcal/Histo2d.h"
 #include "lsst/jointcal/Histo4d.h"
 #include "lsst/jointcal/FastFinder.h"
 #include "lsst/jointcal/ListMatch.h"
+#include "lsst/jointcal/ProcessParallel.h"
 
 namespace {
 LOG_LOGGER _log = LOG_GET("jointcal.ListMatch");
@@ -39,8 +45,8 @@ struct Segment {
         s1rank = star1Rank;
         s1 = std::move(star1);
         s2 = std::move(star2);
-        Point P1 = gtransfo.apply(*star1);
-        Point P2 = gtransfo.apply(*star2);
+        Point P1 = gtransfo.apply(*s1);
+        Point P2 = gtransfo.apply(*s2);
         dx = P2.x - P1.x;
         dy = P2.y - P1.y;
         r = sqrt(dx * dx + dy * dy);
@@ -460,6 +466,27 @@ std::unique_ptr<GtransfoLin> listMatchupShift(const BaseStarList &list1, const B
 }
 #endif /*STORAGE*/
 
+// The matches collected through gtransfo followed by the shift (dx, dy), with their linear transfo refined.
+static std::unique_ptr<StarMatchList> fitShiftedMatches(const BaseStarList &list1, const BaseStarList &list2,
+                                                        const Gtransfo &gtransfo, double dx, double dy,
+                                                        double maxDist) {
+    GtransfoLinShift shift(dx, dy);
+    auto newGuess = gtransfoCompose(shift, gtransfo);
+    auto raw_matches = listMatchCollect(list1, list2, newGuess.get(), maxDist);
+    std::unique_ptr<StarMatchList> matches(new StarMatchList);
+    raw_matches->applyTransfo(*matches, &gtransfo);
+    matches->setTransfoOrder(1);
+    matches->refineTransfo(3.);
+    return matches;
+}
+
+static std::unique_ptr<GtransfoLin> bestShiftSolution(SolList &Solutions) {
+    Solutions.sort(DecreasingQuality);
+    std::unique_ptr<GtransfoLin> best(new GtransfoLin(*std::const_pointer_cast<GtransfoLin>(
+            std::dynamic_pointer_cast<const GtransfoLin>(Solutions.front()->getTransfo()))));
+    return best;
+}
+
 // timing : 140 ms for l1 of 1862 objects  and l2 of 2617 objects (450 MHz, "-O4") maxShift = 200.
 std::unique_ptr<GtransfoLin> listMatchupShift(const BaseStarList &list1, const BaseStarList &list2,
                                               const Gtransfo &gtransfo, double maxShift, double binSize) {
@@ -494,19 +521,220 @@ std::unique_ptr<GtransfoLin> listMatchupShift(const BaseStarList &list1, const B
         double dx = 0, dy = 0;
         double count = histo.maxBin(dx, dy);
         histo.fill(dx, dy, -count);  // zero the maxbin
-        GtransfoLinShift shift(dx, dy);
-        auto newGuess = gtransfoCompose(shift, gtransfo);
-        auto raw_matches = listMatchCollect(list1, list2, newGuess.get(), binSizeNew);
-        std::unique_ptr<StarMatchList> matches(new StarMatchList);
-        raw_matches->applyTransfo(*matches, &gtransfo);
-        matches->setTransfoOrder(1);
-        matches->refineTransfo(3.);
-        Solutions.push_back(std::move(matches));
+        Solutions.push_back(fitShiftedMatches(list1, list2, gtransfo, dx, dy, binSizeNew));
     }
-    Solutions.sort(DecreasingQuality);
-    std::unique_ptr<GtransfoLin> best(new GtransfoLin(*std::const_pointer_cast<GtransfoLin>(
-            std::dynamic_pointer_cast<const GtransfoLin>(Solutions.front()->getTransfo()))));
-    return best;
+    return bestShiftSolution(Solutions);
+}
+
+namespace {
+
+// In-place radix-2 FFT of the n values at data, n being a power of 2. twiddles holds the n/2 factors
+// exp(-+2 i pi k / n) of the direction of the transform, which is not normalized.
+void fft(std::complex<double> *data, std::size_t n, std::vector<std::complex<double>> const &twiddles) {
+    for (std::size_t i = 1, j = 0; i < n; ++i) {  // bit reversal permutation
+        std::size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(data[i], data[j]);
+    }
+    for (std::size_t length = 2; length <= n; length <<= 1) {
+        std::size_t const half = length / 2;
+        std::size_t const stride = n / length;
+        for (std::size_t start = 0; start < n; start += length) {
+            for (std::size_t k = 0; k < half; ++k) {
+                std::complex<double> const u = data[start + k];
+                std::complex<double> const v = data[start + k + half] * twiddles[k * stride];
+                data[start + k] = u + v;
+                data[start + k + half] = u - v;
+            }
+        }
+    }
+}
+
+std::vector<std::complex<double>> makeTwiddles(std::size_t n, bool inverse) {
+    std::vector<std::complex<double>> twiddles(n / 2);
+    for (std::size_t k = 0; k < n / 2; ++k) twiddles[k] = std::polar(1., (inverse ? 2 : -2) * M_PI * k / n);
+    return twiddles;
+}
+
+// In-place 2-d FFT of the nx*ny (powers of 2) values of image, stored row by row.
+void fft2d(std::vector<std::complex<double>> &image, std::size_t nx, std::size_t ny, bool inverse) {
+    auto xTwiddles = makeTwiddles(nx, inverse);
+    auto yTwiddles = makeTwiddles(ny, inverse);
+    for (std::size_t iy = 0; iy < ny; ++iy) fft(&image[iy * nx], nx, xTwiddles);
+    std::vector<std::complex<double>> column(ny);
+    for (std::size_t ix = 0; ix < nx; ++ix) {
+        for (std::size_t iy = 0; iy < ny; ++iy) column[iy] = image[iy * nx + ix];
+        fft(column.data(), ny, yTwiddles);
+        for (std::size_t iy = 0; iy < ny; ++iy) image[iy * nx + ix] = column[iy];
+    }
+}
+
+std::size_t nextPowerOf2(double size) {
+    std::size_t n = 1;
+    while (n < size) n <<= 1;
+    return n;
+}
+
+/*
+ * The stars of two lists, binned with linear interpolation onto a common nx*ny grid (powers of 2) large
+ * enough for the shifts up to maxShift between them not to wrap around, and the circular cross-correlation
+ * of the two images.
+ */
+class CorrelationGrid {
+public:
+    CorrelationGrid(std::vector<Point> const &points1, std::vector<Point> const &points2, double maxShift,
+                    std::size_t maxCells, double minBinSize) {
+        double xMin = points1.front().x, xMax = xMin, yMin = points1.front().y, yMax = yMin;
+        for (auto const *points : {&points1, &points2}) {
+            for (auto const &point : *points) {
+                xMin = std::min(xMin, point.x);
+                xMax = std::max(xMax, point.x);
+                yMin = std::min(yMin, point.y);
+                yMax = std::max(yMax, point.y);
+            }
+        }
+        // coarsen the bins by factors of 2 until the grid fits in maxCells.
+        _binSize = minBinSize;
+        do {
+            _xMin = xMin - _binSize;
+            _yMin = yMin - _binSize;
+            _nx = nextPowerOf2((xMax - xMin + maxShift) / _binSize + 3);
+            _ny = nextPowerOf2((yMax - yMin + maxShift) / _binSize + 3);
+            if (_nx * _ny <= maxCells) break;
+            _binSize *= 2;
+        } while (true);
+
+        // Both real images go in a single complex FFT, of image1 + i image2.
+        std::vector<std::complex<double>> image(_nx * _ny);
+        rasterize(points1, image, 1.);
+        rasterize(points2, image, std::complex<double>(0., 1.));
+        fft2d(image, _nx, _ny, false);
+        // Untangle the transforms F1 and F2 of the two images from Z = F1 + i F2, using the hermitian
+        // symmetry of the transforms of real images, and replace Z by conj(F1) F2.
+        for (std::size_t iy = 0; iy <= _ny / 2; ++iy) {
+            for (std::size_t ix = 0; ix < _nx; ++ix) {
+                std::size_t const k = iy * _nx + ix;
+                std::size_t const mk = ((_ny - iy) % _ny) * _nx + (_nx - ix) % _nx;
+                if (mk < k) continue;  // the pair is done
+                std::complex<double> const z = image[k], zm = std::conj(image[mk]);
+                std::complex<double> const f1 = 0.5 * (z + zm);
+                std::complex<double> const f2 = std::complex<double>(0., -0.5) * (z - zm);
+                image[k] = std::conj(f1) * f2;
+                image[mk] = std::conj(image[k]);  // the correlation is real
+            }
+        }
+        fft2d(image, _nx, _ny, true);
+        _correlation.resize(_nx * _ny);
+        for (std::size_t k = 0; k < _nx * _ny; ++k) _correlation[k] = image[k].real();
+    }
+
+    /**
+     * Pop the highest peak of the correlation within maxShift along each axis, and return its shift from
+     * points1 to points2 in shift; false if there is no peak left. The neighbouring bins of the peak go with
+     * it.
+     */
+    bool popPeak(double maxShift, Point &shift) {
+        int const maxLagX = std::min<int>(maxShift / _binSize, _nx / 2 - 1);
+        int const maxLagY = std::min<int>(maxShift / _binSize, _ny / 2 - 1);
+        double best = 0;
+        int bestX = 0, bestY = 0;
+        for (int lagY = -maxLagY; lagY <= maxLagY; ++lagY) {
+            for (int lagX = -maxLagX; lagX <= maxLagX; ++lagX) {
+                double const value = _correlation[index(lagX, lagY)];
+                if (value > best) {
+                    best = value;
+                    bestX = lagX;
+                    bestY = lagY;
+                }
+            }
+        }
+        if (best <= 0) return false;
+        for (int lagY = bestY - 1; lagY <= bestY + 1; ++lagY) {
+            for (int lagX = bestX - 1; lagX <= bestX + 1; ++lagX) _correlation[index(lagX, lagY)] = 0;
+        }
+        shift = Point(bestX * _binSize, bestY * _binSize);
+        return true;
+    }
+
+    double getBinSize() const { return _binSize; }
+
+private:
+    void rasterize(std::vector<Point> const &points, std::vector<std::complex<double>> &image,
+                   std::complex<double> weight) const {
+        for (auto const &point : points) {
+            double const u = (point.x - _xMin) / _binSize;
+            double const v = (point.y - _yMin) / _binSize;
+            std::size_t const ix = u;
+            std::size_t const iy = v;
+            double const tx = u - ix;
+            double const ty = v - iy;
+            std::size_t const k = iy * _nx + ix;
+            image[k] += weight * ((1 - tx) * (1 - ty));
+            image[k + 1] += weight * (tx * (1 - ty));
+            image[k + _nx] += weight * ((1 - tx) * ty);
+            image[k + _nx + 1] += weight * (tx * ty);
+        }
+    }
+
+    // the index of a lag (in bins) in the circular correlation.
+    std::size_t index(int lagX, int lagY) const {
+        int const nx = _nx, ny = _ny;
+        return ((lagY + ny) % ny) * _nx + (lagX + nx) % nx;
+    }
+
+    double _binSize;
+    std::size_t _nx, _ny;
+    double _xMin, _yMin;
+    std::vector<double> _correlation;
+};
+
+// The largest grid of the cross-correlation: 2 complex images of 512x512 take 8 MB.
+std::size_t const maxCorrelationCells = 512 * 512;
+}  // namespace
+
+std::unique_ptr<GtransfoLin> listMatchupShiftByCorrelation(const BaseStarList &list1,
+                                                           const BaseStarList &list2,
+                                                           const Gtransfo &gtransfo, double maxShift,
+                                                           double binSize) {
+    if (list1.empty() || list2.empty()) return nullptr;
+    if (binSize == 0) {
+        // as listMatchupShift
+        int ncomb = list1.size() * list2.size();
+        int nx = (ncomb > 10000) ? 100 : (int)sqrt(double(ncomb));
+        binSize = 2 * maxShift / nx;
+    }
+    std::vector<Point> points1, points2;
+    points1.reserve(list1.size());
+    for (auto const &star : list1) points1.push_back(gtransfo.apply(*star));
+    points2.reserve(list2.size());
+    for (auto const &star : list2) points2.push_back(*star);
+
+    CorrelationGrid grid(points1, points2, maxShift, maxCorrelationCells, binSize);
+    LOGLS_DEBUG(_log, "listMatchupShiftByCorrelation: correlation bin size " << grid.getBinSize());
+    FastFinder finder(list2);
+    SolList Solutions;
+    Point coarse;
+    for (int i = 0; i < 4 && grid.popPeak(maxShift, coarse); ++i) {
+        // histogram the separations of the pairs within a coarse bin of the peak, with bins of binSize.
+        double const radius = grid.getBinSize();
+        int nBins = std::max(1, int(2 * radius / binSize + 0.5));
+        Histo2d histo(nBins, coarse.x - radius, coarse.x + radius, nBins, coarse.y - radius,
+                      coarse.y + radius);
+        for (auto const &point1 : points1) {
+            FastFinder::Iterator it = finder.beginScan(point1 + coarse, radius * std::sqrt(2.));
+            while (*it) {
+                auto s2 = *it;
+                histo.fill(s2->x - point1.x, s2->y - point1.y);
+                ++it;
+            }
+        }
+        double dx = 0, dy = 0;
+        histo.maxBin(dx, dy);
+        Solutions.push_back(fitShiftedMatches(list1, list2, gtransfo, dx, dy, binSize));
+    }
+    if (Solutions.empty()) return nullptr;
+    return bestShiftSolution(Solutions);
 }
 
 #ifdef STORAGE
@@ -644,20 +872,18 @@ static double median_distance(const StarMatchList *match, const Gtransfo *transf
     return (nstars & 1) ? resid[nstars / 2] : (resid[nstars / 2 - 1] + resid[nstars / 2]) * 0.5;
 }
 
-std::unique_ptr<Gtransfo> listMatchCombinatorial(const BaseStarList &List1, const BaseStarList &List2,
-                                                 const MatchConditions &conditions) {
-    BaseStarList list1, list2;
-    List1.copyTo(list1);
-    list1.fluxSort();
-    List2.copyTo(list2);
-    list2.fluxSort();
-
+/*
+ * listMatchCombinatorial on lists already sorted by decreasing flux. matchSearchRotShiftFlip sorts them
+ * again, which costs little on sorted lists, but reorders them: they must be the caller's own lists.
+ */
+static std::unique_ptr<Gtransfo> matchCombinatorialSorted(BaseStarList &list1, BaseStarList &list2,
+                                                          const MatchConditions &conditions) {
     LOGLS_INFO(_log, "listMatchCombinatorial: find match between " << list1.size() << " and " << list2.size()
                                                                    << " stars...");
     auto match = matchSearchRotShiftFlip(list1, list2, conditions);
     double pixSizeRatio2 = std::pow(conditions.sizeRatio, 2);
     size_t nmin =
-            std::min(size_t(10), size_t(std::min(List1.size(), List2.size()) * conditions.minMatchRatio));
+            std::min(size_t(10), size_t(std::min(list1.size(), list2.size()) * conditions.minMatchRatio));
 
     std::unique_ptr<Gtransfo> transfo;
     if (is_transfo_ok(match.get(), pixSizeRatio2, nmin))
@@ -683,8 +909,18 @@ std::unique_ptr<Gtransfo> listMatchCombinatorial(const BaseStarList &List1, cons
     return transfo;
 }
 
-std::unique_ptr<Gtransfo> listMatchRefine(const BaseStarList &List1, const BaseStarList &List2,
-                                          std::unique_ptr<Gtransfo> transfo, const int maxOrder) {
+std::unique_ptr<Gtransfo> listMatchCombinatorial(const BaseStarList &List1, const BaseStarList &List2,
+                                                 const MatchConditions &conditions) {
+    // The search only reorders the lists: copying the pointers is enough.
+    BaseStarList list1(List1), list2(List2);
+    list1.fluxSort();
+    list2.fluxSort();
+    return matchCombinatorialSorted(list1, list2, conditions);
+}
+
+//! listMatchRefine on lists already sorted by decreasing flux.
+static std::unique_ptr<Gtransfo> matchRefineSorted(const BaseStarList &List1, const BaseStarList &List2,
+                                                   std::unique_ptr<Gtransfo> transfo, const int maxOrder) {
     if (!transfo) {
         return std::unique_ptr<Gtransfo>(nullptr);
     }
@@ -698,13 +934,10 @@ std::unique_ptr<Gtransfo> listMatchRefine(const BaseStarList &List1, const BaseS
     int order = 1;
     size_t nstarmin = 3;
 
+    // the brightest stars of each list, which are at its start.
     BaseStarList list1, list2;
-    List1.copyTo(list1);
-    list1.fluxSort();
-    list1.cutTail(nStars);
-    List2.copyTo(list2);
-    list2.fluxSort();
-    list2.cutTail(nStars);
+    list1.insert(list1.end(), List1.begin(), std::next(List1.begin(), std::min(nStars, List1.size())));
+    list2.insert(list2.end(), List2.begin(), std::next(List2.begin(), std::min(nStars, List2.size())));
 
     auto fullMatch = listMatchCollect(List1, List2, transfo.get(), fullDist);
     auto brightMatch = listMatchCollect(list1, list2, transfo.get(), brightDist);
@@ -741,5 +974,218 @@ std::unique_ptr<Gtransfo> listMatchRefine(const BaseStarList &List1, const BaseS
 
     return transfo;
 }
+
+std::unique_ptr<Gtransfo> listMatchRefine(const BaseStarList &List1, const BaseStarList &List2,
+                                          std::unique_ptr<Gtransfo> transfo, const int maxOrder) {
+    BaseStarList list1(List1), list2(List2);
+    list1.fluxSort();
+    list2.fluxSort();
+    return matchRefineSorted(list1, list2, std::move(transfo), maxOrder);
+}
+
+ReferenceMatchIndex::ReferenceMatchIndex(BaseStarList const &stars, double scale, std::size_t starsPerCell)
+        : _scale(scale), _xMin(0), _yMin(0), _cellSize(1), _nx(1), _ny(1) {
+    if (!(scale > 0)) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "ReferenceMatchIndex scale must be positive, not " + std::to_string(scale));
+    }
+    _stars.reserve(stars.size());
+    for (auto const &star : stars) {
+        auto scaled = std::make_shared<BaseStar>(*star);
+        scaled->x /= scale;
+        scaled->y /= scale;
+        scaled->vx /= scale * scale;
+        scaled->vy /= scale * scale;
+        scaled->vxy /= scale * scale;
+        _stars.push_back(std::move(scaled));
+    }
+    std::stable_sort(_stars.begin(), _stars.end(),
+                     [](std::shared_ptr<BaseStar> const &star1, std::shared_ptr<BaseStar> const &star2) {
+                         return decreasingFlux(star1.get(), star2.get());
+                     });
+    if (!_stars.empty()) {
+        double xMax = _stars.front()->x, yMax = _stars.front()->y;
+        _xMin = xMax;
+        _yMin = yMax;
+        for (auto const &star : _stars) {
+            _xMin = std::min(_xMin, star->x);
+            _yMin = std::min(_yMin, star->y);
+            xMax = std::max(xMax, star->x);
+            yMax = std::max(yMax, star->y);
+        }
+        double nCells = std::max(1., double(_stars.size()) / std::max<std::size_t>(starsPerCell, 1));
+        double area = std::max(xMax - _xMin, 1.) * std::max(yMax - _yMin, 1.);
+        _cellSize = std::sqrt(area / nCells);
+        _nx = int((xMax - _xMin) / _cellSize) + 1;
+        _ny = int((yMax - _yMin) / _cellSize) + 1;
+    }
+    _cells.resize(std::size_t(_nx) * _ny);
+    for (std::size_t rank = 0; rank < _stars.size(); ++rank) {
+        int ix = std::min(int((_stars[rank]->x - _xMin) / _cellSize), _nx - 1);
+        int iy = std::min(int((_stars[rank]->y - _yMin) / _cellSize), _ny - 1);
+        _cells[std::size_t(iy) * _nx + ix].push_back(rank);
+    }
+    LOGLS_DEBUG(_log, "ReferenceMatchIndex: " << _stars.size() << " stars in " << _nx << "x" << _ny
+                                              << " cells of " << _cellSize << " pixels.");
+}
+
+void ReferenceMatchIndex::extract(Frame const &frame, BaseStarList &out) const {
+    Frame scaled(frame.xMin / _scale, frame.yMin / _scale, frame.xMax / _scale, frame.yMax / _scale);
+    auto cellIndex = [this](double value, double origin, int n) {
+        return std::max(0, std::min(int(std::floor((value - origin) / _cellSize)), n - 1));
+    };
+    int const ixMin = cellIndex(scaled.xMin, _xMin, _nx), ixMax = cellIndex(scaled.xMax, _xMin, _nx);
+    int const iyMin = cellIndex(scaled.yMin, _yMin, _ny), iyMax = cellIndex(scaled.yMax, _yMin, _ny);
+    std::vector<std::size_t> ranks;
+    for (int iy = iyMin; iy <= iyMax; ++iy) {
+        for (int ix = ixMin; ix <= ixMax; ++ix) {
+            for (std::size_t rank : _cells[std::size_t(iy) * _nx + ix]) {
+                if (scaled.inFrame(*_stars[rank])) ranks.push_back(rank);
+            }
+        }
+    }
+    // the ranks of each cell are increasing, so this merges a few sorted runs.
+    std::sort(ranks.begin(), ranks.end());
+    for (std::size_t rank : ranks) out.push_back(_stars[rank]);
+}
+
+namespace {
+
+// Number of coefficients of one coordinate of a polynomial of that order.
+std::size_t nTermsOfPoly(int order) { return std::size_t(order + 1) * (order + 2) / 2; }
+
+}  // namespace
+
+/*
+ * Match one list to the reference stars within its footprint, and return the transfo from the list to the
+ * (unscaled) reference; nullptr if the search failed, or threw (which is logged: one bad list must not lose
+ * the transfos of the others, all the less in a worker process).
+ */
+static std::unique_ptr<GtransfoPoly> matchBlind(BaseStarList const &list, Frame const &footprint,
+                                                ReferenceMatchIndex const &reference,
+                                                MatchConditions const &conditions, int maxOrder) {
+    BaseStarList list1(list), list2;
+    list1.fluxSort();
+    reference.extract(footprint, list2);
+    if (list1.empty() || list2.empty()) {
+        LOGLS_WARN(_log, "listMatchBlind: nothing to match " << list1.size() << " stars with "
+                                                             << list2.size() << " reference stars.");
+        return nullptr;
+    }
+    std::unique_ptr<Gtransfo> transfo;
+    try {
+        transfo = matchCombinatorialSorted(list1, list2, conditions);
+        transfo = matchRefineSorted(list1, list2, std::move(transfo), maxOrder);
+    } catch (std::exception const &e) {
+        LOGLS_WARN(_log, "listMatchBlind: matching " << list1.size() << " stars with " << list2.size()
+                                                     << " reference stars failed: " << e.what());
+        return nullptr;
+    }
+    // The match lists always fit GtransfoPolys (see StarMatchList::setTransfoOrder).
+    auto poly = dynamic_cast<GtransfoPoly const *>(transfo.get());
+    if (poly == nullptr) return nullptr;
+    // back from the pixel-sized units of the index.
+    std::unique_ptr<GtransfoPoly> result(new GtransfoPoly(*poly));
+    for (unsigned px = 0; px <= result->getOrder(); ++px) {
+        for (unsigned py = 0; px + py <= result->getOrder(); ++py) {
+            result->coeff(px, py, 0) *= reference.getScale();
+            result->coeff(px, py, 1) *= reference.getScale();
+        }
+    }
+    return result;
+}
+
+std::vector<std::shared_ptr<Gtransfo>> listMatchBlind(std::vector<BaseStarList const *> const &lists,
+                                                      std::vector<Frame> const &footprints,
+                                                      ReferenceMatchIndex const &reference,
+                                                      MatchConditions const &conditions, int maxOrder,
+                                                      unsigned nProcesses) {
+    if (footprints.size() != lists.size()) {
+        throw LSST_EXCEPT(pex::exceptions::LengthError,
+                          "listMatchBlind: " + std::to_string(footprints.size()) + " footprints for " +
+                                  std::to_string(lists.size()) + " lists.");
+    }
+    if (maxOrder < 1) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "listMatchBlind: maxOrder must be at least 1, not " + std::to_string(maxOrder));
+    }
+    std::vector<std::unique_ptr<GtransfoPoly>> polys(lists.size());
+    if (nProcesses <= 1) {
+        for (std::size_t i = 0; i < lists.size(); ++i) {
+            polys[i] = matchBlind(*lists[i], footprints[i], reference, conditions, maxOrder);
+        }
+    } else {
+        // Each list gets a fixed-size record: the order of its transfo (0 if the search failed), then the
+        // coefficients of both coordinates.
+        std::size_t const recordSize = 1 + 2 * nTermsOfPoly(maxOrder);
+        SharedBuffer records(lists.size() * recordSize * sizeof(double));
+        std::vector<std::size_t> weights;
+        weights.reserve(lists.size());
+        for (auto const list : lists) weights.push_back(list->size());
+        auto const bounds = partitionByWeight(weights, nProcesses);
+
+        runInChildProcesses(nProcesses, [&](unsigned worker) {
+            for (std::size_t i = bounds[worker]; i < bounds[worker + 1]; ++i) {
+                auto poly = matchBlind(*lists[i], footprints[i], reference, conditions, maxOrder);
+                if (!poly) continue;
+                double *record = records.data<double>() + i * recordSize;
+                *record++ = poly->getOrder();
+                for (unsigned px = 0; px <= poly->getOrder(); ++px) {
+                    for (unsigned py = 0; px + py <= poly->getOrder(); ++py) {
+                        *record++ = poly->coeff(px, py, 0);
+                        *record++ = poly->coeff(px, py, 1);
+                    }
+                }
+            }
+        });
+
+        for (std::size_t i = 0; i < lists.size(); ++i) {
+            double const *record = records.data<double>() + i * recordSize;
+            unsigned const order = *record++;
+            if (order == 0) continue;
+            polys[i].reset(new GtransfoPoly(order));
+            for (unsigned px = 0; px <= order; ++px) {
+                for (unsigned py = 0; px + py <= order; ++py) {
+                    polys[i]->coeff(px, py, 0) = *record++;
+                    polys[i]->coeff(px, py, 1) = *record++;
+                }
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<Gtransfo>> result(lists.size());
+    std::size_t nFound = 0;
+    for (std::size_t i = 0; i < lists.size(); ++i) {
+        if (!polys[i]) continue;
+        ++nFound;
+        if (polys[i]->getOrder() == 1) {
+            result[i] = std::make_shared<GtransfoLin>(*polys[i]);
+        } else {
+            result[i] = std::move(polys[i]);
+        }
+    }
+    LOGLS_INFO(_log, "listMatchBlind: found the transfos of " << nFound << " of " << lists.size()
+                                                              << " lists.");
+    return result;
+}
+
+std::vector<std::shared_ptr<Gtransfo>> matchCcdImagesBlind(CcdImageList const &ccdImages,
+                                                           ReferenceMatchIndex const &reference,
+                                                           MatchConditions const &conditions,
+                                                           double searchMargin, int maxOrder,
+                                                           unsigned nProcesses) {
+    std::vector<BaseStarList const *> lists;
+    std::vector<Frame> footprints;
+    lists.reserve(ccdImages.size());
+    footprints.reserve(ccdImages.size());
+    for (auto const &ccdImage : ccdImages) {
+        lists.push_back(&Measured2Base(ccdImage->getWholeCatalog()));
+        Frame frame = ccdImage->getPix2CommonTangentPlane()->apply(ccdImage->getImageFrame(), false);
+        footprints.emplace_back(frame.xMin - searchMargin, frame.yMin - searchMargin,
+                                frame.xMax + searchMargin, frame.yMax + searchMargin);
+    }
+    return listMatchBlind(lists, footprints, reference, conditions, maxOrder, nProcesses);
+}
+
 }  // namespace jointcal
 }  // namespace lsst
@@ -32,6 +32,15 @@ for fluxes, we might use :
  where the '2' should be read from the environment.
 */
 
+CompactMeasurementList makeCompactMeasurementList(MeasuredStarList const &measuredStarList) {
+    CompactMeasurementList compactList;
+    compactList.reserve(measuredStarList.size());
+    for (auto const &measuredStar : measuredStarList) {
+        if (measuredStar->isValid()) compactList.emplace_back(*measuredStar);
+    }
+    return compactList;
+}
+
 BaseStarList &Measured2Base(MeasuredStarList &This) { return (BaseStarList &)This; }
 
 BaseStarList *Measured2Base(MeasuredStarList *This) { return (BaseStarList *)This; }
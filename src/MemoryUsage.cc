@@ -0,0 +1,74 @@
+#include <algorithm>
+
+#include "lsst/jointcal/MemoryUsage.h"
+
+namespace lsst {
+namespace jointcal {
+
+std::size_t computeMemoryUsage(CcdImage const &ccdImage) {
+    return computeMemoryUsage(ccdImage.getWholeCatalog()) + computeMemoryUsage(ccdImage.getCatalogForFit());
+}
+
+std::size_t computeMemoryUsage(CcdImageList const &ccdImageList) {
+    std::size_t bytes = 0;
+    for (auto const &ccdImage : ccdImageList) bytes += computeMemoryUsage(*ccdImage);
+    return bytes;
+}
+
+std::ostream &operator<<(std::ostream &s, MemoryEstimate const &estimate) {
+    double const MB = 1024. * 1024.;
+    s << "stars: " << estimate.stars / MB << "MB triplets: " << estimate.triplets / MB
+      << "MB jacobian: " << estimate.jacobian / MB << "MB hessian: " << estimate.hessian / MB
+      << "MB factor: " << estimate.factor / MB << "MB peak: " << estimate.peak / MB << "MB";
+    return s;
+}
+
+MemoryEstimate estimateFitMemory(std::size_t nMeasurements, std::size_t nFittedStars, std::size_t nRefStars,
+                                 std::size_t nCcdImages, std::size_t nModelParameters,
+                                 std::size_t nModelParametersPerMeasurement, std::size_t nParametersPerStar,
+                                 std::size_t nResidualsPerMeasurement) {
+    MemoryEstimate estimate;
+    std::size_t const nParameters = nModelParameters + nParametersPerStar * nFittedStars;
+    std::size_t const perMeasurement = nModelParametersPerMeasurement + nParametersPerStar;
+
+    // the whole catalogs and the catalogs for fit are separate copies.
+    estimate.stars = 2 * nMeasurements * (sizeof(MeasuredStar) + STAR_LIST_OVERHEAD) +
+                     nFittedStars * (sizeof(FittedStar) + STAR_LIST_OVERHEAD) +
+                     nRefStars * (sizeof(RefStar) + STAR_LIST_OVERHEAD);
+
+    std::size_t const nTriplets = nResidualsPerMeasurement * (nMeasurements * perMeasurement +
+                                                              nRefStars * nParametersPerStar);
+    estimate.triplets = nTriplets * sizeof(Trip);
+
+    std::size_t const nColumns = nResidualsPerMeasurement * (nMeasurements + nRefStars);
+    std::size_t const indexSize = sizeof(SpMat::StorageIndex);
+    std::size_t const entrySize = sizeof(SpMat::Scalar) + indexSize;
+    estimate.jacobian = nTriplets * entrySize + (nColumns + 1) * indexSize;
+
+    // J*J^T is stored with both triangles.
+    std::size_t const modelBlock =
+            std::min(nModelParameters * nModelParameters,
+                     nCcdImages * nModelParametersPerMeasurement * nModelParametersPerMeasurement);
+    std::size_t const starBlock = nFittedStars * nParametersPerStar * nParametersPerStar;
+    std::size_t const crossBlock = 2 * nMeasurements * nParametersPerStar * nModelParametersPerMeasurement;
+    std::size_t const hessianNonZeros = modelBlock + starBlock + crossBlock;
+    estimate.hessian = hessianNonZeros * entrySize + (nParameters + 1) * indexSize;
+
+    // Lower triangle of the factor: the star part keeps the Hessian's structure, the model block fills in.
+    std::size_t const factorNonZeros = nModelParameters * (nModelParameters + 1) / 2 +
+                                       nFittedStars * nParametersPerStar * (nParametersPerStar + 1) / 2 +
+                                       crossBlock / 2;
+    // Simplicial LDLt values and row indices, plus per-column arrays and CHOLMOD's workspace.
+    std::size_t const perColumn = 6 * sizeof(int) + 2 * sizeof(double);
+    estimate.factor = factorNonZeros * (sizeof(double) + sizeof(int)) + nParameters * perColumn;
+
+    // gradient, step and the Eigen product temporary of the Hessian.
+    std::size_t const vectors = 3 * nParameters * sizeof(double);
+    std::size_t const formingHessian = estimate.jacobian + 2 * estimate.hessian;
+    std::size_t const factorizing = estimate.hessian + estimate.factor;
+    estimate.peak = estimate.stars + estimate.triplets + vectors + std::max(formingHessian, factorizing);
+    return estimate;
+}
+
+}  // namespace jointcal
+}  // namespace lsst
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "lsst/jointcal/ParameterLayout.h"
+
+namespace lsst {
+namespace jointcal {
+
+namespace {
+
+/// Map value in [low, high] onto [0, 2^order - 1].
+std::uint32_t toGrid(double value, double low, double high, unsigned order) {
+    double const cells = std::ldexp(1.0, order);
+    double const width = high - low;
+    if (!(width > 0)) return 0;
+    double scaled = std::floor((value - low) / width * cells);
+    scaled = std::max(0.0, std::min(cells - 1, scaled));
+    return static_cast<std::uint32_t>(scaled);
+}
+
+}  // namespace
+
+std::uint64_t hilbertIndex(double x, double y, Frame const &frame, unsigned order) {
+    order = std::min(order, 32u);
+    std::uint64_t ix = toGrid(x, frame.xMin, frame.xMax, order);
+    std::uint64_t iy = toGrid(y, frame.yMin, frame.yMax, order);
+    std::uint64_t index = 0;
+    // Classic iterative conversion: at each level, find the quadrant, then rotate/flip the
+    // remaining coordinates into that quadrant's frame.
+    for (std::uint64_t s = (order > 0) ? (std::uint64_t(1) << (order - 1)) : 0; s > 0; s >>= 1) {
+        std::uint64_t rx = (ix & s) ? 1 : 0;
+        std::uint64_t ry = (iy & s) ? 1 : 0;
+        index += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                ix = s - 1 - (ix & (s - 1));
+                iy = s - 1 - (iy & (s - 1));
+            }
+            std::swap(ix, iy);
+        }
+        ix &= s - 1;
+        iy &= s - 1;
+    }
+    return index;
+}
+
+void sortFittedStarsSpatially(FittedStarList &fittedStars) {
+    if (fittedStars.size() < 2) return;
+    // The bounding box grows from the first star: the Frame constructor would swap inverted limits.
+    auto const &first = fittedStars.front();
+    Frame frame(first->x, first->y, first->x, first->y);
+    for (auto const &star : fittedStars) {
+        frame.xMin = std::min(frame.xMin, star->x);
+        frame.xMax = std::max(frame.xMax, star->x);
+        frame.yMin = std::min(frame.yMin, star->y);
+        frame.yMax = std::max(frame.yMax, star->y);
+    }
+    // Compute each key once, then sort the keys; list::splice keeps the stars themselves in place.
+    std::vector<std::pair<std::uint64_t, FittedStarIterator>> keys;
+    keys.reserve(fittedStars.size());
+    for (auto it = fittedStars.begin(); it != fittedStars.end(); ++it) {
+        keys.emplace_back(hilbertIndex((*it)->x, (*it)->y, frame), it);
+    }
+    std::stable_sort(keys.begin(), keys.end(),
+                     [](std::pair<std::uint64_t, FittedStarIterator> const &a,
+                        std::pair<std::uint64_t, FittedStarIterator> const &b) { return a.first < b.first; });
+    for (auto const &key : keys) {
+        fittedStars.splice(fittedStars.end(), fittedStars, key.second);
+    }
+}
+
+void sortCcdImagesByKey(CcdImageList &ccdImages) {
+    ccdImages.sort([](std::shared_ptr<CcdImage> const &a, std::shared_ptr<CcdImage> const &b) {
+        return a->getHashKey() < b->getHashKey();
+    });
+}
+
+}  // namespace jointcal
+}  // namespace lsst
@@ -1,7 +1,10 @@
 #include <iostream>
+#include <cmath>
 #include <iomanip>
 #include <algorithm>
+#include <bitset>
 #include <fstream>
+#include <unordered_map>
 
 #include "Eigen/Sparse"
 
@@ -17,6 +20,88 @@
 namespace lsst {
 namespace jointcal {
 
+template <typename Function>
+void PhotometryFit::forEachReferenceFlux(FittedStarList const &fittedStarList, Function f) const {
+    for (auto const &fittedStar : fittedStarList) {
+        auto refStar = fittedStar->getRefStar();
+        if (refStar == nullptr) continue;  // no contribution if no associated refstar
+        if (!_multiBand) {
+            f(fittedStar, 0, refStar->getFlux(), refStar->getFluxErr());
+            continue;
+        }
+        // collectRefStars only rejected the stars with a bad default flux: check each band. RefStars made
+        // elsewhere (e.g. priors without a catalog star) may have fewer bands, or only a default flux.
+        std::size_t const nBands = std::min(_nBands, refStar->getNFilters());
+        for (std::size_t band = 0; band < nBands; ++band) {
+            if ((fittedStar->getBandMask() & (std::uint32_t(1) << band)) == 0) continue;
+            double refFluxErr = refStar->getFluxErr(band);
+            if (!std::isfinite(refFluxErr) || refFluxErr <= 0 || !std::isfinite(refStar->getFlux(band))) {
+                continue;
+            }
+            f(fittedStar, band, refStar->getFlux(band), refFluxErr);
+        }
+    }
+}
+
+void PhotometryFit::setMultiBand(bool multiBand) {
+    if (multiBand) {
+        std::size_t nFilters = _associations->getNFilters();
+        if (nFilters == 0) {
+            throw LSST_EXCEPT(pex::exceptions::LogicError,
+                              "PhotometryFit::setMultiBand: no reference fluxes per filter; call "
+                              "Associations::collectRefStars first.");
+        }
+        if (nFilters > 32) {
+            throw LSST_EXCEPT(pex::exceptions::LogicError,
+                              "PhotometryFit::setMultiBand: cannot fit more than 32 filters, got " +
+                                      std::to_string(nFilters));
+        }
+        _nBands = nFilters;
+    } else {
+        _nBands = 1;
+    }
+    _multiBand = multiBand;
+    if (_multiBand) initializeBandFluxes();
+}
+
+void PhotometryFit::initializeBandFluxes() {
+    FittedStarList &fittedStarList = _associations->fittedStarList;
+    for (auto &fittedStar : fittedStarList) fittedStar->setBandMask(0);
+    // a band is fitted for a star if it has a valid measurement in that band.
+    std::unordered_map<FittedStar const *, std::vector<std::pair<double, unsigned>>> sums;
+    for (auto const &ccdImage : _associations->getCcdImageList()) {
+        std::size_t const band = getBand(*ccdImage);
+        for (auto const &measuredStar : ccdImage->getCatalogForFit()) {
+            if (!measuredStar->isValid()) continue;
+            auto fittedStar = std::const_pointer_cast<FittedStar>(measuredStar->getFittedStar());
+            fittedStar->setBandMask(fittedStar->getBandMask() | (std::uint32_t(1) << band));
+            if (fittedStar->getBandFluxes().size() == _nBands) continue;  // already initialized
+            auto &sum = sums[fittedStar.get()];
+            sum.resize(_nBands, std::make_pair(0., 0u));
+            sum[band].first += measuredStar->getFlux();
+            sum[band].second++;
+        }
+    }
+    // start the stars that have no band fluxes yet from their mean measured flux in each band.
+    for (auto &fittedStar : fittedStarList) {
+        auto &bandFluxes = fittedStar->getBandFluxes();
+        if (bandFluxes.size() == _nBands) continue;
+        bandFluxes.assign(_nBands, fittedStar->getFlux());
+        auto sum = sums.find(fittedStar.get());
+        if (sum == sums.end()) continue;
+        for (std::size_t band = 0; band < _nBands; ++band) {
+            if (sum->second[band].second > 0) {
+                bandFluxes[band] = sum->second[band].first / sum->second[band].second;
+            }
+        }
+    }
+}
+
+/// The error of a calibrated flux, with the fraction of the flux fitted by FitterBase::fitErrorModel added.
+static double tweakPhotomMeasurementError(double fluxErr, double flux, double fractionVariance) {
+    return std::sqrt(std::pow(fluxErr, 2) + fractionVariance * std::pow(flux, 2));
+}
+
 void PhotometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage, TripletList &tripletList,
                                                       Eigen::VectorXd &grad,
                                                       MeasuredStarList const *measuredStarList) const {
@@ -37,23 +122,26 @@ void PhotometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage,
     if (_fittingModel) _photometryModel->getMappingIndices(ccdImage, indices);
 
     Eigen::VectorXd H(nparTotal);  // derivative matrix
+    std::size_t const band = getBand(ccdImage);
+    double const errorTerm = getErrorTerm(ccdImage);
     // current position in the Jacobian
     unsigned kTriplets = tripletList.getNextFreeIndex();
     const MeasuredStarList &catalog = (measuredStarList) ? *measuredStarList : ccdImage.getCatalogForFit();
 
     for (auto const &measuredStar : catalog) {
         if (!measuredStar->isValid()) continue;
-// tweak the measurement errors
-#ifdef FUTURE
-        TweakPhotomMeasurementErrors(inPos, *measuredStar, _fluxError);
-#endif
         H.setZero();  // we cannot be sure that all entries will be overwritten.
 
-        double residual = _photometryModel->transform(ccdImage, *measuredStar, measuredStar->getInstFlux()) -
-                          measuredStar->getFittedStar()->getFlux();
+        double flux = _photometryModel->transform(ccdImage, *measuredStar, measuredStar->getInstFlux());
+        double residual = flux - getFittedFlux(*measuredStar->getFittedStar(), band);
 
-        double inverseSigma = 1.0 / _photometryModel->transformError(ccdImage, *measuredStar,
-                                                                     measuredStar->getInstFluxErr());
+        // tweak the measurement errors
+        double fluxErr =
+                _photometryModel->transformError(ccdImage, *measuredStar, measuredStar->getInstFluxErr());
+        double inverseSigma = 1.0 / tweakPhotomMeasurementError(fluxErr, flux, errorTerm);
+        if (_robustLoss != RobustLoss::Squared) {
+            inverseSigma *= std::sqrt(robustWeight(std::pow(residual * inverseSigma, 2)));
+        }
         double W = std::pow(inverseSigma, 2);
 
         if (_fittingModel) {
@@ -65,7 +153,7 @@ void PhotometryFit::leastSquareDerivativesMeasurement(CcdImage const &ccdImage,
             }
         }
         if (_fittingFluxes) {
-            unsigned index = measuredStar->getFittedStar()->getIndexInMatrix();
+            unsigned index = getFluxIndex(*measuredStar->getFittedStar(), band);
             // Note: H = dR/dFittedStarFlux == -1
             tripletList.addTriplet(index, kTriplets, -1.0 * inverseSigma);
             grad[index] += -1.0 * W * residual;
@@ -85,33 +173,47 @@ void PhotometryFit::leastSquareDerivativesReference(FittedStarList const &fitted
 
     // Derivatives of terms involving fitted and refstars only contribute if we are fitting fluxes.
     if (!_fittingFluxes) return;
-    // Can't compute anything if there are no refStars.
-    if (_associations->refStarList.size() == 0) return;
+    // Can't compute anything if there are no refStars, neither from the catalog nor from the priors.
+    if (_associations->refStarList.empty() && _associations->getNFittedStarPriors() == 0) return;
 
     unsigned kTriplets = tripletList.getNextFreeIndex();
 
-    for (auto const &fittedStar : fittedStarList) {
-        auto refStar = fittedStar->getRefStar();
-        if (refStar == nullptr) continue;  // no contribution if no associated refstar
-        // TODO: Can we actually work with multiple filters at a time in this scheme?
-        // TODO: I feel we might only be able to fit one filter at a time, because these terms are
-        // independent of the ccdImage, so we don't have a specific filter.
-        // filter = ccdImage.getFilter();
-
+    forEachReferenceFlux(fittedStarList, [&](std::shared_ptr<FittedStar> const &fittedStar, std::size_t band,
+                                             double refFlux, double refFluxErr) {
         // W == inverseSigma^2
-        double inverseSigma = 1.0 / refStar->getFluxErr();
+        double inverseSigma = 1.0 / refFluxErr;
         // Residual is fittedStar.flux - refStar.flux for consistency with measurement terms.
-        double residual = fittedStar->getFlux() - refStar->getFlux();
+        double residual = getFittedFlux(*fittedStar, band) - refFlux;
+        if (_robustLoss != RobustLoss::Squared) {
+            inverseSigma *= std::sqrt(robustWeight(std::pow(residual * inverseSigma, 2)));
+        }
 
-        unsigned index = fittedStar->getIndexInMatrix();
+        unsigned index = getFluxIndex(*fittedStar, band);
         // Note: H = dR/dFittedStar == 1
         tripletList.addTriplet(index, kTriplets, 1.0 * inverseSigma);
         grad(index) += 1.0 * std::pow(inverseSigma, 2) * residual;
         kTriplets += 1;
-    }
+    });
     tripletList.setNextFreeIndex(kTriplets);
 }
 
+std::size_t PhotometryFit::countTripletsMeasurement(CcdImage const &ccdImage) const {
+    unsigned nparModel = (_fittingModel) ? _photometryModel->getNpar(ccdImage) : 0;
+    unsigned nparFlux = (_fittingFluxes) ? 1 : 0;
+    // one column per valid measurement.
+    return std::size_t(nparModel + nparFlux) * ccdImage.countStars().first;
+}
+
+std::size_t PhotometryFit::countTripletsReference(FittedStarList const &fittedStarList) const {
+    if (!_fittingFluxes) return 0;
+    std::size_t nRefTerms = 0;
+    forEachReferenceFlux(fittedStarList, [&nRefTerms](std::shared_ptr<FittedStar> const &, std::size_t,
+                                                           double, double) {
+        nRefTerms++;
+    });
+    return nRefTerms;
+}
+
 void PhotometryFit::accumulateStatImageList(CcdImageList const &ccdImageList, Chi2Accumulator &accum) const {
     /**********************************************************************/
     /** @note the math in this method and leastSquareDerivativesMeasurement() must be kept consistent,
@@ -119,20 +221,19 @@ void PhotometryFit::accumulateStatImageList(CcdImageList const &ccdImageList, Ch
     /**********************************************************************/
     for (auto const &ccdImage : ccdImageList) {
         auto &catalog = ccdImage->getCatalogForFit();
+        std::size_t const band = getBand(*ccdImage);
+        double const errorTerm = getErrorTerm(*ccdImage);
 
         for (auto const &measuredStar : catalog) {
             if (!measuredStar->isValid()) continue;
-            double sigma = _photometryModel->transformError(*ccdImage, *measuredStar,
-                                                            measuredStar->getInstFluxErr());
-#ifdef FUTURE
-            TweakPhotomMeasurementErrors(inPos, measuredStar, _fluxError);
-#endif
-            double residual =
-                    _photometryModel->transform(*ccdImage, *measuredStar, measuredStar->getInstFlux()) -
-                    measuredStar->getFittedStar()->getFlux();
+            double flux = _photometryModel->transform(*ccdImage, *measuredStar, measuredStar->getInstFlux());
+            double fluxErr = _photometryModel->transformError(*ccdImage, *measuredStar,
+                                                              measuredStar->getInstFluxErr());
+            double sigma = tweakPhotomMeasurementError(fluxErr, flux, errorTerm);
+            double residual = flux - getFittedFlux(*measuredStar->getFittedStar(), band);
 
             double chi2Val = std::pow(residual / sigma, 2);
-            accum.addEntry(chi2Val, 1, measuredStar);
+            accum.addEntry(robustChi2(chi2Val), 1, measuredStar);
         }  // end loop on measurements
     }
 }
@@ -144,12 +245,11 @@ void PhotometryFit::accumulateStatRefStars(Chi2Accumulator &accum) const {
     /**********************************************************************/
 
     FittedStarList &fittedStarList = _associations->fittedStarList;
-    for (auto const &fittedStar : fittedStarList) {
-        auto refStar = fittedStar->getRefStar();
-        if (refStar == nullptr) continue;
-        double chi2 = std::pow(((fittedStar->getFlux() - refStar->getFlux()) / refStar->getFluxErr()), 2);
-        accum.addEntry(chi2, 1, fittedStar);
-    }
+    forEachReferenceFlux(fittedStarList, [this, &accum](std::shared_ptr<FittedStar> const &fittedStar,
+                                                        std::size_t band, double refFlux, double refFluxErr) {
+        double chi2 = std::pow(((getFittedFlux(*fittedStar, band) - refFlux) / refFluxErr), 2);
+        accum.addEntry(robustChi2(chi2), 1, fittedStar);
+    });
 }
 
 //! this routine is to be used only in the framework of outlier removal
@@ -163,7 +263,7 @@ void PhotometryFit::getIndicesOfMeasuredStar(MeasuredStar const &measuredStar,
     }
     if (_fittingFluxes) {
         std::shared_ptr<FittedStar const> const fs = measuredStar.getFittedStar();
-        unsigned fsIndex = fs->getIndexInMatrix();
+        unsigned fsIndex = getFluxIndex(*fs, getBand(measuredStar.getCcdImage()));
         indices.push_back(fsIndex);
     }
 }
@@ -177,6 +277,8 @@ void PhotometryFit::assignIndices(std::string const &whatToFit) {
 
     _nParModel = (_fittingModel) ? _photometryModel->assignIndices(whatToFit, 0) : 0;
     unsigned ipar = _nParModel;
+    // the measurements define which bands of each star are fitted, even when only fitting the model.
+    if (_multiBand) initializeBandFluxes();
 
     if (_fittingFluxes) {
         for (auto &fittedStar : _associations->fittedStarList) {
@@ -184,8 +286,9 @@ void PhotometryFit::assignIndices(std::string const &whatToFit) {
             // - when filling the derivatives
             // - when updating (offsetParams())
             // - in getIndicesOfMeasuredStar
+            // Multi-band fits take one index per fitted band of a star (FittedStar::getBandIndexInMatrix).
             fittedStar->setIndexInMatrix(ipar);
-            ipar += 1;
+            ipar += (_multiBand) ? std::bitset<32>(fittedStar->getBandMask()).count() : 1;
         }
     }
     _nParFluxes = ipar - _nParModel;
@@ -206,6 +309,14 @@ void PhotometryFit::offsetParams(Eigen::VectorXd const &delta) {
             // the parameter layout here is used also
             // - when filling the derivatives
             // - when assigning indices (assignIndices())
+            if (_multiBand) {
+                auto &bandFluxes = fittedStar->getBandFluxes();
+                for (std::size_t band = 0; band < _nBands; ++band) {
+                    if ((fittedStar->getBandMask() & (std::uint32_t(1) << band)) == 0) continue;
+                    bandFluxes[band] -= delta(fittedStar->getBandIndexInMatrix(band));
+                }
+                continue;
+            }
             unsigned index = fittedStar->getIndexInMatrix();
             fittedStar->getFlux() -= delta(index);
         }
@@ -244,19 +355,16 @@ void PhotometryFit::saveChi2MeasContributions(std::string const &baseName) const
     const CcdImageList &ccdImageList = _associations->getCcdImageList();
     for (auto const &ccdImage : ccdImageList) {
         const MeasuredStarList &cat = ccdImage->getCatalogForFit();
+        std::size_t const band = getBand(*ccdImage);
         for (auto const &measuredStar : cat) {
             if (!measuredStar->isValid()) continue;
-            double sigma = _photometryModel->transformError(*ccdImage, *measuredStar,
-                                                            measuredStar->getInstFluxErr());
-#ifdef FUTURE
-            tweakPhotomMeasurementErrors(inPos, measuredStar, _fluxError);
-#endif
             double flux = _photometryModel->transform(*ccdImage, *measuredStar, measuredStar->getInstFlux());
             double fluxErr = _photometryModel->transformError(*ccdImage, *measuredStar,
                                                               measuredStar->getInstFluxErr());
+            double sigma = tweakPhotomMeasurementError(fluxErr, flux, getErrorTerm(*ccdImage));
             double jd = ccdImage->getMjd();
             std::shared_ptr<FittedStar const> const fittedStar = measuredStar->getFittedStar();
-            double residual = flux - fittedStar->getFlux();
+            double residual = flux - getFittedFlux(*fittedStar, band);
             double chi2Val = std::pow(residual / sigma, 2);
 
             ofile << std::setprecision(9);
@@ -265,9 +373,10 @@ void PhotometryFit::saveChi2MeasContributions(std::string const &baseName) const
             ofile << fittedStar->getMag() << separator;
             ofile << measuredStar->getInstFlux() << separator << measuredStar->getInstFluxErr() << separator;
             ofile << measuredStar->getFlux() << separator << measuredStar->getFluxErr() << separator;
-            ofile << flux << separator << fluxErr << separator << fittedStar->getFlux() << separator;
+            ofile << flux << separator << fluxErr << separator << getFittedFlux(*fittedStar, band)
+                  << separator;
             ofile << jd << separator << fittedStar->color << separator;
-            ofile << fittedStar->getIndexInMatrix() << separator;
+            ofile << getFluxIndex(*fittedStar, band) << separator;
             ofile << fittedStar->x << separator << fittedStar->y << separator;
             ofile << chi2Val << separator << fittedStar->getMeasurementCount() << separator;
             ofile << ccdImage->getCcdId() << separator << ccdImage->getVisit() << std::endl;
@@ -294,20 +403,19 @@ void PhotometryFit::saveChi2RefContributions(std::string const &baseName) const
 
     // The following loop is heavily inspired from PhotometryFit::computeChi2()
     const FittedStarList &fittedStarList = _associations->fittedStarList;
-    for (auto const &fittedStar : fittedStarList) {
-        const RefStar *refStar = fittedStar->getRefStar();
-        if (refStar == nullptr) continue;
-
-        double chi2 = std::pow(((fittedStar->getFlux() - refStar->getFlux()) / refStar->getFluxErr()), 2);
+    forEachReferenceFlux(fittedStarList, [&](std::shared_ptr<FittedStar> const &fittedStar, std::size_t band,
+                                             double refFlux, double refFluxErr) {
+        double fittedFlux = getFittedFlux(*fittedStar, band);
+        double chi2 = std::pow(((fittedFlux - refFlux) / refFluxErr), 2);
 
         ofile << std::setprecision(9);
         ofile << fittedStar->x << separator << fittedStar->y << separator;
         ofile << fittedStar->getMag() << separator << fittedStar->color << separator;
-        ofile << refStar->getFlux() << separator << refStar->getFluxErr() << separator;
-        ofile << fittedStar->getFlux() << separator << fittedStar->getFluxErr() << separator;
-        ofile << fittedStar->getIndexInMatrix() << separator << chi2 << separator
+        ofile << refFlux << separator << refFluxErr << separator;
+        ofile << fittedFlux << separator << fittedStar->getFluxErr() << separator;
+        ofile << getFluxIndex(*fittedStar, band) << separator << chi2 << separator
               << fittedStar->getMeasurementCount() << std::endl;
-    }  // loop on FittedStars
+    });  // loop on reference terms
 }
 
 }  // namespace jointcal
@@ -50,5 +50,121 @@ void ChipVisitPhotometryMapping::getMappingIndices(std::vector<unsigned> &indice
     }
 }
 
+void FocalPlaneBasis::cache(CcdImageList const &ccdImageList) {
+    std::size_t nStars = 0;
+    for (auto const &ccdImage : ccdImageList) nStars += ccdImage->getCatalogForFit().size();
+    _values.resize(_nTerms, nStars);
+    _positions.resize(2, nStars);
+    _columns.clear();
+    _columns.reserve(nStars);
+    Eigen::Index column = 0;
+    for (auto const &ccdImage : ccdImageList) {
+        for (auto const &measuredStar : ccdImage->getCatalogForFit()) {
+            _positions(0, column) = measuredStar->getXFocal();
+            _positions(1, column) = measuredStar->getYFocal();
+            _chebyshev.computeParameterDerivatives(measuredStar->getXFocal(), measuredStar->getYFocal(), 1,
+                                                   _values.col(column));
+            _columns.emplace(measuredStar.get(), column);
+            ++column;
+        }
+    }
+    LOGLS_DEBUG(_log, "Cached " << _nTerms << " focal plane basis functions for " << nStars
+                                << " measurements.");
+}
+
+Eigen::Ref<Eigen::VectorXd const> FocalPlaneBasis::getValues(MeasuredStar const &measuredStar,
+                                                             Eigen::VectorXd &work) const {
+    Eigen::Index column = findColumn(measuredStar);
+    if (column >= 0) return _values.col(column);
+    work.resize(_nTerms);
+    _chebyshev.computeParameterDerivatives(measuredStar.getXFocal(), measuredStar.getYFocal(), 1, work);
+    return work;
+}
+
+Eigen::Index FocalPlaneBasis::findColumn(MeasuredStar const &measuredStar) const {
+    auto i = _columns.find(&measuredStar);
+    if (i != _columns.end() && _positions(0, i->second) == measuredStar.getXFocal() &&
+        _positions(1, i->second) == measuredStar.getYFocal()) {
+        return i->second;
+    }
+    return -1;
+}
+
+std::shared_ptr<PhotometryTransfoChebyshev> PhotometryStarFlat::toTransfo() const {
+    size_t const order = _basis->getOrder();
+    ndarray::Array<double, 2, 2> coefficients = ndarray::allocate(ndarray::makeVector(order + 1, order + 1));
+    coefficients.deep() = 0.0;
+    // NOTE: same indexing as PhotometryTransfoChebyshev::computeParameterDerivatives.
+    Eigen::VectorXd::Index k = 0;
+    for (size_t j = 0; j <= order; ++j) {
+        for (size_t i = 0; i <= order - j; ++i, ++k) {
+            coefficients[j][i] = _coefficients[k];
+        }
+    }
+    return std::make_shared<PhotometryTransfoChebyshev>(coefficients, _basis->getBBox());
+}
+
+double StarFlatPhotometryMapping::transform(MeasuredStar const &measuredStar, double instFlux) const {
+    Eigen::VectorXd work;
+    double response = _starFlat->evaluate(_starFlat->getBasis().getValues(measuredStar, work));
+    double tempFlux = _chipMapping->getTransfo()->transform(measuredStar.x, measuredStar.y, instFlux);
+    return response * _visitMapping->getTransfo()->transform(measuredStar.getXFocal(),
+                                                             measuredStar.getYFocal(), tempFlux);
+}
+
+double StarFlatPhotometryMapping::transformError(MeasuredStar const &measuredStar,
+                                                 double instFluxErr) const {
+    Eigen::VectorXd work;
+    double response = _starFlat->evaluateError(_starFlat->getBasis().getValues(measuredStar, work));
+    double tempFluxErr = _chipMapping->transformError(measuredStar, instFluxErr);
+    return response * _visitMapping->getTransfoErrors()->transform(measuredStar.getXFocal(),
+                                                                   measuredStar.getYFocal(), tempFluxErr);
+}
+
+void StarFlatPhotometryMapping::computeParameterDerivatives(MeasuredStar const &measuredStar,
+                                                            double instFlux,
+                                                            Eigen::Ref<Eigen::VectorXd> derivatives) const {
+    // The basis functions are looked up once, and serve both the response and its derivatives.
+    Eigen::VectorXd work;
+    auto values = _starFlat->getBasis().getValues(measuredStar, work);
+    double response = _starFlat->evaluate(values);
+    double chipScale = _chipMapping->getTransfo()->transform(measuredStar.x, measuredStar.y, 1);
+    double visitScale =
+            _visitMapping->getTransfo()->transform(measuredStar.getXFocal(), measuredStar.getYFocal(), 1);
+
+    // NOTE: the blocks are chip, visit, then star flat, independent of the full-fit indices.
+    unsigned const nChip = _chipMapping->getNpar();
+    unsigned const nVisit = _visitMapping->getNpar();
+    unsigned const nStarFlat = _starFlat->getNpar();
+    // NOTE: each block is its own derivatives times the value of the other two components.
+    if (!_chipMapping->isFixed()) {
+        Eigen::Ref<Eigen::VectorXd> chipBlock = derivatives.segment(0, nChip);
+        _chipMapping->getTransfo()->computeParameterDerivatives(measuredStar.x, measuredStar.y, instFlux,
+                                                                chipBlock);
+        chipBlock *= visitScale * response;
+    }
+    Eigen::Ref<Eigen::VectorXd> visitBlock = derivatives.segment(nChip, nVisit);
+    _visitMapping->getTransfo()->computeParameterDerivatives(measuredStar.getXFocal(),
+                                                             measuredStar.getYFocal(), instFlux, visitBlock);
+    visitBlock *= chipScale * response;
+    derivatives.segment(nChip + nVisit, nStarFlat) =
+            (instFlux * chipScale * visitScale) * values.tail(nStarFlat);
+}
+
+void StarFlatPhotometryMapping::getMappingIndices(std::vector<unsigned> &indices) const {
+    if (indices.size() < getNpar()) indices.resize(getNpar());
+    _chipMapping->getMappingIndices(indices);
+    unsigned const nChip = _chipMapping->getNpar();
+    unsigned const nVisit = _visitMapping->getNpar();
+    std::vector<unsigned> tempIndices(nVisit);
+    _visitMapping->getMappingIndices(tempIndices);
+    for (unsigned k = 0; k < nVisit; ++k) {
+        indices.at(k + nChip) = tempIndices.at(k);
+    }
+    for (unsigned k = 0; k < _starFlat->getNpar(); ++k) {
+        indices.at(k + nChip + nVisit) = _starFlat->getIndex() + k;
+    }
+}
+
 }  // namespace jointcal
 }  // namespace lsst
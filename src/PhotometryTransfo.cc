@@ -146,6 +146,22 @@ void PhotometryTransfoChebyshev::computeParameterDerivatives(double x, double y,
     }
 }
 
+ndarray::Array<double, 2, 2> PhotometryTransfoChebyshev::getChebyMapCoefficients() const {
+    // 4 x nPar: ChebyMap wants rows that look like (a_ij, 1, i, j) for out += a_ij*T_i(x)*T_j(y)
+    ndarray::Array<double, 2, 2> chebyCoeffs = allocate(ndarray::makeVector(_nParameters, ndarray::Size(4)));
+    Eigen::VectorXd::Index k = 0;
+    for (ndarray::Size j = 0; j <= _order; ++j) {
+        ndarray::Size const iMax = _order - j;  // to save re-computing `i+j <= order` every inner step.
+        for (ndarray::Size i = 0; i <= iMax; ++i, ++k) {
+            chebyCoeffs[k][0] = _coefficients[j][i];
+            chebyCoeffs[k][1] = 1;
+            chebyCoeffs[k][2] = i;
+            chebyCoeffs[k][3] = j;
+        }
+    }
+    return chebyCoeffs;
+}
+
 Eigen::VectorXd PhotometryTransfoChebyshev::getParameters() const {
     Eigen::VectorXd parameters(_nParameters);
     // NOTE: the indexing in this method and offsetParams must be kept consistent!
@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lsst/pex/exceptions.h"
+#include "lsst/jointcal/ProcessParallel.h"
+
+namespace lsst {
+namespace jointcal {
+
+namespace {
+
+/// The cores this process may run on.
+std::vector<int> getAllowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+void pinToCpu(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // Not being able to pin only costs locality.
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+/// Room for the what() of an exception thrown by a child, including the terminating null.
+constexpr std::size_t maxMessageSize = 512;
+
+/// Copy message into the slot of a child, truncated to fit.
+void writeMessage(char *slot, char const *message) {
+    std::strncpy(slot, message, maxMessageSize - 1);
+    slot[maxMessageSize - 1] = '\0';
+}
+
+/// Run task in a child, and return its exit status: 0 if it returned, 1 (with its message) if it threw.
+int runTask(std::function<void()> const &task, char *message) {
+    try {
+        task();
+    } catch (std::exception const &e) {
+        writeMessage(message, e.what());
+        return 1;
+    } catch (...) {
+        writeMessage(message, "unknown exception");
+        return 1;
+    }
+    return 0;
+}
+
+/// Wait for a child to exit; return false if that is not possible.
+bool waitForChild(pid_t pid, int &status) {
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+/// Describe how a child that did not complete its task ended, given what waitForChild returned.
+void describeFailure(std::ostream &s, bool waited, int status, char const *message) {
+    if (!waited) {
+        s << "cannot wait for it";
+    } else if (WIFSIGNALED(status)) {
+        s << "killed by signal " << WTERMSIG(status);
+    } else if (*message != '\0') {
+        s << message;
+    } else {
+        s << "exit status " << WEXITSTATUS(status);
+    }
+}
+
+/// Send size bytes on a socket; return false if the peer is gone.
+bool sendAll(int socket, void const *data, std::size_t size) {
+    char const *bytes = static_cast<char const *>(data);
+    while (size > 0) {
+        // MSG_NOSIGNAL: a dead peer must not raise SIGPIPE in the caller.
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+/// Receive size bytes from a socket; return false if the peer closed it, or is gone.
+bool receiveAll(int socket, void *data, std::size_t size) {
+    char *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+}  // namespace
+
+SharedBuffer::SharedBuffer(std::size_t size) : _data(nullptr), _size(size) {
+    // mmap refuses empty mappings.
+    _data = mmap(nullptr, std::max<std::size_t>(_size, 1), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                 -1, 0);
+    if (_data == MAP_FAILED) {
+        _data = nullptr;
+        throw LSST_EXCEPT(pex::exceptions::MemoryError,
+                          "Cannot map a shared buffer of " + std::to_string(_size) +
+                                  " bytes: " + std::strerror(errno));
+    }
+}
+
+SharedBuffer::~SharedBuffer() {
+    if (_data != nullptr) munmap(_data, std::max<std::size_t>(_size, 1));
+}
+
+void runInChildProcesses(unsigned nProcesses, std::function<void(unsigned)> const &task, bool pinWorkers) {
+    std::vector<int> cpus;
+    if (pinWorkers) cpus = getAllowedCpus();
+    // Anything still buffered would otherwise be written by every child as well.
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+
+    // What each child threw, so that the parent can report it.
+    SharedBuffer messages(std::size_t(nProcesses) * maxMessageSize);
+
+    std::vector<pid_t> children;
+    children.reserve(nProcesses);
+    int forkErrno = 0;
+    for (unsigned i = 0; i < nProcesses; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (!cpus.empty()) pinToCpu(cpus[(std::size_t(i) * cpus.size()) / nProcesses]);
+            int status = runTask([&]() { task(i); }, messages.data<char>(std::size_t(i) * maxMessageSize));
+            // _exit: the child must not run the atexit handlers or destructors of its parent's state.
+            _exit(status);
+        }
+        if (pid < 0) {
+            forkErrno = errno;
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    unsigned nFailed = 0;
+    std::stringstream failures;
+    for (std::size_t i = 0; i < children.size(); ++i) {
+        int status = 0;
+        bool const waited = waitForChild(children[i], status);
+        if (waited && WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+        ++nFailed;
+        failures << "; worker " << i << ": ";
+        describeFailure(failures, waited, status, messages.data<char>(i * maxMessageSize));
+    }
+    if (forkErrno != 0) {
+        throw LSST_EXCEPT(pex::exceptions::RuntimeError,
+                          "Could only fork " + std::to_string(children.size()) + " of " +
+                                  std::to_string(nProcesses) +
+                                  " worker processes: " + std::strerror(forkErrno));
+    }
+    if (nFailed != 0) {
+        std::stringstream message;
+        message << nFailed << " of " << nProcesses << " worker processes failed" << failures.str();
+        throw LSST_EXCEPT(pex::exceptions::RuntimeError, message.str());
+    }
+}
+
+WorkerPool::WorkerPool(unsigned nProcesses, std::function<void(unsigned, unsigned)> task, bool pinWorkers)
+        : _messages(std::size_t(nProcesses) * maxMessageSize), _failed(false) {
+    std::vector<int> cpus;
+    if (pinWorkers) cpus = getAllowedCpus();
+    // Anything still buffered would otherwise be written by every worker as well.
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+
+    _workers.reserve(nProcesses);
+    for (unsigned i = 0; i < nProcesses; ++i) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            int const error = errno;
+            stop();
+            throw LSST_EXCEPT(pex::exceptions::RuntimeError,
+                              "Cannot create the command socket of a worker process: " +
+                                      std::string(std::strerror(error)));
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Only keep our end of our own socket: a worker must see the end of its commands when the
+            // parent closes its end, even if the workers forked later still hold theirs.
+            close(sockets[0]);
+            for (auto const &worker : _workers) close(worker.socket);
+            if (!cpus.empty()) pinToCpu(cpus[(std::size_t(i) * cpus.size()) / nProcesses]);
+            char *message = _messages.data<char>(std::size_t(i) * maxMessageSize);
+            std::uint32_t command;
+            while (receiveAll(sockets[1], &command, sizeof(command))) {
+                message[0] = '\0';
+                char const status = runTask([&]() { task(i, command); }, message);
+                if (!sendAll(sockets[1], &status, sizeof(status))) break;
+            }
+            // _exit: the worker must not run the atexit handlers or destructors of its parent's state.
+            _exit(0);
+        }
+        close(sockets[1]);
+        if (pid < 0) {
+            int const error = errno;
+            close(sockets[0]);
+            stop();
+            throw LSST_EXCEPT(pex::exceptions::RuntimeError,
+                              "Could only fork " + std::to_string(i) + " of " + std::to_string(nProcesses) +
+                                      " worker processes: " + std::strerror(error));
+        }
+        _workers.push_back(Worker{pid, sockets[0]});
+    }
+}
+
+WorkerPool::~WorkerPool() { stop(); }
+
+void WorkerPool::stop() {
+    for (auto &worker : _workers) {
+        if (worker.socket >= 0) close(worker.socket);
+        worker.socket = -1;
+    }
+    for (auto &worker : _workers) {
+        int status;
+        if (worker.pid > 0) waitForChild(worker.pid, status);
+        worker.pid = -1;
+    }
+}
+
+void WorkerPool::run(unsigned command) {
+    if (_failed) {
+        throw LSST_EXCEPT(pex::exceptions::RuntimeError, "The worker processes failed on an earlier command");
+    }
+    // Send all the commands first, so that the workers run them concurrently.
+    std::uint32_t const message = command;
+    std::vector<char> sent(_workers.size());
+    for (std::size_t i = 0; i < _workers.size(); ++i) {
+        sent[i] = sendAll(_workers[i].socket, &message, sizeof(message));
+    }
+
+    unsigned nFailed = 0;
+    std::stringstream failures;
+    for (std::size_t i = 0; i < _workers.size(); ++i) {
+        char status = 1;
+        bool const answered = sent[i] && receiveAll(_workers[i].socket, &status, sizeof(status));
+        if (answered && status == 0) continue;
+        ++nFailed;
+        failures << "; worker " << i << ": ";
+        if (answered) {
+            failures << _messages.data<char>(i * maxMessageSize);
+            continue;
+        }
+        // The worker died, or cannot be reached: make sure it is gone, and find out how it ended.
+        kill(_workers[i].pid, SIGKILL);
+        int exitStatus = 0;
+        bool const waited = waitForChild(_workers[i].pid, exitStatus);
+        _workers[i].pid = -1;
+        describeFailure(failures, waited, exitStatus, _messages.data<char>(i * maxMessageSize));
+    }
+    if (nFailed != 0) {
+        _failed = true;
+        std::stringstream description;
+        description << nFailed << " of " << _workers.size() << " worker processes failed" << failures.str();
+        throw LSST_EXCEPT(pex::exceptions::RuntimeError, description.str());
+    }
+}
+
+std::vector<std::size_t> partitionByWeight(std::vector<std::size_t> const &weights, unsigned nParts) {
+    if (nParts == 0) nParts = 1;
+    std::size_t const total = std::accumulate(weights.begin(), weights.end(), std::size_t(0));
+    std::vector<std::size_t> bounds(nParts + 1, weights.size());
+    bounds[0] = 0;
+    std::size_t index = 0;
+    std::size_t cumulative = 0;
+    for (unsigned part = 1; part < nParts; ++part) {
+        // end the part where the running total is closest to its share of the total.
+        double const target = double(total) * part / nParts;
+        while (index < weights.size() && cumulative + weights[index] / 2. < target) {
+            cumulative += weights[index];
+            ++index;
+        }
+        bounds[part] = index;
+    }
+    return bounds;
+}
+
+}  // namespace jointcal
+}  // namespace lsst
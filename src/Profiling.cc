@@ -0,0 +1,30 @@
+#include "lsst/jointcal/Profiling.h"
+
+namespace lsst {
+namespace jointcal {
+
+void Profile::addTiming(std::string const &phase, double wallTime, double cpuTime,
+                        AllocationCount const &allocations) {
+    auto &timing = _timings[phase];
+    timing.wallTime += wallTime;
+    timing.cpuTime += cpuTime;
+    timing.calls++;
+    timing.allocations += allocations.count;
+    timing.allocatedBytes += allocations.bytes;
+}
+
+std::ostream &operator<<(std::ostream &s, Profile const &profile) {
+    for (auto const &timing : profile._timings) {
+        s << timing.first << ": " << timing.second << std::endl;
+    }
+    for (auto const &counter : profile._counters) {
+        s << counter.first << ": " << counter.second << std::endl;
+    }
+    for (auto const &memory : profile._memory) {
+        s << memory.first << ": " << memory.second << " bytes" << std::endl;
+    }
+    return s;
+}
+
+}  // namespace jointcal
+}  // namespace lsst
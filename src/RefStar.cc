@@ -1,6 +1,7 @@
 // -*- C++ -*-
 #include <algorithm>
 #include <assert.h>
+#include <cmath>
 #include <iomanip>
 
 #include "lsst/jointcal/RefStar.h"
@@ -8,6 +9,41 @@
 namespace lsst {
 namespace jointcal {
 
+void RefStar::propagateToEpoch(double mjd) {
+    if (!_hasProperMotion || !std::isfinite(_epoch)) return;
+    double const dt = mjd - _epoch;
+    double const cosDec = std::cos(y * M_PI / 180.);
+    x += _pmRa * dt / cosDec;
+    y += _pmDec * dt;
+    vx += std::pow(_pmRaErr * dt / cosDec, 2);
+    vy += std::pow(_pmDecErr * dt, 2);
+    _epoch = mjd;
+}
+
+std::array<double, 3> computeSunPosition(double mjd) {
+    double const degToRad = M_PI / 180.;
+    double const n = mjd - 51544.5;  // days since J2000.0
+    double const meanLongitude = 280.460 + 0.9856474 * n;
+    double const meanAnomaly = (357.528 + 0.9856003 * n) * degToRad;
+    double const longitude =
+            (meanLongitude + 1.915 * std::sin(meanAnomaly) + 0.020 * std::sin(2 * meanAnomaly)) * degToRad;
+    double const distance = 1.00014 - 0.01671 * std::cos(meanAnomaly) - 0.00014 * std::cos(2 * meanAnomaly);
+    double const obliquity = (23.439 - 0.0000004 * n) * degToRad;
+    return {distance * std::cos(longitude), distance * std::cos(obliquity) * std::sin(longitude),
+            distance * std::sin(obliquity) * std::sin(longitude)};
+}
+
+Point computeParallaxShift(double ra, double dec, std::array<double, 3> const &sunPosition, double parallax) {
+    double const degToRad = M_PI / 180.;
+    double const sinRa = std::sin(ra * degToRad), cosRa = std::cos(ra * degToRad);
+    double const sinDec = std::sin(dec * degToRad), cosDec = std::cos(dec * degToRad);
+    // The star is seen displaced toward the Sun: project the Sun position on the local ra and dec axes.
+    double const alongRa = -sunPosition[0] * sinRa + sunPosition[1] * cosRa;
+    double const alongDec =
+            -sunPosition[0] * cosRa * sinDec - sunPosition[1] * sinRa * sinDec + sunPosition[2] * cosDec;
+    return Point(parallax * alongRa, parallax * alongDec);
+}
+
 BaseStarList &Ref2Base(RefStarList &This) { return (BaseStarList &)This; }
 
 BaseStarList *Ref2Base(RefStarList *This) { return (BaseStarList *)This; }
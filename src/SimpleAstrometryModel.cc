@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <memory>
 #include <string>
 
@@ -8,6 +9,7 @@
 #include "lsst/jointcal/SimpleAstrometryMapping.h"
 #include "lsst/jointcal/CcdImage.h"
 #include "lsst/jointcal/ProjectionHandler.h"
+#include "lsst/jointcal/StarMatch.h"
 #include "lsst/pex/exceptions.h"
 #include "lsst/jointcal/Gtransfo.h"
 
@@ -20,7 +22,8 @@ namespace jointcal {
 
 SimpleAstrometryModel::SimpleAstrometryModel(CcdImageList const &ccdImageList,
                                              const std::shared_ptr<ProjectionHandler const> projectionHandler,
-                                             bool initFromWcs, unsigned nNotFit, unsigned order)
+                                             bool initFromWcs, unsigned nNotFit, unsigned order,
+                                             std::string const &orderCriterion)
         : _sky2TP(projectionHandler)
 
 {
@@ -42,7 +45,12 @@ SimpleAstrometryModel::SimpleAstrometryModel(CcdImageList const &ccdImageList,
                 LOGLS_WARN(_log, "Empty catalog from image: " << im.getName());
                 continue;
             }
-            GtransfoPoly pol(order);
+            unsigned imageOrder = order;
+            if (!orderCriterion.empty() && order > 1) {
+                unsigned selected = selectOrder(im, order, orderCriterion);
+                if (selected > 0) imageOrder = selected;
+            }
+            GtransfoPoly pol(imageOrder);
             if (pol.getOrder() > 0)  // if not, it cannot be decreased
             {
                 while (unsigned(pol.getNpar()) > 2 * nObj) {
@@ -63,7 +71,7 @@ SimpleAstrometryModel::SimpleAstrometryModel(CcdImageList const &ccdImageList,
             const Frame &frame = im.getImageFrame();
             GtransfoLin shiftAndNormalize = normalizeCoordinatesTransfo(frame);
             if (initFromWcs) {
-                pol = GtransfoPoly(im.getPix2TangentPlane(), frame, order);
+                pol = GtransfoPoly(im.getPix2TangentPlane(), frame, imageOrder);
                 pol = pol * shiftAndNormalize.invert();
             }
             _myMap[im.getHashKey()] =
@@ -72,6 +80,35 @@ SimpleAstrometryModel::SimpleAstrometryModel(CcdImageList const &ccdImageList,
     }
 }
 
+unsigned SimpleAstrometryModel::selectOrder(CcdImage const &ccdImage, unsigned maxOrder,
+                                            std::string const &orderCriterion) const {
+    // The measurement errors, mapped to the tangent plane, weight the positions of the fitted stars there.
+    Frame const &frame = ccdImage.getImageFrame();
+    GtransfoLin pix2TP = ccdImage.getPix2TangentPlane()->linearApproximation(frame.getCenter());
+    auto sky2TP = getSky2TP(ccdImage);
+    StarMatchList matches;
+    for (auto const &measuredStar : ccdImage.getCatalogForFit()) {
+        if (!measuredStar->isValid()) continue;
+        auto fittedStar = measuredStar->getFittedStar();
+        if (!fittedStar) continue;
+        FatPoint errors;
+        pix2TP.transformPosAndErrors(*measuredStar, errors);
+        FatPoint target(sky2TP->apply(*fittedStar), errors.vx, errors.vy, errors.vxy);
+        matches.emplace_back(*measuredStar, target, measuredStar, fittedStar);
+    }
+    auto scores = GtransfoPoly::compareOrders(matches, 1, maxOrder, orderCriterion);
+    if (scores.empty()) return 0;
+    auto best = std::min_element(scores.begin(), scores.end(),
+                                 [](PolyOrderScore const &a, PolyOrderScore const &b) {
+                                     return a.criterion < b.criterion;
+                                 });
+    LOGLS_DEBUG(_log, "Selected order " << best->order << " for " << ccdImage.getName() << " among "
+                                        << scores.size() << " orders, with " << orderCriterion << " "
+                                        << best->criterion << " and chi2 " << best->chi2 << " for "
+                                        << matches.size() << " measurements");
+    return best->order;
+}
+
 const AstrometryMapping *SimpleAstrometryModel::getMapping(CcdImage const &ccdImage) const {
     return findMapping(ccdImage);
 }
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "lsst/log/Log.h"
 #include "lsst/jointcal/PhotometryMapping.h"
@@ -28,9 +30,14 @@ SimplePhotometryModel::SimplePhotometryModel(CcdImageList const &ccdImageList) {
 }
 
 unsigned SimplePhotometryModel::assignIndices(std::string const &whatToFit, unsigned firstIndex) {
+    // _myMap is unordered: assign indices in (visit, ccd) order, so that the layout is reproducible.
+    std::vector<CcdImageKey> keys;
+    keys.reserve(_myMap.size());
+    for (auto const &i : _myMap) keys.push_back(i.first);
+    std::sort(keys.begin(), keys.end());
     unsigned ipar = firstIndex;
-    for (auto const &i : _myMap) {
-        auto mapping = i.second.get();
+    for (auto const &key : keys) {
+        auto mapping = _myMap.at(key).get();
         mapping->setIndex(ipar);
         ipar += mapping->getNpar();
     }
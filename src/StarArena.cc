@@ -0,0 +1,78 @@
+#include <new>
+
+#include "lsst/jointcal/StarArena.h"
+
+namespace lsst {
+namespace jointcal {
+
+constexpr std::size_t StarArena::BLOCK_ALIGNMENT;
+constexpr std::size_t StarArena::MAX_BLOCK_SIZE;
+constexpr std::size_t StarArena::CHUNK_SIZE;
+
+void *StarArena::allocate(std::size_t size) {
+    if (size == 0) size = 1;
+    if (size > MAX_BLOCK_SIZE) return ::operator new(size);
+    std::size_t const sizeClass = (size - 1) / BLOCK_ALIGNMENT;
+    std::size_t const blockSize = (sizeClass + 1) * BLOCK_ALIGNMENT;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    Pool &pool = _pools[sizeClass];
+    void *block;
+    if (pool.freeList != nullptr) {
+        block = pool.freeList;
+        pool.freeList = *static_cast<void **>(block);
+    } else {
+        if (pool.next == nullptr || pool.next + blockSize > pool.end) {
+            // The tail of the previous chunk of this class (less than one block) is left unused.
+            _chunks.emplace_back(new char[CHUNK_SIZE]);
+            pool.next = _chunks.back().get();
+            pool.end = pool.next + CHUNK_SIZE;
+        }
+        block = pool.next;
+        pool.next += blockSize;
+    }
+    ++_nLiveBlocks;
+    return block;
+}
+
+void StarArena::deallocate(void *block, std::size_t size) noexcept {
+    if (block == nullptr) return;
+    if (size == 0) size = 1;
+    if (size > MAX_BLOCK_SIZE) return ::operator delete(block);
+    std::size_t const sizeClass = (size - 1) / BLOCK_ALIGNMENT;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    Pool &pool = _pools[sizeClass];
+    *static_cast<void **>(block) = pool.freeList;
+    pool.freeList = block;
+    --_nLiveBlocks;
+}
+
+bool StarArena::release() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_nLiveBlocks != 0) return false;
+    if (_chunks.empty()) return true;
+    _chunks.clear();
+    _chunks.shrink_to_fit();
+    for (auto &pool : _pools) pool = Pool();
+    ++_nReleases;
+    return true;
+}
+
+std::size_t StarArena::getNLiveBlocks() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _nLiveBlocks;
+}
+
+std::size_t StarArena::getNChunks() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _chunks.size();
+}
+
+std::size_t StarArena::getNReleases() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _nReleases;
+}
+
+}  // namespace jointcal
+}  // namespace lsst
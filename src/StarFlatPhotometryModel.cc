@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+
+#include "lsst/log/Log.h"
+
+#include "astshim.h"
+#include "astshim/ChebyMap.h"
+#include "lsst/afw/geom/Transform.h"
+#include "lsst/afw/image/PhotoCalib.h"
+#include "lsst/afw/math/TransformBoundedField.h"
+#include "lsst/pex/exceptions.h"
+#include "lsst/jointcal/CcdImage.h"
+#include "lsst/jointcal/PhotometryMapping.h"
+#include "lsst/jointcal/StarFlatPhotometryModel.h"
+
+namespace {
+LOG_LOGGER _log = LOG_GET("jointcal.StarFlatPhotometryModel");
+}
+
+namespace lsst {
+namespace jointcal {
+
+StarFlatPhotometryModel::StarFlatPhotometryModel(CcdImageList const &ccdImageList,
+                                                 afw::geom::Box2D const &focalPlaneBBox, int starFlatOrder,
+                                                 std::vector<double> const &epochBoundaries)
+        : _basis(std::make_shared<FocalPlaneBasis>(starFlatOrder, focalPlaneBBox)) {
+    if (!std::is_sorted(epochBoundaries.begin(), epochBoundaries.end())) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "StarFlatPhotometryModel epoch boundaries must be increasing.");
+    }
+    // keep track of which chip we want to constrain (the one closest to the middle of the focal plane)
+    double minRadius2 = std::numeric_limits<double>::infinity();
+    CcdIdType constrainedChip = -1;
+
+    for (auto const &ccdImage : ccdImageList) {
+        auto visit = ccdImage->getVisit();
+        auto chip = ccdImage->getCcdId();
+        if (_chipMap.find(chip) == _chipMap.end()) {
+            auto center = ccdImage->getDetector()->getCenter(afw::cameraGeom::FOCAL_PLANE);
+            double radius2 = std::pow(center.getX(), 2) + std::pow(center.getY(), 2);
+            if (radius2 < minRadius2) {
+                minRadius2 = radius2;
+                constrainedChip = chip;
+            }
+            // Use the single-frame processing calibration from the PhotoCalib as the default.
+            auto chipTransfo = std::make_shared<PhotometryTransfoSpatiallyInvariant>(
+                    ccdImage->getPhotoCalib()->getCalibrationMean());
+            _chipMap[chip] = std::make_shared<PhotometryMapping>(std::move(chipTransfo));
+        }
+        if (_visitMap.find(visit) == _visitMap.end()) {
+            auto visitTransfo = std::make_shared<PhotometryTransfoSpatiallyInvariant>();
+            _visitMap[visit] = std::make_shared<PhotometryMapping>(std::move(visitTransfo));
+        }
+    }
+
+    // Fix one chip mapping, to remove the degeneracy from the system.
+    _chipMap.at(constrainedChip)->setFixed(true);
+
+    _basis->cache(ccdImageList);
+    // One star flat per epoch that has data: an empty one would make the fit degenerate.
+    std::map<std::size_t, std::shared_ptr<PhotometryStarFlat>> epochMap;
+    _myMap.reserve(ccdImageList.size());
+    for (auto const &ccdImage : ccdImageList) {
+        std::size_t epoch =
+                std::upper_bound(epochBoundaries.begin(), epochBoundaries.end(), ccdImage->getMjd()) -
+                epochBoundaries.begin();
+        auto &starFlat = epochMap[epoch];
+        if (!starFlat) starFlat = std::make_shared<PhotometryStarFlat>(_basis);
+        _myMap.emplace(ccdImage->getHashKey(),
+                       std::unique_ptr<StarFlatPhotometryMapping>(new StarFlatPhotometryMapping(
+                               _chipMap[ccdImage->getCcdId()], _visitMap[ccdImage->getVisit()], starFlat)));
+    }
+    for (auto const &i : epochMap) {
+        _starFlats.push_back(i.second);
+    }
+    LOGLS_INFO(_log, "Got " << _chipMap.size() << " chip mappings, " << _visitMap.size()
+                            << " visit mappings and " << _starFlats.size() << " star flats of order "
+                            << starFlatOrder << "; holding chip " << constrainedChip << " fixed.");
+    LOGLS_DEBUG(_log, "Star flat basis cached for " << _basis->getCacheSize() << " measurements.");
+}
+
+unsigned StarFlatPhotometryModel::assignIndices(std::string const &whatToFit, unsigned firstIndex) {
+    // TODO DM-8046: currently ignoring whatToFit: eventually implement configurability.
+    unsigned index = firstIndex;
+    for (auto &i : _chipMap) {
+        auto mapping = i.second.get();
+        // Don't assign indices for fixed parameters.
+        if (mapping->isFixed()) continue;
+        mapping->setIndex(index);
+        index += mapping->getNpar();
+    }
+    for (auto &i : _visitMap) {
+        auto mapping = i.second.get();
+        mapping->setIndex(index);
+        index += mapping->getNpar();
+    }
+    for (auto &starFlat : _starFlats) {
+        starFlat->setIndex(index);
+        index += starFlat->getNpar();
+    }
+    return index;
+}
+
+void StarFlatPhotometryModel::offsetParams(Eigen::VectorXd const &delta) {
+    for (auto &i : _chipMap) {
+        auto mapping = i.second.get();
+        // Don't offset indices for fixed parameters.
+        if (mapping->isFixed()) continue;
+        mapping->offsetParams(delta.segment(mapping->getIndex(), mapping->getNpar()));
+    }
+    for (auto &i : _visitMap) {
+        auto mapping = i.second.get();
+        mapping->offsetParams(delta.segment(mapping->getIndex(), mapping->getNpar()));
+    }
+    for (auto &starFlat : _starFlats) {
+        starFlat->offsetParams(delta.segment(starFlat->getIndex(), starFlat->getNpar()));
+    }
+}
+
+double StarFlatPhotometryModel::transform(CcdImage const &ccdImage, MeasuredStar const &measuredStar,
+                                          double instFlux) const {
+    return findMapping(ccdImage)->transform(measuredStar, instFlux);
+}
+
+double StarFlatPhotometryModel::transformError(CcdImage const &ccdImage, MeasuredStar const &measuredStar,
+                                               double instFluxErr) const {
+    return findMapping(ccdImage)->transformError(measuredStar, instFluxErr);
+}
+
+void StarFlatPhotometryModel::freezeErrorTransform() {
+    for (auto &i : _chipMap) {
+        i.second->freezeErrorTransform();
+    }
+    for (auto &i : _visitMap) {
+        i.second->freezeErrorTransform();
+    }
+    for (auto &starFlat : _starFlats) {
+        starFlat->freezeErrorTransform();
+    }
+}
+
+void StarFlatPhotometryModel::getMappingIndices(CcdImage const &ccdImage,
+                                                std::vector<unsigned> &indices) const {
+    findMapping(ccdImage)->getMappingIndices(indices);
+}
+
+void StarFlatPhotometryModel::computeParameterDerivatives(MeasuredStar const &measuredStar,
+                                                          CcdImage const &ccdImage,
+                                                          Eigen::VectorXd &derivatives) const {
+    findMapping(ccdImage)->computeParameterDerivatives(measuredStar, measuredStar.getInstFlux(), derivatives);
+}
+
+std::shared_ptr<afw::image::PhotoCalib> StarFlatPhotometryModel::toPhotoCalib(
+        CcdImage const &ccdImage) const {
+    auto oldPhotoCalib = ccdImage.getPhotoCalib();
+    auto detector = ccdImage.getDetector();
+    auto mapping = dynamic_cast<StarFlatPhotometryMapping *>(findMapping(ccdImage));
+    // We created all the mappings as StarFlatPhotometryMappings, so blow up if it's not.
+    assert(mapping != nullptr);
+    auto pixToFocal = detector->getTransform(afw::cameraGeom::PIXELS, afw::cameraGeom::FOCAL_PLANE);
+    auto starFlat = mapping->getStarFlat()->toTransfo();
+    auto focalBBox = starFlat->getBBox();
+
+    std::vector<double> lowerBound = {focalBBox.getMinX(), focalBBox.getMinY()};
+    std::vector<double> upperBound = {focalBBox.getMaxX(), focalBBox.getMaxY()};
+    afw::geom::TransformPoint2ToGeneric chebyTransform(
+            ast::ChebyMap(starFlat->getChebyMapCoefficients(), 1, lowerBound, upperBound));
+
+    // The chip and visit zero points combine into a single "zoom" factor.
+    double zeroPoint = mapping->getChipMapping()->getParameters()[0] *
+                       mapping->getVisitMapping()->getParameters()[0];
+    afw::geom::Transform<afw::geom::GenericEndpoint, afw::geom::GenericEndpoint> zoomTransform(
+            ast::ZoomMap(1, zeroPoint));
+
+    auto transform = pixToFocal->then(chebyTransform)->then(zoomTransform);
+    // NOTE: TransformBoundedField does not yet implement mean(), so we have to compute it here.
+    double mean = zeroPoint * starFlat->mean();
+    auto boundedField = std::make_shared<afw::math::TransformBoundedField>(detector->getBBox(), *transform);
+    return std::make_shared<afw::image::PhotoCalib>(mean, oldPhotoCalib->getCalibrationErr(), boundedField,
+                                                    false);
+}
+
+void StarFlatPhotometryModel::dump(std::ostream &stream) const {
+    for (auto &i : _chipMap) {
+        i.second->dump(stream);
+        stream << std::endl;
+    }
+    stream << std::endl;
+    for (auto &i : _visitMap) {
+        i.second->dump(stream);
+        stream << std::endl;
+    }
+    stream << std::endl;
+    for (auto &starFlat : _starFlats) {
+        starFlat->dump(stream);
+        stream << std::endl;
+    }
+}
+
+PhotometryMappingBase *StarFlatPhotometryModel::findMapping(CcdImage const &ccdImage) const {
+    auto i = _myMap.find(ccdImage.getHashKey());
+    if (i == _myMap.end())
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "StarFlatPhotometryModel cannot find CcdImage " + ccdImage.getName());
+    return i->second.get();
+}
+
+}  // namespace jointcal
+}  // namespace lsst
@@ -41,9 +41,9 @@ void StarList<Star>::extractInFrame(StarList<Star> &out, const Frame &frame) con
 }
 
 template <class Star>
-void StarList<Star>::copyTo(StarList<Star> &copy) const {
+void StarList<Star>::copyTo(StarList<Star> &copy, std::shared_ptr<StarArena> const &arena) const {
     copy.clearList();
-    for (auto const &si : *this) copy.push_back(std::make_shared<Star>(*si));
+    for (auto const &si : *this) copy.push_back(makeArenaShared<Star>(arena, *si));
 }
 
 // Explicit instantiations
@@ -65,17 +65,43 @@ static unsigned chi2_cleanup(StarMatchList &starMatchList, const double chi2Cut,
    set by the fit) and iterates until stabilization of the number of pairs.
    If the transfo is not assigned, it will be set to a GtransfoLinear. User
    can set an other type/order using setTransfo() before call. */
-void StarMatchList::refineTransfo(double nSigmas) {
+void StarMatchList::refineTransfo(double nSigmas, bool incremental) {
     double cut;
     unsigned nremoved;
     if (!_transfo) _transfo.reset(new GtransfoLin);
+    auto poly = std::dynamic_pointer_cast<GtransfoPoly>(_transfo);
+    // GtransfoLinShift and GtransfoLinRot have their own constrained fits.
+    if (incremental && poly && !std::dynamic_pointer_cast<GtransfoLinShift>(_transfo) &&
+        !std::dynamic_pointer_cast<GtransfoLinRot>(_transfo)) {
+        std::vector<bool> kept;
+        std::vector<double> chi2s;
+        _chi2 = poly->fitWithClipping(*this, nSigmas, kept, chi2s);
+        // the discarded pairs all go in a single pass.
+        std::size_t index = 0;
+        for (auto smi = begin(); smi != end(); ++index) {
+            if (!kept[index]) {
+                smi = erase(smi);
+                continue;
+            }
+            if (chi2s[index] >= 0) smi->chi2 = chi2s[index];
+            ++smi;
+        }
+        if (_chi2 <= 0 && size() > 2) return;
+        setDistance(*_transfo);
+        _dist2 = computeDist2(*this, *_transfo);
+        return;
+    }
+    std::vector<double> chi2s;
+    bool firstFit = true;
     do {
         int nused = size();
         if (nused <= 2) {
             _chi2 = -1;
             break;
         }
-        _chi2 = _transfo->fit(*this);
+        // after the first fit, only a few outliers go at each step: start from the previous solution.
+        _chi2 = firstFit ? _transfo->fit(*this) : _transfo->refit(*this);
+        firstFit = false;
         /* convention of the fitted routines :
            -  chi2 = 0 means zero degrees of freedom
                 (this was not enforced in Gtransfo{Lin,Quad,Cub} ...)
@@ -89,14 +115,15 @@ void StarMatchList::refineTransfo(double nSigmas) {
         unsigned npair = int(size());
         if (npair == 0) break;  // should never happen
 
-        // compute some chi2 statistics
-        std::unique_ptr<double[]> chi2_array(new double[npair]);
-        unsigned count = 0;
-        for (auto &starMatch : *this) chi2_array[count++] = starMatch.chi2 = starMatch.computeChi2(*_transfo);
+        // compute some chi2 statistics: only the median is needed, no full sort.
+        chi2s.clear();
+        for (auto &starMatch : *this) chi2s.push_back(starMatch.chi2 = starMatch.computeChi2(*_transfo));
 
-        std::sort(chi2_array.get(), chi2_array.get() + npair);
-        double median = (npair & 1) ? chi2_array[npair / 2]
-                                    : (chi2_array[npair / 2 - 1] + chi2_array[npair / 2]) * 0.5;
+        std::size_t const half = npair / 2;
+        std::nth_element(chi2s.begin(), chi2s.begin() + half, chi2s.end());
+        double median = chi2s[half];
+        // for an even count, the lower middle value is the largest of the lower half.
+        if (!(npair & 1)) median = (*std::max_element(chi2s.begin(), chi2s.begin() + half) + median) * 0.5;
 
         // discard outliers : the cut is understood as a "distance" cut
         cut = sq(nSigmas) * median;
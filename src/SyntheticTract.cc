@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "lsst/log/Log.h"
+#include "lsst/pex/exceptions.h"
+#include "lsst/afw/cameraGeom/CameraSys.h"
+#include "lsst/afw/coord/Observatory.h"
+#include "lsst/afw/coord/Weather.h"
+#include "lsst/afw/geom/Angle.h"
+#include "lsst/afw/geom/SkyWcs.h"
+#include "lsst/afw/geom/SpherePoint.h"
+#include "lsst/afw/geom/ellipses/Quadrupole.h"
+#include "lsst/afw/image/PhotoCalib.h"
+#include "lsst/afw/image/VisitInfo.h"
+#include "lsst/afw/table/aggregates.h"
+#include "lsst/daf/base/DateTime.h"
+
+#include "lsst/jointcal/Frame.h"
+#include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/SyntheticTract.h"
+
+namespace {
+LOG_LOGGER _log = LOG_GET("jointcal.SyntheticTract");
+
+// Flux (maggies) of one instrumental count: a nominal zero point of 27 mag.
+double const calibrationMean = std::pow(10., -0.4 * 27.);
+
+// TODO: Remove this once RFC-356 is implemented and all refcats give fluxes in Maggies.
+double const JanskyToMaggy = 3631.0;
+
+// All visits are observed from this latitude (degrees), at this airmass.
+double const observatoryLatitude = -30.;
+double const airmass = 1.2;
+
+// Noise of a star of magnitude mag, relative to one at magMin: photon noise dominated.
+double noiseScale(double mag, double magMin) { return std::pow(10., 0.2 * (mag - magMin)); }
+}  // namespace
+
+namespace lsst {
+namespace jointcal {
+
+SyntheticTract::SyntheticTract(SyntheticTractControl const &control,
+                               std::vector<std::shared_ptr<afw::cameraGeom::Detector>> const &detectors)
+        : _control(control), _detectors(detectors), _focalPlaneRadius(0) {
+    if (_control.nVisits <= 0) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError, "SyntheticTract: nVisits must be > 0");
+    }
+    if (_detectors.empty()) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError,
+                          "SyntheticTract: at least one detector is required");
+    }
+    if (_control.magMax <= _control.magMin) {
+        throw LSST_EXCEPT(pex::exceptions::InvalidParameterError, "SyntheticTract: magMax must be > magMin");
+    }
+
+    std::mt19937 generator(_control.seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::normal_distribution<double> gaussian(0., 1.);
+
+    // the radius of the focal plane on the tangent plane (degrees)
+    double focalPlaneRadius = 0;
+    for (auto const &detector : _detectors) {
+        auto pixToFocal = detector->getTransform(afw::cameraGeom::PIXELS, afw::cameraGeom::FOCAL_PLANE);
+        for (auto const &corner : afw::geom::Box2D(detector->getBBox()).getCorners()) {
+            auto focal = pixToFocal->applyForward(corner);
+            Point tangentPlane = focalToTangentPlane(Point(focal.getX(), focal.getY()));
+            focalPlaneRadius = std::max(focalPlaneRadius, std::hypot(tangentPlane.x, tangentPlane.y));
+            _focalPlaneRadius = std::max(_focalPlaneRadius, std::hypot(focal.getX(), focal.getY()));
+        }
+    }
+
+    // boresights: uniform within a disk around the tract center.
+    TanPix2RaDec tangentPlane2Sky(GtransfoLin(), Point(_control.raCenter, _control.decCenter));
+    _boresights.reserve(_control.nVisits);
+    _zeroPoints.reserve(_control.nVisits);
+    for (int visit = 0; visit < _control.nVisits; ++visit) {
+        double radius = _control.ditherRadius * std::sqrt(uniform(generator));
+        double angle = 2 * M_PI * uniform(generator);
+        _boresights.push_back(tangentPlane2Sky.apply(radius * std::cos(angle), radius * std::sin(angle)));
+        _zeroPoints.push_back(_control.visitZeroPointSpread * gaussian(generator));
+        for (std::size_t k = 0; k < _detectors.size(); ++k) {
+            _wcsOffsets.emplace_back(_control.wcsError / 3600. * gaussian(generator),
+                                     _control.wcsError / 3600. * gaussian(generator));
+        }
+    }
+
+    // true stars: uniform on the tangent plane, in a disk covering all visits (5% margin).
+    double fieldRadius = 1.05 * (focalPlaneRadius + _control.ditherRadius);
+    std::size_t nStars = std::lround(_control.starDensity * M_PI * std::pow(fieldRadius * 60., 2));
+    // number counts grow as 10^(0.3 m): draw magnitudes by inverting the cumulative distribution.
+    double countMin = std::pow(10., 0.3 * _control.magMin);
+    double countMax = std::pow(10., 0.3 * _control.magMax);
+    _stars.reserve(nStars);
+    for (std::size_t i = 0; i < nStars; ++i) {
+        double radius = fieldRadius * std::sqrt(uniform(generator));
+        double angle = 2 * M_PI * uniform(generator);
+        Point sky = tangentPlane2Sky.apply(radius * std::cos(angle), radius * std::sin(angle));
+        double mag = std::log10(countMin + uniform(generator) * (countMax - countMin)) / 0.3;
+        _stars.push_back({sky.x, sky.y, mag, 0.});
+    }
+    // colors have their own random stream, so that the other star properties do not depend on colorSpread.
+    std::mt19937 colorGenerator(_control.seed + 2);
+    for (auto &star : _stars) star.color = _control.colorSpread * gaussian(colorGenerator);
+    LOGLS_INFO(_log, "Generated " << _stars.size() << " stars within " << fieldRadius << " degrees of ("
+                                  << _control.raCenter << ", " << _control.decCenter << "), "
+                                  << _control.nVisits << " visits of " << _detectors.size() << " detectors");
+}
+
+Point SyntheticTract::focalToTangentPlane(Point const &focal) const {
+    double r2 = focal.x * focal.x + focal.y * focal.y;
+    double scale = _control.plateScale / 3600. * (1 + _control.distortion * r2);
+    return Point(focal.x * scale, focal.y * scale);
+}
+
+Point SyntheticTract::tangentPlaneToFocal(Point const &tangentPlane) const {
+    // the distortion is small: a few fixed point iterations are plenty.
+    Point focal(tangentPlane.x * 3600. / _control.plateScale, tangentPlane.y * 3600. / _control.plateScale);
+    for (int iteration = 0; iteration < 5; ++iteration) {
+        double r2 = focal.x * focal.x + focal.y * focal.y;
+        double scale = _control.plateScale / 3600. * (1 + _control.distortion * r2);
+        focal = Point(tangentPlane.x / scale, tangentPlane.y / scale);
+    }
+    return focal;
+}
+
+double SyntheticTract::getFocalPlaneResponse(double xFocal, double yFocal) const {
+    return 1 + _control.focalPlaneResponse * (xFocal * xFocal + yFocal * yFocal) /
+                       (_focalPlaneRadius * _focalPlaneRadius);
+}
+
+double SyntheticTract::getCalibrationMean() const { return calibrationMean; }
+
+afw::table::SourceCatalog SyntheticTract::makeSourceCatalog(int visit, int detectorIndex) const {
+    auto const &detector = _detectors.at(detectorIndex);
+
+    auto schema = afw::table::SourceTable::makeMinimalSchema();
+    auto centroidKey = afw::table::Point2DKey::addFields(schema, "centroid", "synthetic centroid", "pixel");
+    auto xSigmaKey = schema.addField<float>("centroid_xSigma", "synthetic centroid x error", "pixel");
+    auto ySigmaKey = schema.addField<float>("centroid_ySigma", "synthetic centroid y error", "pixel");
+    auto shapeKey = afw::table::QuadrupoleKey::addFields(schema, "shape", "synthetic shape",
+                                                         afw::table::CoordinateType::PIXEL);
+    auto fluxKey = schema.addField<double>("synthetic_flux", "synthetic instrumental flux", "count");
+    auto fluxSigmaKey =
+            schema.addField<double>("synthetic_fluxSigma", "synthetic instrumental flux error", "count");
+    schema.getAliasMap()->set("slot_Centroid", "centroid");
+    schema.getAliasMap()->set("slot_Shape", "shape");
+    schema.getAliasMap()->set("slot_CalibFlux", "synthetic");
+    afw::table::SourceCatalog catalog(schema);
+
+    // each (visit, detector) has its own random stream, so that catalogs do not depend on call order.
+    std::seed_seq seeds{_control.seed, static_cast<unsigned>(visit), static_cast<unsigned>(detectorIndex)};
+    std::mt19937 generator(seeds);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::normal_distribution<double> gaussian(0., 1.);
+
+    auto pixToFocal = detector->getTransform(afw::cameraGeom::PIXELS, afw::cameraGeom::FOCAL_PLANE);
+    afw::geom::Box2D bbox(detector->getBBox());
+    // the detector footprint on the tangent plane, to skip most stars cheaply.
+    std::vector<Point> corners;
+    for (auto const &corner : bbox.getCorners()) {
+        auto focal = pixToFocal->applyForward(corner);
+        corners.push_back(focalToTangentPlane(Point(focal.getX(), focal.getY())));
+    }
+    Frame tangentPlaneFrame(corners[0], corners[0]);
+    for (auto const &corner : corners) tangentPlaneFrame += Frame(corner, corner);
+    tangentPlaneFrame = tangentPlaneFrame.rescale(1.05);
+
+    TanRaDec2Pix sky2TangentPlane(GtransfoLin(), _boresights.at(visit));
+    double zeroPointFactor = std::pow(10., -0.4 * _zeroPoints.at(visit));
+    Point const refraction = refractionVector(visit);
+    for (std::size_t i = 0; i < _stars.size(); ++i) {
+        auto const &star = _stars[i];
+        Point tangentPlane = sky2TangentPlane.apply(star.ra, star.dec);
+        tangentPlane.x += refraction.x * star.color * _control.refractionCoefficient;
+        tangentPlane.y += refraction.y * star.color * _control.refractionCoefficient;
+        if (!tangentPlaneFrame.inFrame(tangentPlane)) continue;
+        Point focal = tangentPlaneToFocal(tangentPlane);
+        auto pixel = pixToFocal->applyInverse(afw::geom::Point2D(focal.x, focal.y));
+        if (!bbox.contains(pixel)) continue;
+
+        double const mag = star.mag + _control.colorSlope * star.color;
+        double scale = noiseScale(mag, _control.magMin);
+        double positionSigma = _control.positionNoise * scale;
+        double x = pixel.getX() + positionSigma * gaussian(generator);
+        double y = pixel.getY() + positionSigma * gaussian(generator);
+        if (uniform(generator) < _control.outlierFraction) {
+            x += _control.outlierOffset * gaussian(generator);
+            y += _control.outlierOffset * gaussian(generator);
+        }
+        double instFlux = std::pow(10., -0.4 * mag) * zeroPointFactor / calibrationMean *
+                          getFocalPlaneResponse(focal.x, focal.y);
+        double instFluxErr = instFlux * _control.fluxNoise * scale;
+        instFlux += instFluxErr * gaussian(generator);
+
+        auto record = catalog.addNew();
+        record->setId(i);
+        record->set(centroidKey, afw::geom::Point2D(x, y));
+        record->set(xSigmaKey, positionSigma);
+        record->set(ySigmaKey, positionSigma);
+        // round, well sampled stars: the xy covariance cooked up by CcdImage will be 0.
+        record->set(shapeKey, afw::geom::ellipses::Quadrupole(4., 4., 0.));
+        record->set(fluxKey, instFlux);
+        record->set(fluxSigmaKey, instFluxErr);
+    }
+    return catalog;
+}
+
+std::shared_ptr<afw::geom::SkyWcs> SyntheticTract::makeInputWcs(int visit, int detectorIndex) const {
+    auto const &detector = _detectors.at(detectorIndex);
+    auto pixToFocal = detector->getTransform(afw::cameraGeom::PIXELS, afw::cameraGeom::FOCAL_PLANE);
+    auto center = afw::geom::Box2D(detector->getBBox()).getCenter();
+    auto focalCenter = pixToFocal->applyForward(center);
+    // the linear (undistorted) approximation of pixels -> tangent plane, in degrees.
+    Eigen::Matrix2d cdMatrix;
+    for (int axis = 0; axis < 2; ++axis) {
+        auto step = center;
+        step[axis] += 1.;
+        auto focalStep = pixToFocal->applyForward(step);
+        cdMatrix(0, axis) = (focalStep.getX() - focalCenter.getX()) * _control.plateScale / 3600.;
+        cdMatrix(1, axis) = (focalStep.getY() - focalCenter.getY()) * _control.plateScale / 3600.;
+    }
+    Point const &offset = _wcsOffsets.at(visit * _detectors.size() + detectorIndex);
+    TanPix2RaDec tangentPlane2Sky(GtransfoLin(), _boresights.at(visit));
+    Point crval = tangentPlane2Sky.apply(focalCenter.getX() * _control.plateScale / 3600. + offset.x,
+                                         focalCenter.getY() * _control.plateScale / 3600. + offset.y);
+    return afw::geom::makeSkyWcs(center, afw::geom::SpherePoint(crval.x, crval.y, afw::geom::degrees),
+                                 cdMatrix);
+}
+
+double SyntheticTract::hourAngle(int visit) const {
+    // the visits spread over +-2 hours, so that their refraction vectors differ.
+    if (_control.nVisits == 1) return 0.;
+    return M_PI / 6. * (2. * visit / (_control.nVisits - 1) - 1.);
+}
+
+Point SyntheticTract::refractionVector(int visit) const {
+    double const tgz = std::tan(std::acos(1. / airmass));
+    double const dec = _boresights.at(visit).y * M_PI / 180.;
+    double const latitude = observatoryLatitude * M_PI / 180.;
+    double const ha = hourAngle(visit);
+    double const eta =
+            std::atan2(std::sin(ha), std::cos(dec) * std::tan(latitude) - std::sin(dec) * std::cos(ha));
+    return Point(tgz * std::cos(eta), tgz * std::sin(eta));
+}
+
+std::shared_ptr<afw::image::VisitInfo> SyntheticTract::makeVisitInfo(int visit) const {
+    Point const &boresight = _boresights.at(visit);
+    // An observatory on the Greenwich meridian, observing at the hour angle of the visit, 3 nights apart.
+    afw::coord::Observatory observatory(0. * afw::geom::degrees, observatoryLatitude * afw::geom::degrees,
+                                        2000.);
+    daf::base::DateTime date(57000. + 3. * visit, daf::base::DateTime::MJD, daf::base::DateTime::TAI);
+    double altitude = std::asin(1. / airmass);
+    return std::make_shared<afw::image::VisitInfo>(
+            visitId(visit), 30., 30., date, 0.,
+            boresight.x * afw::geom::degrees + hourAngle(visit) * afw::geom::radians,
+            afw::geom::SpherePoint(boresight.x, boresight.y, afw::geom::degrees),
+            afw::geom::SpherePoint(0. * afw::geom::degrees, altitude * afw::geom::radians), airmass,
+            0. * afw::geom::degrees, afw::image::RotType::SKY, observatory,
+            afw::coord::Weather(10., 70000., 40.));
+}
+
+void SyntheticTract::addCcdImages(Associations &associations, JointcalControl const &control,
+                                  std::vector<std::size_t> const &detectorIndices) const {
+    std::vector<std::size_t> indices = detectorIndices;
+    if (indices.empty()) {
+        for (std::size_t k = 0; k < _detectors.size(); ++k) indices.push_back(k);
+    }
+    for (auto k : indices) {
+        if (k >= _detectors.size()) {
+            throw LSST_EXCEPT(pex::exceptions::OutOfRangeError,
+                              "addCcdImages: no detector with index " + std::to_string(k));
+        }
+    }
+    auto photoCalib = std::make_shared<afw::image::PhotoCalib>(calibrationMean);
+    for (int visit = 0; visit < _control.nVisits; ++visit) {
+        auto visitInfo = makeVisitInfo(visit);
+        for (auto k : indices) {
+            auto catalog = makeSourceCatalog(visit, k);
+            associations.createCcdImage(catalog, makeInputWcs(visit, k), visitInfo, _detectors[k]->getBBox(),
+                                        _control.filter, photoCalib, _detectors[k], visitId(visit),
+                                        _detectors[k]->getId(), control);
+        }
+    }
+}
+
+std::shared_ptr<Associations> SyntheticTract::makeAssociations(JointcalControl const &control) const {
+    auto associations = std::make_shared<Associations>();
+    addCcdImages(*associations, control);
+    return associations;
+}
+
+afw::table::SimpleCatalog SyntheticTract::makeRefCatalog() const {
+    auto schema = afw::table::SimpleTable::makeMinimalSchema();
+    auto fluxKey = schema.addField<double>(getRefFluxField(), "reference flux", "Jy");
+    auto fluxSigmaKey = schema.addField<double>(getRefFluxField() + "Sigma", "reference flux error", "Jy");
+    afw::table::SimpleCatalog refCat(schema);
+
+    std::mt19937 generator(_control.seed + 1);
+    std::normal_distribution<double> gaussian(0., 1.);
+
+    // reference catalogs are shallower than the images: keep the brightest stars.
+    std::vector<std::size_t> order(_stars.size());
+    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::size_t nRef = std::lround(_control.refFraction * _stars.size());
+    nRef = std::min(nRef, order.size());
+    std::partial_sort(order.begin(), order.begin() + nRef, order.end(),
+                      [this](std::size_t i, std::size_t j) { return _stars[i].mag < _stars[j].mag; });
+    order.resize(nRef);
+    std::sort(order.begin(), order.end());
+
+    refCat.reserve(nRef);
+    for (auto i : order) {
+        auto const &star = _stars[i];
+        double sigma = _control.refPositionNoise / 3600.;
+        double dec = star.dec + sigma * gaussian(generator);
+        double ra = star.ra + sigma * gaussian(generator) / std::cos(star.dec * M_PI / 180.);
+        double flux = std::pow(10., -0.4 * (star.mag + _control.colorSlope * star.color)) * JanskyToMaggy;
+        double fluxErr = flux * _control.fluxNoise;
+        auto record = refCat.addNew();
+        record->setId(i);
+        record->setCoord(afw::geom::SpherePoint(ra, dec, afw::geom::degrees));
+        record->set(fluxKey, flux + fluxErr * gaussian(generator));
+        record->set(fluxSigmaKey, fluxErr);
+    }
+    return refCat;
+}
+
+}  // namespace jointcal
+}  // namespace lsst
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <utility>
+
+#include "lsst/pex/exceptions.h"
+#include "lsst/jointcal/Tripletlist.h"
+
+namespace lsst {
+namespace jointcal {
+
+void TripletList::reserve(std::size_t count) {
+    if (_storage == Storage::Triplets) {
+        _triplets.reserve(count);
+    } else {
+        _rows.reserve(count);
+        _values.reserve(count);
+    }
+}
+
+void TripletList::clear() {
+    _triplets.clear();
+    _rows.clear();
+    _values.clear();
+    _columnStarts.clear();
+    _nextFreeIndex = 0;
+}
+
+void TripletList::release() {
+    // swapping with empty vectors is the only portable way to actually free the memory.
+    std::vector<Trip>().swap(_triplets);
+    std::vector<Index>().swap(_rows);
+    std::vector<double>().swap(_values);
+    std::vector<Index>().swap(_columnStarts);
+    _nextFreeIndex = 0;
+}
+
+void TripletList::setStorage(Storage storage) {
+    if (storage == _storage) return;
+    if (size() != 0) {
+        throw LSST_EXCEPT(pex::exceptions::LogicError,
+                          "Cannot change the storage of a non-empty TripletList");
+    }
+    release();
+    _storage = storage;
+}
+
+std::size_t TripletList::getMemoryUsage() const {
+    return _triplets.capacity() * sizeof(Trip) + _rows.capacity() * sizeof(Index) +
+           _values.capacity() * sizeof(double) + _columnStarts.capacity() * sizeof(Index);
+}
+
+void TripletList::toSparseMatrix(Eigen::SparseMatrix<double> &matrix, unsigned nRows) const {
+    unsigned const nColumns = _nextFreeIndex;
+    if (_storage == Storage::Triplets) {
+        matrix.resize(nRows, nColumns);
+        matrix.setFromTriplets(_triplets.begin(), _triplets.end());
+        return;
+    }
+    if (_columnStarts.size() > nColumns) {
+        throw LSST_EXCEPT(pex::exceptions::LogicError,
+                          "TripletList has entries beyond the next free index");
+    }
+    // The entries are already laid out by column: copy them, sorting rows and summing duplicates
+    // within each column (a few entries per column, so insertion sort is the right tool).
+    matrix.resize(nRows, nColumns);
+    matrix.resizeNonZeros(_rows.size());
+    Index *outer = matrix.outerIndexPtr();
+    Index *inner = matrix.innerIndexPtr();
+    double *values = matrix.valuePtr();
+    Index nonZeros = 0;
+    for (unsigned j = 0; j < nColumns; ++j) {
+        outer[j] = nonZeros;
+        if (j >= _columnStarts.size()) continue;
+        Index begin = _columnStarts[j];
+        Index end = (j + 1 < _columnStarts.size()) ? _columnStarts[j + 1] : Index(_rows.size());
+        Index columnStart = nonZeros;
+        for (Index k = begin; k < end; ++k) {
+            Index row = _rows[k];
+            double value = _values[k];
+            Index position = nonZeros;
+            while (position > columnStart && inner[position - 1] > row) --position;
+            if (position > columnStart && inner[position - 1] == row) {
+                values[position - 1] += value;
+                continue;
+            }
+            for (Index m = nonZeros; m > position; --m) {
+                inner[m] = inner[m - 1];
+                values[m] = values[m - 1];
+            }
+            inner[position] = row;
+            values[position] = value;
+            ++nonZeros;
+        }
+    }
+    outer[nColumns] = nonZeros;
+    matrix.resizeNonZeros(nonZeros);
+}
+
+}  // namespace jointcal
+}  // namespace lsst
@@ -0,0 +1,280 @@
+/*
+ * Microbenchmarks of the inner kernels of the fits: the Gtransfo evaluations and
+ * derivatives, the astrometric mappings, the photometric transfos, and the traversal of the
+ * measurements by the astrometric fit loops.
+ *
+ * Usage: benchmark_kernels [name filter]   (see microbenchmark.h for the environment variables)
+ */
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Eigen/Core"
+
+#include "lsst/afw/geom/Box.h"
+#include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/FatPoint.h"
+#include "lsst/jointcal/FittedStar.h"
+#include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/MeasuredStar.h"
+#include "lsst/jointcal/PhotometryTransfo.h"
+#include "lsst/jointcal/SimpleAstrometryMapping.h"
+#include "lsst/jointcal/TwoTransfoMapping.h"
+
+#include "microbenchmark.h"
+
+JOINTCAL_BENCHMARK_COUNT_ALLOCATIONS()
+
+namespace jointcal = lsst::jointcal;
+namespace benchmark = lsst::jointcal::benchmark;
+
+namespace {
+
+// A CCD-sized domain, as for the pixel-space transfos.
+double const xMax = 2048;
+double const yMax = 4096;
+
+std::vector<jointcal::FatPoint> makePoints(std::size_t n, double xScale = xMax, double yScale = yMax) {
+    std::mt19937 generator(12345);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::vector<jointcal::FatPoint> points(n);
+    for (auto &point : points) {
+        point.x = xScale * uniform(generator);
+        point.y = yScale * uniform(generator);
+        point.vx = 0.01;
+        point.vy = 0.02;
+        point.vxy = 0.001;
+    }
+    return points;
+}
+
+// A polynomial close to the identity, with small non-linear terms as a real distortion.
+jointcal::GtransfoPoly makePoly(unsigned order) {
+    jointcal::GtransfoPoly poly(order);
+    std::mt19937 generator(order);
+    std::normal_distribution<double> gaussian(0., 1.);
+    for (unsigned px = 0; px <= order; ++px) {
+        for (unsigned py = 0; px + py <= order; ++py) {
+            if (px + py < 2) continue;
+            double scale = 1e-3 / std::pow(xMax, px + py - 1);
+            poly.coeff(px, py, 0) = scale * gaussian(generator);
+            poly.coeff(px, py, 1) = scale * gaussian(generator);
+        }
+    }
+    return poly;
+}
+
+// The [-1,1] normalization SimplePolyMapping expects.
+jointcal::GtransfoLin makeCenterAndScale() {
+    return jointcal::GtransfoLin(-1., -1., 2. / xMax, 0., 0., 2. / yMax);
+}
+
+std::vector<unsigned> const orders = {1, 3, 5};
+std::vector<std::size_t> const batchSizes = {100, 10000};
+
+std::string makeName(std::string const &kernel, unsigned order, std::size_t batch) {
+    return kernel + "/order:" + std::to_string(order) + "/batch:" + std::to_string(batch);
+}
+
+void registerGtransfoPoly(benchmark::Registry &registry) {
+    for (auto order : orders) {
+        for (auto batch : batchSizes) {
+            auto poly = std::make_shared<jointcal::GtransfoPoly>(makePoly(order));
+            auto points = std::make_shared<std::vector<jointcal::FatPoint>>(makePoints(batch));
+            registry.add(makeName("GtransfoPoly::apply", order, batch), batch, [poly, points]() {
+                double xOut, yOut;
+                for (auto const &point : *points) {
+                    poly->apply(point.x, point.y, xOut, yOut);
+                    benchmark::doNotOptimize(xOut);
+                    benchmark::doNotOptimize(yOut);
+                }
+            });
+            registry.add(makeName("GtransfoPoly::transformPosAndErrors", order, batch), batch,
+                         [poly, points]() {
+                             jointcal::FatPoint out;
+                             for (auto const &point : *points) {
+                                 poly->transformPosAndErrors(point, out);
+                                 benchmark::doNotOptimize(out);
+                             }
+                         });
+            registry.add(makeName("GtransfoPoly::computeDerivative", order, batch), batch,
+                         [poly, points]() {
+                             jointcal::GtransfoLin derivative;
+                             for (auto const &point : *points) {
+                                 poly->computeDerivative(point, derivative);
+                                 benchmark::doNotOptimize(derivative);
+                             }
+                         });
+            registry.add(makeName("GtransfoPoly::paramDerivatives", order, batch), batch, [poly, points]() {
+                std::vector<double> dx(poly->getNpar()), dy(poly->getNpar());
+                for (auto const &point : *points) {
+                    poly->paramDerivatives(point, dx.data(), dy.data());
+                    benchmark::doNotOptimize(dx.front());
+                }
+            });
+        }
+    }
+}
+
+void registerTanRaDec2Pix(benchmark::Registry &registry) {
+    jointcal::Point tangentPoint(150., 2.);
+    auto proj = std::make_shared<jointcal::TanRaDec2Pix>(jointcal::GtransfoLin(), tangentPoint);
+    for (auto batch : batchSizes) {
+        // a square degree around the tangent point.
+        auto points = std::make_shared<std::vector<jointcal::FatPoint>>(makePoints(batch, 1., 1.));
+        for (auto &point : *points) {
+            point.x += tangentPoint.x - 0.5;
+            point.y += tangentPoint.y - 0.5;
+            point.vx = point.vy = 1e-10;
+            point.vxy = 0;
+        }
+        registry.add(makeName("TanRaDec2Pix::apply", 0, batch), batch, [proj, points]() {
+            double xOut, yOut;
+            for (auto const &point : *points) {
+                proj->apply(point.x, point.y, xOut, yOut);
+                benchmark::doNotOptimize(xOut);
+                benchmark::doNotOptimize(yOut);
+            }
+        });
+        registry.add(makeName("TanRaDec2Pix::transformPosAndErrors", 0, batch), batch, [proj, points]() {
+            jointcal::FatPoint out;
+            for (auto const &point : *points) {
+                proj->transformPosAndErrors(point, out);
+                benchmark::doNotOptimize(out);
+            }
+        });
+    }
+}
+
+void registerMappings(benchmark::Registry &registry) {
+    for (auto order : orders) {
+        auto simple = std::make_shared<jointcal::SimplePolyMapping>(makeCenterAndScale(), makePoly(order));
+        auto chip = std::make_shared<jointcal::SimplePolyMapping>(makeCenterAndScale(), makePoly(1));
+        auto visit = std::make_shared<jointcal::SimplePolyMapping>(jointcal::GtransfoLin(), makePoly(order));
+        auto two = std::make_shared<jointcal::TwoTransfoMapping>(chip, visit);
+        for (auto batch : batchSizes) {
+            auto points = std::make_shared<std::vector<jointcal::FatPoint>>(makePoints(batch));
+            registry.add(makeName("SimplePolyMapping::computeTransformAndDerivatives", order, batch), batch,
+                         [simple, points]() {
+                             jointcal::FatPoint out;
+                             Eigen::MatrixX2d H(simple->getNpar(), 2);
+                             for (auto const &point : *points) {
+                                 simple->computeTransformAndDerivatives(point, out, H);
+                                 benchmark::doNotOptimize(H(0, 0));
+                             }
+                         });
+            registry.add(makeName("TwoTransfoMapping::computeTransformAndDerivatives", order, batch), batch,
+                         [two, points]() {
+                             jointcal::FatPoint out;
+                             Eigen::MatrixX2d H(two->getNpar(), 2);
+                             for (auto const &point : *points) {
+                                 two->computeTransformAndDerivatives(point, out, H);
+                                 benchmark::doNotOptimize(H(0, 0));
+                             }
+                         });
+            registry.add(makeName("TwoTransfoMapping::transformPosAndErrors", order, batch), batch,
+                         [two, points]() {
+                             jointcal::FatPoint out;
+                             for (auto const &point : *points) {
+                                 two->transformPosAndErrors(point, out);
+                                 benchmark::doNotOptimize(out);
+                             }
+                         });
+        }
+    }
+}
+
+void registerPhotometryTransfo(benchmark::Registry &registry) {
+    lsst::afw::geom::Box2D bbox(lsst::afw::geom::Point2D(0, 0), lsst::afw::geom::Point2D(xMax, yMax));
+    for (unsigned order : {1, 3, 7}) {
+        auto transfo = std::make_shared<jointcal::PhotometryTransfoChebyshev>(order, bbox);
+        Eigen::VectorXd delta = Eigen::VectorXd::Constant(transfo->getNpar(), 1e-3);
+        transfo->offsetParams(delta);
+        for (auto batch : batchSizes) {
+            auto points = std::make_shared<std::vector<jointcal::FatPoint>>(makePoints(batch));
+            registry.add(makeName("PhotometryTransfoChebyshev::transform", order, batch), batch,
+                         [transfo, points]() {
+                             for (auto const &point : *points) {
+                                 double value = transfo->transform(point.x, point.y, 1000.);
+                                 benchmark::doNotOptimize(value);
+                             }
+                         });
+            registry.add(makeName("PhotometryTransfoChebyshev::computeParameterDerivatives", order, batch),
+                         batch, [transfo, points]() {
+                             Eigen::VectorXd derivatives(transfo->getNpar());
+                             for (auto const &point : *points) {
+                                 transfo->computeParameterDerivatives(point.x, point.y, 1000., derivatives);
+                                 benchmark::doNotOptimize(derivatives(0));
+                             }
+                         });
+        }
+    }
+}
+
+// The chi2 loop of AstrometryFit over the measurements of a catalog, read from the MeasuredStars or from
+// their CompactMeasurements. Each fitted star has about three measurements, assigned at random as after
+// the association of several visits.
+void registerMeasurementLoops(benchmark::Registry &registry) {
+    auto mapping = std::make_shared<jointcal::SimplePolyMapping>(makeCenterAndScale(), makePoly(3));
+    for (std::size_t batch : {10000, 300000}) {
+        auto points = makePoints(batch);
+        std::vector<std::shared_ptr<jointcal::FittedStar>> fittedStars;
+        for (std::size_t i = 0; i < batch / 3; ++i) {
+            jointcal::BaseStar const star(points[3 * i], 1., 0.1);
+            fittedStars.push_back(std::make_shared<jointcal::FittedStar>(star));
+        }
+        std::mt19937 generator(7);
+        std::uniform_int_distribution<std::size_t> pick(0, fittedStars.size() - 1);
+        auto catalog = std::make_shared<jointcal::MeasuredStarList>();
+        for (auto const &point : points) {
+            auto measuredStar = std::make_shared<jointcal::MeasuredStar>(jointcal::BaseStar(point, 1., 0.1));
+            measuredStar->vx = point.vx;
+            measuredStar->vy = point.vy;
+            measuredStar->vxy = point.vxy;
+            measuredStar->setFittedStar(fittedStars[pick(generator)]);
+            catalog->push_back(std::move(measuredStar));
+        }
+        auto compact = std::make_shared<jointcal::CompactMeasurementList>(
+                jointcal::makeCompactMeasurementList(*catalog));
+        std::string const suffix = "/batch:" + std::to_string(batch);
+        registry.add("AstrometryFit::measurementLoop/storage:list" + suffix, batch, [mapping, catalog]() {
+            jointcal::FatPoint out;
+            double chi2 = 0;
+            for (auto const &measuredStar : *catalog) {
+                if (!measuredStar->isValid()) continue;
+                jointcal::FittedStar const &fittedStar = *measuredStar->getFittedStar();
+                mapping->transformPosAndErrors(jointcal::FatPoint(*measuredStar), out);
+                chi2 += std::pow(fittedStar.x - out.x, 2) / out.vx +
+                        std::pow(fittedStar.y - out.y, 2) / out.vy;
+            }
+            benchmark::doNotOptimize(chi2);
+        });
+        registry.add("AstrometryFit::measurementLoop/storage:compact" + suffix, batch, [mapping, compact]() {
+            jointcal::FatPoint out;
+            double chi2 = 0;
+            for (auto const &measurement : *compact) {
+                jointcal::FittedStar const &fittedStar = *measurement.fittedStar;
+                mapping->transformPosAndErrors(measurement.getPosition(), out);
+                chi2 += std::pow(fittedStar.x - out.x, 2) / out.vx +
+                        std::pow(fittedStar.y - out.y, 2) / out.vy;
+            }
+            benchmark::doNotOptimize(chi2);
+        });
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    benchmark::Registry registry;
+    registerGtransfoPoly(registry);
+    registerTanRaDec2Pix(registry);
+    registerMappings(registry);
+    registerPhotometryTransfo(registry);
+    registerMeasurementLoops(registry);
+    auto results = registry.run(argc > 1 ? argv[1] : "");
+    return (benchmark::Registry::check(results) == 0) ? 0 : 1;
+}
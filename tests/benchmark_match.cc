@@ -0,0 +1,224 @@
+/*
+ * Benchmarks of the list matching code used to register catalogs: the FastFinder
+ * nearest-neighbour search, listMatchCollect, the combinatorial search of
+ * listMatchCombinatorial, the shift searches, the polynomial fits of the matches, and the blind
+ * matching of many CCDs to a shared reference index.
+ *
+ * Usage: benchmark_match [name filter]   (see microbenchmark.h for the environment variables)
+ * Exits with a non-zero status if a baseline is given and a benchmark regressed.
+ */
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lsst/log/Log.h"
+#include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/FastFinder.h"
+#include "lsst/jointcal/FatPoint.h"
+#include "lsst/jointcal/Frame.h"
+#include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/ListMatch.h"
+#include "lsst/jointcal/StarMatch.h"
+
+#include "microbenchmark.h"
+
+JOINTCAL_BENCHMARK_COUNT_ALLOCATIONS()
+
+namespace jointcal = lsst::jointcal;
+namespace benchmark = lsst::jointcal::benchmark;
+
+namespace {
+
+// A CCD-sized domain.
+double const xMax = 2048;
+double const yMax = 4096;
+
+/// Stars uniformly spread over the domain, with a power-law flux distribution.
+std::shared_ptr<jointcal::BaseStarList> makeStars(std::size_t n, unsigned seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    auto stars = std::make_shared<jointcal::BaseStarList>();
+    for (std::size_t i = 0; i < n; ++i) {
+        double flux = 1000. * std::pow(uniform(generator) + 1e-3, -1.5);
+        stars->push_back(std::make_shared<jointcal::BaseStar>(xMax * uniform(generator),
+                                                              yMax * uniform(generator), flux, 1.));
+    }
+    return stars;
+}
+
+/**
+ * The same sky seen through a rotation and shift, with centroid noise, a fraction of the stars
+ * missing and as many spurious ones: a typical pair of lists to register.
+ */
+std::shared_ptr<jointcal::BaseStarList> makeMatchingStars(jointcal::BaseStarList const &stars,
+                                                          jointcal::Gtransfo const &transfo, unsigned seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::normal_distribution<double> noise(0., 0.1);
+    auto result = std::make_shared<jointcal::BaseStarList>();
+    for (auto const &star : stars) {
+        if (uniform(generator) < 0.1) continue;
+        jointcal::Point where = transfo.apply(*star);
+        result->push_back(std::make_shared<jointcal::BaseStar>(
+                where.x + noise(generator), where.y + noise(generator), star->getFlux(), 1.));
+    }
+    auto spurious = makeStars(stars.size() / 10, seed + 1);
+    for (auto const &star : *spurious) result->push_back(star);
+    return result;
+}
+
+void registerFastFinder(benchmark::Registry &registry) {
+    for (std::size_t n : {1000, 10000}) {
+        auto stars = makeStars(n, 1);
+        auto queries = makeStars(n, 2);
+        auto finder = std::make_shared<jointcal::FastFinder>(*stars);
+        registry.add("FastFinder::findClosest/n:" + std::to_string(n), n, [finder, queries]() {
+            for (auto const &query : *queries) {
+                benchmark::doNotOptimize(finder->findClosest(*query, 5.).get());
+            }
+        });
+        registry.add("FastFinder::FastFinder/n:" + std::to_string(n), n,
+                     [stars]() { benchmark::doNotOptimize(jointcal::FastFinder(*stars).count); });
+    }
+}
+
+void registerListMatch(benchmark::Registry &registry) {
+    jointcal::Point center(xMax / 2, yMax / 2);
+    auto transfo = std::make_shared<jointcal::GtransfoLin>(
+            jointcal::GtransfoLinShift(12.3, -25.6) * jointcal::GtransfoLinRot(0.01, &center));
+    for (std::size_t n : {1000, 10000}) {
+        auto stars1 = makeStars(n, 3);
+        auto stars2 = makeMatchingStars(*stars1, *transfo, 4);
+        registry.add("listMatchCollect/n:" + std::to_string(n), n, [stars1, stars2, transfo]() {
+            benchmark::doNotOptimize(jointcal::listMatchCollect(*stars1, *stars2, transfo.get(), 1.)->size());
+        });
+    }
+    for (std::size_t n : {100, 1000}) {
+        auto stars1 = makeStars(n, 5);
+        auto stars2 = makeMatchingStars(*stars1, *transfo, 6);
+        registry.add("listMatchCombinatorial/n:" + std::to_string(n), 1, [stars1, stars2]() {
+            benchmark::doNotOptimize(jointcal::listMatchCombinatorial(*stars1, *stars2).get());
+        });
+    }
+}
+
+/**
+ * Matches of the points of a CCD-sized domain through an order-5 distortion, with centroid noise and a few
+ * percent of outliers for refineTransfo to clip.
+ */
+std::shared_ptr<jointcal::StarMatchList> makeDistortedMatches(std::size_t n, unsigned seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::normal_distribution<double> noise(0., 0.1);
+    auto matches = std::make_shared<jointcal::StarMatchList>();
+    for (std::size_t i = 0; i < n; ++i) {
+        jointcal::FatPoint point1(xMax * uniform(generator), yMax * uniform(generator), 0.01, 0.01, 0.);
+        double u = point1.x / xMax - 0.5;
+        double v = point1.y / yMax - 0.5;
+        double outlier = (uniform(generator) < 0.03) ? 20. : 0.;
+        jointcal::FatPoint point2(point1.x + 3. * u * v + 2. * std::pow(u, 5) + noise(generator) + outlier,
+                                  point1.y - 4. * u * u + std::pow(v, 4) + noise(generator), 0.01, 0.01, 0.);
+        // distinct stars, or removeAmbiguities would keep a single match.
+        matches->emplace_back(point1, point2, std::make_shared<jointcal::BaseStar>(point1, 1., 0.),
+                              std::make_shared<jointcal::BaseStar>(point2, 1., 0.));
+    }
+    return matches;
+}
+
+// The two shift searches, for a large initial error.
+void registerShift(benchmark::Registry &registry) {
+    auto transfo = std::make_shared<jointcal::GtransfoLinShift>(57.3, -123.8);
+    double const maxShift = 200;
+    for (std::size_t n : {1000, 10000}) {
+        auto stars1 = makeStars(n, 8);
+        auto stars2 = makeMatchingStars(*stars1, *transfo, 9);
+        std::string suffix = "/maxShift:" + std::to_string(int(maxShift)) + "/n:" + std::to_string(n);
+        registry.add("listMatchupShift" + suffix, n, [stars1, stars2, maxShift]() {
+            jointcal::GtransfoIdentity identity;
+            benchmark::doNotOptimize(jointcal::listMatchupShift(*stars1, *stars2, identity, maxShift).get());
+        });
+        registry.add("listMatchupShiftByCorrelation" + suffix, n, [stars1, stars2, maxShift]() {
+            jointcal::GtransfoIdentity identity;
+            benchmark::doNotOptimize(
+                    jointcal::listMatchupShiftByCorrelation(*stars1, *stars2, identity, maxShift).get());
+        });
+    }
+}
+
+/**
+ * A row of CCDs, each rotated a little and seen at half its pixel size in the reference, matched blindly
+ * to the union of their stars.
+ */
+void registerBlindMatch(benchmark::Registry &registry) {
+    std::size_t const nCcds = 8;
+    std::size_t const n = 1000;
+    double const scale = 0.5;
+    auto lists = std::make_shared<std::vector<std::shared_ptr<jointcal::BaseStarList>>>();
+    auto footprints = std::make_shared<std::vector<jointcal::Frame>>();
+    jointcal::BaseStarList reference;
+    jointcal::Point center(xMax / 2, yMax / 2);
+    for (std::size_t ccd = 0; ccd < nCcds; ++ccd) {
+        jointcal::GtransfoLin transfo = jointcal::GtransfoLinScale(scale) *
+                                        jointcal::GtransfoLinShift(1.05 * xMax * ccd, 0.) *
+                                        jointcal::GtransfoLinRot(0.002 * ccd, &center);
+        lists->push_back(makeStars(n, 20 + ccd));
+        auto stars = makeMatchingStars(*lists->back(), transfo, 40 + ccd);
+        reference.insert(reference.end(), stars->begin(), stars->end());
+        jointcal::Frame frame = transfo.apply(jointcal::Frame(0, 0, xMax, yMax), false);
+        footprints->emplace_back(frame.xMin - 25, frame.yMin - 25, frame.xMax + 25, frame.yMax + 25);
+    }
+    auto index = std::make_shared<jointcal::ReferenceMatchIndex>(reference, scale);
+    for (unsigned nProcesses : {1, 4}) {
+        std::string suffix = "/nCcds:" + std::to_string(nCcds) + "/n:" + std::to_string(n) +
+                             "/nProcesses:" + std::to_string(nProcesses);
+        registry.add("listMatchBlind" + suffix, nCcds, [lists, footprints, index, nProcesses]() {
+            std::vector<jointcal::BaseStarList const *> pointers;
+            for (auto const &list : *lists) pointers.push_back(list.get());
+            jointcal::MatchConditions conditions;
+            benchmark::doNotOptimize(
+                    jointcal::listMatchBlind(pointers, *footprints, *index, conditions, 1, nProcesses)
+                            .size());
+        });
+    }
+}
+
+void registerPolyFit(benchmark::Registry &registry) {
+    unsigned const order = 5;
+    std::size_t const n = 10000;
+    auto matches = makeDistortedMatches(n, 7);
+    std::string suffix = "/order:" + std::to_string(order) + "/n:" + std::to_string(n);
+    registry.add("GtransfoPoly::fit" + suffix, n, [matches, order]() {
+        jointcal::GtransfoPoly poly(order);
+        benchmark::doNotOptimize(poly.fit(*matches));
+    });
+    // The list is copied at each call, because the clipping shortens it.
+    for (bool incremental : {false, true}) {
+        std::string name = "StarMatchList::refineTransfo" + std::string(incremental ? "/incremental" : "");
+        registry.add(name + suffix, n, [matches, order, incremental]() {
+            jointcal::StarMatchList list;
+            list.insert(list.end(), matches->begin(), matches->end());
+            list.setTransfoOrder(order);
+            list.refineTransfo(3., incremental);
+            benchmark::doNotOptimize(list.size());
+        });
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    // listMatchCombinatorial reports its progress at INFO level.
+    LOG_CONFIG_PROP("log4j.rootLogger=WARN, A1\nlog4j.appender.A1=ConsoleAppender\n"
+                    "log4j.appender.A1.layout=PatternLayout\n");
+    benchmark::Registry registry;
+    registerFastFinder(registry);
+    registerListMatch(registry);
+    registerShift(registry);
+    registerBlindMatch(registry);
+    registerPolyFit(registry);
+    auto results = registry.run(argc > 1 ? argv[1] : "");
+    return (benchmark::Registry::check(results) == 0) ? 0 : 1;
+}
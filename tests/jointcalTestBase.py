@@ -213,8 +213,11 @@ class JointcalTestBase:
             Result metric dictionary from jointcal.py
         expect : dict
             Expected metric dictionary; set a value to None to not test it.
+            Run-dependent profiling metrics (timings, matrix sizes) are not tested.
         """
         for key in result:
+            if 'profile' in result[key].metric.tags:
+                continue
             if expect[key.metric] is not None:
                 value = result[key].quantity.value
                 if type(value) == float:
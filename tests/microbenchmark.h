@@ -0,0 +1,209 @@
+// -*- LSST-C++ -*-
+#ifndef LSST_JOINTCAL_TESTS_MICROBENCHMARK_H
+#define LSST_JOINTCAL_TESTS_MICROBENCHMARK_H
+
+/*
+ * A minimal, dependency-free harness in the spirit of Google Benchmark, for the
+ * benchmark_*.cc programs in this directory.
+ *
+ * A benchmark is a name, a number of "items" processed per call (points, matches, ...)
+ * and a callable. Each benchmark is run repeatedly until it accumulated at least the
+ * minimum time, and the best of a few such repetitions is reported in ns per item.
+ *
+ * The programs are built and run by scons with the unit tests, with a short minimum time
+ * so that they stay cheap. To get stable numbers, run them by hand with e.g.
+ *     JOINTCAL_BENCHMARK_MIN_TIME=0.5 tests/benchmark_kernels [name filter]
+ * Set JOINTCAL_BENCHMARK_OUTPUT to a file name to also get the results as CSV.
+ *
+ * Regression guard: set JOINTCAL_BENCHMARK_BASELINE to a CSV file written earlier through
+ * JOINTCAL_BENCHMARK_OUTPUT (on the same machine), and check() reports every benchmark slower than
+ * JOINTCAL_BENCHMARK_TOLERANCE (default 1.5) times its baseline, or allocating more than
+ * JOINTCAL_BENCHMARK_ALLOCATION_TOLERANCE (default 1.0) times as often. Allocations are only counted in
+ * programs that expand JOINTCAL_BENCHMARK_COUNT_ALLOCATIONS() once, at namespace scope.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace lsst {
+namespace jointcal {
+namespace benchmark {
+
+/// Prevent the compiler from optimizing away a computed value.
+template <typename T>
+inline void doNotOptimize(T const &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// Number of calls to the global operator new so far (always 0 without JOINTCAL_BENCHMARK_COUNT_ALLOCATIONS).
+inline long &allocationCount() {
+    static long count = 0;
+    return count;
+}
+
+struct Result {
+    std::string name;
+    double itemsPerCall;
+    double nsPerItem;
+    long calls;
+    long allocationsPerCall;
+};
+
+class Registry {
+public:
+    /**
+     * Register a benchmark.
+     *
+     * @param name          Unique name, conventionally "Class::method/param:value/...".
+     * @param itemsPerCall  How many items (points, matches...) one call of func processes.
+     * @param func          The code to time.
+     */
+    void add(std::string const &name, double itemsPerCall, std::function<void()> func) {
+        _benchmarks.push_back({name, itemsPerCall, std::move(func)});
+    }
+
+    /// Run all benchmarks whose name contains filter, print the results and return them.
+    std::vector<Result> run(std::string const &filter = "") const {
+        double minTime = 0.01;
+        if (char const *env = std::getenv("JOINTCAL_BENCHMARK_MIN_TIME")) minTime = std::atof(env);
+        std::vector<Result> results;
+        std::cout << std::left << std::setw(64) << "benchmark" << std::right << std::setw(14) << "ns/item"
+                  << std::setw(12) << "calls" << std::setw(12) << "allocs/call" << std::endl;
+        for (auto const &benchmark : _benchmarks) {
+            if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) continue;
+            Result result = runOne(benchmark, minTime);
+            std::cout << std::left << std::setw(64) << result.name << std::right << std::setw(14)
+                      << std::setprecision(4) << result.nsPerItem << std::setw(12) << result.calls
+                      << std::setw(12) << result.allocationsPerCall << std::endl;
+            results.push_back(result);
+        }
+        if (char const *output = std::getenv("JOINTCAL_BENCHMARK_OUTPUT")) {
+            std::ofstream stream(output);
+            stream << "name,itemsPerCall,nsPerItem,calls,allocationsPerCall" << std::endl;
+            for (auto const &result : results) {
+                stream << result.name << ',' << result.itemsPerCall << ',' << result.nsPerItem << ','
+                       << result.calls << ',' << result.allocationsPerCall << std::endl;
+            }
+        }
+        return results;
+    }
+
+    /**
+     * Compare results to the baseline named by JOINTCAL_BENCHMARK_BASELINE, if any.
+     *
+     * Benchmarks missing from the baseline are not checked.
+     *
+     * @return The number of regressions, each of which is reported on std::cerr.
+     */
+    static int check(std::vector<Result> const &results) {
+        char const *baselineFile = std::getenv("JOINTCAL_BENCHMARK_BASELINE");
+        if (!baselineFile) return 0;
+        double tolerance = 1.5;
+        if (char const *env = std::getenv("JOINTCAL_BENCHMARK_TOLERANCE")) tolerance = std::atof(env);
+        double allocationTolerance = 1.0;
+        if (char const *env = std::getenv("JOINTCAL_BENCHMARK_ALLOCATION_TOLERANCE")) {
+            allocationTolerance = std::atof(env);
+        }
+        std::map<std::string, Result> baseline = readResults(baselineFile);
+        int regressions = 0;
+        for (auto const &result : results) {
+            auto found = baseline.find(result.name);
+            if (found == baseline.end()) continue;
+            Result const &reference = found->second;
+            if (result.nsPerItem > tolerance * reference.nsPerItem) {
+                std::cerr << "REGRESSION " << result.name << ": " << result.nsPerItem << " ns/item, baseline "
+                          << reference.nsPerItem << " (tolerance " << tolerance << ")" << std::endl;
+                ++regressions;
+            }
+            if (result.allocationsPerCall > allocationTolerance * reference.allocationsPerCall) {
+                std::cerr << "REGRESSION " << result.name << ": " << result.allocationsPerCall
+                          << " allocations/call, baseline " << reference.allocationsPerCall << " (tolerance "
+                          << allocationTolerance << ")" << std::endl;
+                ++regressions;
+            }
+        }
+        return regressions;
+    }
+
+private:
+    struct Benchmark {
+        std::string name;
+        double itemsPerCall;
+        std::function<void()> func;
+    };
+
+    std::vector<Benchmark> _benchmarks;
+
+    static Result runOne(Benchmark const &benchmark, double minTime) {
+        using clock = std::chrono::steady_clock;
+        // warm up (caches, lazy initializations), and estimate the cost of one call.
+        auto start = clock::now();
+        benchmark.func();
+        double once = std::chrono::duration<double>(clock::now() - start).count();
+        long calls = std::max(1L, static_cast<long>(minTime / std::max(once, 1e-9)));
+        // count allocations on a call after the warm up, which may have allocated lazily-built state.
+        long allocationsBefore = allocationCount();
+        benchmark.func();
+        long allocationsPerCall = allocationCount() - allocationsBefore;
+        double best = std::numeric_limits<double>::infinity();
+        for (int repetition = 0; repetition < 3; ++repetition) {
+            start = clock::now();
+            for (long i = 0; i < calls; ++i) benchmark.func();
+            double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+            best = std::min(best, elapsed);
+        }
+        return {benchmark.name, benchmark.itemsPerCall, 1e9 * best / (calls * benchmark.itemsPerCall), calls,
+                allocationsPerCall};
+    }
+
+    /// Read a CSV file written through JOINTCAL_BENCHMARK_OUTPUT.
+    static std::map<std::string, Result> readResults(std::string const &fileName) {
+        std::map<std::string, Result> results;
+        std::ifstream stream(fileName);
+        if (!stream) {
+            std::cerr << "Cannot read benchmark baseline " << fileName << std::endl;
+            return results;
+        }
+        std::string line;
+        std::getline(stream, line);  // header
+        while (std::getline(stream, line)) {
+            std::istringstream fields(line);
+            Result result{"", 0, 0, 0, 0};
+            std::string field;
+            std::getline(fields, result.name, ',');
+            if (std::getline(fields, field, ',')) result.itemsPerCall = std::atof(field.c_str());
+            if (std::getline(fields, field, ',')) result.nsPerItem = std::atof(field.c_str());
+            if (std::getline(fields, field, ',')) result.calls = std::atol(field.c_str());
+            if (std::getline(fields, field, ',')) result.allocationsPerCall = std::atol(field.c_str());
+            if (!result.name.empty()) results[result.name] = result;
+        }
+        return results;
+    }
+};
+
+}  // namespace benchmark
+}  // namespace jointcal
+}  // namespace lsst
+
+/// Replace the global operator new/delete with versions that count allocations in allocationCount().
+#define JOINTCAL_BENCHMARK_COUNT_ALLOCATIONS()                                    \
+    void *operator new(std::size_t size) {                                        \
+        ++lsst::jointcal::benchmark::allocationCount();                           \
+        if (void *pointer = std::malloc(size ? size : 1)) return pointer;         \
+        throw std::bad_alloc();                                                   \
+    }                                                                             \
+    void operator delete(void *pointer) noexcept { std::free(pointer); }          \
+    void operator delete(void *pointer, std::size_t) noexcept { std::free(pointer); }
+
+#endif  // LSST_JOINTCAL_TESTS_MICROBENCHMARK_H
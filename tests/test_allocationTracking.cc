@@ -0,0 +1,110 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_allocationTracking
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "lsst/jointcal/AllocationTracking.h"
+#include "lsst/jointcal/Profiling.h"
+
+namespace jointcal = lsst::jointcal;
+
+namespace {
+
+// Room for the pointers, allocated before any counting starts.
+std::vector<void *> reserve(std::size_t nAllocations) {
+    std::vector<void *> pointers;
+    pointers.reserve(nAllocations);
+    return pointers;
+}
+
+// Direct calls to ::operator new, unlike new expressions, cannot be elided by the compiler.
+void fill(std::vector<void *> &pointers, std::size_t nAllocations, std::size_t size) {
+    for (std::size_t i = 0; i < nAllocations; ++i) pointers.push_back(::operator new(size));
+}
+
+void release(std::vector<void *> &pointers) {
+    for (auto pointer : pointers) ::operator delete(pointer);
+    pointers.clear();
+}
+
+/// Allocations reported for nAllocations of size bytes made inside a scope, or outside of any if !scoped.
+jointcal::AllocationCount countAllocations(std::size_t nAllocations, std::size_t size, bool scoped) {
+    auto pointers = reserve(nAllocations);
+    jointcal::AllocationCount before, after;
+    if (scoped) {
+        jointcal::AllocationTrackingScope scope;
+        before = jointcal::getThreadAllocations();
+        fill(pointers, nAllocations, size);
+        after = jointcal::getThreadAllocations();
+    } else {
+        before = jointcal::getThreadAllocations();
+        fill(pointers, nAllocations, size);
+        after = jointcal::getThreadAllocations();
+    }
+    release(pointers);
+    return jointcal::AllocationCount(after.count - before.count, after.bytes - before.bytes);
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_allocationTracking)
+
+BOOST_AUTO_TEST_CASE(test_scope_counts_exactly) {
+    auto counted = countAllocations(7, 24, true);
+    if (jointcal::isAllocationTrackingEnabled()) {
+        BOOST_CHECK_EQUAL(counted.count, 7u);
+        BOOST_CHECK_EQUAL(counted.bytes, 7u * 24u);
+    } else {
+        BOOST_CHECK_EQUAL(counted.count, 0u);
+        BOOST_CHECK_EQUAL(counted.bytes, 0u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_inert_outside_scopes) {
+    auto counted = countAllocations(7, 24, false);
+    BOOST_CHECK_EQUAL(counted.count, 0u);
+    BOOST_CHECK_EQUAL(counted.bytes, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_nested_scopes_count_once) {
+    std::uint64_t const expected = jointcal::isAllocationTrackingEnabled() ? 5 : 0;
+    auto pointers = reserve(5);
+    jointcal::AllocationCount before, after;
+    {
+        jointcal::AllocationTrackingScope outer;
+        before = jointcal::getThreadAllocations();
+        fill(pointers, 2, 16);
+        {
+            jointcal::AllocationTrackingScope inner;
+            fill(pointers, 3, 16);
+        }
+        after = jointcal::getThreadAllocations();
+    }
+    release(pointers);
+    BOOST_CHECK_EQUAL(after.count - before.count, expected);
+    // the outer scope has ended: nothing more is counted.
+    BOOST_CHECK_EQUAL(countAllocations(4, 16, false).count, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_phase_counts_its_allocations) {
+    jointcal::Profile profile;
+    auto pointers = reserve(3);
+    {
+        jointcal::ScopedPhase phase(profile, "allocate");
+        fill(pointers, 3, 40);
+        phase.stop();
+    }
+    release(pointers);
+    auto timing = profile.getTimings().at("allocate");
+    BOOST_CHECK_EQUAL(timing.calls, 1u);
+    BOOST_CHECK_EQUAL(timing.allocations, jointcal::isAllocationTrackingEnabled() ? 3u : 0u);
+    BOOST_CHECK_EQUAL(timing.allocatedBytes, jointcal::isAllocationTrackingEnabled() ? 120u : 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -246,6 +246,53 @@ class SimpleAstrometryModelTestCase(AstrometryModelTestBase, lsst.utils.tests.Te
         result = self.model2.getNpar(self.associations.getCcdImageList()[1])
         self.assertEqual(result, polyParams(self.order2))
 
+    def testOrderSelection(self):
+        """Each ccdImage gets its own order, and AIC, which penalizes parameters less than BIC for more
+        than 7 measurements, never selects a lower order."""
+        ccdImageList = self.associations.getCcdImageList()
+        bic = astrometryModels.SimpleAstrometryModel(ccdImageList, self.projectionHandler, True,
+                                                     order=self.order2, orderCriterion="BIC")
+        aic = astrometryModels.SimpleAstrometryModel(ccdImageList, self.projectionHandler, True,
+                                                     order=self.order2, orderCriterion="AIC")
+        validNpars = [(order + 1)*(order + 2) for order in range(1, self.order2 + 1)]
+        for ccdImage in ccdImageList:
+            self.assertIn(bic.getNpar(ccdImage), validNpars)
+            self.assertGreaterEqual(aic.getNpar(ccdImage), bic.getNpar(ccdImage))
+
+        with self.assertRaises(lsst.pex.exceptions.InvalidParameterError):
+            astrometryModels.SimpleAstrometryModel(ccdImageList, self.projectionHandler, True,
+                                                   order=self.order2, orderCriterion="XIC")
+
+
+    def testGetTransfoAfterOffsetParams(self):
+        """The transfo of a mapping, which getTransfo keeps between calls, follows offsetParams."""
+        ccdImageList = self.associations.getCcdImageList()
+        nParameters = sum(self.model1.getNpar(ccdImage) for ccdImage in ccdImageList)
+        mapping = self.model1.getMapping(ccdImageList[0])
+        bbox = ccdImageList[0].getDetector().getBBox()
+        stars = [lsst.jointcal.star.BaseStar(x, y, 1e-3, 1e-3)
+                 for x, y in itertools.product(np.linspace(bbox.getMinX(), bbox.getMaxX(), 5),
+                                               np.linspace(bbox.getMinY(), bbox.getMaxY(), 5))]
+
+        def checkTransfo():
+            """Return the images of the stars by getTransfo, checked against transformPosAndErrors."""
+            transfo = mapping.getTransfo()
+            result = []
+            for star in stars:
+                point = transfo.apply(star)
+                expect = mapping.transformPosAndErrors(star)
+                self.assertFloatsAlmostEqual(point.x, expect.x, rtol=1e-12, atol=1e-12)
+                self.assertFloatsAlmostEqual(point.y, expect.y, rtol=1e-12, atol=1e-12)
+                result.append((point.x, point.y))
+            return np.array(result)
+
+        before = checkTransfo()
+        # a second call without changing the parameters returns the same transfo.
+        self.assertFloatsEqual(checkTransfo(), before)
+        self.model1.offsetParams(1e-6*np.random.randn(nParameters))
+        after = checkTransfo()
+        self.assertGreater(np.max(np.abs(after - before)), 1e-9)
+
 
 class ConstrainedAstrometryModelTestCase(AstrometryModelTestBase, lsst.utils.tests.TestCase):
     """Test the `ConstrainedAstrometryModel`, with one mapping per ccd and one
@@ -0,0 +1,280 @@
+"""Tests of domain-decomposed fitting: partitioning, shared star matching, consensus and priors."""
+import unittest
+
+import numpy as np
+
+import lsst.afw.geom
+import lsst.afw.table
+import lsst.log
+import lsst.utils.tests
+
+import lsst.jointcal
+from lsst.jointcal import benchmark
+from lsst.jointcal import decomposition
+
+
+def makeCatalog(ra, dec, flux):
+    """A catalog like Associations.makeFittedStarCatalog's, with ids the row indices."""
+    schema = lsst.afw.table.SimpleTable.makeMinimalSchema()
+    fluxKey = schema.addField("flux", type=float, doc="flux")
+    catalog = lsst.afw.table.SimpleCatalog(schema)
+    for i, (r, d, f) in enumerate(zip(ra, dec, flux)):
+        record = catalog.addNew()
+        record.setId(i)
+        record.setCoord(lsst.afw.geom.SpherePoint(r, d, lsst.afw.geom.degrees))
+        record.set(fluxKey, f)
+    return catalog
+
+
+def makeFit(tract, kind, detectorIndices=(), withRefStars=True):
+    """The associations, model and fit of the astrometry or photometry of some detectors of tract."""
+    if kind == "astrometry":
+        associations = benchmark.makeSyntheticAssociations(tract, detectorIndices, rejectBadFluxes=False,
+                                                           withRefStars=withRefStars)
+        associations.deprojectFittedStars()
+        projection = lsst.jointcal.OneTPPerVisitHandler(associations.getCcdImageList())
+        model = lsst.jointcal.SimpleAstrometryModel(associations.getCcdImageList(), projection, True,
+                                                    nNotFit=0, order=3)
+        fit = lsst.jointcal.AstrometryFit(associations, model, 0.02)
+    else:
+        associations = benchmark.makeSyntheticAssociations(tract, detectorIndices, withRefStars=withRefStars)
+        model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
+        fit = lsst.jointcal.PhotometryFit(associations, model)
+    return associations, model, fit
+
+
+class DecompositionTestCase(lsst.utils.tests.TestCase):
+    def test_partitionRegions(self):
+        rng = np.random.RandomState(1)
+        ra = rng.uniform(359, 361, 200) % 360  # across ra=0
+        dec = rng.uniform(-1, 1, 200)
+        regions = decomposition.partitionRegions(ra, dec, 4, 0.1)
+        self.assertEqual(len(regions), 4)
+        owned = np.concatenate([region.owned for region in regions])
+        np.testing.assert_array_equal(np.sort(owned), np.arange(200))
+        for region in regions:
+            self.assertEqual(len(region.owned), 50)
+            self.assertTrue(np.all(np.in1d(region.owned, region.members)))
+            self.assertGreater(len(region.members), len(region.owned))
+        self.assertGreater(len(decomposition.findNeighbours(regions)), 0)
+        # no overlap: the regions only fit what they own.
+        for region in decomposition.partitionRegions(ra, dec, 4, 0.):
+            np.testing.assert_array_equal(region.owned, region.members)
+
+    def test_matchSharedStars(self):
+        catalogs = [makeCatalog([10., 10.1, 10.2], [0., 0., 0.], [1., 2., 3.]),
+                    makeCatalog([10.2, 10.3, 10.1], [0., 0., 1e-5], [3., 4., 2.]),
+                    makeCatalog([10.2, 11.], [0., 0.], [3., 5.])]
+        groups = decomposition.matchSharedStars(catalogs, 0.5*lsst.afw.geom.arcseconds,
+                                                [(0, 1), (1, 2)])
+        self.assertEqual(groups, [[(0, 1), (1, 2)], [(0, 2), (1, 0), (2, 0)]])
+
+    def test_consensus(self):
+        """Two regions that each pull their copies of the shared stars toward their own values, as
+        quadratic objectives of equal weight, agree on the mean."""
+        groups = [[(0, 0), (1, 1)], [(0, 1), (1, 0)]]
+        solver = decomposition.ConsensusSolver(groups, 2)
+        own = [np.array([1.0, 2.0]), np.array([2.04, 1.01])]
+        catalogs = [makeCatalog([10., 11.], [0., 0.], own[0]), makeCatalog([11., 10.], [0., 0.], own[1])]
+        for i in range(50):
+            update = solver.update(catalogs, "photometry")
+            if update.primal < 1e-6 and update.dual < 1e-6:
+                break
+            fluxes = []
+            for region, (starIds, (target,)) in enumerate(update.targets):
+                flux = own[region].copy()
+                flux[starIds] = (own[region][starIds] + target)/2  # objective and prior of equal weight
+                fluxes.append(flux)
+            catalogs = [makeCatalog([10., 11.], [0., 0.], fluxes[0]),
+                        makeCatalog([11., 10.], [0., 0.], fluxes[1])]
+        else:
+            self.fail("No consensus after 50 rounds")
+        self.assertFloatsAlmostEqual(catalogs[0]['flux'], np.array([1.005, 2.02]), rtol=1e-5)
+        self.assertFloatsAlmostEqual(catalogs[1]['flux'], np.array([2.02, 1.005]), rtol=1e-5)
+
+
+class FittedStarPriorsTestCase(lsst.utils.tests.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.tract = benchmark.makeSyntheticTract('tiny')
+
+    def setUp(self):
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+        self.associations = benchmark.makeSyntheticAssociations(self.tract)
+
+    def test_flux_priors(self):
+        model = lsst.jointcal.SimplePhotometryModel(self.associations.getCcdImageList())
+        fit = lsst.jointcal.PhotometryFit(self.associations, model)
+        fit.minimize("Model Fluxes")
+        before = self.associations.makeFittedStarCatalog()
+        self.assertEqual(len(before), self.associations.fittedStarListSize())
+        np.testing.assert_array_equal(before['id'], np.arange(len(before)))
+
+        indices = [0, 5, 10]
+        targets = [1.1*before['flux'][i] for i in indices]
+        errors = [1e-6*target for target in targets]
+        self.associations.setFittedStarPriors(indices, [], [], [], targets, errors)
+        self.assertEqual(self.associations.getNFittedStarPriors(), 3)
+        fit.minimize("Fluxes")
+        after = self.associations.makeFittedStarCatalog()
+        self.assertFloatsAlmostEqual(after['flux'][indices], np.array(targets), rtol=1e-4)
+
+        self.associations.clearFittedStarPriors()
+        self.assertEqual(self.associations.getNFittedStarPriors(), 0)
+        fit.minimize("Fluxes")
+        self.assertFloatsAlmostEqual(self.associations.makeFittedStarCatalog()['flux'], before['flux'],
+                                     rtol=1e-6)
+
+    def test_position_priors(self):
+        associations, model, fit = makeFit(self.tract, "astrometry")
+        fit.minimize("Distortions Positions")
+        before = associations.makeFittedStarCatalog()
+
+        # targets 0.1 arcseconds north-east of the fitted positions, with priors much tighter than the
+        # measurements.
+        indices = [0, 5, 10]
+        offset = 0.1/3600
+        dec = np.degrees(before['coord_dec'][indices]) + offset
+        ra = np.degrees(before['coord_ra'][indices]) + offset/np.cos(np.radians(dec))
+        associations.setFittedStarPriors(indices, ra.tolist(), dec.tolist(), [1e-8]*len(indices), [], [])
+        self.assertEqual(associations.getNFittedStarPriors(), len(indices))
+        fit.minimize("Distortions Positions")
+        after = associations.makeFittedStarCatalog()
+        for index, targetRa, targetDec in zip(indices, ra, dec):
+            target = lsst.afw.geom.SpherePoint(targetRa, targetDec, lsst.afw.geom.degrees)
+            self.assertLess(after[index].getCoord().separation(target).asArcseconds(), 1e-3)
+        # the other stars hardly move.
+        others = np.setdiff1d(np.arange(len(before)), indices)
+        separations = [after[i].getCoord().separation(before[i].getCoord()).asArcseconds() for i in others]
+        self.assertLess(np.median(separations), 0.01)
+
+        associations.clearFittedStarPriors()
+        self.assertEqual(associations.getNFittedStarPriors(), 0)
+        fit.minimize("Distortions Positions")
+        cleared = associations.makeFittedStarCatalog()
+        for star, original in zip(cleared, before):
+            self.assertLess(star.getCoord().separation(original.getCoord()).asArcseconds(), 1e-4)
+
+    def test_position_priors_need_sky_coordinates(self):
+        with self.assertRaises(lsst.pex.exceptions.LogicError):
+            self.associations.setFittedStarPriors([0], [10.], [0.], [1e-6], [], [])
+        with self.assertRaises(lsst.pex.exceptions.LengthError):
+            self.associations.setFittedStarPriors([0, 1], [], [], [], [1.], [1.])
+
+
+class ConsensusFitTestCase(lsst.utils.tests.TestCase):
+    """Fit two overlapping regions of a tract, the first three and the last three of its four detectors,
+    and bring them to a consensus as JointcalTask._fit_decomposed does."""
+    @classmethod
+    def setUpClass(cls):
+        cls.tract = benchmark.makeSyntheticTract('tiny')
+
+    def setUp(self):
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+        self.config = decomposition.DecompositionConfig()
+
+    def runConsensus(self, kind, whatToFit, tolerance, maxRounds=30):
+        fits = [makeFit(self.tract, kind, detectorIndices) for detectorIndices in ([0, 1, 2], [1, 2, 3])]
+        for associations, model, fit in fits:
+            fit.minimize(whatToFit)
+        catalogs = [associations.makeFittedStarCatalog() for associations, _, _ in fits]
+        groups = decomposition.matchSharedStars(catalogs, self.config.matchRadius*lsst.afw.geom.arcseconds,
+                                                [(0, 1)])
+        self.assertGreater(len(groups), 0)
+        solver = decomposition.ConsensusSolver(groups, len(fits))
+
+        disagreements = []
+        for nRounds in range(maxRounds):
+            update = solver.update(catalogs, kind)
+            disagreements.append(update.primal)
+            if update.primal < tolerance and update.dual < tolerance:
+                break
+            for (associations, model, fit), (ids, values) in zip(fits, update.targets):
+                ids = [int(i) for i in ids]
+                if kind == "astrometry":
+                    positionErr = [self.config.positionSigma/3600.]*len(ids)
+                    associations.setFittedStarPriors(ids, values[0].tolist(), values[1].tolist(), positionErr,
+                                                     [], [])
+                else:
+                    fluxErr = (np.abs(values[0])*self.config.fluxSigma).tolist()
+                    associations.setFittedStarPriors(ids, [], [], [], values[0].tolist(), fluxErr)
+                fit.minimize(whatToFit)
+            catalogs = [associations.makeFittedStarCatalog() for associations, _, _ in fits]
+        else:
+            self.fail("No %s consensus after %d rounds: disagreements %s" % (kind, maxRounds, disagreements))
+        # the independent fits disagree, and the consensus rounds bring them together.
+        self.assertGreater(nRounds, 0)
+        self.assertGreater(disagreements[0], tolerance)
+        return fits, catalogs, groups
+
+    def test_astrometry_consensus(self):
+        tolerance = self.config.positionTolerance
+        fits, catalogs, groups = self.runConsensus("astrometry", "Distortions Positions", tolerance)
+        for (first, firstId), (second, secondId) in groups:
+            separation = catalogs[first][firstId].getCoord().separation(catalogs[second][secondId].getCoord())
+            self.assertLess(separation.asArcseconds(), 2*tolerance)
+
+    def test_photometry_consensus(self):
+        tolerance = self.config.fluxTolerance
+        fits, catalogs, groups = self.runConsensus("photometry", "Model Fluxes", tolerance)
+        for (first, firstId), (second, secondId) in groups:
+            self.assertFloatsAlmostEqual(catalogs[first]['flux'][firstId], catalogs[second]['flux'][secondId],
+                                         rtol=2*tolerance)
+
+    def matchRegionWithoutRefStars(self, kind, whatToFit):
+        """Fit the first region with, and make the fit of the second without, reference stars; return the
+        second fit and the ids in each region of the stars they share."""
+        associations, model, fit = makeFit(self.tract, kind, [0, 1, 2])
+        fit.minimize(whatToFit)
+        bare = makeFit(self.tract, kind, [1, 2, 3], withRefStars=False)
+        self.assertEqual(bare[0].refStarListSize(), 0)
+        catalogs = [associations.makeFittedStarCatalog(), bare[0].makeFittedStarCatalog()]
+        groups = decomposition.matchSharedStars(catalogs, self.config.matchRadius*lsst.afw.geom.arcseconds,
+                                                [(0, 1)])
+        self.assertGreater(len(groups), 0)
+        ids = [[int(group[region][1]) for group in groups] for region in range(2)]
+        return bare, catalogs[0], ids
+
+    def test_priors_without_reference_stars(self):
+        """The priors alone constrain the fit of a region without reference stars: they add their terms
+        to the derivatives and pull the shared stars to their targets."""
+        (associations, model, fit), reference, (refIds, ids) = \
+            self.matchRegionWithoutRefStars("photometry", "Model Fluxes")
+        # the measurements alone fix the fluxes, but not their scale.
+        fit.minimize("Fluxes")
+        nTriplets = fit.countTriplets()
+        targets = reference['flux'][refIds]
+        associations.setFittedStarPriors(ids, [], [], [], targets.tolist(), (1e-6*targets).tolist())
+        self.assertEqual(fit.countTriplets(), nTriplets + len(ids))
+        self.assertEqual(fit.minimize("Model Fluxes"), lsst.jointcal.MinimizeResult.Converged)
+        self.assertEqual(fit.getProfile().getCounters()["nTriplets"], fit.countTriplets())
+        after = associations.makeFittedStarCatalog()
+        self.assertFloatsAlmostEqual(after['flux'][ids], targets, rtol=1e-4)
+
+        (associations, model, fit), reference, (refIds, ids) = \
+            self.matchRegionWithoutRefStars("astrometry", "Distortions Positions")
+        fit.minimize("Positions")
+        nTriplets = fit.countTriplets()
+        associations.setFittedStarPriors(ids, np.degrees(reference['coord_ra'][refIds]).tolist(),
+                                         np.degrees(reference['coord_dec'][refIds]).tolist(),
+                                         [1e-8]*len(ids), [], [])
+        # 2 position parameters in 2 columns per prior.
+        self.assertEqual(fit.countTriplets(), nTriplets + 4*len(ids))
+        self.assertEqual(fit.minimize("Distortions Positions"), lsst.jointcal.MinimizeResult.Converged)
+        after = associations.makeFittedStarCatalog()
+        for refId, id in zip(refIds, ids):
+            separation = after[id].getCoord().separation(reference[refId].getCoord())
+            self.assertLess(separation.asArcseconds(), 1e-3)
+
+
+class MemoryTester(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,686 @@
+"""Tests of FitterBase.minimize bookkeeping, worker processes, robust losses, error models, compact
+measurements, chromatic terms, reference proper motions and parallaxes, multi-band photometry, star flats,
+parameter layout and memory estimates, on a small synthetic tract."""
+import os
+import tempfile
+import unittest
+
+import numpy as np
+
+import lsst.afw.cameraGeom
+import lsst.afw.geom
+import lsst.afw.table
+import lsst.log
+import lsst.pex.exceptions
+import lsst.utils.tests
+
+import lsst.jointcal
+from lsst.jointcal import benchmark
+
+
+def matchTrueStars(tract, catalog):
+    """The index of the true star of tract nearest to each record of catalog, and its distance in
+    arcseconds."""
+    truth = np.array([[tract.getStarPosition(i).x, tract.getStarPosition(i).y]
+                      for i in range(tract.getNStars())])
+    indices = []
+    separations = []
+    for record in catalog:
+        ra = record.getCoord().getLongitude().asDegrees()
+        dec = record.getCoord().getLatitude().asDegrees()
+        dx = (truth[:, 0] - ra)*np.cos(np.radians(dec))
+        dy = truth[:, 1] - dec
+        distances = dx*dx + dy*dy
+        indices.append(np.argmin(distances))
+        separations.append(np.sqrt(distances[indices[-1]])*3600)
+    return np.array(indices), np.array(separations)
+
+
+class FitterTestBase:
+    """Set up a photometric fit of a tiny synthetic tract."""
+    @classmethod
+    def setUpClass(cls):
+        cls.tract = benchmark.makeSyntheticTract('tiny')
+
+    def setUp(self):
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+        self.associations, self.model, self.fit = self.makeFit()
+
+    def makeFit(self):
+        associations = benchmark.makeSyntheticAssociations(self.tract)
+        model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
+        fit = lsst.jointcal.PhotometryFit(associations, model)
+        return associations, model, fit
+
+    def makeAstrometryFit(self, compact=False, refCat=None):
+        """An astrometric fit of the same tract, with single precision measurements if compact, and the
+        tract's reference catalog unless refCat is given."""
+        associations = benchmark.makeSyntheticAssociations(self.tract, refCat=refCat, rejectBadFluxes=False)
+        associations.deprojectFittedStars()
+        projection = lsst.jointcal.OneTPPerVisitHandler(associations.getCcdImageList())
+        model = lsst.jointcal.SimpleAstrometryModel(associations.getCcdImageList(), projection, True,
+                                                    nNotFit=0, order=3)
+        fit = lsst.jointcal.AstrometryFit(associations, model, 0.02)
+        fit.setUseCompactMeasurements(compact)
+        return associations, model, fit
+
+    def assertSameAstrometry(self, associations1, model1, associations2, model2, tolerance):
+        """The fitted stars and the pixel to sky mappings agree to tolerance arcseconds."""
+        stars1 = associations1.makeFittedStarCatalog()
+        stars2 = associations2.makeFittedStarCatalog()
+        self.assertEqual(len(stars1), len(stars2))
+        for star1, star2 in zip(stars1, stars2):
+            self.assertLess(star1.getCoord().separation(star2.getCoord()).asArcseconds(), tolerance)
+        pixel = lsst.afw.geom.Point2D(1000, 1000)
+        for ccdImage1, ccdImage2 in zip(associations1.getCcdImageList(), associations2.getCcdImageList()):
+            coord1 = model1.makeSkyWcs(ccdImage1).pixelToSky(pixel)
+            coord2 = model2.makeSkyWcs(ccdImage2).pixelToSky(pixel)
+            self.assertLess(coord1.separation(coord2).asArcseconds(), tolerance)
+
+
+class FitHistoryTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+
+    def test_history(self):
+        self.fit.minimize("Model")
+        # the photometric triplet count is exact, for the layout of the last minimize.
+        self.assertEqual(self.fit.getProfile().getCounters()["nTriplets"], self.fit.countTriplets())
+        self.fit.minimize("Model Fluxes", 3)
+        history = self.fit.getHistory()
+        records = history.getRecords()
+        self.assertEqual(history.getNCalls(), 2)
+        self.assertEqual(records[0].call, 0)
+        self.assertEqual(records[0].whatToFit, "Model")
+        self.assertEqual(len([record for record in records if record.call == 0]), 1)
+        iterations = [record for record in records if record.call == 1]
+        self.assertEqual([record.iteration for record in iterations], list(range(len(iterations))))
+        self.assertEqual([record.nDowndates for record in iterations], list(range(len(iterations))))
+        # The last iteration of a converged fit removes no outliers.
+        self.assertEqual(iterations[-1].nMeasOutliers + iterations[-1].nRefOutliers, 0)
+
+        # The last record is the current state of the fit, and the visits add up to the measurement terms.
+        chi2 = self.fit.computeChi2()
+        self.assertFloatsAlmostEqual(records[-1].chi2, chi2.chi2, rtol=1e-12)
+        self.assertEqual(records[-1].ndof, chi2.ndof)
+        self.assertEqual(len(records[-1].visitChi2), self.tract.getNVisits())
+        self.assertLessEqual(sum(visit.chi2 for visit in records[-1].visitChi2.values()), chi2.chi2)
+
+        with tempfile.TemporaryDirectory() as directory:
+            baseName = os.path.join(directory, "history")
+            self.fit.saveHistory(baseName)
+            with open(baseName + "-iterations.csv") as stream:
+                self.assertEqual(len(stream.readlines()), len(records) + 1)
+            self.assertTrue(os.path.exists(baseName + "-visits.csv"))
+
+        self.fit.resetHistory()
+        self.assertEqual(len(self.fit.getHistory()), 0)
+
+
+class FitProcessesTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def test_same_fit_in_processes(self):
+        """Worker processes only change the order of the sums."""
+        self.fit.minimize("Model")
+        self.fit.setNProcesses(3)
+        self.assertEqual(self.fit.getNProcesses(), 3)
+        chi2 = self.fit.computeChi2()
+        self.fit.setNProcesses(1)
+        self.assertFloatsAlmostEqual(chi2.chi2, self.fit.computeChi2().chi2, rtol=1e-12)
+        self.assertEqual(chi2.ndof, self.fit.computeChi2().ndof)
+
+        associations, model, fit = self.makeFit()
+        fit.setNProcesses(3)
+        fit.minimize("Model")
+        for whatToFit in ("Fluxes", "Model Fluxes"):
+            self.fit.minimize(whatToFit, 3)
+            fit.minimize(whatToFit, 3)
+            self.assertEqual(fit.getProfile().getCounters()["nTriplets"],
+                             self.fit.getProfile().getCounters()["nTriplets"])
+            self.assertFloatsAlmostEqual(fit.computeChi2().chi2, self.fit.computeChi2().chi2, rtol=1e-8)
+        # the workers are forked once per minimize, and follow its outlier removals.
+        counters = fit.getProfile().getCounters()
+        self.assertEqual(counters["workerForks"], 3*3)
+        for name in ("nIterations", "nMeasOutliers"):
+            self.assertEqual(counters[name], self.fit.getProfile().getCounters()[name])
+
+        with self.assertRaises(lsst.pex.exceptions.InvalidParameterError):
+            fit.setNProcesses(0)
+
+    def test_same_astrometric_fit_in_processes(self):
+        """The two columns of each astrometric measurement keep their order through the workers, in both
+        Jacobian storages."""
+        whatToFits = ("Distortions", "Positions", "Distortions Positions")
+        associations, model, fit = self.makeAstrometryFit()
+        for whatToFit in whatToFits:
+            fit.minimize(whatToFit)
+        chi2 = fit.computeChi2()
+        for storage in (lsst.jointcal.TripletStorage.Triplets, lsst.jointcal.TripletStorage.Compact):
+            with self.subTest(storage=storage):
+                processAssociations, processModel, processFit = self.makeAstrometryFit()
+                processFit.setTripletStorage(storage)
+                processFit.setNProcesses(3)
+                for whatToFit in whatToFits:
+                    processFit.minimize(whatToFit)
+                processChi2 = processFit.computeChi2()
+                self.assertEqual(processChi2.ndof, chi2.ndof)
+                self.assertFloatsAlmostEqual(processChi2.chi2, chi2.chi2, rtol=1e-8)
+                self.assertSameAstrometry(associations, model, processAssociations, processModel, 1e-6)
+
+
+class RobustLossTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def test_huge_scale_is_least_squares(self):
+        self.fit.minimize("Model")
+        associations, model, fit = self.makeFit()
+        fit.setRobustLoss(lsst.jointcal.RobustLoss.Huber, 1e10)
+        fit.minimize("Model")
+        self.assertFloatsAlmostEqual(fit.computeChi2().chi2, self.fit.computeChi2().chi2, rtol=1e-8)
+
+    def test_reweighting_replaces_rejection(self):
+        self.fit.minimize("Model")
+        for loss in (lsst.jointcal.RobustLoss.Huber, lsst.jointcal.RobustLoss.Cauchy):
+            self.fit.setRobustLoss(loss)
+            self.assertEqual(self.fit.getRobustLoss(), loss)
+            self.assertGreater(self.fit.getRobustScale(), 1)
+            self.fit.resetHistory()
+            self.fit.minimize("Model Fluxes", 3)
+            records = self.fit.getHistory().getRecords()
+            self.assertLessEqual(len(records), 10)
+            self.assertEqual(sum(record.nMeasOutliers + record.nRefOutliers for record in records), 0)
+            self.assertEqual(sum(record.nDowndates for record in records), 0)
+            # the robust losses are below the squares.
+            robustChi2 = self.fit.computeChi2().chi2
+            self.fit.setRobustLoss(lsst.jointcal.RobustLoss.Squared)
+            self.assertLess(robustChi2, self.fit.computeChi2().chi2)
+
+        with self.assertRaises(lsst.pex.exceptions.InvalidParameterError):
+            self.fit.setRobustLoss(lsst.jointcal.RobustLoss.Huber, -1.)
+
+
+class RobustOutlierTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    """Astrometric fits of a tract with 10% of gross outlier measurements, displaced by about 150 times
+    the noise of the brightest stars."""
+    @classmethod
+    def setUpClass(cls):
+        cls.tract = benchmark.makeSyntheticTract('tiny', nVisits=5, starDensity=2., outlierFraction=0.1,
+                                                 outlierOffset=3.)
+
+    def fitWithoutRejection(self):
+        associations, model, fit = self.makeAstrometryFit()
+        for whatToFit in ("Distortions", "Positions"):
+            fit.minimize(whatToFit)
+        fit.resetProfile()
+        return associations, fit
+
+    def separationsFromTruth(self, associations):
+        """Distances, in arcseconds, of the fitted stars measured in at least 4 of the 5 visits to the
+        nearest true star."""
+        catalog = associations.makeFittedStarCatalog()
+        catalog = catalog[catalog['nMeasurements'] >= 4]
+        self.assertGreater(len(catalog), 100)
+        return matchTrueStars(self.tract, catalog)[1]
+
+    def countFactorizations(self, fit):
+        """Factorizations and rank updates of the factor since the last resetProfile."""
+        timings = fit.getProfile().getTimings()
+        return sum(timings[phase].calls for phase in ("factorization", "downdate") if phase in timings)
+
+    def test_robust_fit_ignores_outliers(self):
+        associations, fit = self.fitWithoutRejection()
+        fit.setRobustLoss(lsst.jointcal.RobustLoss.Cauchy, 0, 10)
+        fit.minimize("Distortions Positions")
+        robust = np.percentile(self.separationsFromTruth(associations), 95)
+        nRobust = self.countFactorizations(fit)
+
+        associations, fit = self.fitWithoutRejection()
+        fit.minimize("Distortions Positions")
+        leastSquares = np.percentile(self.separationsFromTruth(associations), 95)
+
+        # the robust fit is as close to the truth as the noise of the faint stars allows, but a third of
+        # the least squares fitted stars are pulled by an outlier.
+        self.assertLess(robust, 0.1)
+        self.assertGreater(leastSquares, 0.1)
+        self.assertGreater(leastSquares, 3*robust)
+
+        # the clip-and-refit loop of JointcalTask._iterate_fit downdates the factor for every pass of
+        # outlier rejection, which removes at most one outlier per image while fitting distortions.
+        associations, fit = self.fitWithoutRejection()
+        for step in range(20):
+            if fit.minimize("Distortions Positions", 5) == lsst.jointcal.MinimizeResult.Converged:
+                fit.minimize("Distortions Positions", 5)
+                break
+        nClipped = self.countFactorizations(fit)
+        self.assertLessEqual(nRobust, 10)
+        self.assertLess(nRobust, nClipped)
+
+
+class ErrorModelTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def assertReachTargets(self, fit, terms):
+        """The Gaussian measurement chi2 per ndof of each visit with a positive term is the fraction of the
+        degrees of freedom left by the fitted parameters; that of the others is below it."""
+        robustLoss = fit.getRobustLoss()
+        fit.setRobustLoss(lsst.jointcal.RobustLoss.Squared)
+        chi2, visitChi2 = fit.computeChi2PerVisit()
+        fit.setRobustLoss(robustLoss)
+        nParameters = fit.getNParameters()
+        dofFraction = 1 - nParameters/(chi2.ndof + nParameters)
+        self.assertEqual(set(visitChi2), set(terms))
+        for visit, term in terms.items():
+            if term > 0:
+                self.assertFloatsAlmostEqual(visitChi2[visit].chi2/visitChi2[visit].ndof, dofFraction,
+                                             rtol=1e-2)
+            else:
+                self.assertLessEqual(visitChi2[visit].chi2/visitChi2[visit].ndof, dofFraction)
+
+    def test_fit_error_model(self):
+        self.fit.minimize("Model Fluxes")
+        before = self.fit.computeChi2()
+        terms = self.fit.fitErrorModel("visit")
+        self.assertEqual(len(terms), self.tract.getNVisits())
+        self.assertTrue(all(term >= 0 for term in terms.values()))
+        for ccdImage in self.associations.getCcdImageList():
+            self.assertEqual(self.fit.getErrorTerm(ccdImage), terms[ccdImage.getVisit()])
+        self.assertReachTargets(self.fit, terms)
+        # the added variance can only lower the chi2.
+        self.assertLessEqual(self.fit.computeChi2().chi2, before.chi2)
+
+        self.fit.clearErrorModel()
+        self.assertEqual(self.fit.getErrorTerm(self.associations.getCcdImageList()[0]), 0)
+        self.assertFloatsAlmostEqual(self.fit.computeChi2().chi2, before.chi2, rtol=1e-12)
+        with self.assertRaises(lsst.pex.exceptions.InvalidParameterError):
+            self.fit.fitErrorModel("filter")
+
+    def test_error_model_with_robust_loss(self):
+        """Under a robust loss, the terms still bring the Gaussian chi2 to its target: the outlier
+        measurements of the tract, which the loss down-weights, make every visit need one."""
+        associations, model, fit = self.makeAstrometryFit()
+        fit.setRobustLoss(lsst.jointcal.RobustLoss.Cauchy)
+        for whatToFit in ("Distortions", "Positions", "Distortions Positions"):
+            fit.minimize(whatToFit)
+        terms = fit.fitErrorModel("visit")
+        self.assertEqual(fit.getRobustLoss(), lsst.jointcal.RobustLoss.Cauchy)
+        self.assertEqual(len(terms), self.tract.getNVisits())
+        self.assertTrue(all(term > 0 for term in terms.values()))
+        self.assertReachTargets(fit, terms)
+
+
+class CompactMeasurementsTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def makeFit(self, compact=False):
+        associations, model, fit = self.makeAstrometryFit(compact)
+        self.assertEqual(fit.getUseCompactMeasurements(), compact)
+        return associations, model, fit
+
+    def test_compact_agrees_with_double(self):
+        """The single precision measurements give the same fit, to well within its uncertainties, also when
+        outliers are removed from the factorization."""
+        results = []
+        for compact in (False, True):
+            associations, model, fit = self.makeFit(compact)
+            for whatToFit in ("Distortions", "Positions", "Distortions Positions"):
+                fit.minimize(whatToFit)
+            fit.resetHistory()
+            fit.minimize("Distortions Positions", 2.5)
+            records = fit.getHistory().getRecords()
+            self.assertGreater(sum(record.nMeasOutliers for record in records), 0)
+            results.append((associations, model, fit.computeChi2()))
+        (associations, model, chi2), (compactAssociations, compactModel, compactChi2) = results
+        self.assertEqual(compactChi2.ndof, chi2.ndof)
+        self.assertFloatsAlmostEqual(compactChi2.chi2, chi2.chi2, rtol=1e-3)
+        self.assertSameAstrometry(associations, model, compactAssociations, compactModel, 1e-3)
+
+    def test_refraction_coefficients(self):
+        """One chromatic coefficient per filter, not fit without star colors."""
+        associations, model, fit = self.makeFit(False)
+        self.assertEqual(fit.getRefractionCoefficients(), {self.tract.getRefFluxField()[:-len("_flux")]: 0.})
+        self.assertEqual(associations.computeFittedStarColors("r", "notAFilter"), 0)
+        fit.minimize("Distortions Refrac")
+        self.assertEqual(list(fit.getRefractionCoefficients().values()), [0.])
+
+
+class ChromaticTestCase(lsst.utils.tests.TestCase):
+    """The tiny tract in r and i (visits from 101), with star colors r-i and a chromatic shift of the
+    measurements in each filter."""
+    def setUp(self):
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+        # degrees per magnitude of color, 0.2 and -0.1 arcseconds.
+        self.coefficients = {"r": 0.2/3600, "i": -0.1/3600}
+        self.rTract = benchmark.makeSyntheticTract('tiny', colorSpread=0.5,
+                                                   refractionCoefficient=self.coefficients["r"])
+        self.iTract = benchmark.makeSyntheticTract('tiny', filter="i", firstVisit=101, colorSpread=0.5,
+                                                   colorSlope=-1.,
+                                                   refractionCoefficient=self.coefficients["i"])
+
+    def makeFit(self):
+        associations = benchmark.makeSyntheticAssociations([self.rTract, self.iTract], rejectBadFluxes=False)
+        associations.deprojectFittedStars()
+        # the colors must be set before the fit is made, as it takes their mean as reference.
+        self.assertGreater(associations.computeFittedStarColors("r", "i"), 50)
+        projection = lsst.jointcal.OneTPPerVisitHandler(associations.getCcdImageList())
+        model = lsst.jointcal.SimpleAstrometryModel(associations.getCcdImageList(), projection, True,
+                                                    nNotFit=0, order=3)
+        fit = lsst.jointcal.AstrometryFit(associations, model, 0.02)
+        for whatToFit in ("Distortions", "Positions", "Distortions Positions"):
+            fit.minimize(whatToFit)
+        return associations, model, fit
+
+    def test_recover_coefficients(self):
+        """The fitted chromatic coefficient of each filter is the one the measurements were shifted with,
+        and fitting them explains the shifts."""
+        associations, model, fit = self.makeFit()
+        fit.minimize("Distortions Positions", 5)
+        withoutRefraction = fit.computeChi2()
+        fit.minimize("Distortions Positions Refrac", 5)
+        withRefraction = fit.computeChi2()
+        coefficients = fit.getRefractionCoefficients()
+        self.assertEqual(set(coefficients), set(self.coefficients))
+        for filterName, expected in self.coefficients.items():
+            self.assertFloatsAlmostEqual(coefficients[filterName], expected, rtol=0.05)
+        self.assertLess(withRefraction.chi2/withRefraction.ndof,
+                        0.9*withoutRefraction.chi2/withoutRefraction.ndof)
+
+
+class ReferenceMotionTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def makeRefCatalog(self, pmSigma=0., years=0., parallax=0., withEpoch=True):
+        """The tract's reference catalog, with random proper motions of pmSigma arcseconds per year on each
+        axis, the positions they had years before the data, and a parallax in arcseconds."""
+        refCat = self.tract.makeRefCatalog()
+        fluxField = self.tract.getRefFluxField()
+        schema = lsst.afw.table.SimpleTable.makeMinimalSchema()
+        fluxKey = schema.addField(fluxField, type=float, doc="reference flux")
+        fluxSigmaKey = schema.addField(fluxField + "Sigma", type=float, doc="reference flux error")
+        angleKeys = {name: schema.addField(name, type="Angle", doc=name)
+                     for name in ("pm_ra", "pm_dec", "pm_raErr", "pm_decErr", "parallax")}
+        if withEpoch:
+            epochKey = schema.addField("epoch", type=float, doc="epoch of the positions, MJD")
+        epoch = self.tract.makeAssociations(lsst.jointcal.JointcalControl("slot_CalibFlux")).getEpoch()
+
+        rng = np.random.RandomState(3)
+        catalog = lsst.afw.table.SimpleCatalog(schema)
+        for record in refCat:
+            pmRa, pmDec = pmSigma*rng.normal(size=2)
+            dec = record.getCoord().getLatitude().asDegrees() - pmDec*years/3600
+            ra = record.getCoord().getLongitude().asDegrees() - pmRa*years/3600/np.cos(np.radians(dec))
+            new = catalog.addNew()
+            new.setId(record.getId())
+            new.setCoord(lsst.afw.geom.SpherePoint(ra, dec, lsst.afw.geom.degrees))
+            new.set(fluxKey, record.get(fluxField))
+            new.set(fluxSigmaKey, record.get(fluxField + "Sigma"))
+            new.set(angleKeys["pm_ra"], pmRa*lsst.afw.geom.arcseconds)
+            new.set(angleKeys["pm_dec"], pmDec*lsst.afw.geom.arcseconds)
+            new.set(angleKeys["pm_raErr"], 0*lsst.afw.geom.arcseconds)
+            new.set(angleKeys["pm_decErr"], 0*lsst.afw.geom.arcseconds)
+            new.set(angleKeys["parallax"], parallax*lsst.afw.geom.arcseconds)
+            if withEpoch:
+                new.set(epochKey, epoch - 365.25*years)
+        return catalog
+
+    def fitAstrometry(self, refCat):
+        associations, model, fit = self.makeAstrometryFit(refCat=refCat)
+        for whatToFit in ("Distortions", "Positions", "Distortions Positions"):
+            fit.minimize(whatToFit)
+        return associations, fit, fit.computeChi2()
+
+    def test_proper_motions_move_reference_stars(self):
+        """Reference positions of ten years before the data, with the proper motions bringing them back,
+        give the fit of the positions at the data epoch; without an epoch to move them from, they do not."""
+        _, _, chi2 = self.fitAstrometry(self.tract.makeRefCatalog())
+        _, _, moved = self.fitAstrometry(self.makeRefCatalog(pmSigma=0.1, years=10))
+        self.assertEqual(moved.ndof, chi2.ndof)
+        self.assertFloatsAlmostEqual(moved.chi2, chi2.chi2, rtol=1e-6)
+        _, _, unmoved = self.fitAstrometry(self.makeRefCatalog(pmSigma=0.1, years=10, withEpoch=False))
+        self.assertGreater(unmoved.chi2/unmoved.ndof, 2*chi2.chi2/chi2.ndof)
+
+    def test_parallaxes_displace_stars(self):
+        """The stars of the data have no parallax: reference parallaxes displace their fitted stars where
+        the measurements are not, and the priors of setFittedStarPriors keep them."""
+        _, _, chi2 = self.fitAstrometry(self.tract.makeRefCatalog())
+        associations, fit, withParallax = self.fitAstrometry(self.makeRefCatalog(parallax=1.))
+        self.assertEqual(withParallax.ndof, chi2.ndof)
+        self.assertGreater(withParallax.chi2, 1.5*chi2.chi2)
+
+        # priors too wide to constrain anything: the stars with a RefStar keep its parallax.
+        stars = associations.makeFittedStarCatalog()
+        indices = list(range(len(stars)))
+        associations.setFittedStarPriors(indices, np.degrees(stars['coord_ra']).tolist(),
+                                         np.degrees(stars['coord_dec']).tolist(), [1.]*len(indices), [], [])
+        fit.minimize("Distortions Positions")
+        self.assertFloatsAlmostEqual(fit.computeChi2().chi2, withParallax.chi2, rtol=1e-4)
+
+
+class MultiBandTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def test_one_band_agrees_with_single_flux(self):
+        """With a single filter, the band fluxes are the fluxes of the single-band fit."""
+        with self.assertRaises(lsst.pex.exceptions.LogicError):
+            self.fit.setMultiBand(True)
+
+        associations = benchmark.makeSyntheticAssociations(self.tract, bandFluxes=True)
+        filterName = self.tract.getRefFluxField()[:-len("_flux")]
+        self.assertEqual(associations.getNFilters(), 1)
+        self.assertEqual(associations.getFilterIndex(filterName), 0)
+        with self.assertRaises(lsst.pex.exceptions.NotFoundError):
+            associations.getFilterIndex("not" + filterName)
+        model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
+        fit = lsst.jointcal.PhotometryFit(associations, model)
+        fit.setMultiBand(True)
+        self.assertTrue(fit.getMultiBand())
+
+        for whatToFit in ("Model", "Fluxes", "Model Fluxes"):
+            self.fit.minimize(whatToFit)
+            fit.minimize(whatToFit)
+        chi2 = self.fit.computeChi2()
+        self.assertEqual(fit.computeChi2().ndof, chi2.ndof)
+        self.assertFloatsAlmostEqual(fit.computeChi2().chi2, chi2.chi2, rtol=1e-4)
+
+    def makeTwoFilterFit(self):
+        """The tiny tract observed in r and i: the i visits see the same stars with the same noise."""
+        iTract = benchmark.makeSyntheticTract('tiny', filter="i", firstVisit=101)
+        associations = benchmark.makeSyntheticAssociations([self.tract, iTract], bandFluxes=True)
+        model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
+        fit = lsst.jointcal.PhotometryFit(associations, model)
+        fit.setMultiBand(True)
+        return associations, model, fit
+
+    def test_two_filters(self):
+        """Two filters with identical data make two copies of the single filter problem."""
+        associations, model, fit = self.makeTwoFilterFit()
+        self.assertEqual(associations.getNFilters(), 2)
+        self.assertEqual(len(associations.getCcdImageList()), 2*len(self.associations.getCcdImageList()))
+        singleAssociations, singleModel, singleFit = self.makeFit()
+        for whatToFit in ("Model", "Fluxes", "Model Fluxes", "Model Fluxes", "Model Fluxes"):
+            singleFit.minimize(whatToFit)
+            self.assertEqual(fit.minimize(whatToFit), lsst.jointcal.MinimizeResult.Converged)
+        self.assertTruthRecovered(associations, model)
+        self.assertEqual(fit.getNParameters(), 2*singleFit.getNParameters())
+        chi2 = fit.computeChi2()
+        singleChi2 = singleFit.computeChi2()
+        self.assertEqual(chi2.ndof, 2*singleChi2.ndof)
+        self.assertFloatsAlmostEqual(chi2.chi2, 2*singleChi2.chi2, rtol=1e-4)
+
+        # Priors on all the fitted stars: those with a RefStar keep its fluxes per filter, the others
+        # only get a default flux, which the multi-band fit does not use.
+        stars = associations.makeFittedStarCatalog()
+        associations.setFittedStarPriors([int(i) for i in stars["id"]], [], [], [], list(stars["flux"]),
+                                         list(stars["fluxErr"]))
+        withPriors = fit.computeChi2()
+        self.assertEqual(withPriors.ndof, chi2.ndof)
+        self.assertFloatsAlmostEqual(withPriors.chi2, chi2.chi2, rtol=1e-12)
+        self.assertEqual(fit.minimize("Model Fluxes"), lsst.jointcal.MinimizeResult.Converged)
+        self.assertTruthRecovered(associations, model)
+
+    def assertTruthRecovered(self, associations, model):
+        """The fluxes of each band are the true fluxes of the stars, and the calibration of each image is
+        the true one of its visit, within the noise."""
+        stars = associations.makeFittedStarCatalog()
+        trueStars, separations = matchTrueStars(self.tract, stars)
+        self.assertLess(np.max(separations), 1.)
+        # the tracts have no color terms: a star has the same flux in both bands.
+        trueFluxes = np.array([10**(-0.4*self.tract.getStarMag(int(star))) for star in trueStars])
+        for filterName in ("r", "i"):
+            ratios = stars[filterName + "_flux"]/trueFluxes
+            ratios = ratios[np.isfinite(ratios)]
+            self.assertGreater(len(ratios), 0.9*len(stars))
+            self.assertLess(abs(np.median(ratios) - 1), 5e-3)
+            self.assertLess(np.percentile(np.abs(ratios - 1), 68), 0.03)
+        # the visit zero points span about 10%.
+        for ccdImage in associations.getCcdImageList():
+            # the i visits are numbered from 101.
+            visit = ccdImage.getVisit()
+            zeroPoint = self.tract.getVisitZeroPoint(visit - (101 if visit >= 101 else 1))
+            trueCalibration = self.tract.getCalibrationMean()*10**(0.4*zeroPoint)
+            center = lsst.afw.geom.Box2D(ccdImage.getDetector().getBBox()).getCenter()
+            calibration = model.toPhotoCalib(ccdImage).instFluxToMaggies(1.0, center)
+            self.assertFloatsAlmostEqual(calibration, trueCalibration, rtol=1e-2)
+
+
+class StarFlatTestCase(lsst.utils.tests.TestCase):
+    """The tiny tract with a radial focal plane response, fit with a star flat."""
+    @classmethod
+    def setUpClass(cls):
+        cls.tract = benchmark.makeSyntheticTract('tiny', focalPlaneResponse=0.3)
+
+    def setUp(self):
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+
+    def makeFit(self, photometryModel, epochBoundaries=()):
+        associations = benchmark.makeSyntheticAssociations(self.tract)
+        ccdImageList = associations.getCcdImageList()
+        if photometryModel == "starFlat":
+            focalPlaneBBox = lsst.afw.geom.Box2D()
+            for ccdImage in ccdImageList:
+                for corner in ccdImage.getDetector().getCorners(lsst.afw.cameraGeom.FOCAL_PLANE):
+                    focalPlaneBBox.include(corner)
+            model = lsst.jointcal.StarFlatPhotometryModel(ccdImageList, focalPlaneBBox, starFlatOrder=2,
+                                                          epochBoundaries=list(epochBoundaries))
+        else:
+            model = lsst.jointcal.SimplePhotometryModel(ccdImageList)
+        fit = lsst.jointcal.PhotometryFit(associations, model)
+        fit.minimize("Model")
+        fit.minimize("Fluxes")
+        # the star flat multiplies the zero points: iterate the linearized fit.
+        for i in range(5):
+            fit.minimize("Model Fluxes")
+        return associations, model, fit
+
+    def assertRecoversResponse(self, associations, model, rtol):
+        """Across each CCD, the fitted calibration varies as the inverse of the injected response."""
+        responses = []
+        for ccdImage in associations.getCcdImageList():
+            photoCalib = model.toPhotoCalib(ccdImage)
+            detector = ccdImage.getDetector()
+            pixToFocal = detector.getTransform(lsst.afw.cameraGeom.PIXELS, lsst.afw.cameraGeom.FOCAL_PLANE)
+            bbox = lsst.afw.geom.Box2D(detector.getBBox())
+            points = [bbox.getCenter()] + [lsst.afw.geom.Point2D(x, y)
+                                           for x in (bbox.getMinX() + 100, bbox.getMaxX() - 100)
+                                           for y in (bbox.getMinY() + 100, bbox.getMaxY() - 100)]
+            products = []
+            for point in points:
+                focal = pixToFocal.applyForward(point)
+                response = self.tract.getFocalPlaneResponse(focal.getX(), focal.getY())
+                responses.append(response)
+                products.append(photoCalib.instFluxToMaggies(1.0, point)*response)
+            self.assertFloatsAlmostEqual(np.array(products), products[0], rtol=rtol)
+        # the response varies by much more than the tolerance across the detectors.
+        self.assertGreater(max(responses)/min(responses), 1 + 5*rtol)
+
+    def test_recover_focal_plane_response(self):
+        """The star flat recovers the response, which the per-CCD zero points cannot follow."""
+        associations, model, fit = self.makeFit("starFlat")
+        self.assertEqual(model.getNEpochs(), 1)
+        # the fitted measurements are all read from the star flat cache.
+        nMeasurements = sum(len(ccdImage.getCatalogForFit()) for ccdImage in associations.getCcdImageList())
+        self.assertEqual(model.getCacheSize(), nMeasurements)
+        self.assertRecoversResponse(associations, model, 1e-2)
+        starFlatChi2 = fit.computeChi2()
+        simpleChi2 = self.makeFit("simple")[2].computeChi2()
+        self.assertLess(starFlatChi2.chi2/starFlatChi2.ndof, 0.5*simpleChi2.chi2/simpleChi2.ndof)
+
+    def test_two_epochs(self):
+        """With the last visit in its own epoch, both star flats recover the response."""
+        associations = self.tract.makeAssociations(lsst.jointcal.JointcalControl("slot_CalibFlux"))
+        mjds = sorted(set(ccdImage.getMjd() for ccdImage in associations.getCcdImageList()))
+        self.assertEqual(len(mjds), self.tract.getNVisits())
+        associations, model, fit = self.makeFit("starFlat", [0.5*(mjds[-2] + mjds[-1])])
+        self.assertEqual(model.getNEpochs(), 2)
+        self.assertRecoversResponse(associations, model, 2e-2)
+
+
+class ParameterLayoutTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def makeTwoTractFit(self, iFirst):
+        """The tiny tract in r and i (visits from 101), the catalogs of i loaded first if iFirst."""
+        iTract = benchmark.makeSyntheticTract('tiny', filter="i", firstVisit=101)
+        tracts = [iTract, self.tract] if iFirst else [self.tract, iTract]
+        associations = benchmark.makeSyntheticAssociations(tracts, refTract=self.tract)
+        model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
+        fit = lsst.jointcal.PhotometryFit(associations, model)
+        return associations, model, fit
+
+    def test_layout_does_not_depend_on_loading_order(self):
+        """prepareFittedStars sorts the ccdImages by (visit, ccd), whatever order they were loaded in, so
+        that the fit does not depend on it either."""
+        iFirst = self.makeTwoTractFit(True)
+        rFirst = self.makeTwoTractFit(False)
+        for associations, model, fit in (iFirst, rFirst):
+            keys = [(ccdImage.getVisit(), ccdImage.getCcdId()) for ccdImage in associations.getCcdImageList()]
+            self.assertEqual(keys, sorted(keys))
+            self.assertEqual(keys[0][0], 1)
+            self.assertEqual(keys[-1][0], 101 + self.tract.getNVisits() - 1)
+            for whatToFit in ("Model", "Fluxes", "Model Fluxes"):
+                fit.minimize(whatToFit)
+        self.assertEqual(iFirst[0].fittedStarListSize(), rFirst[0].fittedStarListSize())
+        chi2 = iFirst[2].computeChi2()
+        self.assertEqual(chi2.ndof, rFirst[2].computeChi2().ndof)
+        self.assertFloatsAlmostEqual(chi2.chi2, rFirst[2].computeChi2().chi2, rtol=1e-10)
+
+
+class MemoryEstimateTestCase(FitterTestBase, lsst.utils.tests.TestCase):
+    def test_estimateFitMemory(self):
+        components = ("stars", "triplets", "jacobian", "hessian", "factor")
+        estimate = lsst.jointcal.estimateFitMemory(1000, 300, 100, 10, 50, 5, 2, 2)
+        for component in components:
+            self.assertGreater(getattr(estimate, component), 0)
+            self.assertLessEqual(getattr(estimate, component), estimate.peak)
+        # the stars and the triplets grow as the numbers of measurements and stars.
+        doubled = lsst.jointcal.estimateFitMemory(2000, 600, 200, 10, 50, 5, 2, 2)
+        self.assertEqual(doubled.stars, 2*estimate.stars)
+        self.assertEqual(doubled.triplets, 2*estimate.triplets)
+        self.assertGreater(doubled.peak, estimate.peak)
+        empty = lsst.jointcal.estimateFitMemory(0, 0, 0, 0, 0, 0, 0, 0)
+        self.assertEqual(empty.triplets, 0)
+        self.assertEqual(empty.stars, 0)
+
+    def test_parameter_counts(self):
+        self.fit.assignIndices("Model")
+        nModelParameters = self.fit.getNModelParameters()
+        self.assertGreater(nModelParameters, 0)
+        self.assertEqual(self.fit.getNParameters(), nModelParameters)
+        self.fit.assignIndices("Model Fluxes")
+        self.assertEqual(self.fit.getNModelParameters(), nModelParameters)
+        self.assertEqual(self.fit.getNParameters() - nModelParameters, self.associations.fittedStarListSize())
+
+    def test_estimate_of_the_fit(self):
+        """The predicted Jacobian is the measured one, and the Hessian is of the measured size."""
+        ccdImageList = self.associations.getCcdImageList()
+        self.fit.assignIndices("Model Fluxes")
+        estimate = lsst.jointcal.estimateFitMemory(
+            sum(ccdImage.countStars()[0] for ccdImage in ccdImageList),
+            self.associations.fittedStarListSize(),
+            self.associations.nFittedStarsWithAssociatedRefStar(),
+            len(ccdImageList),
+            self.fit.getNModelParameters(),
+            max(self.model.getNpar(ccdImage) for ccdImage in ccdImageList),
+            1, 1)
+        self.fit.minimize("Model Fluxes")
+        memory = self.fit.getProfile().getMemory()
+        self.assertFloatsAlmostEqual(float(estimate.jacobian), float(memory["jacobian"]), rtol=0.2)
+        self.assertLess(memory["hessian"], 4*estimate.hessian)
+        self.assertGreater(memory["hessian"], estimate.hessian/4)
+
+
+class MemoryTester(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -148,6 +148,25 @@ class GtransfoPolyTestCase(GtransfoPolyBase, lsst.utils.tests.TestCase):
         # looser tolerance: 9th order polynomials are harder to get a good inverse for.
         self.checkToAstMap(self.poly9, inverseMaxDiff=4e-5)
 
+    def testCompose(self):
+        """Test that compose() is the composition, and truncates it to the requested order."""
+        composed = self.poly3.compose(self.poly2, 6)
+        self.assertEqual(composed.getOrder(), 6)
+        for point in self.points[::97]:
+            tempPoint = lsst.jointcal.star.Point(point[0], point[1])
+            expect = self.poly3.apply(self.poly2.apply(tempPoint))
+            result = composed.apply(tempPoint)
+            self.assertFloatsAlmostEqual(result.x, expect.x, rtol=1e-10)
+            self.assertFloatsAlmostEqual(result.y, expect.y, rtol=1e-10)
+
+        truncated = self.poly3.compose(self.poly2, 2)
+        self.assertEqual(truncated.getOrder(), 2)
+        for degree in range(3):
+            for py in range(degree + 1):
+                for coord in range(2):
+                    self.assertFloatsAlmostEqual(truncated.coeff(degree - py, py, coord),
+                                                 composed.coeff(degree - py, py, coord), rtol=1e-14)
+
 
 class MemoryTester(lsst.utils.tests.MemoryTestCase):
     pass
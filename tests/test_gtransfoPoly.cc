@@ -0,0 +1,211 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_gtransfoPoly
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Eigen/Dense"
+
+#include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/StarMatch.h"
+
+namespace jointcal = lsst::jointcal;
+
+namespace {
+
+/// A mild second order distortion.
+jointcal::GtransfoPoly makeTrueTransfo() {
+    jointcal::GtransfoPoly transfo(2);
+    transfo.coeff(0, 0, 0) = 10.;
+    transfo.coeff(1, 0, 0) = 1.01;
+    transfo.coeff(0, 1, 0) = 0.02;
+    transfo.coeff(2, 0, 0) = 1e-5;
+    transfo.coeff(0, 0, 1) = -5.;
+    transfo.coeff(1, 0, 1) = -0.01;
+    transfo.coeff(0, 1, 1) = 0.99;
+    transfo.coeff(1, 1, 1) = 2e-5;
+    return transfo;
+}
+
+/**
+ * nMatches matches of makeTrueTransfo() over [0, 1000]^2, whose point1 errors have variance variance1.
+ *
+ * The point2 errors of each match have standard deviations between sigma/2 and 2 sigma on each coordinate,
+ * and a correlation coefficient between -maxRho and maxRho. (With the same covariance for all matches, the
+ * weighted fit would be the unweighted one, whatever the correlation.)
+ */
+void makeMatches(jointcal::StarMatchList &matches, std::size_t nMatches, double sigma, double maxRho,
+                 double variance1, unsigned seed = 1) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::normal_distribution<double> gaussian(0., 1.);
+    auto const transfo = makeTrueTransfo();
+    for (std::size_t i = 0; i < nMatches; ++i) {
+        jointcal::Point const point1(1000 * uniform(generator), 1000 * uniform(generator));
+        auto star1 = std::make_shared<jointcal::BaseStar>(point1, 1., 0.1);
+        star1->vx = star1->vy = variance1;
+        double const sigmaX = sigma * std::pow(2., 2 * uniform(generator) - 1);
+        double const sigmaY = sigma * std::pow(2., 2 * uniform(generator) - 1);
+        double const rho = maxRho * (2 * uniform(generator) - 1);
+        // correlated noise: u and rho u + sqrt(1 - rho^2) v.
+        double const u = gaussian(generator);
+        double const v = gaussian(generator);
+        jointcal::Point point2 = transfo.apply(*star1);
+        point2.x += sigmaX * u;
+        point2.y += sigmaY * (rho * u + std::sqrt(1 - rho * rho) * v);
+        auto star2 = std::make_shared<jointcal::BaseStar>(point2, 1., 0.1);
+        star2->vx = sigmaX * sigmaX;
+        star2->vy = sigmaY * sigmaY;
+        star2->vxy = rho * sigmaX * sigmaY;
+        matches.emplace_back(*star1, *star2, star1, star2);
+    }
+}
+
+/**
+ * The generalized least-squares polynomial of order mapping point1 onto point2, weighted with the point2
+ * covariances alone, from the QR decomposition of the whitened design; its chi2 is returned in chi2.
+ */
+jointcal::GtransfoPoly solveReference(jointcal::StarMatchList const &matches, unsigned order, double &chi2) {
+    jointcal::GtransfoPoly result(order);
+    std::size_t const nterms = result.getNpar() / 2;
+    Eigen::MatrixXd design = Eigen::MatrixXd::Zero(2 * matches.size(), 2 * nterms);
+    Eigen::VectorXd target(2 * matches.size());
+    std::size_t row = 0;
+    for (auto const &match : matches) {
+        Eigen::Matrix2d covariance;
+        covariance << match.point2.vx, match.point2.vxy, match.point2.vxy, match.point2.vy;
+        // the inverse of the lower Cholesky factor whitens the residuals.
+        Eigen::Matrix2d whiten = Eigen::Matrix2d(covariance.llt().matrixL()).inverse();
+        Eigen::MatrixXd jacobian = Eigen::MatrixXd::Zero(2, 2 * nterms);
+        std::size_t k = 0;
+        for (unsigned degree = 0; degree <= order; ++degree) {
+            for (unsigned py = 0; py <= degree; ++py, ++k) {
+                double const monomial = std::pow(match.point1.x, degree - py) * std::pow(match.point1.y, py);
+                jacobian(0, k) = monomial;
+                jacobian(1, nterms + k) = monomial;
+            }
+        }
+        design.middleRows(row, 2) = whiten * jacobian;
+        target.segment(row, 2) = whiten * Eigen::Vector2d(match.point2.x, match.point2.y);
+        row += 2;
+    }
+    Eigen::VectorXd solution = design.colPivHouseholderQr().solve(target);
+    chi2 = (design * solution - target).squaredNorm();
+    std::size_t k = 0;
+    for (unsigned degree = 0; degree <= order; ++degree) {
+        for (unsigned py = 0; py <= degree; ++py, ++k) {
+            result.coeff(degree - py, py, 0) = solution(k);
+            result.coeff(degree - py, py, 1) = solution(nterms + k);
+        }
+    }
+    return result;
+}
+
+/// The largest distance between the images of a grid of points by two transfos.
+double maxDistance(jointcal::Gtransfo const &transfo1, jointcal::Gtransfo const &transfo2) {
+    double result = 0;
+    for (double x = 0; x <= 1000; x += 100) {
+        for (double y = 0; y <= 1000; y += 100) {
+            jointcal::Point point(x, y);
+            result = std::max(result, transfo1.apply(point).Distance(transfo2.apply(point)));
+        }
+    }
+    return result;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_gtransfoPoly)
+
+BOOST_AUTO_TEST_CASE(test_fit_with_correlated_errors) {
+    jointcal::StarMatchList matches;
+    makeMatches(matches, 500, 0.05, 0.9, 0.);
+    double expectedChi2;
+    auto const expected = solveReference(matches, 2, expectedChi2);
+
+    jointcal::GtransfoPoly fitted(2);
+    double const chi2 = fitted.fit(matches);
+    BOOST_CHECK_CLOSE(chi2, expectedChi2, 1e-6);
+    BOOST_CHECK_SMALL(maxDistance(fitted, expected), 1e-8);
+
+    // the correlations matter: dropping them moves the solution by much more than the tolerance above.
+    for (auto &match : matches) match.point2.vxy = 0;
+    jointcal::GtransfoPoly uncorrelated(2);
+    uncorrelated.fit(matches);
+    BOOST_CHECK(maxDistance(uncorrelated, expected) > 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(test_refit_agrees_with_fit) {
+    jointcal::StarMatchList matches;
+    makeMatches(matches, 500, 0.05, 0.5, 1e-3);
+    jointcal::GtransfoPoly fitted(2);
+    double const chi2 = fitted.fit(matches);
+
+    // from the true transfo, or from the solution itself, refit converges to the same solution.
+    for (auto const &start : {makeTrueTransfo(), fitted}) {
+        jointcal::GtransfoPoly refitted(start);
+        double const refitChi2 = refitted.refit(matches);
+        BOOST_CHECK_CLOSE(refitChi2, chi2, 1e-6);
+        BOOST_CHECK_SMALL(maxDistance(refitted, fitted), 1e-8);
+    }
+
+    // too few matches for the order: both give up the same way.
+    jointcal::StarMatchList few;
+    makeMatches(few, 5, 0.05, 0.5, 1e-3);
+    jointcal::GtransfoPoly poly(2);
+    BOOST_CHECK_EQUAL(poly.fit(few), -1.);
+    BOOST_CHECK_EQUAL(poly.refit(few), -1.);
+}
+
+BOOST_AUTO_TEST_CASE(test_compare_orders_chi2s) {
+    // compareOrders weights with the point2 variances alone: without correlations nor point1 errors, each
+    // order scores the chi2 of its own fit.
+    jointcal::StarMatchList matches;
+    makeMatches(matches, 300, 0.05, 0., 0.);
+    auto const scores = jointcal::GtransfoPoly::compareOrders(matches, 1, 4, "BIC");
+    BOOST_REQUIRE_EQUAL(scores.size(), 4u);
+    for (auto const &score : scores) {
+        jointcal::GtransfoPoly poly(score.order);
+        double const chi2 = poly.fit(matches);
+        BOOST_CHECK_EQUAL(score.nPar, poly.getNpar());
+        BOOST_CHECK_CLOSE(score.chi2, chi2, 1e-6);
+        BOOST_CHECK_CLOSE(score.criterion, chi2 + score.nPar * std::log(2. * matches.size()), 1e-6);
+    }
+
+    // orders with more coefficients than matches are not scored, nor are lists that constrain none.
+    jointcal::StarMatchList few;
+    makeMatches(few, 12, 0.05, 0., 0.);
+    BOOST_CHECK_EQUAL(jointcal::GtransfoPoly::compareOrders(few, 1, 5, "AIC").size(), 3u);
+    jointcal::StarMatchList two;
+    makeMatches(two, 2, 0.05, 0., 0.);
+    BOOST_CHECK(jointcal::GtransfoPoly::compareOrders(two, 1, 3, "BIC").empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_compare_orders_selects_true_order) {
+    // the second order of the true transfo is far above the noise, and the higher orders only fit noise.
+    for (unsigned seed : {1, 2, 3}) {
+        jointcal::StarMatchList matches;
+        makeMatches(matches, 500, 0.05, 0., 0., seed);
+        for (std::string criterion : {"BIC", "AIC"}) {
+            auto const scores = jointcal::GtransfoPoly::compareOrders(matches, 1, 5, criterion);
+            BOOST_REQUIRE_EQUAL(scores.size(), 5u);
+            auto best = std::min_element(scores.begin(), scores.end(),
+                                         [](jointcal::PolyOrderScore const &a,
+                                            jointcal::PolyOrderScore const &b) {
+                                             return a.criterion < b.criterion;
+                                         });
+            BOOST_CHECK_EQUAL(best->order, 2u);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,235 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_listMatch
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "lsst/pex/exceptions.h"
+#include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/Frame.h"
+#include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/ListMatch.h"
+
+namespace jointcal = lsst::jointcal;
+
+namespace {
+
+/**
+ * nStars stars of random positions over [0, size]^2 and fluxes in list2, and in list1 the same stars
+ * displaced by -shift (plus noise of sigma), then mapped through the inverse of gtransfo, so that
+ * gtransfo followed by shift maps list1 onto list2. Each list also gets nExtra stars of its own.
+ */
+void makeShiftedLists(jointcal::BaseStarList &list1, jointcal::BaseStarList &list2,
+                      jointcal::GtransfoLin const &gtransfo, jointcal::Point const &shift,
+                      std::size_t nStars, std::size_t nExtra, double size = 2000., double sigma = 0.01,
+                      unsigned seed = 1) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., size);
+    std::uniform_real_distribution<double> fluxes(100., 10000.);
+    std::normal_distribution<double> gaussian(0., sigma);
+    auto const inverse = gtransfo.invert();
+    for (std::size_t i = 0; i < nStars; ++i) {
+        jointcal::Point const point2(uniform(generator), uniform(generator));
+        double const flux = fluxes(generator);
+        list2.push_back(std::make_shared<jointcal::BaseStar>(point2, flux, 1.));
+        jointcal::Point const point1(point2.x - shift.x + gaussian(generator),
+                                     point2.y - shift.y + gaussian(generator));
+        list1.push_back(std::make_shared<jointcal::BaseStar>(inverse.apply(point1), flux, 1.));
+    }
+    for (std::size_t i = 0; i < nExtra; ++i) {
+        list1.push_back(std::make_shared<jointcal::BaseStar>(uniform(generator), uniform(generator),
+                                                             fluxes(generator), 1.));
+        list2.push_back(std::make_shared<jointcal::BaseStar>(uniform(generator), uniform(generator),
+                                                             fluxes(generator), 1.));
+    }
+}
+
+/// The found transfo is the shift, to a small fraction of the noise-free matching tolerance.
+void checkShift(jointcal::GtransfoLin const *found, jointcal::Point const &shift) {
+    BOOST_REQUIRE(found != nullptr);
+    BOOST_CHECK_SMALL(found->coeff(0, 0, 0) - shift.x, 0.01);
+    BOOST_CHECK_SMALL(found->coeff(0, 0, 1) - shift.y, 0.01);
+    BOOST_CHECK_SMALL(found->coeff(1, 0, 0) - 1., 1e-5);
+    BOOST_CHECK_SMALL(found->coeff(0, 1, 0), 1e-5);
+    BOOST_CHECK_SMALL(found->coeff(1, 0, 1), 1e-5);
+    BOOST_CHECK_SMALL(found->coeff(0, 1, 1) - 1., 1e-5);
+}
+
+/// nStars stars over frame, with a power-law flux distribution.
+void makeStars(jointcal::BaseStarList &stars, jointcal::Frame const &frame, std::size_t nStars,
+               unsigned seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    for (std::size_t i = 0; i < nStars; ++i) {
+        double const flux = 1000. * std::pow(uniform(generator) + 1e-3, -1.5);
+        double const x = frame.xMin + frame.getWidth() * uniform(generator);
+        double const y = frame.yMin + frame.getHeight() * uniform(generator);
+        stars.push_back(std::make_shared<jointcal::BaseStar>(x, y, flux, 1.));
+    }
+}
+
+/**
+ * A row of CCDs of 1000x2000 pixels seen at half their pixel size, each shifted and rotated a little: their
+ * catalogs, the true transfos from their pixels to the reference, and the footprints of the CCDs in the
+ * reference, with a margin. The reference holds the images of 90% of the stars of all CCDs, with noise.
+ */
+struct BlindMatchData {
+    std::vector<std::shared_ptr<jointcal::BaseStarList>> lists;
+    std::vector<jointcal::GtransfoLin> transfos;
+    std::vector<jointcal::Frame> footprints;
+    jointcal::BaseStarList reference;
+    double const scale = 0.5;
+
+    explicit BlindMatchData(std::size_t nCcds) {
+        jointcal::Frame const ccdFrame(0, 0, 1000, 2000);
+        jointcal::Point const center = ccdFrame.getCenter();
+        std::mt19937 generator(10);
+        std::uniform_real_distribution<double> uniform(0., 1.);
+        std::normal_distribution<double> noise(0., 0.01);
+        for (std::size_t ccd = 0; ccd < nCcds; ++ccd) {
+            transfos.push_back(jointcal::GtransfoLinScale(scale) *
+                               jointcal::GtransfoLinShift(1100. * ccd + 3. * ccd * ccd, -7. * ccd) *
+                               jointcal::GtransfoLinRot(0.003 * ccd, &center));
+            lists.push_back(std::make_shared<jointcal::BaseStarList>());
+            makeStars(*lists.back(), ccdFrame, 300, 20 + ccd);
+            for (auto const &star : *lists.back()) {
+                if (uniform(generator) < 0.1) continue;
+                jointcal::Point const where = transfos.back().apply(*star);
+                reference.push_back(std::make_shared<jointcal::BaseStar>(
+                        where.x + noise(generator), where.y + noise(generator), star->getFlux(), 1.));
+            }
+            jointcal::Frame const frame = transfos.back().apply(ccdFrame, false);
+            footprints.emplace_back(frame.xMin - 25, frame.yMin - 25, frame.xMax + 25, frame.yMax + 25);
+        }
+    }
+
+    std::vector<jointcal::BaseStarList const *> getLists() const {
+        std::vector<jointcal::BaseStarList const *> result;
+        for (auto const &list : lists) result.push_back(list.get());
+        return result;
+    }
+};
+
+/// The coefficients of both coordinates of a polynomial transfo.
+std::vector<double> getCoefficients(jointcal::Gtransfo const &transfo) {
+    auto const &poly = dynamic_cast<jointcal::GtransfoPoly const &>(transfo);
+    std::vector<double> result;
+    for (unsigned px = 0; px <= poly.getOrder(); ++px) {
+        for (unsigned py = 0; px + py <= poly.getOrder(); ++py) {
+            result.push_back(poly.coeff(px, py, 0));
+            result.push_back(poly.coeff(px, py, 1));
+        }
+    }
+    return result;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_listMatch)
+
+BOOST_AUTO_TEST_CASE(test_shift_by_correlation) {
+    jointcal::Point const shift(23.4, -17.8);
+    jointcal::GtransfoIdentity const identity;
+    jointcal::BaseStarList list1, list2;
+    makeShiftedLists(list1, list2, jointcal::GtransfoLin(), shift, 300, 50);
+    // the default bin size, as listMatchupShift chooses it, and a finer one.
+    for (double binSize : {0., 1.}) {
+        auto found = jointcal::listMatchupShiftByCorrelation(list1, list2, identity, 50., binSize);
+        checkShift(found.get(), shift);
+    }
+    // the same shift as the pair histogram finds.
+    auto histogram = jointcal::listMatchupShift(list1, list2, identity, 50.);
+    checkShift(histogram.get(), shift);
+}
+
+BOOST_AUTO_TEST_CASE(test_shift_by_correlation_after_guess) {
+    // the shift is searched for after the guess, which the returned transfo does not include.
+    jointcal::Point const shift(-8.3, 31.2);
+    jointcal::GtransfoLinShift const guess(120., -45.);
+    jointcal::BaseStarList list1, list2;
+    makeShiftedLists(list1, list2, guess, shift, 300, 0, 2000., 0.01, 2);
+    auto found = jointcal::listMatchupShiftByCorrelation(list1, list2, guess, 40.);
+    checkShift(found.get(), shift);
+}
+
+BOOST_AUTO_TEST_CASE(test_shift_by_correlation_empty) {
+    jointcal::GtransfoIdentity const identity;
+    jointcal::BaseStarList list1, list2, empty;
+    makeShiftedLists(list1, list2, jointcal::GtransfoLin(), jointcal::Point(1., 2.), 20, 0);
+    BOOST_CHECK(jointcal::listMatchupShiftByCorrelation(empty, list2, identity, 50.) == nullptr);
+    BOOST_CHECK(jointcal::listMatchupShiftByCorrelation(list1, empty, identity, 50.) == nullptr);
+    BOOST_CHECK(jointcal::listMatchupShiftByCorrelation(empty, empty, identity, 50., 1.) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(test_reference_index_extract) {
+    jointcal::BaseStarList stars;
+    makeStars(stars, jointcal::Frame(-300, 200, 700, 900), 2000, 3);
+    double const scale = 0.25;
+    jointcal::ReferenceMatchIndex index(stars, scale, 16);
+    BOOST_CHECK_EQUAL(index.size(), stars.size());
+    BOOST_CHECK_EQUAL(index.getScale(), scale);
+
+    // frames across cells, partly outside the stars, outside them, and around them all.
+    for (auto const &frame : {jointcal::Frame(-100, 250, 150, 600), jointcal::Frame(600, 800, 1000, 1200),
+                              jointcal::Frame(2000, 2000, 2100, 2100), jointcal::Frame(-400, 0, 800, 1000)}) {
+        jointcal::BaseStarList extracted;
+        index.extract(frame, extracted);
+        std::vector<double> expected;
+        for (auto const &star : stars) {
+            if (frame.inFrame(*star)) expected.push_back(star->getFlux());
+        }
+        std::sort(expected.begin(), expected.end(), [](double a, double b) { return a > b; });
+        // the stars in the frame, scaled, brightest first.
+        BOOST_REQUIRE_EQUAL(extracted.size(), expected.size());
+        auto flux = expected.begin();
+        for (auto const &star : extracted) {
+            BOOST_CHECK_EQUAL(star->getFlux(), *flux++);
+            BOOST_CHECK(frame.inFrame(jointcal::Point(star->x * scale, star->y * scale)));
+        }
+    }
+    BOOST_CHECK_THROW(jointcal::ReferenceMatchIndex(stars, 0.), lsst::pex::exceptions::InvalidParameterError);
+}
+
+BOOST_AUTO_TEST_CASE(test_list_match_blind) {
+    BlindMatchData data(4);
+    jointcal::ReferenceMatchIndex index(data.reference, data.scale);
+    auto lists = data.getLists();
+    auto footprints = data.footprints;
+    // a last list whose footprint holds no reference star.
+    lists.push_back(data.lists.front().get());
+    footprints.emplace_back(-5000, -5000, -4000, -4000);
+    jointcal::MatchConditions conditions;
+    for (int maxOrder : {1, 2}) {
+        auto found = jointcal::listMatchBlind(lists, footprints, index, conditions, maxOrder);
+        BOOST_REQUIRE_EQUAL(found.size(), lists.size());
+        for (std::size_t i = 0; i < data.transfos.size(); ++i) {
+            BOOST_REQUIRE(found[i] != nullptr);
+            for (auto const &star : *lists[i]) {
+                BOOST_CHECK_SMALL(found[i]->apply(*star).Distance(data.transfos[i].apply(*star)), 0.01);
+            }
+        }
+        BOOST_CHECK(found.back() == nullptr);
+
+        // the worker processes find the very same transfos.
+        auto inProcesses = jointcal::listMatchBlind(lists, footprints, index, conditions, maxOrder, 4);
+        BOOST_REQUIRE_EQUAL(inProcesses.size(), found.size());
+        for (std::size_t i = 0; i < found.size(); ++i) {
+            BOOST_REQUIRE_EQUAL(inProcesses[i] == nullptr, found[i] == nullptr);
+            if (!found[i]) continue;
+            BOOST_CHECK(getCoefficients(*inProcesses[i]) == getCoefficients(*found[i]));
+        }
+    }
+
+    footprints.pop_back();
+    BOOST_CHECK_THROW(jointcal::listMatchBlind(lists, footprints, index, conditions),
+                      lsst::pex::exceptions::LengthError);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
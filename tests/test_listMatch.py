@@ -0,0 +1,71 @@
+"""Tests of the Python interface to the blind matching of star lists to a reference index."""
+import numpy as np
+
+import unittest
+import lsst.utils.tests
+
+import lsst.pex.exceptions
+import lsst.jointcal.frame
+import lsst.jointcal.listMatch
+import lsst.jointcal.star
+
+
+class ListMatchBlindTestCase(lsst.utils.tests.TestCase):
+    """Two CCDs of 1000x2000 pixels, seen at half their pixel size in the reference, side by side."""
+    def setUp(self):
+        np.random.seed(100)
+        self.scale = 0.5
+        self.offsets = [(0., 0.), (550., -3.)]
+        self.lists = []
+        self.footprints = []
+        reference = []
+        for x0, y0 in self.offsets:
+            x = 1000*np.random.random(300)
+            y = 2000*np.random.random(300)
+            flux = 1000*(np.random.random(300) + 1e-3)**-1.5
+            self.lists.append([lsst.jointcal.star.BaseStar(*args, 1.) for args in zip(x, y, flux)])
+            xRef = x0 + self.scale*x + np.random.normal(0, 0.01, 300)
+            yRef = y0 + self.scale*y + np.random.normal(0, 0.01, 300)
+            reference.extend(lsst.jointcal.star.BaseStar(*args, 1.) for args in zip(xRef, yRef, flux))
+            self.footprints.append(lsst.jointcal.frame.Frame(lsst.jointcal.star.Point(x0 - 25, y0 - 25),
+                                                             lsst.jointcal.star.Point(x0 + 525, y0 + 1025)))
+        self.index = lsst.jointcal.listMatch.ReferenceMatchIndex(reference, self.scale)
+
+    def testExtract(self):
+        self.assertEqual(len(self.index), 600)
+        self.assertEqual(self.index.scale, self.scale)
+        # the stars of the first CCD, in pixel-sized units, brightest first.
+        stars = self.index.extract(self.footprints[0])
+        self.assertEqual(len(stars), 300)
+        fluxes = [star.flux for star in stars]
+        self.assertEqual(fluxes, sorted(fluxes, reverse=True))
+        self.assertLess(max(star.x for star in stars), 525/self.scale)
+
+    def testListMatchBlind(self):
+        conditions = lsst.jointcal.listMatch.MatchConditions()
+        for nProcesses in (1, 2):
+            transfos = lsst.jointcal.listMatch.listMatchBlind(self.lists, self.footprints, self.index,
+                                                              conditions, nProcesses=nProcesses)
+            self.assertEqual(len(transfos), 2)
+            for transfo, stars, (x0, y0) in zip(transfos, self.lists, self.offsets):
+                self.assertIsNotNone(transfo)
+                for star in stars[:10]:
+                    point = transfo.apply(star)
+                    self.assertFloatsAlmostEqual(point.x, x0 + self.scale*star.x, atol=0.01)
+                    self.assertFloatsAlmostEqual(point.y, y0 + self.scale*star.y, atol=0.01)
+
+        with self.assertRaises(lsst.pex.exceptions.LengthError):
+            lsst.jointcal.listMatch.listMatchBlind(self.lists, self.footprints[:1], self.index, conditions)
+
+
+class MemoryTester(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
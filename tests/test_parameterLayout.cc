@@ -0,0 +1,152 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_parameterLayout
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/FittedStar.h"
+#include "lsst/jointcal/Frame.h"
+#include "lsst/jointcal/ParameterLayout.h"
+
+namespace jointcal = lsst::jointcal;
+
+namespace {
+
+/// nStars fitted stars at random positions over frame.
+void makeFittedStars(jointcal::FittedStarList &stars, jointcal::Frame const &frame, std::size_t nStars,
+                     unsigned seed = 1) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    for (std::size_t i = 0; i < nStars; ++i) {
+        double const x = frame.xMin + frame.getWidth() * uniform(generator);
+        double const y = frame.yMin + frame.getHeight() * uniform(generator);
+        stars.push_back(std::make_shared<jointcal::FittedStar>(jointcal::BaseStar(x, y, 1., 0.1)));
+    }
+}
+
+/// The mean distance between the consecutive stars of a list.
+double meanStep(jointcal::FittedStarList const &stars) {
+    double sum = 0;
+    auto previous = stars.begin();
+    for (auto it = std::next(previous); it != stars.end(); ++it, ++previous) {
+        sum += (*it)->Distance(**previous);
+    }
+    return sum / (stars.size() - 1);
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_parameterLayout)
+
+BOOST_AUTO_TEST_CASE(test_hilbert_index_is_a_continuous_curve) {
+    // over the cell centers of a 2^order grid, the index is a bijection onto [0, 4^order), and consecutive
+    // indices are adjacent cells.
+    unsigned const order = 4;
+    int const n = 1 << order;
+    jointcal::Frame const frame(-3., 10., 5., 26.);
+    std::map<std::uint64_t, std::pair<int, int>> cells;
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            double const x = frame.xMin + (i + 0.5) * frame.getWidth() / n;
+            double const y = frame.yMin + (j + 0.5) * frame.getHeight() / n;
+            cells[jointcal::hilbertIndex(x, y, frame, order)] = std::make_pair(i, j);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(cells.size(), std::size_t(n * n));
+    BOOST_CHECK_EQUAL(cells.begin()->first, 0u);
+    BOOST_CHECK_EQUAL(cells.rbegin()->first, std::uint64_t(n * n - 1));
+    // the curve starts and ends at the two bottom corners.
+    BOOST_CHECK(cells.begin()->second == std::make_pair(0, 0));
+    BOOST_CHECK(cells.rbegin()->second == std::make_pair(n - 1, 0));
+    for (auto it = std::next(cells.begin()); it != cells.end(); ++it) {
+        auto const &previous = std::prev(it)->second;
+        int const step =
+                std::abs(it->second.first - previous.first) + std::abs(it->second.second - previous.second);
+        BOOST_CHECK_EQUAL(step, 1);
+    }
+
+    // the first level visits the quadrants in that order.
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(-2., 11., frame, 1), 0u);
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(-2., 25., frame, 1), 1u);
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(4., 25., frame, 1), 2u);
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(4., 11., frame, 1), 3u);
+}
+
+BOOST_AUTO_TEST_CASE(test_hilbert_index_clamping) {
+    jointcal::Frame const frame(0., 0., 1., 1.);
+    unsigned const order = 8;
+    // points outside the frame go to the cells of its boundary.
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(-5., -5., frame, order),
+                      jointcal::hilbertIndex(0., 0., frame, order));
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(2., -1., frame, order),
+                      jointcal::hilbertIndex(1., 0., frame, order));
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(0.3, 7., frame, order),
+                      jointcal::hilbertIndex(0.3, 1., frame, order));
+    // the upper edges belong to the last cells.
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(1., 0., frame, order), (std::uint64_t(1) << (2 * order)) - 1);
+    // a degenerate frame maps everything onto its first cells.
+    jointcal::Frame const line(0., 2., 1., 2.);
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(0., 2., line, order), 0u);
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(0., 5., line, order), 0u);
+    // the full precision does not overflow.
+    BOOST_CHECK_EQUAL(jointcal::hilbertIndex(1., 0., frame, 32), ~std::uint64_t(0));
+}
+
+BOOST_AUTO_TEST_CASE(test_sort_fitted_stars_spatially) {
+    jointcal::Frame const frame(100., -50., 300., 250.);
+    jointcal::FittedStarList stars;
+    makeFittedStars(stars, frame, 2000);
+    std::set<jointcal::FittedStar const *> before;
+    for (auto const &star : stars) before.insert(star.get());
+    double const randomStep = meanStep(stars);
+
+    jointcal::sortFittedStarsSpatially(stars);
+    // the same stars, in increasing order along the curve over their bounding box.
+    BOOST_REQUIRE_EQUAL(stars.size(), before.size());
+    auto const &first = stars.front();
+    jointcal::Frame box(first->x, first->y, first->x, first->y);
+    for (auto const &star : stars) {
+        BOOST_CHECK(before.count(star.get()) == 1);
+        box.xMin = std::min(box.xMin, star->x);
+        box.yMin = std::min(box.yMin, star->y);
+        box.xMax = std::max(box.xMax, star->x);
+        box.yMax = std::max(box.yMax, star->y);
+    }
+    std::uint64_t previous = 0;
+    for (auto const &star : stars) {
+        std::uint64_t const index = jointcal::hilbertIndex(star->x, star->y, box);
+        BOOST_CHECK(index >= previous);
+        previous = index;
+    }
+    // neighbors along the list are neighbors on the sky: a random order steps about half the field, the
+    // curve about the mean star separation.
+    BOOST_CHECK(meanStep(stars) < randomStep / 10);
+
+    // stars in the same cell keep their relative order.
+    jointcal::FittedStarList twins;
+    for (int i = 0; i < 3; ++i) {
+        twins.push_back(std::make_shared<jointcal::FittedStar>(jointcal::BaseStar(5., 5., i, 0.1)));
+    }
+    twins.push_back(std::make_shared<jointcal::FittedStar>(jointcal::BaseStar(0., 0., 3., 0.1)));
+    twins.push_back(std::make_shared<jointcal::FittedStar>(jointcal::BaseStar(10., 10., 4., 0.1)));
+    jointcal::sortFittedStarsSpatially(twins);
+    std::vector<double> fluxes;
+    for (auto const &star : twins) {
+        if (star->getFlux() < 3) fluxes.push_back(star->getFlux());
+    }
+    BOOST_CHECK(fluxes == std::vector<double>({0., 1., 2.}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,246 @@
+"""Performance regression tests of association and minimization on a fixed synthetic tract.
+
+Each test checks the quantities that do not depend on the machine: the star and parameter counts, the
+number of Jacobian triplets, the non-zeros of the Hessian and of its factor, the number of iterations
+and, in builds with allocation tracking (``scons allocTracking=1``), the number of heap allocations.
+They are computed from the structure of the problem or must be the same in every repetition.
+
+Each test also measures the best wall time over a few repetitions and the memory high-water marks that
+the Associations or fitter Profile recorded. Those depend on the machine, so no baselines are shipped
+for them: record them once with::
+
+    JOINTCAL_PERF_UPDATE=1 python tests/test_performance.py
+
+which writes ``tests/data/performance_baselines.json`` (or the file named by JOINTCAL_PERF_BASELINES).
+Once a baseline exists, a wall time may not exceed JOINTCAL_PERF_TOLERANCE (default 1.5) times it, and
+a memory high-water mark JOINTCAL_PERF_MEMORY_TOLERANCE (default 1.1) times it.
+
+The C++ list matching and kernel benchmarks (tests/benchmark_*.cc) have the same kind of guard, through
+JOINTCAL_BENCHMARK_BASELINE (see tests/microbenchmark.h).
+"""
+import json
+import os
+import time
+import unittest
+
+import lsst.log
+import lsst.utils
+import lsst.utils.tests
+
+import lsst.jointcal
+from lsst.jointcal import benchmark
+
+# Scale of the synthetic tract: large enough for the timings to be meaningful, small enough for the
+# test suite.
+SCALE = 'small'
+REPEAT = 3
+
+
+def _baselinePath():
+    default = os.path.join(lsst.utils.getPackageDir('jointcal'), 'tests/data/performance_baselines.json')
+    return os.environ.get('JOINTCAL_PERF_BASELINES', default)
+
+
+class PerformanceTestCase(lsst.utils.tests.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.path = _baselinePath()
+        cls.update = bool(os.environ.get('JOINTCAL_PERF_UPDATE'))
+        cls.tolerance = float(os.environ.get('JOINTCAL_PERF_TOLERANCE', 1.5))
+        cls.memoryTolerance = float(os.environ.get('JOINTCAL_PERF_MEMORY_TOLERANCE', 1.1))
+        cls.baselines = {}
+        if os.path.exists(cls.path):
+            with open(cls.path) as stream:
+                cls.baselines = json.load(stream)
+        cls.tract = benchmark.makeSyntheticTract(SCALE)
+
+    @classmethod
+    def tearDownClass(cls):
+        if cls.update:
+            with open(cls.path, 'w') as stream:
+                json.dump(cls.baselines, stream, indent=2, sort_keys=True)
+                stream.write('\n')
+
+    def setUp(self):
+        self.logLevel = lsst.log.getLogger("jointcal").getLevel()
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+
+    def tearDown(self):
+        lsst.log.setLevel("jointcal", self.logLevel)
+
+    def _check(self, name, wallTime, memory):
+        """Compare the machine dependent measurements to their baseline, or record them.
+
+        Parameters
+        ----------
+        name : `str`
+            Name of the measurement in the baseline file.
+        wallTime : `float`
+            Best wall time, in seconds.
+        memory : `dict` [`str`, `int`]
+            Memory high-water marks, in bytes.
+        """
+        if self.update:
+            self.baselines[name] = {'wallTime': wallTime, 'memory': dict(memory)}
+            return
+        if name not in self.baselines:
+            return
+        baseline = self.baselines[name]
+        self.assertLessEqual(wallTime, self.tolerance*baseline['wallTime'],
+                             msg="{} wall time regressed".format(name))
+        for key, value in baseline['memory'].items():
+            if key in memory:
+                self.assertLessEqual(memory[key], self.memoryTolerance*value,
+                                     msg="{} {} memory regressed".format(name, key))
+
+    def assertRepeatable(self, name, runs):
+        """The counters of every run agree, and the allocations of every run but the first (which may fill
+        caches the others reuse) agree, and are at most those of the first.
+
+        Parameters
+        ----------
+        name : `str`
+            Name of the measurement, for the messages.
+        runs : `list` [`tuple` [`dict` [`str`, `int`], `int` or `None`]]
+            Counters and allocations of each run.
+        """
+        counters = [run[0] for run in runs]
+        for other in counters[1:]:
+            self.assertEqual(other, counters[0], msg="{} counters differ between runs".format(name))
+        allocations = [run[1] for run in runs]
+        if allocations[0] is None:
+            return
+        for other in allocations[1:]:
+            self.assertEqual(other, allocations[1], msg="{} allocations differ between runs".format(name))
+            self.assertLessEqual(other, allocations[0], msg="{} reruns allocate more".format(name))
+
+    @staticmethod
+    def _allocations(profile, phase):
+        """Allocations made in phase (all phases if None), or None without allocation tracking."""
+        if not lsst.jointcal.isAllocationTrackingEnabled():
+            return None
+        timings = profile.getTimings()
+        if phase is None:
+            return sum(timing.allocations for timing in timings.values())
+        return timings[phase].allocations
+
+    def _associate(self):
+        return benchmark.makeSyntheticAssociations(self.tract, rejectBadFluxes=False)
+
+    def test_associate(self):
+        name = 'associate_' + SCALE
+        best = float('inf')
+        runs = []
+        for i in range(REPEAT):
+            start = time.perf_counter()
+            associations = self._associate()
+            best = min(best, time.perf_counter() - start)
+            profile = associations.getProfile()
+            runs.append((profile.getCounters(), self._allocations(profile, None)))
+        self.assertRepeatable(name, runs)
+        counters = runs[0][0]
+        self.assertEqual(counters["nFittedStars"], associations.fittedStarListSize())
+        self.assertEqual(counters["nRefStars"], associations.refStarListSize())
+        self.assertLessEqual(counters["nFittedStars"], counters["nAssociatedFittedStars"])
+        self.assertLessEqual(counters["nFittedStars"], self.tract.getNStars())
+        self.assertGreater(associations.nFittedStarsWithAssociatedRefStar(), 0)
+        memory = profile.getMemory()
+        self.assertLessEqual(memory["catalogsForFit"], memory["wholeCatalogs"])
+        self._check(name, best, memory)
+
+    def _minimize(self, name, makeFit, whatToFit, deproject=False):
+        """Time one minimize call on a fresh fit, REPEAT times, check that every call does the same
+        work, and return the associations, the model and fit of the last call, and its counters."""
+        associations = self._associate()
+        if deproject:
+            associations.deprojectFittedStars()
+        best = float('inf')
+        runs = []
+        for i in range(REPEAT):
+            model, fit = makeFit(associations)
+            start = time.perf_counter()
+            result = fit.minimize(whatToFit)
+            best = min(best, time.perf_counter() - start)
+            self.assertEqual(result, lsst.jointcal.MinimizeResult.Converged)
+            profile = fit.getProfile()
+            runs.append((profile.getCounters(), self._allocations(profile, "minimize")))
+        self.assertRepeatable(name, runs)
+        counters = runs[0][0]
+        # without outlier rejection, a least squares minimize takes one step.
+        self.assertEqual(counters["nIterations"], 1)
+        self.assertEqual(counters["nParameters"], fit.getNParameters())
+        # every parameter is on the diagonal of the Hessian, and the factor holds its lower triangle.
+        self.assertGreaterEqual(counters["hessianNonZeros"], counters["nParameters"])
+        self.assertGreaterEqual(2*counters["factorNonZeros"],
+                                counters["hessianNonZeros"] + counters["nParameters"])
+        self._check(name, best, profile.getMemory())
+        return associations, model, fit, counters
+
+    def assertJacobianShape(self, counters, measurementEntries, nRefStars, refEntries):
+        """The Hessian of a Jacobian whose measurement columns have measurementEntries[i] entries, and
+        with nRefStars columns of refEntries entries, has at most the squares of those non-zeros."""
+        bound = sum(n*n for n in measurementEntries) + nRefStars*refEntries*refEntries
+        self.assertLessEqual(counters["hessianNonZeros"], bound)
+
+    def test_minimize_astrometry(self):
+        def makeFit(associations):
+            projection = lsst.jointcal.OneTPPerVisitHandler(associations.getCcdImageList())
+            model = lsst.jointcal.SimpleAstrometryModel(associations.getCcdImageList(), projection,
+                                                        True, nNotFit=0, order=3)
+            return model, lsst.jointcal.AstrometryFit(associations, model, 0.02)
+        associations, model, fit, counters = self._minimize('minimize_astrometry_' + SCALE, makeFit,
+                                                            "Distortions Positions", deproject=True)
+        ccdImages = associations.getCcdImageList()
+        nFittedStars = associations.fittedStarListSize()
+        nRefStars = associations.nFittedStarsWithAssociatedRefStar()
+        self.assertEqual(counters["nParameters"],
+                         sum(model.getNpar(ccdImage) for ccdImage in ccdImages) + 2*nFittedStars)
+        # 2 columns per measurement with the mapping and position parameters, and 2 per reference
+        # star with its position; measurements with inconsistent errors and derivatives that are exactly
+        # zero are skipped.
+        nMeasurements = sum(ccdImage.countStars()[0] for ccdImage in ccdImages)
+        self.assertLessEqual(counters["jacobianColumns"], 2*nMeasurements + 2*nRefStars)
+        self.assertEqual(fit.countTriplets(),
+                         sum(2*(model.getNpar(ccdImage) + 2)*ccdImage.countStars()[0]
+                             for ccdImage in ccdImages) + 4*nRefStars)
+        self.assertLessEqual(counters["nTriplets"], fit.countTriplets())
+        entries = []
+        for ccdImage in ccdImages:
+            entries += [model.getNpar(ccdImage) + 2]*(2*ccdImage.countStars()[0])
+        self.assertJacobianShape(counters, entries, 2*nRefStars, 2)
+
+    def test_minimize_photometry(self):
+        def makeFit(associations):
+            model = lsst.jointcal.SimplePhotometryModel(associations.getCcdImageList())
+            return model, lsst.jointcal.PhotometryFit(associations, model)
+        associations, model, fit, counters = self._minimize('minimize_photometry_' + SCALE, makeFit,
+                                                            "Model Fluxes")
+        ccdImages = associations.getCcdImageList()
+        nRefStars = associations.nFittedStarsWithAssociatedRefStar()
+        self.assertEqual(counters["nParameters"], sum(model.getNpar(ccdImage) for ccdImage in ccdImages) +
+                         associations.fittedStarListSize())
+        # one column per measurement, with its model parameters and fitted flux, and one per reference
+        # star, with its fitted flux.
+        nMeasurements = sum(ccdImage.countStars()[0] for ccdImage in ccdImages)
+        self.assertEqual(counters["jacobianColumns"], nMeasurements + nRefStars)
+        nMeasurementTriplets = sum((model.getNpar(ccdImage) + 1)*ccdImage.countStars()[0]
+                                   for ccdImage in ccdImages)
+        self.assertEqual(counters["nTriplets"], nMeasurementTriplets + nRefStars)
+        self.assertEqual(counters["nTriplets"], fit.countTriplets())
+        entries = []
+        for ccdImage in ccdImages:
+            entries += [model.getNpar(ccdImage) + 1]*ccdImage.countStars()[0]
+        self.assertJacobianShape(counters, entries, nRefStars, 1)
+
+
+class MemoryTester(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
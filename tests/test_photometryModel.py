@@ -121,6 +121,154 @@ class ConstrainedPhotometryModelTestCase(PhotometryModelTestBase, lsst.utils.tes
         self._toPhotoCalib(self.ccdImageList[1])
 
 
+class StarFlatPhotometryModelTestCase(PhotometryModelTestBase, lsst.utils.tests.TestCase):
+    def setUp(self):
+        super(StarFlatPhotometryModelTestCase, self).setUp()
+        self.starFlatOrder = 3
+        self.focalPlaneBBox = self.camera.getFpBBox()
+        self.model = lsst.jointcal.photometryModels.StarFlatPhotometryModel(self.ccdImageList,
+                                                                            self.focalPlaneBBox,
+                                                                            self.starFlatOrder)
+        # have to call this once to let offsetParams work.
+        self.model.assignIndices("", self.firstIndex)
+        # two visit zero points, then the 9 non-constant star flat coefficients.
+        self.delta = np.arange(11, dtype=float)*-0.02 + 0.1
+        self.model.offsetParams(self.delta)
+
+    def test_getNpar(self):
+        """
+        Order 3 => (3+1)*(3+2))/2 - 1 = 9 star flat parameters (the constant term is fixed),
+        plus one visit zero point; the chip map is fixed (only one ccd), so does not contribute.
+        """
+        expect = (4*5)/2 - 1 + 1
+        result = self.model.getNpar(self.ccdImageList[0])
+        self.assertEqual(result, expect)
+        result = self.model.getNpar(self.ccdImageList[1])
+        self.assertEqual(result, expect)
+
+    def _copyStar(self, star):
+        """Return a new MeasuredStar with the same measurement as star, that the cache does not hold."""
+        copy = lsst.jointcal.star.MeasuredStar()
+        copy.x = star.x
+        copy.y = star.y
+        copy.setInstFlux(star.getInstFlux())
+        copy.setInstFluxErr(star.getInstFluxErr())
+        copy.setXFocal(star.getXFocal())
+        copy.setYFocal(star.getYFocal())
+        return copy
+
+    def _checkDerivatives(self, model, nParameters, ccdImage, star):
+        """The derivatives of model for star on ccdImage are the central finite differences of transform,
+        which is linear in each parameter."""
+        indices = model.getMappingIndices(ccdImage)
+        derivatives = model.computeParameterDerivatives(star, ccdImage)
+        self.assertEqual(len(indices), len(derivatives))
+        flux = model.transform(ccdImage, star, star.getInstFlux())
+        step = 1e-4
+        for index, derivative in zip(indices, derivatives):
+            # offsetParams subtracts delta from the parameters.
+            delta = np.zeros(nParameters)
+            delta[index] = step
+            model.offsetParams(delta)
+            fluxMinus = model.transform(ccdImage, star, star.getInstFlux())
+            model.offsetParams(-2*delta)
+            fluxPlus = model.transform(ccdImage, star, star.getInstFlux())
+            model.offsetParams(delta)
+            self.assertFloatsAlmostEqual((fluxPlus - fluxMinus)/(2*step), derivative,
+                                         rtol=1e-6, atol=1e-9*abs(flux))
+        self.assertFloatsAlmostEqual(model.transform(ccdImage, star, star.getInstFlux()), flux, rtol=1e-12)
+
+    def test_cache(self):
+        """The measurements to fit are cached, and give what a fresh evaluation of the same measurement
+        gives; other stars, and cached ones that moved, are evaluated directly."""
+        nCatalog = sum(len(ccdImage.getCatalogForFit()) for ccdImage in self.ccdImageList)
+        self.assertEqual(self.model.getCacheSize(), nCatalog)
+        self.assertEqual(self.model.getNEpochs(), 1)
+        for ccdImage in self.ccdImageList:
+            for star in ccdImage.getCatalogForFit():
+                fresh = self._copyStar(star)
+                self.assertTrue(self.model.isCached(star))
+                self.assertFalse(self.model.isCached(fresh))
+                self.assertFloatsAlmostEqual(self.model.transform(ccdImage, star, self.instFlux),
+                                             self.model.transform(ccdImage, fresh, self.instFlux), rtol=1e-14)
+                self.assertFloatsAlmostEqual(self.model.transformError(ccdImage, star, self.instFluxErr),
+                                             self.model.transformError(ccdImage, fresh, self.instFluxErr),
+                                             rtol=1e-14)
+                self.assertFloatsAlmostEqual(self.model.computeParameterDerivatives(star, ccdImage),
+                                             self.model.computeParameterDerivatives(fresh, ccdImage),
+                                             rtol=1e-14)
+        for star in self.stars:
+            self.assertFalse(self.model.isCached(star))
+
+        # a cached star that moved on the focal plane is no longer read from the cache.
+        ccdImage = self.ccdImageList[1]
+        star = ccdImage.getCatalogForFit()[0]
+        before = self.model.transform(ccdImage, star, self.instFlux)
+        xFocal = star.getXFocal()
+        star.setXFocal(xFocal + 10.0)
+        self.assertFalse(self.model.isCached(star))
+        moved = self.model.transform(ccdImage, star, self.instFlux)
+        self.assertFloatsNotEqual(moved, before)
+        fresh = self._copyStar(star)
+        self.assertFloatsAlmostEqual(moved, self.model.transform(ccdImage, fresh, self.instFlux), rtol=1e-14)
+        star.setXFocal(xFocal)
+        self.assertTrue(self.model.isCached(star))
+        self.assertFloatsAlmostEqual(self.model.transform(ccdImage, star, self.instFlux), before, rtol=1e-14)
+
+    def test_derivatives(self):
+        """The derivatives of the cached measurements and of the test stars match finite differences."""
+        nParameters = self.model.assignIndices("", self.firstIndex)
+        for ccdImage in self.ccdImageList:
+            for star in ccdImage.getCatalogForFit()[:5]:
+                self._checkDerivatives(self.model, nParameters, ccdImage, star)
+        self._checkDerivatives(self.model, nParameters, self.ccdImageList[1], self.star0)
+
+    def test_epochs(self):
+        """Epochs without data get no star flat."""
+        model = lsst.jointcal.photometryModels.StarFlatPhotometryModel(self.ccdImageList, self.focalPlaneBBox,
+                                                                       self.starFlatOrder, [1., 1e6])
+        self.assertEqual(model.getNEpochs(), 1)
+        with self.assertRaises(lsst.pex.exceptions.InvalidParameterError):
+            lsst.jointcal.photometryModels.StarFlatPhotometryModel(self.ccdImageList, self.focalPlaneBBox,
+                                                                   self.starFlatOrder, [2., 1.])
+
+    def test_two_epochs(self):
+        """A boundary between the two visits gives each its own star flat, on the shared cache."""
+        mjds = [ccdImage.getMjd() for ccdImage in self.ccdImageList]
+        self.assertNotEqual(mjds[0], mjds[1])
+        model = lsst.jointcal.photometryModels.StarFlatPhotometryModel(self.ccdImageList, self.focalPlaneBBox,
+                                                                       self.starFlatOrder, [np.mean(mjds)])
+        self.assertEqual(model.getNEpochs(), 2)
+        # two visit zero points and two sets of 9 star flat coefficients.
+        nParameters = model.assignIndices("", self.firstIndex)
+        self.assertEqual(nParameters, 2 + 2*9)
+        indices = [model.getMappingIndices(ccdImage) for ccdImage in self.ccdImageList]
+        self.assertEqual(len(indices[0]), 10)
+        self.assertEqual(set(indices[0]) & set(indices[1]), set())
+
+        # offsetting one epoch's star flat only changes the fluxes of that epoch.
+        ccdImage0, ccdImage1 = self.ccdImageList
+        star0 = ccdImage0.getCatalogForFit()[0]
+        star1 = ccdImage1.getCatalogForFit()[0]
+        self.assertTrue(model.isCached(star0))
+        self.assertTrue(model.isCached(star1))
+        before0 = model.transform(ccdImage0, star0, self.instFlux)
+        before1 = model.transform(ccdImage1, star1, self.instFlux)
+        delta = np.zeros(nParameters)
+        delta[indices[1][1:]] = 0.01
+        model.offsetParams(delta)
+        self.assertFloatsEqual(model.transform(ccdImage0, star0, self.instFlux), before0)
+        self.assertFloatsNotEqual(model.transform(ccdImage1, star1, self.instFlux), before1)
+
+        for ccdImage in self.ccdImageList:
+            for star in ccdImage.getCatalogForFit()[:5]:
+                self._checkDerivatives(model, nParameters, ccdImage, star)
+
+    def test_toPhotoCalib(self):
+        self._toPhotoCalib(self.ccdImageList[0])
+        self._toPhotoCalib(self.ccdImageList[1])
+
+
 class MemoryTester(lsst.utils.tests.MemoryTestCase):
     pass
 
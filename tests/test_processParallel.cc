@@ -0,0 +1,125 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_processParallel
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <csignal>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "lsst/pex/exceptions.h"
+#include "lsst/jointcal/ProcessParallel.h"
+
+namespace jointcal = lsst::jointcal;
+
+BOOST_AUTO_TEST_SUITE(test_processParallel)
+
+BOOST_AUTO_TEST_CASE(test_children_write_shared_buffers) {
+    std::vector<double> input(1000);
+    for (std::size_t i = 0; i < input.size(); ++i) input[i] = i;
+    jointcal::SharedBuffer output(input.size() * sizeof(double));
+    double *local = new double(1.);
+
+    // the children read the parent's memory in place, and only their writes to the buffer come back.
+    jointcal::runInChildProcesses(4, [&](unsigned worker) {
+        for (std::size_t i = worker; i < input.size(); i += 4) output.data<double>()[i] = 2 * input[i];
+        *local = 3.;
+    });
+    for (std::size_t i = 0; i < input.size(); ++i) BOOST_CHECK_EQUAL(output.data<double>()[i], 2. * i);
+    BOOST_CHECK_EQUAL(*local, 1.);
+    delete local;
+}
+
+BOOST_AUTO_TEST_CASE(test_failed_child) {
+    BOOST_CHECK_THROW(jointcal::runInChildProcesses(3,
+                                                    [](unsigned worker) {
+                                                        if (worker == 1) throw std::runtime_error("failed");
+                                                    }),
+                      lsst::pex::exceptions::RuntimeError);
+
+    // the parent reports what the child threw.
+    std::string message;
+    try {
+        jointcal::runInChildProcesses(3, [](unsigned worker) {
+            if (worker == 1) throw std::runtime_error("no stars in ccd 42");
+        });
+    } catch (lsst::pex::exceptions::RuntimeError const &e) {
+        message = e.what();
+    }
+    BOOST_CHECK(message.find("1 of 3") != std::string::npos);
+    BOOST_CHECK(message.find("worker 1: no stars in ccd 42") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_worker_pool_keeps_state) {
+    jointcal::SharedBuffer output(3 * sizeof(double));
+    jointcal::SharedBuffer pids(3 * sizeof(pid_t));
+    double total = 0;
+    {
+        // each worker accumulates in its own copy of total, forked once for all the commands.
+        jointcal::WorkerPool pool(3, [&](unsigned worker, unsigned command) {
+            total += command * (worker + 1);
+            output.data<double>()[worker] = total;
+            pids.data<pid_t>()[worker] = getpid();
+        });
+        BOOST_CHECK_EQUAL(pool.size(), 3u);
+        pool.run(1);
+        std::vector<pid_t> first(pids.data<pid_t>(), pids.data<pid_t>() + 3);
+        pool.run(2);
+        for (unsigned worker = 0; worker < 3; ++worker) {
+            BOOST_CHECK_EQUAL(output.data<double>()[worker], 3. * (worker + 1));
+            BOOST_CHECK_EQUAL(pids.data<pid_t>()[worker], first[worker]);
+            BOOST_CHECK(first[worker] != getpid());
+        }
+    }
+    BOOST_CHECK_EQUAL(total, 0.);
+}
+
+BOOST_AUTO_TEST_CASE(test_worker_pool_failures) {
+    jointcal::WorkerPool pool(3, [](unsigned worker, unsigned command) {
+        if (command == 1 && worker == 2) throw std::runtime_error("no stars in ccd 42");
+    });
+    pool.run(0);
+    std::string message;
+    try {
+        pool.run(1);
+    } catch (lsst::pex::exceptions::RuntimeError const &e) {
+        message = e.what();
+    }
+    BOOST_CHECK(message.find("1 of 3") != std::string::npos);
+    BOOST_CHECK(message.find("worker 2: no stars in ccd 42") != std::string::npos);
+    // the pool is unusable after a failure.
+    BOOST_CHECK_THROW(pool.run(0), lsst::pex::exceptions::RuntimeError);
+
+    jointcal::WorkerPool killed(2, [](unsigned worker, unsigned) {
+        if (worker == 0) std::raise(SIGKILL);
+    });
+    message.clear();
+    try {
+        killed.run(0);
+    } catch (lsst::pex::exceptions::RuntimeError const &e) {
+        message = e.what();
+    }
+    BOOST_CHECK(message.find("worker 0: killed by signal " + std::to_string(SIGKILL)) != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_partitionByWeight) {
+    std::vector<std::size_t> weights = {10, 10, 10, 10, 40, 5, 5, 10};
+    auto bounds = jointcal::partitionByWeight(weights, 2);
+    BOOST_CHECK_EQUAL(bounds.size(), 3u);
+    BOOST_CHECK_EQUAL(bounds[0], 0u);
+    BOOST_CHECK_EQUAL(bounds[1], 4u);
+    BOOST_CHECK_EQUAL(bounds[2], weights.size());
+
+    // more parts than elements: the extra parts are empty.
+    bounds = jointcal::partitionByWeight({1, 1}, 4);
+    BOOST_CHECK_EQUAL(bounds.size(), 5u);
+    BOOST_CHECK_EQUAL(bounds.back(), 2u);
+    for (std::size_t i = 1; i < bounds.size(); ++i) BOOST_CHECK(bounds[i - 1] <= bounds[i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,56 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_refStar
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <cmath>
+#include <vector>
+
+#include "lsst/jointcal/RefStar.h"
+
+namespace jointcal = lsst::jointcal;
+
+BOOST_AUTO_TEST_SUITE(test_refStar)
+
+BOOST_AUTO_TEST_CASE(test_propagateToEpoch) {
+    std::vector<double> fluxes, fluxErrs;
+    jointcal::RefStar star(10., 60., 1., 0.1, fluxes, fluxErrs);
+    star.vx = star.vy = 1e-10;
+    // without proper motion or epoch, nothing moves.
+    star.propagateToEpoch(60000.);
+    BOOST_CHECK_EQUAL(star.x, 10.);
+    star.setProperMotion(1e-6, -2e-6, 1e-8, 1e-8);
+    star.propagateToEpoch(60000.);
+    BOOST_CHECK_EQUAL(star.y, 60.);
+
+    star.setEpoch(57000.);
+    star.propagateToEpoch(58000.);
+    // the motion along ra is a great circle distance: the ra offset is twice as large at dec=60.
+    BOOST_CHECK_CLOSE(star.x, 10. + 2e-3, 1e-9);
+    BOOST_CHECK_CLOSE(star.y, 60. - 2e-3, 1e-9);
+    BOOST_CHECK_CLOSE(star.vy, 1e-10 + 1e-10, 1e-9);
+    BOOST_CHECK_EQUAL(star.getEpoch(), 58000.);
+}
+
+BOOST_AUTO_TEST_CASE(test_parallax) {
+    // A star at the north ecliptic pole describes a circle of radius the parallax over a year.
+    double const ra = 270., dec = 66.56;
+    double const parallax = 1.;
+    for (double mjd = 58000.; mjd < 58365.; mjd += 30.) {
+        auto shift = jointcal::computeParallaxShift(ra, dec, jointcal::computeSunPosition(mjd), parallax);
+        BOOST_CHECK_CLOSE(std::hypot(shift.x, shift.y), parallax, 2.);
+    }
+    // A star in the ecliptic, opposite the Sun, is not displaced.
+    double const mjd = 58000.;  // 2017 September 4: the Sun is near ra=163, dec=7
+    auto sun = jointcal::computeSunPosition(mjd);
+    double const sunRa = std::atan2(sun[1], sun[0]) * 180. / M_PI;
+    double const sunDec = std::asin(sun[2] / std::sqrt(sun[0] * sun[0] + sun[1] * sun[1] + sun[2] * sun[2])) *
+                          180. / M_PI;
+    BOOST_CHECK_CLOSE(sunRa, 163., 0.5);
+    auto shift = jointcal::computeParallaxShift(sunRa + 180., -sunDec, sun, parallax);
+    BOOST_CHECK_SMALL(std::hypot(shift.x, shift.y), 1e-6);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
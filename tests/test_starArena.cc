@@ -0,0 +1,84 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_starArena
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+
+#include "lsst/jointcal/StarArena.h"
+
+namespace jointcal = lsst::jointcal;
+
+namespace {
+
+struct Payload {
+    double x, y, flux;
+    Payload(double x_, double y_, double flux_) : x(x_), y(y_), flux(flux_) {}
+};
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_starArena)
+
+BOOST_AUTO_TEST_CASE(test_blocks_are_recycled) {
+    jointcal::StarArena arena;
+    void *first = arena.allocate(40);
+    void *second = arena.allocate(40);
+    BOOST_CHECK(first != second);
+    BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(first) % jointcal::StarArena::BLOCK_ALIGNMENT, 0u);
+    BOOST_CHECK_EQUAL(arena.getNLiveBlocks(), 2u);
+    BOOST_CHECK_EQUAL(arena.getNChunks(), 1u);
+
+    arena.deallocate(first, 40);
+    // same size class: the freed block comes back
+    BOOST_CHECK_EQUAL(arena.allocate(33), first);
+    // another size class gets its own chunk
+    arena.deallocate(arena.allocate(100), 100);
+    BOOST_CHECK_EQUAL(arena.getNChunks(), 2u);
+
+    // large blocks come from the heap
+    void *large = arena.allocate(jointcal::StarArena::MAX_BLOCK_SIZE + 1);
+    BOOST_CHECK_EQUAL(arena.getNLiveBlocks(), 2u);
+    arena.deallocate(large, jointcal::StarArena::MAX_BLOCK_SIZE + 1);
+    arena.deallocate(first, 33);
+    arena.deallocate(second, 40);
+}
+
+BOOST_AUTO_TEST_CASE(test_release_only_when_unused) {
+    auto arena = std::make_shared<jointcal::StarArena>();
+    std::list<std::shared_ptr<Payload>> stars;
+    for (int i = 0; i < 10000; ++i) {
+        stars.push_back(jointcal::makeArenaShared<Payload>(arena, i, -i, 2. * i));
+    }
+    BOOST_CHECK_EQUAL(arena->getNLiveBlocks(), stars.size());
+    BOOST_CHECK(arena->getNChunks() > 1);
+    BOOST_CHECK_EQUAL(stars.back()->flux, 2. * 9999);
+
+    auto kept = stars.front();
+    stars.clear();
+    BOOST_CHECK(!arena->release());
+    BOOST_CHECK_EQUAL(kept->y, 0.);
+
+    kept.reset();
+    BOOST_CHECK(arena->release());
+    BOOST_CHECK_EQUAL(arena->getNChunks(), 0u);
+    BOOST_CHECK_EQUAL(arena->getNReleases(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_objects_outlive_their_owner) {
+    auto arena = std::make_shared<jointcal::StarArena>();
+    auto star = jointcal::makeArenaShared<Payload>(arena, 1., 2., 3.);
+    arena.reset();  // the object's control block keeps the arena alive
+    BOOST_CHECK_EQUAL(star->x, 1.);
+    star.reset();
+
+    // without an arena, this is make_shared
+    auto heap = jointcal::makeArenaShared<Payload>(nullptr, 4., 5., 6.);
+    BOOST_CHECK_EQUAL(heap->flux, 6.);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
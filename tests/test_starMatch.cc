@@ -0,0 +1,162 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_starMatch
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "lsst/jointcal/BaseStar.h"
+#include "lsst/jointcal/Gtransfo.h"
+#include "lsst/jointcal/StarMatch.h"
+
+namespace jointcal = lsst::jointcal;
+
+namespace {
+
+/// The true transfo of the synthetic matches: a mild second order distortion.
+jointcal::GtransfoPoly makeTrueTransfo() {
+    jointcal::GtransfoPoly transfo(2);
+    transfo.coeff(0, 0, 0) = 10.;
+    transfo.coeff(1, 0, 0) = 1.01;
+    transfo.coeff(0, 1, 0) = 0.02;
+    transfo.coeff(2, 0, 0) = 1e-6;
+    transfo.coeff(0, 0, 1) = -5.;
+    transfo.coeff(1, 0, 1) = -0.01;
+    transfo.coeff(0, 1, 1) = 0.99;
+    transfo.coeff(1, 1, 1) = 2e-6;
+    return transfo;
+}
+
+/// A star at point with variance on both coordinates.
+std::shared_ptr<jointcal::BaseStar> makeStar(jointcal::Point const &point, double variance) {
+    auto star = std::make_shared<jointcal::BaseStar>(point, 1., 0.1);
+    star->vx = star->vy = variance;
+    return star;
+}
+
+/**
+ * nGood matches of the true transfo with noise sigma, nOutliers matches displaced by 50 sigma, and
+ * nAmbiguous extra matches of new stars to the first stars of the second list.
+ */
+void makeMatches(jointcal::StarMatchList &matches, std::size_t nGood, std::size_t nOutliers,
+                 std::size_t nAmbiguous, double sigma = 0.01, unsigned seed = 1) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> uniform(0., 2000.);
+    std::uniform_real_distribution<double> angles(0., 2 * M_PI);
+    std::normal_distribution<double> gaussian(0., 1.);
+    auto const transfo = makeTrueTransfo();
+    double const variance = 0.5 * sigma * sigma;
+    std::vector<std::shared_ptr<jointcal::BaseStar>> stars2;
+    for (std::size_t i = 0; i < nGood + nOutliers; ++i) {
+        auto star1 = makeStar(jointcal::Point(uniform(generator), uniform(generator)), variance);
+        jointcal::Point point2 = transfo.apply(*star1);
+        if (i < nGood) {
+            point2.x += sigma * gaussian(generator);
+            point2.y += sigma * gaussian(generator);
+        } else {
+            double const angle = angles(generator);
+            point2.x += 50 * sigma * std::cos(angle);
+            point2.y += 50 * sigma * std::sin(angle);
+        }
+        auto star2 = makeStar(point2, variance);
+        stars2.push_back(star2);
+        matches.emplace_back(*star1, *star2, star1, star2);
+    }
+    for (std::size_t i = 0; i < nAmbiguous; ++i) {
+        auto star1 = makeStar(jointcal::Point(uniform(generator), uniform(generator)), variance);
+        matches.emplace_back(*star1, *stars2[i], star1, stars2[i]);
+    }
+}
+
+/// The per-match chi2s are those of the final transfo.
+void checkMatchChi2s(jointcal::StarMatchList const &matches) {
+    for (auto const &match : matches) {
+        double const chi2 = match.computeChi2(*matches.getTransfo());
+        BOOST_CHECK_SMALL(match.chi2 - chi2, 1e-8 * std::max(1., chi2));
+    }
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_starMatch)
+
+BOOST_AUTO_TEST_CASE(test_incremental_agrees_with_refitting) {
+    jointcal::StarMatchList matches, incremental;
+    makeMatches(matches, 300, 10, 5);
+    makeMatches(incremental, 300, 10, 5);
+    matches.setTransfo(jointcal::GtransfoPoly(2));
+    incremental.setTransfo(jointcal::GtransfoPoly(2));
+    matches.refineTransfo(5., false);
+    incremental.refineTransfo(5., true);
+
+    // both discard all the outliers and ambiguous matches, and keep the same matches.
+    auto const transfo = makeTrueTransfo();
+    for (auto const &match : incremental) BOOST_CHECK_SMALL(match.computeDistance(transfo), 0.1);
+    BOOST_CHECK(incremental.size() > 290u);
+    BOOST_REQUIRE_EQUAL(incremental.size(), matches.size());
+    // refitting reorders the list when it removes the ambiguities.
+    auto keys = [](jointcal::StarMatchList const &list) {
+        std::vector<std::pair<double, double>> result;
+        for (auto const &match : list) result.emplace_back(match.point1.x, match.point2.x);
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    BOOST_CHECK(keys(incremental) == keys(matches));
+    // the weights frozen after the first fit only make a small difference.
+    BOOST_CHECK_CLOSE(incremental.getChi2(), matches.getChi2(), 5.);
+    checkMatchChi2s(incremental);
+
+    // the two transfos agree to a small fraction of the noise over the whole field.
+    for (double x = 0; x <= 2000; x += 500) {
+        for (double y = 0; y <= 2000; y += 500) {
+            jointcal::Point point(x, y);
+            jointcal::Point const expected = matches.getTransfo()->apply(point);
+            BOOST_CHECK_SMALL(incremental.getTransfo()->apply(point).Distance(expected), 1e-3);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_exactly_determined) {
+    // as many matches as coefficients: the fit is exact and its chi2 is 0.
+    jointcal::StarMatchList matches;
+    makeMatches(matches, 3, 0, 0);
+    for (auto &match : matches) match.chi2 = 1e10;
+    matches.setTransfo(jointcal::GtransfoLin());
+    matches.refineTransfo(3., true);
+    BOOST_CHECK_EQUAL(matches.getChi2(), 0.);
+    BOOST_CHECK_EQUAL(matches.size(), 3u);
+    checkMatchChi2s(matches);
+}
+
+BOOST_AUTO_TEST_CASE(test_clipped_to_exactly_determined) {
+    // the ambiguities leave as many matches as coefficients, which the downdated solution fits exactly.
+    jointcal::StarMatchList matches;
+    makeMatches(matches, 3, 0, 3);
+    for (auto &match : matches) match.chi2 = 1e10;
+    matches.setTransfo(jointcal::GtransfoLin());
+    matches.refineTransfo(3., true);
+    BOOST_CHECK_EQUAL(matches.getChi2(), 0.);
+    BOOST_CHECK_EQUAL(matches.size(), 3u);
+    checkMatchChi2s(matches);
+}
+
+BOOST_AUTO_TEST_CASE(test_clipped_below_determined) {
+    // the ambiguities leave fewer matches than coefficients: the clipping gives up on the last fit.
+    jointcal::StarMatchList matches;
+    makeMatches(matches, 5, 0, 3);
+    for (auto &match : matches) match.chi2 = 1e10;
+    matches.setTransfo(jointcal::GtransfoPoly(2));
+    matches.refineTransfo(3., true);
+    BOOST_CHECK_EQUAL(matches.getChi2(), -1.);
+    BOOST_CHECK_EQUAL(matches.size(), 5u);
+    checkMatchChi2s(matches);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,116 @@
+"""Tests of the synthetic tract generator: determinism for a seed, and the truth it generates."""
+import math
+import unittest
+
+import numpy as np
+
+import lsst.afw.geom
+import lsst.log
+import lsst.utils.tests
+
+import lsst.jointcal
+from lsst.jointcal import benchmark
+
+
+def getColumns(catalog, *names):
+    """The named fields of all the records of a catalog, as numpy arrays."""
+    return [np.array([record.get(name) for record in catalog]) for name in names]
+
+
+class SyntheticTractTestCase(lsst.utils.tests.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        lsst.log.setLevel("jointcal", lsst.log.WARN)
+        # no outliers, so that every measurement is within its noise of the truth.
+        cls.tract = benchmark.makeSyntheticTract('tiny', seed=3, outlierFraction=0.)
+
+    def test_determinism(self):
+        """The same seed gives the same tract, another seed a different one."""
+        same = benchmark.makeSyntheticTract('tiny', seed=3, outlierFraction=0.)
+        other = benchmark.makeSyntheticTract('tiny', seed=4, outlierFraction=0.)
+        self.assertEqual(same.getNStars(), self.tract.getNStars())
+        for star in range(0, self.tract.getNStars(), 97):
+            self.assertEqual(same.getStarMag(star), self.tract.getStarMag(star))
+            self.assertEqual(same.getStarPosition(star).x, self.tract.getStarPosition(star).x)
+        for visit in range(self.tract.getNVisits()):
+            self.assertEqual(same.getVisitZeroPoint(visit), self.tract.getVisitZeroPoint(visit))
+            self.assertEqual(same.getBoresight(visit).y, self.tract.getBoresight(visit).y)
+
+        names = ("id", "centroid_x", "centroid_y", "synthetic_flux")
+        # the catalogs do not depend on the order they are made in.
+        last = self.tract.getNDetectors() - 1
+        catalog = getColumns(self.tract.makeSourceCatalog(1, last), *names)
+        same.makeSourceCatalog(0, 0)
+        for column, sameColumn in zip(catalog, getColumns(same.makeSourceCatalog(1, last), *names)):
+            np.testing.assert_array_equal(column, sameColumn)
+        otherCatalog = getColumns(other.makeSourceCatalog(1, last), *names)
+        self.assertFalse(len(catalog[0]) == len(otherCatalog[0]) and np.all(catalog[3] == otherCatalog[3]))
+
+        refCat = self.tract.makeRefCatalog()
+        sameRefCat = same.makeRefCatalog()
+        self.assertEqual(len(refCat), len(sameRefCat))
+        for record, sameRecord in zip(refCat, sameRefCat):
+            self.assertEqual(record.getId(), sameRecord.getId())
+            self.assertEqual(record.getCoord(), sameRecord.getCoord())
+
+    def test_source_truth(self):
+        """The measured fluxes are the true ones through the visit zero point, within the noise."""
+        control = self.tract.getControl()
+        for visit in range(self.tract.getNVisits()):
+            zeroPoint = self.tract.getVisitZeroPoint(visit)
+            catalog = self.tract.makeSourceCatalog(visit, 0)
+            self.assertGreater(len(catalog), 0)
+            ids, fluxes, fluxErrs = getColumns(catalog, "id", "synthetic_flux", "synthetic_fluxSigma")
+            trueFluxes = np.array([10**(-0.4*(self.tract.getStarMag(int(i)) + zeroPoint)) for i in ids])
+            trueFluxes /= self.tract.getCalibrationMean()
+            self.assertLess(np.max(np.abs(fluxes - trueFluxes)/fluxErrs), 6.)
+            # the noise grows as the stars get fainter.
+            mags = np.array([self.tract.getStarMag(int(i)) for i in ids])
+            scales = 10**(0.2*(mags - control.magMin))
+            self.assertFloatsAlmostEqual(fluxErrs/trueFluxes, control.fluxNoise*scales, rtol=1e-6)
+            # every star is seen at most once per CCD, and within its bounding box.
+            self.assertEqual(len(set(ids)), len(ids))
+        bbox = lsst.afw.geom.Box2D(benchmark.getBenchmarkDetectors(1)[0].getBBox())
+        for record in self.tract.makeSourceCatalog(0, 0):
+            self.assertTrue(bbox.contains(record.getCentroid()))
+
+    def test_reference_truth(self):
+        """The reference catalog holds the brightest stars, at their true positions within the noise."""
+        control = self.tract.getControl()
+        refCat = self.tract.makeRefCatalog()
+        nStars = self.tract.getNStars()
+        self.assertEqual(len(refCat), round(control.refFraction*nStars))
+        refIds = set()
+        for record in refCat:
+            star = record.getId()
+            refIds.add(star)
+            position = self.tract.getStarPosition(star)
+            truth = lsst.afw.geom.SpherePoint(position.x, position.y, lsst.afw.geom.degrees)
+            separation = record.getCoord().separation(truth).asArcseconds()
+            self.assertLess(separation, 6*control.refPositionNoise)
+            trueFlux = 10**(-0.4*self.tract.getStarMag(star))*3631.
+            self.assertLess(abs(record.get(self.tract.getRefFluxField()) - trueFlux),
+                            6*control.fluxNoise*trueFlux)
+        faintestRef = max(self.tract.getStarMag(star) for star in refIds)
+        brightestOther = min(self.tract.getStarMag(star) for star in range(nStars) if star not in refIds)
+        self.assertLessEqual(faintestRef, brightestOther)
+        mags = [self.tract.getStarMag(star) for star in range(nStars)]
+        self.assertGreaterEqual(min(mags), control.magMin)
+        self.assertLessEqual(max(mags), control.magMax)
+        # the stars cover the tract: their mean position is near its center.
+        self.assertLess(abs(np.mean([self.tract.getStarPosition(star).y for star in range(nStars)]) -
+                            control.decCenter), 0.1)
+        self.assertTrue(math.isfinite(self.tract.getCalibrationMean()))
+
+
+class MemoryTester(lsst.utils.tests.MemoryTestCase):
+    pass
+
+
+def setup_module(module):
+    lsst.utils.tests.init()
+
+
+if __name__ == "__main__":
+    lsst.utils.tests.init()
+    unittest.main()
@@ -0,0 +1,92 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE test_tripletList
+
+// The boost unit test header
+#include "boost/test/unit_test.hpp"
+
+#include "lsst/pex/exceptions.h"
+#include "lsst/jointcal/Tripletlist.h"
+
+namespace jointcal = lsst::jointcal;
+
+namespace {
+
+/// Fill a list the way the fitters do: columns in order, rows in any order, some columns empty,
+/// and a duplicate (row, column) entry.
+void fill(jointcal::TripletList &list) {
+    list.addTriplet(3, 0, 1.0);
+    list.addTriplet(0, 0, 2.0);
+    list.addTriplet(5, 1, -1.5);
+    list.addTriplet(1, 1, 4.0);
+    list.addTriplet(5, 1, 0.5);
+    // column 2 is empty
+    list.addTriplet(2, 3, 7.0);
+    list.setNextFreeIndex(5);  // column 4 is empty too
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_tripletList)
+
+BOOST_AUTO_TEST_CASE(test_compact_matches_triplets) {
+    jointcal::TripletList triplets(10, jointcal::TripletList::Storage::Triplets);
+    jointcal::TripletList compact(10, jointcal::TripletList::Storage::Compact);
+    fill(triplets);
+    fill(compact);
+    BOOST_CHECK_EQUAL(triplets.size(), compact.size());
+
+    Eigen::SparseMatrix<double> expected, result;
+    triplets.toSparseMatrix(expected, 6);
+    compact.toSparseMatrix(result, 6);
+    BOOST_CHECK_EQUAL(result.rows(), 6);
+    BOOST_CHECK_EQUAL(result.cols(), 5);
+    BOOST_CHECK_EQUAL(result.nonZeros(), expected.nonZeros());
+    BOOST_CHECK_EQUAL((Eigen::MatrixXd(expected) - Eigen::MatrixXd(result)).norm(), 0.0);
+    BOOST_CHECK_EQUAL(result.coeff(5, 1), -1.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_interleaved_columns) {
+    // [[1, 2], [3, 4]] filled row by row, i.e. with the columns interleaved.
+    jointcal::TripletList triplets(4, jointcal::TripletList::Storage::Triplets);
+    triplets.addTriplet(0, 0, 1.);
+    triplets.addTriplet(0, 1, 2.);
+    triplets.addTriplet(1, 0, 3.);
+    triplets.addTriplet(1, 1, 4.);
+    triplets.setNextFreeIndex(2);
+    Eigen::SparseMatrix<double> matrix;
+    triplets.toSparseMatrix(matrix, 2);
+    BOOST_CHECK_EQUAL(matrix.coeff(1, 0), 3.);
+    BOOST_CHECK_EQUAL(matrix.coeff(1, 1), 4.);
+
+    // the compact storage refuses to go back to a column instead of misplacing the entry.
+    jointcal::TripletList compact(4, jointcal::TripletList::Storage::Compact);
+    compact.addTriplet(0, 0, 1.);
+    compact.addTriplet(0, 1, 2.);
+    BOOST_CHECK_THROW(compact.addTriplet(1, 0, 3.), lsst::pex::exceptions::LogicError);
+
+    // the same entries, column by column, as the fitters add them.
+    compact.clear();
+    compact.addTriplet(1, 0, 3.);
+    compact.addTriplet(0, 0, 1.);
+    compact.addTriplet(0, 1, 2.);
+    compact.addTriplet(1, 1, 4.);
+    compact.setNextFreeIndex(2);
+    Eigen::SparseMatrix<double> result;
+    compact.toSparseMatrix(result, 2);
+    BOOST_CHECK_EQUAL((Eigen::MatrixXd(matrix) - Eigen::MatrixXd(result)).norm(), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_clear_keeps_storage) {
+    jointcal::TripletList list(0, jointcal::TripletList::Storage::Compact);
+    fill(list);
+    std::size_t memory = list.getMemoryUsage();
+    list.clear();
+    BOOST_CHECK_EQUAL(list.size(), 0u);
+    BOOST_CHECK_EQUAL(list.getNextFreeIndex(), 0u);
+    BOOST_CHECK_EQUAL(list.getMemoryUsage(), memory);
+    list.release();
+    BOOST_CHECK_EQUAL(list.getMemoryUsage(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()